@@ -29,6 +29,7 @@ using NetTopologySuite.IO;
 using Npgsql;
 using NpgsqlTypes;
 using System;
+using System.Collections.Concurrent;
 using System.Collections.Generic;
 using System.Diagnostics;
 using System.IO;
@@ -41,6 +42,7 @@ using System.Text.Json;
 using System.Text.Json.Serialization;
 using System.Text.RegularExpressions;
 using System.Threading;
+using System.Threading.Channels;
 using System.Threading.Tasks;
 
 
@@ -54,6 +56,30 @@ namespace Hyperspace
 		private DatabaseOptions                     options  { get; set; }
 		private static int ReportsPort = 2200;
 		private static int MulticastPort = 2201;
+		private static int ReportsBatchMs   = 250;	/* Max time a report waits to be inserted */
+		private static int ReportsBatchSize = 500;	/* Max reports inserted by one statement */
+		private static int ReportsQueueSize = 8192;	/* Reports waiting to be inserted */
+		private static int ReportsNotifyMs  = 500;	/* Period of coalesced report notifications */
+		private static int ReportsRetryMs   = 5000;	/* Delay before reconnecting to the database */
+
+		private record struct Report(IPAddress ip, DateTime updated_at, Point loc, string report);
+
+		/* Counters of the reports pipeline since startup. Served by api/reports/stats so that
+		 * ReportsLoadTest can find the sustainable report rate. */
+		public record struct ReportsStats(long received, long dropped, long inserted, long failed, int queued);
+
+		private readonly Channel<Report> reports;
+
+		private long reportsReceived;
+		private long reportsDropped;
+		private long reportsInserted;
+		private long reportsFailed;
+
+		/* Telemetry observation of each device that has announced itself */
+		private readonly ConcurrentDictionary<IPAddress, Request> observations = new();
+
+		/* Latest report notification of each device waiting to be sent to clients */
+		private readonly ConcurrentDictionary<string, string> reportNotifications = new();
 
 		public BorderRouter(
 			ILogger<BorderRouter>               logger,
@@ -66,6 +92,13 @@ namespace Hyperspace
 			this.hub      = hub;
 			this.options  = options.Value;
 			this.hypertun = new HyperTun(hypertunLogger, this.options.HyperspaceConnectionString);
+
+			this.reports = Channel.CreateBounded<Report>(
+				new BoundedChannelOptions(ReportsQueueSize) {
+					FullMode     = BoundedChannelFullMode.DropOldest,
+					SingleWriter = false,
+				},
+				report => Interlocked.Increment(ref reportsDropped));
 		}
 
 		public void SetupApi(Microsoft.AspNetCore.Builder.WebApplication app)
@@ -86,6 +119,19 @@ namespace Hyperspace
 				await db.Reports
 					.FromSqlRaw(@"SELECT DISTINCT ON (ip) * FROM reports ORDER BY ip, updated_at DESC;")
 					.ToListAsync());
+
+			app.MapGet("api/reports/stats", () =>
+				Results.Ok(GetReportsStats()));
+		}
+
+		public ReportsStats GetReportsStats()
+		{
+			return new ReportsStats(
+				Interlocked.Read(ref reportsReceived),
+				Interlocked.Read(ref reportsDropped),
+				Interlocked.Read(ref reportsInserted),
+				Interlocked.Read(ref reportsFailed),
+				reports.Reader.Count);
 		}
 
 		protected override async Task ExecuteAsync(CancellationToken token)
@@ -95,6 +141,8 @@ namespace Hyperspace
 			await Task.WhenAll(
 				hypertun.Run(token),
 				ReportsListener(token),
+				ReportsWriter(token),
+				ReportsNotifier(token),
 				DbPollImageInfo(token),
 				DbPollCoapWellKnown(token),
 				DbWatchDataChanged(token)
@@ -102,12 +150,15 @@ namespace Hyperspace
 		}
 
 		#region Reports Listener
+		/* Reports are received by ReportsListener and queued for ReportsWriter which inserts them in
+		 * batches. A batch collects reports for up to ReportsBatchMs after the first report arrives
+		 * so that one round trip to the database inserts many reports. A device sends reports to
+		 * ReportsListener every 5 s until it is observed. After that its reports arrive as CoAP
+		 * notifications of telemetry/loc which are sent when its location changes, and it only
+		 * announces itself once a minute. Each announcement renews the observation so that
+		 * observations lost by restarting are recovered. */
 		private async Task ReportsListener(CancellationToken token)
 		{
-			/* Setup connection to the database */
-			await using var db = new NpgsqlConnection(options.HyperspaceConnectionString);
-			await db.OpenAsync();
-
 			/* Setup UDP listener */
 			var udp = new UdpClient(ReportsPort, AddressFamily.InterNetworkV6);
 
@@ -118,34 +169,177 @@ namespace Hyperspace
 				var    res     = await udp.ReceiveAsync();
 				var    utcnow  = DateTime.UtcNow;
 				var    ep_addr = res.RemoteEndPoint.Address;
-				var    ep_port = res.RemoteEndPoint.Port;
-
 				string str     = Encoding.UTF8.GetString(res.Buffer);
-				var    json    = JsonSerializer.Deserialize<Dictionary<string, JsonElement>>(str);
 
-				/* Todo: there seems to be some bug in .NET 6 regarding GetSingle() and NaNs */
-				var    loc     = json["loc"];
-				float  x       = Convert.ToSingle(loc[0].ToString());
-				float  y       = Convert.ToSingle(loc[1].ToString());
-				float  z       = Convert.ToSingle(loc[2].ToString());
+				QueueReport(ep_addr, utcnow, str);
+
+				ObserveTelemetry(ep_addr);
+			}
+
+			reports.Writer.TryComplete();
+
+			logger.LogError("Reports listener cancellation requested");
+		}
+
+		/* Queues a report for ReportsWriter. ReportsLoadTest also uses this to inject synthetic
+		 * reports. */
+		public void QueueReport(IPAddress ip, DateTime updated_at, string str)
+		{
+			Interlocked.Increment(ref reportsReceived);
+			reports.Writer.TryWrite(ParseReport(ip, updated_at, str));
+		}
+
+		private static Report ParseReport(IPAddress ip, DateTime updated_at, string str)
+		{
+			var    json    = JsonSerializer.Deserialize<Dictionary<string, JsonElement>>(str);
+
+			/* Todo: there seems to be some bug in .NET 6 regarding GetSingle() and NaNs */
+			var    loc     = json["loc"];
+			float  x       = Convert.ToSingle(loc[0].ToString());
+			float  y       = Convert.ToSingle(loc[1].ToString());
+			float  z       = Convert.ToSingle(loc[2].ToString());
 
-				json.Remove("loc");
+			json.Remove("loc");
 
-				string reserialized = JsonSerializer.Serialize(json);
+			string reserialized = JsonSerializer.Serialize(json);
 
-				await using(var cmd = new NpgsqlCommand(
-					"INSERT INTO reports (ip, updated_at, loc, report) " +
-					"VALUES(@ip, @updated_at, @loc, @report)", db))
+			return new Report(ip, updated_at, new Point(x, y, z), reserialized);
+		}
+
+		/* Registers as an observer of a device's location. The device announced itself so any
+		 * earlier observation has been lost and is replaced. */
+		private void ObserveTelemetry(IPAddress ip)
+		{
+			var request = new Request(Method.GET);
+			request.URI = new Uri($"coap://[{ip}]/telemetry/loc");
+			request.MarkObserve();
+
+			request.Respond += (s, e) =>
+			{
+				try
 				{
-					cmd.Parameters.AddWithValue("ip",         ep_addr);
-					cmd.Parameters.AddWithValue("updated_at", utcnow);
-					cmd.Parameters.AddWithValue("loc",        new Point(x, y, z));
-					cmd.Parameters.AddWithValue("report", NpgsqlDbType.Jsonb, reserialized);
-					await cmd.ExecuteNonQueryAsync();
+					QueueReport(ip, DateTime.UtcNow, e.Response.ResponseText);
 				}
+				catch(Exception ex)
+				{
+					logger.LogError("Invalid telemetry from " + ip + ": " + ex.Message);
+				}
+			};
+
+			if(observations.TryRemove(ip, out var old))
+			{
+				old.Cancel();
 			}
 
-			logger.LogError("Reports listener cancellation requested");
+			observations[ip] = request;
+
+			request.Send();
+		}
+
+		/* Inserts queued reports until the listener stops. The connection is reopened whenever it is
+		 * lost. A batch that failed because the connection was lost is inserted again after
+		 * reconnecting. Reports keep being queued meanwhile and the oldest are dropped once the
+		 * queue is full. */
+		private async Task ReportsWriter(CancellationToken token)
+		{
+			var batch = new List<Report>(ReportsBatchSize);
+
+			try
+			{
+				while(!token.IsCancellationRequested)
+				{
+					try
+					{
+						await using var db = new NpgsqlConnection(options.HyperspaceConnectionString);
+						await db.OpenAsync(token);
+
+						while(batch.Count > 0 || await CollectReports(batch, token))
+						{
+							await InsertReports(db, batch, token);
+							batch.Clear();
+						}
+
+						break;
+					}
+					catch(Exception e) when(e is NpgsqlException || e is IOException)
+					{
+						logger.LogError("Reports writer lost the database, reconnecting in " +
+							ReportsRetryMs + " ms: " + e.Message);
+
+						await Task.Delay(ReportsRetryMs, token);
+					}
+				}
+			}
+			catch(OperationCanceledException)
+			{
+			}
+
+			logger.LogError("Reports writer cancellation requested");
+		}
+
+		/* Waits for a report and collects reports into batch for up to ReportsBatchMs. Returns
+		 * false once the listener has stopped and every report has been collected. */
+		private async Task<bool> CollectReports(List<Report> batch, CancellationToken token)
+		{
+			if(!await reports.Reader.WaitToReadAsync(token))
+			{
+				return false;
+			}
+
+			var window = Task.Delay(ReportsBatchMs, token);
+
+			while(batch.Count < ReportsBatchSize)
+			{
+				if(reports.Reader.TryRead(out var report))
+				{
+					batch.Add(report);
+					continue;
+				}
+
+				var more = reports.Reader.WaitToReadAsync(token).AsTask();
+
+				if(await Task.WhenAny(more, window) == window || !await more)
+				{
+					break;
+				}
+			}
+
+			return true;
+		}
+
+		private async Task InsertReports(NpgsqlConnection db, List<Report> batch, CancellationToken token)
+		{
+			var sql = new StringBuilder("INSERT INTO reports (ip, updated_at, loc, report) VALUES ");
+
+			await using(var cmd = new NpgsqlCommand())
+			{
+				for(int i = 0; i < batch.Count; i++)
+				{
+					sql.AppendFormat("{0}(@ip{1}, @updated_at{1}, @loc{1}, @report{1})",
+						i == 0 ? "" : ", ", i);
+
+					cmd.Parameters.AddWithValue("ip"         + i, batch[i].ip);
+					cmd.Parameters.AddWithValue("updated_at" + i, batch[i].updated_at);
+					cmd.Parameters.AddWithValue("loc"        + i, batch[i].loc);
+					cmd.Parameters.AddWithValue("report"     + i, NpgsqlDbType.Jsonb, batch[i].report);
+				}
+
+				cmd.Connection  = db;
+				cmd.CommandText = sql.ToString();
+
+				/* Transient errors are left to ReportsWriter which reconnects and retries the batch.
+				 * Any other error is caused by the reports themselves so they are dropped. */
+				try
+				{
+					await cmd.ExecuteNonQueryAsync(token);
+					Interlocked.Add(ref reportsInserted, batch.Count);
+				}
+				catch(PostgresException e) when(!e.IsTransient)
+				{
+					Interlocked.Add(ref reportsFailed, batch.Count);
+					logger.LogError("Failed inserting " + batch.Count + " reports: " + e.Message);
+				}
+			}
 		}
 		#endregion
 		#region Database Listener
@@ -289,13 +483,38 @@ namespace Hyperspace
 				}
 				else if(table.ToString() == "reports")
 				{
-					await UpdateReportsWorkaround(e.Payload);
+					/* Every inserted report raises a notification. Keep only the latest report of
+					 * each device. ReportsNotifier sends them to clients periodically. */
+					string ip = root.GetProperty("data").GetProperty("ip").ToString();
+					reportNotifications[ip] = e.Payload;
 
 					// await hub.Clients.All.UpdateReports(e.Payload);
 				}
 			}
 		}
 
+		private async Task ReportsNotifier(CancellationToken token)
+		{
+			try
+			{
+				while(!token.IsCancellationRequested)
+				{
+					await Task.Delay(ReportsNotifyMs, token);
+
+					foreach(var ip in reportNotifications.Keys)
+					{
+						if(reportNotifications.TryRemove(ip, out var payload))
+						{
+							await UpdateReportsWorkaround(payload);
+						}
+					}
+				}
+			}
+			catch(OperationCanceledException)
+			{
+			}
+		}
+
 		private async Task UpdateReportsWorkaround(string s)
 		{
 			/* There is weird behavior in postgresql-9.6 where row_to_json returns the raw EWKB text
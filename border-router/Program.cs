@@ -65,6 +65,13 @@ builder.Services.AddSingleton<BorderRouter>();
 builder.Services.AddHostedService<BorderRouter>(
 	provider => provider.GetService<BorderRouter>());
 
+builder.Services.Configure<ReportsLoadTestOptions>(builder.Configuration.GetSection("ReportsLoadTest"));
+
+if(builder.Configuration.GetValue<bool>("ReportsLoadTest:Enabled"))
+{
+	builder.Services.AddHostedService<ReportsLoadTest>();
+}
+
 
 var app = builder.Build();	/* Microsoft.AspNetCore.Builder.WebApplication */
 
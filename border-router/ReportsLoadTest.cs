@@ -0,0 +1,144 @@
+/************************************************************************************************//**
+ * @file		ReportsLoadTest.cs
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ ***************************************************************************************************/
+using Microsoft.Extensions.Hosting;
+using Microsoft.Extensions.Logging;
+using Microsoft.Extensions.Options;
+using System;
+using System.Diagnostics;
+using System.Globalization;
+using System.Net;
+using System.Threading;
+using System.Threading.Tasks;
+
+namespace Hyperspace
+{
+	/* Property names must match the ReportsLoadTest section of the configuration */
+	public class ReportsLoadTestOptions
+	{
+		public bool Enabled     { get; set; } = false;
+		public int  Nodes       { get; set; } = 500;	/* Simulated devices fd00::ffff:0:1 and up */
+		public int  StartRate   { get; set; } = 100;	/* Reports per second of the first step */
+		public int  MaxRate     { get; set; } = 50000;	/* Reports per second of the last step */
+		public int  StepSeconds { get; set; } = 10;		/* Duration of each step */
+	}
+
+	/* Benchmarks the sustainable report rate of BorderRouter. Synthetic reports of Nodes devices
+	 * are queued at a rate that doubles every step, starting at StartRate, until a step can't be
+	 * sustained. A step is sustained if no report was dropped or failed to insert and the reports
+	 * still queued at the end of the step fit in one batch. UDP reception and telemetry
+	 * observation are bypassed, everything from parsing to notifying clients is included.
+	 *
+	 * The reports are inserted into the configured database so only run this against a scratch
+	 * database:
+	 *
+	 * 	dotnet run -- --ReportsLoadTest:Enabled=true --ReportsLoadTest:Nodes=1000 */
+	public class ReportsLoadTest : BackgroundService
+	{
+		private ILogger<ReportsLoadTest> logger  { get; set; }
+		private BorderRouter             router  { get; set; }
+		private ReportsLoadTestOptions   options { get; set; }
+		private static int TickMs        = 10;	/* Period reports are queued at */
+		private static int DrainMs       = 2000;	/* Time allowed for the last batches of a step */
+		private static int MaxQueuedEnd  = 500;	/* Reports still queued for a step to be sustained */
+
+		public ReportsLoadTest(
+			ILogger<ReportsLoadTest>         logger,
+			BorderRouter                     router,
+			IOptions<ReportsLoadTestOptions> options)
+		{
+			this.logger  = logger;
+			this.router  = router;
+			this.options = options.Value;
+		}
+
+		protected override async Task ExecuteAsync(CancellationToken token)
+		{
+			int sustained = 0;
+
+			try
+			{
+				/* Let BorderRouter connect to the database before the first step */
+				await Task.Delay(DrainMs, token);
+
+				for(int rate = options.StartRate; rate <= options.MaxRate; rate *= 2)
+				{
+					if(!await RunStep(rate, token))
+					{
+						break;
+					}
+
+					sustained = rate;
+				}
+			}
+			catch(OperationCanceledException)
+			{
+				return;
+			}
+
+			logger.LogInformation("Sustainable report rate: " + sustained + " reports/s from " +
+				options.Nodes + " devices");
+		}
+
+		/* Queues reports at rate for StepSeconds. Returns true if the rate was sustained. */
+		private async Task<bool> RunStep(int rate, CancellationToken token)
+		{
+			var  before = router.GetReportsStats();
+			var  clock  = Stopwatch.StartNew();
+			long total  = (long)rate * options.StepSeconds;
+			long sent   = 0;
+
+			while(sent < total)
+			{
+				long due = Math.Min(total, rate * clock.ElapsedMilliseconds / 1000);
+
+				for(; sent < due; sent++)
+				{
+					QueueReport(sent);
+				}
+
+				await Task.Delay(TickMs, token);
+			}
+
+			double elapsed = clock.Elapsed.TotalSeconds;
+
+			await Task.Delay(DrainMs, token);
+
+			var  after    = router.GetReportsStats();
+			long dropped  = after.dropped  - before.dropped;
+			long failed   = after.failed   - before.failed;
+			long inserted = after.inserted - before.inserted;
+			bool ok       = dropped == 0 && failed == 0 && after.queued <= MaxQueuedEnd;
+
+			logger.LogInformation(String.Format(
+				"{0} reports/s: offered {1:F0}/s, inserted {2}, dropped {3}, failed {4}, queued {5}: {6}",
+				rate, sent / elapsed, inserted, dropped, failed, after.queued,
+				ok ? "sustained" : "not sustained"));
+
+			return ok;
+		}
+
+		private void QueueReport(long n)
+		{
+			int   node = (int)(n % options.Nodes) + 1;
+			float t    = n * 0.001f;
+			var   ip   = IPAddress.Parse(String.Format("fd00::ffff:0:{0:x}", node));
+
+			router.QueueReport(ip, DateTime.UtcNow, String.Format(CultureInfo.InvariantCulture,
+				"{{\"loc\":[{0:F3},{1:F3},{2:F3}],\"bindex\":0}}",
+				node + MathF.Cos(t), node + MathF.Sin(t), 1.0f));
+		}
+	}
+}
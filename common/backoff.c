@@ -13,8 +13,6 @@
  *				governing permissions and limitations under the License.
  *
  ***************************************************************************************************/
-#include <stdlib.h>
-
 #include "backoff.h"
 
 
@@ -37,17 +35,7 @@ void backoff_fail(Backoff* b)
 
 	if(b->limit > 1)
 	{
-		/* Divide RAND_MAX into n equally sized slots */
-		int r;
-		int n = b->limit;
-		int blocksize = (RAND_MAX) / n;
-
-		/* Keep rolling r until it is within range */
-		do {
-			r = rand();
-		} while(r >= blocksize * n);
-
-		b->t = r / blocksize;
+		b->t = prng_range(&b->rng, b->limit);
 	}
 }
 
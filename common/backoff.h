@@ -29,6 +29,8 @@ extern "C" {
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "prng.h"
+
 
 /* Public Types ---------------------------------------------------------------------------------- */
 typedef struct {
@@ -36,6 +38,7 @@ typedef struct {
 	uint8_t limit;
 	uint8_t min;
 	uint8_t max;
+	Prng    rng;
 } Backoff;
 
 
@@ -57,6 +60,7 @@ inline void backoff_init(Backoff* b, uint8_t min, uint8_t max)
 	b->min   = min;
 	b->max   = max;
 	b->limit = min;
+	prng_init(&b->rng);
 }
 
 
@@ -13,36 +13,76 @@
  *				governing permissions and limitations under the License.
  *
  ***************************************************************************************************/
-#include <random/rand32.h>
-#include <stdlib.h>
-// #include <zephyr.h>
-
 #include "bayesian.h"
 
 
 /* Inline Function Instances --------------------------------------------------------------------- */
 extern void  bayes_init   (Bayesian*, float);
-extern void  bayes_update (Bayesian*);
 extern void  bayes_success(Bayesian*);
 extern void  bayes_hole   (Bayesian*);
 extern void  bayes_fail   (Bayesian*);
+extern bool  bayes_try    (Bayesian*);
+extern float bayes_rate   (Bayesian*);
+
+
+/* Private Functions ----------------------------------------------------------------------------- */
+static void bayes_tune(Bayesian*);
 
 
-/* bayes_try ************************************************************************************//**
- * @brief		Returns true if a packet should be transmitted using bayesian backoff. */
-bool bayes_try(Bayesian* b)
+/* bayes_update *********************************************************************************//**
+ * @brief		Advances the estimator by one slot. Called once per slot after the outcome of the slot
+ * 				has been reported with bayes_success, bayes_hole or bayes_fail.
+ *
+ * 				The fixed estimator adds 1/e per slot which is the largest arrival rate Bayesian
+ * 				broadcast is stable for. Adding the estimated arrival rate instead lets v drain back to
+ * 				one quickly once a burst has been delivered rather than lingering at a high value and
+ * 				leaving slots empty. In steady state the rate of successful slots equals the arrival
+ * 				rate so the arrival rate is estimated from the filtered success rate. */
+void bayes_update(Bayesian* b)
 {
-	return bayes_rand() < (1.0f / b->v);
+	float rate = iir_filter(&b->rate, b->outcome == BAYES_SUCCESS ? 1.0f : 0.0f);
+
+	rate = calc_clamp_f(rate, BAYES_RATE_MIN, 1.0f / M_E);
+	b->v = calc_clamp_f(b->v + rate, 1.0f, b->limit);
+
+	/* Precompute the transmit threshold so that bayes_try is a single integer compare */
+	b->threshold = prng_threshold(1.0f / b->v);
+
+	b->counts[b->outcome]++;
+	b->outcome = BAYES_EMPTY;
+
+	if(++b->slots >= BAYES_WINDOW)
+	{
+		bayes_tune(b);
+	}
 }
 
 
-/* bayes_rand ***********************************************************************************//**
- * @brief		*/
-float bayes_rand(void)
+/* bayes_tune ***********************************************************************************//**
+ * @brief		Adjusts the limit of v from the outcomes of the last window of slots. The slot is
+ * 				congested if more slots collide than expected of Bayesian broadcast operating at its
+ * 				optimum of 1 - 2/e. The limit is raised while v is pinned against it so that a large
+ * 				burst of contending nodes can be resolved and decays back to its initial value once the
+ * 				burst has been delivered. */
+static void bayes_tune(Bayesian* b)
 {
-	return (float)(rand()) / (float)(RAND_MAX);
-	// return (float)(sys_rand32_get()) / (float)(UINT32_MAX);
-	// return (float)(sys_rand32_get()) / (UINT32_MAX + 1.0f);
+	float collisions = (float)b->counts[BAYES_COLLISION] / (float)b->slots;
+
+	if(collisions > BAYES_COLLISION_HIGH && b->v >= b->limit)
+	{
+		b->limit = calc_min_f(b->limit * 1.5f, BAYES_LIMIT_MAX);
+	}
+	else if(collisions < BAYES_COLLISION_LOW)
+	{
+		b->limit = calc_max_f(b->limit * 0.9f, b->base);
+	}
+
+	b->slots = 0;
+
+	for(unsigned i = 0; i < BAYES_NUM_OUTCOMES; i++)
+	{
+		b->counts[i] = 0;
+	}
 }
 
 
@@ -1,5 +1,5 @@
 /************************************************************************************************//**
- * @file		backoff.h
+ * @file		bayesian.h
  *
  * @copyright	Copyright 2022 Kurt Hildebrand.
  * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
@@ -30,43 +30,73 @@ extern "C" {
 #include <stdint.h>
 
 #include "calc.h"
+#include "iir.h"
+#include "prng.h"
+
+
+/* Public Macros --------------------------------------------------------------------------------- */
+#define BAYES_WINDOW          (32)       /* Number of slots between limit adjustments */
+#define BAYES_RATE_ALPHA      (0.95f)    /* Arrival rate filter coefficient */
+#define BAYES_RATE_MIN        (0.05f)    /* Smallest arrival rate estimate */
+#define BAYES_COLLISION_HIGH  (0.35f)    /* Collision fraction above which the limit is raised */
+#define BAYES_COLLISION_LOW   (0.10f)    /* Collision fraction below which the limit decays */
+#define BAYES_LIMIT_MAX       (40.0f)    /* Largest limit the estimator may tune to */
 
 
 /* Public Types ---------------------------------------------------------------------------------- */
+typedef enum {
+	BAYES_EMPTY = 0,
+	BAYES_SUCCESS,
+	BAYES_COLLISION,
+	BAYES_NUM_OUTCOMES,
+} BayesOutcome;
+
 typedef struct {
-	float v;
-	float limit;
+	float    v;          /* Estimated number of nodes contending for the slot */
+	float    limit;      /* Current upper bound of v */
+	float    base;       /* Limit the node was initialized with */
+	iir      rate;       /* Estimated packet arrival rate per slot */
+	uint8_t  outcome;    /* Outcome of the current slot */
+	uint8_t  slots;      /* Slots seen in the current window */
+	uint8_t  counts[BAYES_NUM_OUTCOMES];
+	uint32_t threshold;  /* Transmit if a random number is below the threshold (2^32 / v) */
+	Prng     rng;
 } Bayesian;
 
 
 /* Public Functions ------------------------------------------------------------------------------ */
 inline void  bayes_init   (Bayesian*, float);
-// inline void  bayes_update (Bayesian* b) { b->v = calc_max_f(b->v + 1.0f / M_E, 1.0f);         }
-inline void  bayes_update (Bayesian* b) { b->v = calc_clamp_f(b->v + 1.0f / M_E, 1.0f, b->limit); }
-       bool  bayes_try    (Bayesian*);
-inline void  bayes_success(Bayesian* b) { b->v -= 1.0f;                                       }
-inline void  bayes_hole   (Bayesian* b) { b->v -= 1.0f;                                       }
-inline void  bayes_fail   (Bayesian* b) { if(b->v < b->limit) { b->v += 1.0f / (M_E - 2.0f); }}
-       float bayes_rand   (void);
+       void  bayes_update (Bayesian*);
+inline bool  bayes_try    (Bayesian* b) { return prng_chance(&b->rng, b->threshold);                     }
+inline void  bayes_success(Bayesian* b) { b->v -= 1.0f;                     b->outcome = BAYES_SUCCESS;   }
+inline void  bayes_hole   (Bayesian* b) { b->v -= 1.0f;                     b->outcome = BAYES_EMPTY;     }
+inline void  bayes_fail   (Bayesian* b) { b->v += 1.0f / (M_E - 2.0f);      b->outcome = BAYES_COLLISION; }
+inline float bayes_rate   (Bayesian* b) { return iir_value(&b->rate);                                     }
 
 
 /* bayes_init ***********************************************************************************//**
- * @brief		Initializes bayesian backoff. */
+ * @brief		Initializes bayesian backoff. The limit is the initial upper bound of the estimated
+ * 				number of contending nodes. The bound is raised while the slot is congested and decays
+ * 				back to its initial value once the congestion clears. */
 inline void bayes_init(Bayesian* b, float limit)
 {
-	b->v     = 1.0f;
-	b->limit = limit;
+	b->v         = 1.0f;
+	b->limit     = limit;
+	b->base      = limit;
+	b->outcome   = BAYES_EMPTY;
+	b->slots     = 0;
+	b->threshold = UINT32_MAX;
+
+	for(unsigned i = 0; i < BAYES_NUM_OUTCOMES; i++)
+	{
+		b->counts[i] = 0;
+	}
+
+	iir_init(&b->rate, BAYES_RATE_ALPHA, 1.0f / M_E);
+	prng_init(&b->rng);
 }
 
 
-// /* bayes_try ************************************************************************************//**
-//  * @brief		Returns true if a packet should be transmitted using bayesian backoff. */
-// inline bool bayes_try(Bayesian* b)
-// {
-// 	return bayes_rand() < (1.0f / b->v);
-// }
-
-
 #ifdef __cplusplus
 }
 #endif
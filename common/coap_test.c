@@ -31,6 +31,7 @@ LOG_MODULE_REGISTER(net_coap_server_sample, LOG_LEVEL_DBG);
 #include <net/coap_link_format.h>
 
 #include "net_private.h"
+#include "telemetry.h"
 #if defined(CONFIG_NET_IPV6)
 #include "ipv6.h"
 #endif
@@ -1430,6 +1431,7 @@ static struct coap_resource resources[] = {
 	  .get  = led_get,
 	  .put  = led_put,
 	},
+	TELEMETRY_RESOURCES,
 	{ },
 };
 
@@ -1489,6 +1491,10 @@ not_found:
 		struct coap_resource *r;
 		struct coap_observer *o;
 
+		if (telemetry_reset(client_addr)) {
+			return;
+		}
+
 		o = coap_find_observer_by_addr(observers, NUM_OBSERVERS, client_addr);
 		if (!o) {
 			LOG_ERR("Observer not found\n");
@@ -1561,6 +1567,7 @@ void coap_test(void* p1, void* p2, void* p3)
 
 	k_work_init_delayable(&retransmit_work, retransmit_request);
 	k_work_init_delayable(&observer_work, update_counter);
+	telemetry_init(sock);
 
 	while (1) {
 		r = process_client_request();
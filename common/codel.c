@@ -0,0 +1,96 @@
+/************************************************************************************************//**
+ * @file		codel.c
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ ***************************************************************************************************/
+#include <math.h>
+
+#include "codel.h"
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Public Functions                                                                                //
+// ----------------------------------------------------------------------------------------------- //
+/* codel_init ***********************************************************************************//**
+ * @brief		Initializes the control law with a target delay and an interval in ms. */
+void codel_init(Codel* c, uint32_t target, uint32_t interval)
+{
+	c->target      = target;
+	c->interval    = interval;
+	c->dropping    = false;
+	c->above       = false;
+	c->first_above = 0;
+	c->drop_next   = 0;
+	c->count       = 0;
+}
+
+
+/* codel_drop ***********************************************************************************//**
+ * @brief		Returns true if the packet just dequeued at time now in ms should be dropped. Its
+ * 				sojourn is the time in ms it spent queued and last is true if the queue is now empty.
+ * 				Once the delay has stayed above target for an interval, packets are dropped at a rate
+ * 				that increases with the square root of the number of drops until the delay falls
+ * 				below target again. */
+bool codel_drop(Codel* c, uint32_t now, uint32_t sojourn, bool last)
+{
+	/* Delay is below target or the queue has drained */
+	if(sojourn < c->target || last)
+	{
+		codel_empty(c);
+		return false;
+	}
+
+	if(!c->above)
+	{
+		c->above       = true;
+		c->first_above = now + c->interval;
+		return false;
+	}
+
+	if(!c->dropping)
+	{
+		if((int32_t)(now - c->first_above) < 0)
+		{
+			return false;
+		}
+
+		/* Resume near the previous drop rate if dropping stopped only recently */
+		c->dropping  = true;
+		c->count     = (c->count > 2 && (int32_t)(now - c->drop_next) < 16 * (int32_t)c->interval) ?
+			c->count - 2 : 1;
+		c->drop_next = now;
+	}
+
+	if((int32_t)(now - c->drop_next) < 0)
+	{
+		return false;
+	}
+
+	c->count++;
+	c->drop_next = now + (uint32_t)(c->interval / sqrtf(c->count));
+	return true;
+}
+
+
+/* codel_empty **********************************************************************************//**
+ * @brief		Leaves the dropping state because the queue has no packets. */
+void codel_empty(Codel* c)
+{
+	c->above    = false;
+	c->dropping = false;
+}
+
+
+/******************************************* END OF FILE *******************************************/
@@ -0,0 +1,61 @@
+/************************************************************************************************//**
+ * @file		codel.h
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ * @brief		CoDel (RFC 8289) control law used by the class queues of tsch.c. The queue itself is
+ * 				left to the caller, which asks codel_drop about each head packet it dequeues. Kept
+ * 				free of Zephyr and mistlib so that the queueing delay under overload can be simulated
+ * 				on the host.
+ *
+ ***************************************************************************************************/
+#ifndef CODEL_H
+#define CODEL_H
+
+#if __STDC_VERSION__ < 199901L
+#error Compile with C99 or higher!
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Public Includes ------------------------------------------------------------------------------- */
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/* Public Types ---------------------------------------------------------------------------------- */
+typedef struct {
+	uint32_t target;        /* Acceptable standing queue delay in ms */
+	uint32_t interval;      /* Delay must stay above target this long to drop, in ms */
+	bool     dropping;      /* True while the queue delay has been above target for an interval */
+	bool     above;         /* True while the queue delay is above target */
+	uint32_t first_above;   /* While above, time in ms dropping may start */
+	uint32_t drop_next;     /* Time in ms of the next drop while dropping */
+	uint32_t count;         /* Packets dropped since entering the dropping state */
+} Codel;
+
+
+/* Public Functions ------------------------------------------------------------------------------ */
+void codel_init (Codel*, uint32_t, uint32_t);
+bool codel_drop (Codel*, uint32_t, uint32_t, bool);
+void codel_empty(Codel*);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CODEL_H
+/******************************************* END OF FILE *******************************************/
@@ -0,0 +1,291 @@
+/************************************************************************************************//**
+ * @file		diag.c
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ ***************************************************************************************************/
+#include <errno.h>
+#include <net/coap.h>
+#include <net/net_ip.h>
+#include <net/socket.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/printk.h>
+#include <zephyr.h>
+
+#include "diag.h"
+#include "hyperspace.h"
+#include "location.h"
+#include "timeslot.h"
+
+#include "logging/log.h"
+LOG_MODULE_REGISTER(diag, LOG_LEVEL_INF);
+
+
+/* Private Macros -------------------------------------------------------------------------------- */
+#define DIAG_MAX_MSG_LEN        (256)
+#define DIAG_MAX_PAYLOAD_LEN    (DIAG_MAX_MSG_LEN - 32)
+
+
+/* Private Functions ----------------------------------------------------------------------------- */
+static int diag_reply(struct coap_packet*, struct sockaddr*, socklen_t, uint8_t, const char*, int);
+
+
+/* Private Variables ----------------------------------------------------------------------------- */
+const char* const diag_slots_path[]   = { "slots",   0 };
+const char* const diag_timing_path[]  = { "timing",  0 };
+const char* const diag_hyper_path[]   = { "hyper",   0 };
+const char* const diag_capture_path[] = { "capture", 0 };
+
+static int diag_sock;
+static const uint8_t plain_text_format;
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Public Functions                                                                                //
+// ----------------------------------------------------------------------------------------------- //
+/* diag_init ************************************************************************************//**
+ * @brief		Replies are sent from the CoAP server's socket. */
+void diag_init(int sock)
+{
+	diag_sock = sock;
+}
+
+
+/* diag_slots_get *******************************************************************************//**
+ * @brief		Replies with the execution statistics of each slot handler, one handler per line:
+ *
+ * 					name,count,exec_avg_us,exec_max_us,slack_us,slack_min_us,deadlines,missed */
+int diag_slots_get(
+	struct coap_resource* resource,
+	struct coap_packet* request,
+	struct sockaddr* addr,
+	socklen_t addr_len)
+{
+	char     payload[DIAG_MAX_PAYLOAD_LEN];
+	unsigned len = 0;
+	TsStats  stats;
+
+	for(unsigned i = 0; ts_stats_get(i, &stats) && len < sizeof(payload); i++)
+	{
+		int r = snprintk(&payload[len], sizeof(payload) - len, "%s,%u,%u,%u,%d,%d,%u,%u\n",
+			stats.name,
+			stats.count,
+			stats.count ? (uint32_t)(stats.exec_total_us / stats.count) : 0,
+			stats.exec_max_us,
+			stats.slack_us,
+			stats.slack_min_us,
+			stats.deadlines,
+			stats.missed);
+		if(r < 0) {
+			return r;
+		}
+
+		len = MIN(len + r, sizeof(payload) - 1);
+	}
+
+	return diag_reply(request, addr, addr_len, COAP_RESPONSE_CODE_CONTENT, payload, len);
+}
+
+
+/* diag_slots_del *******************************************************************************//**
+ * @brief		Clears the execution statistics of each slot handler. */
+int diag_slots_del(
+	struct coap_resource* resource,
+	struct coap_packet* request,
+	struct sockaddr* addr,
+	socklen_t addr_len)
+{
+	ts_stats_reset();
+	return diag_reply(request, addr, addr_len, COAP_RESPONSE_CODE_DELETED, 0, 0);
+}
+
+
+/* diag_timing_get ******************************************************************************//**
+ * @brief		Replies with the execution times of the location pipeline as one comma separated
+ * 				line:
+ *
+ * 					acquire_us,acquire_max_us,solve_us,solve_max_us,overruns */
+int diag_timing_get(
+	struct coap_resource* resource,
+	struct coap_packet* request,
+	struct sockaddr* addr,
+	socklen_t addr_len)
+{
+	char      payload[64];
+	LocTiming timing = loc_timing();
+
+	int r = snprintk(payload, sizeof(payload), "%u,%u,%u,%u,%u\n",
+		timing.acquire_us,
+		timing.acquire_max_us,
+		timing.solve_us,
+		timing.solve_max_us,
+		timing.overruns);
+	if(r < 0) {
+		return r;
+	}
+
+	return diag_reply(request, addr, addr_len, COAP_RESPONSE_CODE_CONTENT, payload,
+		MIN(r, sizeof(payload) - 1));
+}
+
+
+/* diag_hyper_get *******************************************************************************//**
+ * @brief		Replies with the hyperspace routing statistics as one comma separated line:
+ *
+ * 					greedy,floods,minima,delivered,hops_total,hops_max,coord_reqs,coord_retries,
+ * 					coord_fails,coord_updates
+ *
+ * 				The greedy success ratio is greedy / (greedy + minima). Dividing hops_total by
+ * 				delivered gives the average path length to compare against the shortest paths. */
+int diag_hyper_get(
+	struct coap_resource* resource,
+	struct coap_packet* request,
+	struct sockaddr* addr,
+	socklen_t addr_len)
+{
+	char       payload[128];
+	HyperStats stats;
+
+	hyperspace_stats(&stats);
+
+	int r = snprintk(payload, sizeof(payload), "%u,%u,%u,%u,%u,%u,%u,%u,%u,%u\n",
+		stats.greedy,
+		stats.floods,
+		stats.minima,
+		stats.delivered,
+		stats.hops_total,
+		stats.hops_max,
+		stats.coord_reqs,
+		stats.coord_retries,
+		stats.coord_fails,
+		stats.coord_updates);
+	if(r < 0) {
+		return r;
+	}
+
+	return diag_reply(request, addr, addr_len, COAP_RESPONSE_CODE_CONTENT, payload,
+		MIN(r, sizeof(payload) - 1));
+}
+
+
+/* diag_hyper_del *******************************************************************************//**
+ * @brief		Clears the hyperspace routing statistics. */
+int diag_hyper_del(
+	struct coap_resource* resource,
+	struct coap_packet* request,
+	struct sockaddr* addr,
+	socklen_t addr_len)
+{
+	hyperspace_stats_reset();
+	return diag_reply(request, addr, addr_len, COAP_RESPONSE_CODE_DELETED, 0, 0);
+}
+
+
+/* diag_capture_put *****************************************************************************//**
+ * @brief		Captures the next count location updates and sends them to the border router host.
+ * 				The count is given by the query count=<n>. A count of 0 stops capturing. */
+int diag_capture_put(
+	struct coap_resource* resource,
+	struct coap_packet* request,
+	struct sockaddr* addr,
+	socklen_t addr_len)
+{
+	struct coap_option opts[1] = { 0 };
+	uint8_t code = COAP_RESPONSE_CODE_CHANGED;
+	char    query[16];
+
+	int r = coap_find_options(request, COAP_OPTION_URI_QUERY, opts, sizeof(opts) / sizeof(opts[0]));
+
+	if(r <= 0 || opts[0].len < 7 || opts[0].len >= sizeof(query) ||
+	   memcmp(opts[0].value, "count=", 6) != 0)
+	{
+		code = COAP_RESPONSE_CODE_BAD_REQUEST;
+	}
+	else
+	{
+		memmove(query, opts[0].value, opts[0].len);
+		query[opts[0].len] = 0;
+		loc_capture(strtoul(&query[6], 0, 10));
+	}
+
+	return diag_reply(request, addr, addr_len, code, 0, 0);
+}
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Private Functions                                                                               //
+// ----------------------------------------------------------------------------------------------- //
+/* diag_reply ***********************************************************************************//**
+ * @brief		Replies to the request with the response code and a plain text payload of len bytes.
+ * 				No payload is sent if payload is 0. */
+static int diag_reply(
+	struct coap_packet* request,
+	struct sockaddr*    addr,
+	socklen_t           addr_len,
+	uint8_t             code,
+	const char*         payload,
+	int                 len)
+{
+	struct coap_packet response;
+	uint8_t  data[DIAG_MAX_MSG_LEN];
+	uint8_t  token[8];
+	uint8_t  type = coap_header_get_type (request);
+	uint16_t id   = coap_header_get_id   (request);
+	uint8_t  tkl  = coap_header_get_token(request, token);
+	int r;
+
+	if(type == COAP_TYPE_CON) {
+		type = COAP_TYPE_ACK;
+	} else {
+		type = COAP_TYPE_NON_CON;
+	}
+
+	r = coap_packet_init(&response, data, sizeof(data), 1, type, tkl, token, code, id);
+	if(r < 0) {
+		return r;
+	}
+
+	if(payload)
+	{
+		r = coap_packet_append_option(&response, COAP_OPTION_CONTENT_FORMAT,
+			&plain_text_format, sizeof(plain_text_format));
+		if(r < 0) {
+			return r;
+		}
+
+		r = coap_packet_append_payload_marker(&response);
+		if(r < 0) {
+			return r;
+		}
+
+		r = coap_packet_append_payload(&response, (const uint8_t*)payload, len);
+		if(r < 0) {
+			return r;
+		}
+	}
+
+	r = sendto(diag_sock, response.data, response.offset, 0, addr, addr_len);
+	if(r < 0) {
+		LOG_ERR("failed to send %d", errno);
+		return -errno;
+	}
+
+	return r;
+}
+
+
+/******************************************* END OF FILE *******************************************/
@@ -0,0 +1,71 @@
+/************************************************************************************************//**
+ * @file		diag.h
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ * @brief		Diagnostic CoAP resources shared by the applications. Each GET replies with plain
+ * 				text comma separated values:
+ *
+ * 				slots    one line per slot handler. DELETE clears the statistics.
+ * 				timing   execution times of the location pipeline
+ * 				hyper    hyperspace routing statistics. DELETE clears the statistics.
+ * 				capture  PUT with the query count=<n> captures the next n location updates
+ *
+ ***************************************************************************************************/
+#ifndef DIAG_H
+#define DIAG_H
+
+#if __STDC_VERSION__ < 199901L
+#error Compile with C99 or higher!
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Includes -------------------------------------------------------------------------------------- */
+#include <net/coap.h>
+
+
+/* Public Macros --------------------------------------------------------------------------------- */
+/* Resource table entries. Add to a CoAP server's resource table. */
+#define DIAG_RESOURCES                                                                              \
+	{ .path = diag_slots_path,   .get = diag_slots_get,  .del = diag_slots_del, },                  \
+	{ .path = diag_timing_path,  .get = diag_timing_get,                        },                  \
+	{ .path = diag_hyper_path,   .get = diag_hyper_get,  .del = diag_hyper_del, },                  \
+	{ .path = diag_capture_path, .put = diag_capture_put,                       }
+
+
+/* Public Variables ------------------------------------------------------------------------------ */
+extern const char* const diag_slots_path[];
+extern const char* const diag_timing_path[];
+extern const char* const diag_hyper_path[];
+extern const char* const diag_capture_path[];
+
+
+/* Public Functions ------------------------------------------------------------------------------ */
+void diag_init       (int);
+int  diag_slots_get  (struct coap_resource*, struct coap_packet*, struct sockaddr*, socklen_t);
+int  diag_slots_del  (struct coap_resource*, struct coap_packet*, struct sockaddr*, socklen_t);
+int  diag_timing_get (struct coap_resource*, struct coap_packet*, struct sockaddr*, socklen_t);
+int  diag_hyper_get  (struct coap_resource*, struct coap_packet*, struct sockaddr*, socklen_t);
+int  diag_hyper_del  (struct coap_resource*, struct coap_packet*, struct sockaddr*, socklen_t);
+int  diag_capture_put(struct coap_resource*, struct coap_packet*, struct sockaddr*, socklen_t);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DIAG_H
+/******************************************* END OF FILE *******************************************/
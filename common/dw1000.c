@@ -168,6 +168,7 @@
  * 						1 = 2 byte sub address
  *
  ***************************************************************************************************/
+#include <math.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <nrfx/hal/nrf_gpio.h>
@@ -187,6 +188,8 @@ extern DW1000_Pre_Length dw1000_preamble_length(const DW1000*);
 extern unsigned          dw1000_tx_code        (const DW1000*);
 extern unsigned          dw1000_rx_code        (const DW1000*);
 extern uint16_t          dw1000_sfd_timeout    (const DW1000*);
+extern uint16_t          dw1000_ant_delay      (const DW1000*);
+extern bool              dw1000_valid_channel_code(DW1000_Prf, unsigned, unsigned);
 extern uint64_t          dw1000_ns_to_ticks    (uint64_t);
 extern uint64_t          dw1000_us_to_ticks    (uint64_t);
 extern uint64_t          dw1000_ms_to_ticks    (uint64_t);
@@ -196,6 +199,7 @@ extern uint64_t          dw1000_ms_to_ticks    (uint64_t);
 static void     dw1000_ldeload            (DW1000*);
 static void     dw1000_set_xtal_trim      (DW1000*, uint8_t);
 static void     dw1000_set_channel        (DW1000*, unsigned);
+static void     dw1000_set_tx_power       (DW1000*);
 static void     dw1000_set_pac_prf        (DW1000*, DW1000_Pac, DW1000_Prf);
 static void     dw1000_set_data_rate      (DW1000*, DW1000_Data_Rate);
 static void     dw1000_set_tx_code        (DW1000*, unsigned);
@@ -228,28 +232,28 @@ static unsigned dw1000_set_header      (void*, uint8_t, uint16_t, bool);
 // 	3,	/* 6.8 Mbps */
 // };
 
-// /* 0x1E – TX_POWER. Indexed by dw1000_tx_power[DIS_STXP = 0/1][Channel - 1][DW1000_Prf] */
-// static const uint32_t dw1000_tx_power[2][7][2] = {
-// 	/* Transmit Power Control for DIS_STXP = 0
-// 	 * 16 MHz,      64 MHz */
-// 	{ { 0x15355575, 0x07274767 },	/* Ch. 1 */
-// 	  { 0x15355575, 0x07274767 },	/* Ch. 2 */
-// 	  { 0x0F2F4F6F, 0x2B4B6B8B },	/* Ch. 3 */
-// 	  { 0x1F1F3F5F, 0x3A5A7A9A },	/* Ch. 4 */
-// 	  { 0x0E082848, 0x25456585 },	/* Ch. 5 */
-// 	  { 0x00000000, 0x00000000 },	/* Ch. 6 */
-// 	  { 0x32527292, 0x5171B1D1 } },	/* Ch. 7 */
-
-// 	/* Transmit Power Control for DIS_STXP = 1
-// 	 * 16 MHz,      64 MHz */
-// 	{ { 0x75757575, 0x67676767 },	/* Ch. 1 */
-// 	  { 0x75757575, 0x67676767 },	/* Ch. 2 */
-// 	  { 0x6F6F6F6F, 0x8B8B8B8B },	/* Ch. 3 */
-// 	  { 0x5F5F5F5F, 0x9A9A9A9A },	/* Ch. 4 */
-// 	  { 0x48484848, 0x85858585 },	/* Ch. 5 */
-// 	  { 0x00000000, 0x00000000 },	/* Ch. 6 */
-// 	  { 0x92929292, 0xD1D1D1D1 } },	/* Ch. 7 */
-// };
+/* 0x1E – TX_POWER. Indexed by dw1000_tx_power[DIS_STXP = 0/1][Channel - 1][DW1000_Prf] */
+static const uint32_t dw1000_tx_power[2][7][2] = {
+	/* Transmit Power Control for DIS_STXP = 0
+	 * 16 MHz,      64 MHz */
+	{ { 0x15355575, 0x07274767 },	/* Ch. 1 */
+	  { 0x15355575, 0x07274767 },	/* Ch. 2 */
+	  { 0x0F2F4F6F, 0x2B4B6B8B },	/* Ch. 3 */
+	  { 0x1F1F3F5F, 0x3A5A7A9A },	/* Ch. 4 */
+	  { 0x0E082848, 0x25456585 },	/* Ch. 5 */
+	  { 0x00000000, 0x00000000 },	/* Ch. 6 */
+	  { 0x32527292, 0x5171B1D1 } },	/* Ch. 7 */
+
+	/* Transmit Power Control for DIS_STXP = 1
+	 * 16 MHz,      64 MHz */
+	{ { 0x75757575, 0x67676767 },	/* Ch. 1 */
+	  { 0x75757575, 0x67676767 },	/* Ch. 2 */
+	  { 0x6F6F6F6F, 0x8B8B8B8B },	/* Ch. 3 */
+	  { 0x5F5F5F5F, 0x9A9A9A9A },	/* Ch. 4 */
+	  { 0x48484848, 0x85858585 },	/* Ch. 5 */
+	  { 0x00000000, 0x00000000 },	/* Ch. 6 */
+	  { 0x92929292, 0xD1D1D1D1 } },	/* Ch. 7 */
+};
 
 /* 0x23:04 – AGC_TUNE1. Indexed by dw1000_agc_tune1[DW1000_Prf] */
 static const uint16_t dw1000_agc_tune1[] = {
@@ -324,16 +328,16 @@ static const uint32_t dw1000_rf_txctrl[] = {
  	0x001E7DE0,	/* Ch. 7 */
 };
 
-// /* 0x2A:0B – TC_PGDELAY. Indexed by dw1000_rf_txctrl[Channel - 1] */
-// static const uint8_t dw1000_tc_pgdelay[] = {
-// 	0xC9,	/* Ch. 1 */
-// 	0xC2,	/* Ch. 2 */
-// 	0xC5,	/* Ch. 3 */
-// 	0x95,	/* Ch. 4 */
-// 	0xC0,	/* Ch. 5 */
-// 	0x00,	/* UNUSED */
-// 	0x93,	/* Ch. 7 */
-// };
+/* 0x2A:0B – TC_PGDELAY. Indexed by dw1000_tc_pgdelay[Channel - 1] */
+static const uint8_t dw1000_tc_pgdelay[] = {
+	0xC9,	/* Ch. 1 */
+	0xC2,	/* Ch. 2 */
+	0xC5,	/* Ch. 3 */
+	0x95,	/* Ch. 4 */
+	0xC0,	/* Ch. 5 */
+	0x00,	/* UNUSED */
+	0x93,	/* Ch. 7 */
+};
 
 /* 0x2B:07 – FS_PLLCFG. Indexed by dw1000_fs_pllcfg[Channel - 1] */
 static const uint32_t dw1000_fs_pllcfg[] = {
@@ -444,8 +448,13 @@ void dw1000_init(DW1000* dw1000, uint32_t gpio_int_pin)
 		dw1000->on_wake |= DW1000_AON_WCFG_ONW_LLD0;
 	}
 
+	/* The OTP only holds a single antenna delay. Use it for every channel until calibrated
+	 * per channel with dw1000_set_ant_delay. */
 	uint32_t ant_delay = dw1000_otp_read(dw1000, DW1000_OTP_ANT_DELAY_ADDR);
-	dw1000->ant_delay  = ant_delay & 0xFFFF;
+	for(unsigned i = 0; i < sizeof(dw1000->ant_delay) / sizeof(dw1000->ant_delay[0]); i++)
+	{
+		dw1000->ant_delay[i] = ant_delay & 0xFFFF;
+	}
 
 	/* Read OTP revision and XTAL trim */
 	uint32_t xtrim = dw1000_otp_read(dw1000, DW1000_OTP_XTRIM_ADDR) & 0xFFFF;
@@ -608,6 +617,9 @@ bool dw1000_reconfig(DW1000* dw1000, DW1000_Config* config)
 	/* Write SYS_CFG */
 	dw1000_spi_write32(dw1000, DW1000_SYS_CFG, DW1000_NO_SUB_ADDR, dw1000->sys_cfg);
 
+	/* TX_POWER depends on the channel, PRF and DIS_STXP so write it once all three are set */
+	dw1000_set_tx_power(dw1000);
+
 	/* Write CHAN_CTRL */
 	dw1000_spi_write32(dw1000, DW1000_CHAN_CTRL, DW1000_NO_SUB_ADDR, dw1000->chan_ctrl);
 
@@ -630,6 +642,41 @@ bool dw1000_reconfig(DW1000* dw1000, DW1000_Config* config)
 }
 
 
+/* dw1000_set_channel_code **********************************************************************//**
+ * @brief		Switches the DW1000 to a new channel and preamble code without reconfiguring the
+ * 				data rate, PRF, PAC or preamble length. Intended to be called at the start of a
+ * 				timeslot to hop channels. The RF registers are only rewritten if the channel
+ * 				actually changes. Returns false if the channel or code is invalid for the
+ * 				configured PRF.
+ * @warning		The DW1000 must be idle (not transmitting or receiving). */
+bool dw1000_set_channel_code(DW1000* dw1000, unsigned ch, unsigned code)
+{
+	if(ch == dw1000->channel && code == dw1000->tx_code && code == dw1000->rx_code)
+	{
+		return true;
+	}
+
+	if(!dw1000_valid_channel_code(dw1000->prf, ch, code))
+	{
+		return false;
+	}
+
+	if(ch != dw1000->channel)
+	{
+		dw1000_set_channel(dw1000, ch);
+		dw1000_set_tx_power(dw1000);
+	}
+
+	dw1000_set_tx_code(dw1000, code);
+	dw1000_set_rx_code(dw1000, code);
+
+	/* Write CHAN_CTRL */
+	dw1000_spi_write32(dw1000, DW1000_CHAN_CTRL, DW1000_NO_SUB_ADDR, dw1000->chan_ctrl);
+
+	return true;
+}
+
+
 /* dw1000_set_channel ***************************************************************************//**
  * @brief		Sets the DW1000 channel. Accepted values are 1, 2, 3, 4, 5, 7. */
 static void dw1000_set_channel(DW1000* dw1000, unsigned ch)
@@ -648,8 +695,6 @@ static void dw1000_set_channel(DW1000* dw1000, unsigned ch)
 	dw1000->chan_ctrl |= ch << DW1000_CHAN_CTRL_RX_CHAN_SHIFT;
 	dw1000->chan_ctrl |= ch << DW1000_CHAN_CTRL_TX_CHAN_SHIFT;
 
-	/* @TODO: Transmit Power Control */
-
 	/* Write 0x28:0B - RF_RXCTRLH. Confiugures RF RX blocks for the specified channel and
 	 * bandwidth. */
 	dw1000_spi_write8(
@@ -665,7 +710,12 @@ static void dw1000_set_channel(DW1000* dw1000, unsigned ch)
 		DW1000_RF_TXCTRL_OFFSET,
 		dw1000_rf_txctrl[ch-1]);
 
-	/* Write 0x2A:0B – TC_PGDELAY. @TODO */
+	/* Write 0x2A:0B – TC_PGDELAY. Pulse generator delay for the channel's bandwidth. */
+	dw1000_spi_write8(
+		dw1000,
+		DW1000_TX_CAL,
+		DW1000_TC_PGDELAY_OFFSET,
+		dw1000_tc_pgdelay[ch-1]);
 
 	/* Write 0x2B:07 – FS_PLLCFG */
 	dw1000_spi_write32(
@@ -683,6 +733,20 @@ static void dw1000_set_channel(DW1000* dw1000, unsigned ch)
 }
 
 
+/* dw1000_set_tx_power **************************************************************************//**
+ * @brief		Writes 0x1E – TX_POWER for the configured channel, PRF and smart TX power setting. */
+static void dw1000_set_tx_power(DW1000* dw1000)
+{
+	unsigned stxp = (dw1000->sys_cfg & DW1000_SYS_CFG_DIS_STXP_MASK) >> DW1000_SYS_CFG_DIS_STXP_SHIFT;
+
+	dw1000_spi_write32(
+		dw1000,
+		DW1000_TX_POWER,
+		DW1000_NO_SUB_ADDR,
+		dw1000_tx_power[stxp][dw1000->channel-1][dw1000->prf]);
+}
+
+
 /* dw1000_set_prf *******************************************************************************//**
  * @brief		Sets the DW1000 pulse repetition frequency. */
 static void dw1000_set_pac_prf(DW1000* dw1000, DW1000_Pac pac, DW1000_Prf prf)
@@ -946,6 +1010,19 @@ void dw1000_set_tx_ant_delay(DW1000* dw1000, uint16_t delay)
 }
 
 
+/* dw1000_set_ant_delay *************************************************************************//**
+ * @brief		Sets the antenna delay of a channel in DW1000 ticks. The antenna delay depends on the
+ * 				channel so it is calibrated per channel. dw1000_ant_delay returns the delay of the
+ * 				current channel. */
+void dw1000_set_ant_delay(DW1000* dw1000, unsigned ch, uint16_t delay)
+{
+	if(ch > 0 && ch <= sizeof(dw1000->ant_delay) / sizeof(dw1000->ant_delay[0]))
+	{
+		dw1000->ant_delay[ch-1] = delay;
+	}
+}
+
+
 /* dw1000_set_rx_ant_delay **********************************************************************//**
  * @brief		Sets the receive antenna delay. Units are 499.2 MHz × 128 = ~15.65 ps. The receive
  * 				antenna delay is used by the LDE algorithm to to produce the fully adjusted receive
@@ -1504,6 +1581,88 @@ float dw1000_rx_clk_offset(DW1000* dw1000)
 }
 
 
+/* dw1000_read_rx_diag **************************************************************************//**
+ * @brief		Reads the receive diagnostics of the last received frame. Finfo is the frame's
+ * 				RX_FINFO which callers already read for the frame length, so this only takes two SPI
+ * 				transactions. Only raw register values are read so that the power estimates can be
+ * 				computed outside of the slot. The diagnostic registers are part of the swinging set
+ * 				so this may be called after re-enabling the receiver when double buffering. */
+void dw1000_read_rx_diag(DW1000* dw1000, uint32_t finfo, DW1000_Rx_Diag* diag)
+{
+	uint8_t buf[8];
+
+	/* reg:12:00 - reg:12:07 */
+	dw1000_spi_read(dw1000, DW1000_RX_FQUAL, DW1000_NO_SUB_ADDR, buf, sizeof(buf));
+
+	diag->std_noise = ((uint16_t)(buf[1]) << 8) | buf[0];
+	diag->fp_ampl2  = ((uint16_t)(buf[3]) << 8) | buf[2];
+	diag->fp_ampl3  = ((uint16_t)(buf[5]) << 8) | buf[4];
+	diag->cir_pwr   = ((uint16_t)(buf[7]) << 8) | buf[6];
+
+	/* reg:15:07 - reg:15:08 */
+	dw1000_spi_read(dw1000, DW1000_RX_TIME, 7, buf, 2);
+
+	diag->fp_ampl1  = ((uint16_t)(buf[1]) << 8) | buf[0];
+
+	diag->rxpacc    = (finfo & DW1000_RX_FINFO_RXPACC_MASK) >> DW1000_RX_FINFO_RXPACC_SHIFT;
+}
+
+
+/* dw1000_rx_power ******************************************************************************//**
+ * @brief		Returns the estimated total receive power in dBm:
+ *
+ * 					10 * log10(C * 2^17 / N^2) - A
+ *
+ * 				where C is CIR_PWR and N is RXPACC. N is not corrected for RXPACC_NOSAT which biases
+ * 				the estimate by a small constant that cancels in dw1000_rx_is_nlos. */
+float dw1000_rx_power(const DW1000* dw1000, const DW1000_Rx_Diag* diag)
+{
+	float n = diag->rxpacc;
+	float a = dw1000_prf(dw1000) == DW1000_PRF_16MHZ ?
+		DW1000_RX_POWER_A_16MHZ : DW1000_RX_POWER_A_64MHZ;
+
+	return 10.0f * log10f((float)diag->cir_pwr * 131072.0f / (n * n)) - a;
+}
+
+
+/* dw1000_fp_power ******************************************************************************//**
+ * @brief		Returns the estimated first path power in dBm:
+ *
+ * 					10 * log10((F1^2 + F2^2 + F3^2) / N^2) - A
+ *
+ * 				where F1, F2 and F3 are the first path amplitudes and N is RXPACC. */
+float dw1000_fp_power(const DW1000* dw1000, const DW1000_Rx_Diag* diag)
+{
+	float n  = diag->rxpacc;
+	float f1 = diag->fp_ampl1;
+	float f2 = diag->fp_ampl2;
+	float f3 = diag->fp_ampl3;
+	float a  = dw1000_prf(dw1000) == DW1000_PRF_16MHZ ?
+		DW1000_RX_POWER_A_16MHZ : DW1000_RX_POWER_A_64MHZ;
+
+	return 10.0f * log10f((f1*f1 + f2*f2 + f3*f3) / (n * n)) - a;
+}
+
+
+/* dw1000_rx_is_nlos ****************************************************************************//**
+ * @brief		Returns true if the last received frame was likely received through a non line of
+ * 				sight or multipath dominated channel. In line of sight, most of the received power
+ * 				is in the first path and the difference between the total and first path power is
+ * 				small (< 6 dB). A difference above DW1000_NLOS_THRESHOLD indicates the first path
+ * 				was attenuated and the leading edge, and therefore the timestamp, is unreliable. */
+bool dw1000_rx_is_nlos(const DW1000* dw1000, const DW1000_Rx_Diag* diag)
+{
+	if(diag->rxpacc == 0 || diag->cir_pwr == 0)
+	{
+		return false;
+	}
+
+	float diff = dw1000_rx_power(dw1000, diag) - dw1000_fp_power(dw1000, diag);
+
+	return isfinite(diff) && diff > DW1000_NLOS_THRESHOLD;
+}
+
+
 /* dw1000_sleep_after_tx ************************************************************************//**
  * @brief		Automatically enter sleep or deep sleep after transmitting. */
 void dw1000_sleep_after_tx(DW1000* dw1000, bool enable)
@@ -134,6 +134,10 @@ extern "C" {
 #define DW1000_BW_CH5          (499.2E6f)
 #define DW1000_BW_CH7          (1081.6E6f)
 
+#define DW1000_RX_POWER_A_16MHZ (113.77f)	/* Rx power constant A for 16 MHz PRF (dBm) */
+#define DW1000_RX_POWER_A_64MHZ (121.74f)	/* Rx power constant A for 64 MHz PRF (dBm) */
+#define DW1000_NLOS_THRESHOLD   (10.0f)		/* Rx power - first path power above which NLOS (dB) */
+
 #define DW1000_SPI_READ_SHIFT  (7)
 #define DW1000_SPI_SUB_SHIFT   (6)
 #define DW1000_SPI_EXT_SHIFT   (7)
@@ -3142,6 +3146,16 @@ typedef enum {
 } DW1000_Status;
 
 
+typedef struct {
+	uint16_t std_noise;		/* Standard deviation of noise */
+	uint16_t fp_ampl1;		/* First path amplitude point 1 */
+	uint16_t fp_ampl2;		/* First path amplitude point 2 */
+	uint16_t fp_ampl3;		/* First path amplitude point 3 */
+	uint16_t cir_pwr;		/* Channel impulse response power */
+	uint16_t rxpacc;		/* Preamble accumulation count */
+} DW1000_Rx_Diag;
+
+
 typedef struct {
 	unsigned          channel;			/* Channel Number 1, 2, 3, 4, 5, 7 */
 	DW1000_Data_Rate  data_rate;
@@ -3177,7 +3191,7 @@ typedef struct {
 	uint8_t  rx_code;			/* Receiver preamble code */
 	uint8_t  xtal_trim;
 	uint16_t sfd_timeout;
-	uint16_t ant_delay;
+	uint16_t ant_delay[7];		/* Indexed by ant_delay[Channel - 1] */
 
 	uint32_t otp_revision;
 	uint32_t part_id;
@@ -3208,6 +3222,8 @@ void dw1000_lock             (DW1000*);
 void dw1000_unlock           (DW1000*);
 void dw1000_soft_reset       (DW1000*);
 bool dw1000_reconfig         (DW1000*, DW1000_Config*);
+bool dw1000_set_channel_code (DW1000*, unsigned, unsigned);
+void dw1000_set_ant_delay    (DW1000*, unsigned, uint16_t);
 void dw1000_set_tx_ant_delay (DW1000*, uint16_t);
 void dw1000_set_rx_ant_delay (DW1000*, uint16_t);
 // void dw1000_irq_gpio_callback(const struct device*, struct gpio_callback*, uint32_t);
@@ -3221,7 +3237,15 @@ inline DW1000_Pre_Length dw1000_preamble_length(const DW1000* d) { return d->pre
 inline unsigned          dw1000_tx_code        (const DW1000* d) { return d->tx_code;         }
 inline unsigned          dw1000_rx_code        (const DW1000* d) { return d->rx_code;         }
 inline uint16_t          dw1000_sfd_timeout    (const DW1000* d) { return d->sfd_timeout;     }
-inline uint16_t          dw1000_ant_delay      (const DW1000* d) { return d->ant_delay;       }
+inline uint16_t          dw1000_ant_delay      (const DW1000* d) { return d->ant_delay[d->channel-1]; }
+
+/* Returns true if ch is 1, 2, 3, 4, 5 or 7 and the preamble code is valid for the PRF */
+inline bool dw1000_valid_channel_code(DW1000_Prf prf, unsigned ch, unsigned code)
+{
+	return ch > 0 && ch != 6 && ch <= 7 &&
+	       ((prf == DW1000_PRF_16MHZ && code >= 1 && code <= 8) ||
+	        (prf == DW1000_PRF_64MHZ && code >= 9 && code <= 24));
+}
        uint32_t          dw1000_read_dev_id    (DW1000*);
 
 /* DW1000 time conversion.
@@ -3257,6 +3281,10 @@ uint64_t dw1000_read_sys_tstamp     (DW1000*);
 uint64_t dw1000_read_tx_tstamp      (DW1000*);
 uint64_t dw1000_read_rx_tstamp      (DW1000*);
 float    dw1000_rx_clk_offset       (DW1000*);
+void     dw1000_read_rx_diag        (DW1000*, uint32_t, DW1000_Rx_Diag*);
+float    dw1000_rx_power            (const DW1000*, const DW1000_Rx_Diag*);
+float    dw1000_fp_power            (const DW1000*, const DW1000_Rx_Diag*);
+bool     dw1000_rx_is_nlos          (const DW1000*, const DW1000_Rx_Diag*);
 void     dw1000_sleep_after_tx      (DW1000*, bool);
 void     dw1000_sleep_after_rx      (DW1000*, bool);
 
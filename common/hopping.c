@@ -0,0 +1,108 @@
+/************************************************************************************************//**
+ * @file		hopping.c
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ ***************************************************************************************************/
+#include "hopping.h"
+
+
+/* Public Variables ------------------------------------------------------------------------------ */
+/* Default hopping sequence. The DWM1001 antenna supports channels 2 and 5. Preamble codes 9-12 are
+ * valid for both channels at 64 MHz PRF. The hopping sequence length should be coprime with the
+ * slotframe length so that every cell visits every entry of the hopping sequence. The first entry
+ * matches dwcfg in tsch.c and is the channel that scanning nodes listen on. */
+const Tsch_Channel hopping_default_seq[] = {
+	{ .channel = 5, .code = 10 },
+	{ .channel = 2, .code = 9  },
+	{ .channel = 5, .code = 12 },
+};
+
+const unsigned hopping_default_len = sizeof(hopping_default_seq) / sizeof(hopping_default_seq[0]);
+
+
+/* hopping_check ********************************************************************************//**
+ * @brief		Returns true if the hopping sequence can be adopted. The length must be 1 to
+ * 				TSCH_MAX_HOPPING_LEN and every entry must be a channel and preamble code the DW1000
+ * 				accepts at the given PRF. Sequences are checked once when they are adopted so that
+ * 				hopping in the slot handler can't fail. */
+bool hopping_check(const Tsch_Channel* seq, unsigned len, DW1000_Prf prf)
+{
+	unsigned i;
+
+	if(len == 0 || len > TSCH_MAX_HOPPING_LEN)
+	{
+		return false;
+	}
+
+	for(i = 0; i < len; i++)
+	{
+		if(!dw1000_valid_channel_code(prf, seq[i].channel, seq[i].code))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/* hopping_channel ******************************************************************************//**
+ * @brief		Returns the entry of the hopping sequence used by a cell with the given channel offset
+ * 				at asn. */
+const Tsch_Channel* hopping_channel(
+	const Tsch_Channel* seq,
+	unsigned            len,
+	uint64_t            asn,
+	unsigned            offset)
+{
+	return &seq[(asn + offset) % len];
+}
+
+
+/* hopping_lanes ********************************************************************************//**
+ * @brief		Returns how many cells can run at the same ASN, up to max. Lane l of a cell uses the
+ * 				entry at channel offset + l so any lanes consecutive entries must be pairwise distinct
+ * 				channel and code pairs. */
+unsigned hopping_lanes(const Tsch_Channel* seq, unsigned len, unsigned max)
+{
+	unsigned lanes, i, a, b;
+
+	for(lanes = max < len ? max : len; lanes > 1; lanes--)
+	{
+		bool distinct = true;
+
+		for(i = 0; distinct && i < len; i++)
+		{
+			for(a = 0; a < lanes; a++)
+			{
+				for(b = a + 1; b < lanes; b++)
+				{
+					const Tsch_Channel* ca = &seq[(i + a) % len];
+					const Tsch_Channel* cb = &seq[(i + b) % len];
+
+					distinct &= ca->channel != cb->channel || ca->code != cb->code;
+				}
+			}
+		}
+
+		if(distinct)
+		{
+			return lanes;
+		}
+	}
+
+	return 1;
+}
+
+
+/******************************************* END OF FILE *******************************************/
@@ -0,0 +1,80 @@
+/************************************************************************************************//**
+ * @file		hopping.h
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ * @brief		TSCH channel hopping. Every node maps a cell's ASN and channel offset to a DW1000
+ * 				channel and preamble code the same way. Kept free of Zephyr so that the agreement
+ * 				between nodes can be tested on the host.
+ *
+ ***************************************************************************************************/
+#ifndef HOPPING_H
+#define HOPPING_H
+
+#if __STDC_VERSION__ < 199901L
+#error Compile with C99 or higher!
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Public Includes ------------------------------------------------------------------------------- */
+#include <stdbool.h>
+#include <stdint.h>
+#include <zephyr.h>
+
+#include "dw1000.h"
+
+
+/* Public Macros --------------------------------------------------------------------------------- */
+#define TSCH_MAX_HOPPING_LEN   (8)
+
+
+/* Public Types ---------------------------------------------------------------------------------- */
+/* Hopping Sequence IE. Each entry of the hopping sequence is a DW1000 channel and preamble code.
+ * The channel used by a cell is:
+ *
+ * 		hopping_seq[(ASN + channel offset) % hopping_len]
+ *
+ * 		                     1                   2                   3
+ * 		 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ * 		+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * 		|   Channel 0   |    Code 0     |   Channel 1   |    Code 1     |
+ * 		+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * 		| ...
+ * 		+-+-+-+-+-+-+-+-+-
+ */
+typedef struct __packed {
+	uint8_t channel;
+	uint8_t code;
+} Tsch_Channel;
+
+
+/* Public Variables ------------------------------------------------------------------------------ */
+extern const Tsch_Channel hopping_default_seq[];
+extern const unsigned     hopping_default_len;
+
+
+/* Public Functions ------------------------------------------------------------------------------ */
+bool                hopping_check  (const Tsch_Channel*, unsigned, DW1000_Prf);
+unsigned            hopping_lanes  (const Tsch_Channel*, unsigned, unsigned);
+const Tsch_Channel* hopping_channel(const Tsch_Channel*, unsigned, uint64_t, unsigned);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HOPPING_H
+/******************************************* END OF FILE *******************************************/
@@ -0,0 +1,215 @@
+/************************************************************************************************//**
+ * @file		hyperembed.c
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ ***************************************************************************************************/
+#include <math.h>
+
+#include "hyperembed.h"
+
+
+/* Private Macros -------------------------------------------------------------------------------- */
+#define HYPER_PI                (3.14159265358979323846)
+#define HYPER_AXIS_X            (0.0)
+#define HYPER_AXIS_Y            (HYPER_PI / 3.0)
+#define HYPER_AXIS_Z            (HYPER_PI * 2.0 / 3.0)
+
+
+/* Private Functions ----------------------------------------------------------------------------- */
+static void hyper_translate(double[2], double, double);
+
+
+/* hyper_embed **********************************************************************************//**
+ * @brief		Computes the hyperspace coordinate (r, t) of the lattice cell (cx, cy, cz). */
+void hyper_embed(float cx, float cy, float cz, float* r, float* t)
+{
+	double v[2] = { 0, 0 };
+	float  x    = cx * HYPER_LATTICE_R;
+	float  y    = cy * HYPER_LATTICE_R;
+	float  z    = cz * HYPER_LATTICE_R;
+
+	/* x > y > z */
+	if(x >= y && y >= z)
+	{
+		hyper_translate(v, z, HYPER_AXIS_Z);
+		hyper_translate(v, y, HYPER_AXIS_Y);
+		hyper_translate(v, x, HYPER_AXIS_X);
+	}
+	/* x > z > y */
+	else if(x >= z && z >= y)
+	{
+		hyper_translate(v, y, HYPER_AXIS_Y);
+		hyper_translate(v, z, HYPER_AXIS_Z);
+		hyper_translate(v, x, HYPER_AXIS_X);
+	}
+	/* y > x > z */
+	else if(y >= x && x >= z)
+	{
+		hyper_translate(v, z, HYPER_AXIS_Z);
+		hyper_translate(v, x, HYPER_AXIS_X);
+		hyper_translate(v, y, HYPER_AXIS_Y);
+	}
+	/* y > z > x */
+	else if(y >= z && z >= x)
+	{
+		hyper_translate(v, x, HYPER_AXIS_X);
+		hyper_translate(v, z, HYPER_AXIS_Z);
+		hyper_translate(v, y, HYPER_AXIS_Y);
+	}
+	/* z > x > y */
+	else if(z >= x && x >= y)
+	{
+		hyper_translate(v, y, HYPER_AXIS_Y);
+		hyper_translate(v, x, HYPER_AXIS_X);
+		hyper_translate(v, z, HYPER_AXIS_Z);
+	}
+	/* z > y > x */
+	else if(z >= y && y >= x)
+	{
+		hyper_translate(v, x, HYPER_AXIS_X);
+		hyper_translate(v, y, HYPER_AXIS_Y);
+		hyper_translate(v, z, HYPER_AXIS_Z);
+	}
+
+	*r = v[0];
+	*t = v[1];
+}
+
+
+/* hyper_dist ***********************************************************************************//**
+ * @brief		Computes the hyperbolic distance between two hyperbolic coordinates. */
+float hyper_dist(float r1, float t1, float r2, float t2)
+{
+	return acosh(cosh(r1)*cosh(r2) - sinh(r1)*sinh(r2)*cos(t2 - t1));
+}
+
+
+/* hyper_rate ***********************************************************************************//**
+ * @brief		Returns the progress towards the coordinate (dr, dt) per expected transmission of
+ * 				forwarding to a neighbor at (r, t) over a link with etx expected transmissions.
+ * 				dist is the distance of the forwarding node to the coordinate. Returns 0 if the
+ * 				neighbor is not closer to the coordinate. */
+float hyper_rate(float dist, float r, float t, float dr, float dt, float etx)
+{
+	float progress = dist - hyper_dist(r, t, dr, dt);
+
+	return progress > 0 ? progress / etx : 0;
+}
+
+
+/* hyper_cell_set *******************************************************************************//**
+ * @brief		Places the node in the lattice cell (cx, cy, cz) without hysteresis. A NAN cell
+ * 				clears the cell so that the next location is adopted immediately. */
+void hyper_cell_set(HyperCell* c, float cx, float cy, float cz)
+{
+	c->x          = cx;
+	c->y          = cy;
+	c->z          = cz;
+	c->next_count = 0;
+}
+
+
+/* hyper_cell_moved *****************************************************************************//**
+ * @brief		Tracks the lattice cell of a node at (px, py, pz), given in cells. Returns true if
+ * 				the node has moved to a new cell. The node only leaves its cell once its location is
+ * 				HYPER_CELL_MARGIN past the cell's edge and the new cell must be seen for
+ * 				HYPER_CELL_CONFIRM consecutive updates. A node jittering across a cell's edge
+ * 				therefore keeps its coordinate. */
+bool hyper_cell_moved(HyperCell* c, float px, float py, float pz)
+{
+	float cx = roundf(px);
+	float cy = roundf(py);
+	float cz = roundf(pz);
+
+	/* No cell yet. Adopt the cell immediately. */
+	if(!isfinite(c->x) || !isfinite(c->y) || !isfinite(c->z))
+	{
+		hyper_cell_set(c, cx, cy, cz);
+		return true;
+	}
+
+	if(fabsf(px - c->x) < 0.5f + HYPER_CELL_MARGIN &&
+	   fabsf(py - c->y) < 0.5f + HYPER_CELL_MARGIN &&
+	   fabsf(pz - c->z) < 0.5f + HYPER_CELL_MARGIN)
+	{
+		c->next_count = 0;
+		return false;
+	}
+
+	if(c->next_count == 0 || cx != c->next_x || cy != c->next_y || cz != c->next_z)
+	{
+		c->next_x     = cx;
+		c->next_y     = cy;
+		c->next_z     = cz;
+		c->next_count = 0;
+	}
+
+	if(++c->next_count < HYPER_CELL_CONFIRM)
+	{
+		return false;
+	}
+
+	hyper_cell_set(c, cx, cy, cz);
+	return true;
+}
+
+
+/* hyper_translate ******************************************************************************//**
+ * @brief		Translates the vector v = [r, theta] 'a' units in the 't0' angle. */
+static void hyper_translate(double v[2], double a, double t0)
+{
+	if(a == 0)
+	{
+		return;
+	}
+
+	/* 	Translate 'a' units along the x axis
+	 *
+	 * 		    | cosh(a) 0 sinh(a) |
+	 * 		M = | 0       1 0       |
+	 * 		    | sinh(a) 0 cosh(a) |
+	 *
+	 * 	Parameter conversion between (r, theta) and (x,y,z)
+	 *
+	 * 		    | sinh(r)*cos(theta) | (x)
+	 * 		v = | sinh(r)*sin(theta) | (y)
+	 * 		    | cosh(r)            | (z)
+	 *
+	 * 		r = acosh(z)
+	 * 		t = atan(y/x)
+	 *
+	 * 	Translation and conversion:
+	 *
+	 * 		        | cosh(a)*sinh(r)*cos(theta) + sinh(a)*cosh(r) |
+	 * 		M * v = | sinh(r)*sin(theta)                           |
+	 * 		        | sinh(a)*sinh(r)*cos(theta) + cosh(a)*cosh(r) |
+	 *
+	 * 		r = acosh(sinh(a)*sinh(r)*cos(theta) + cosh(a)*cosh(r))
+	 * 		t = atan(sinh(r)*sin(theta) / cosh(a)*sinh(r)*cos(theta) + sinh(a)*cosh(r))
+	 */
+	double r = acosh(sinh(a) * sinh(v[0]) * cos(v[1] - t0) + cosh(a) * cosh(v[0]));
+	double y = sinh(v[0]) * sin(v[1] - t0);
+	double x = cosh(a) * sinh(v[0]) * cos(v[1] - t0) + sinh(a) * cosh(v[0]);
+	double theta = fmod(atan2(y, x) + t0, 2.0 * HYPER_PI);
+
+	if(theta < 0)
+	{
+		theta += 2.0 * HYPER_PI;
+	}
+
+	v[0] = r;
+	v[1] = theta;
+}
+
+
+/******************************************* END OF FILE *******************************************/
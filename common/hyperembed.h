@@ -0,0 +1,65 @@
+/************************************************************************************************//**
+ * @file		hyperembed.h
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ * @brief		Embedding of lattice cells into the hyperbolic plane. A node's hyperspace coordinate
+ * 				is found by translating the origin along three axes 120 degrees apart by the node's
+ * 				cell indices scaled by HYPER_LATTICE_R, largest index last. The cell a node is in is
+ * 				tracked with hysteresis so that a node near a cell's edge keeps its coordinate. Kept
+ * 				free of Zephyr so that the host analysis tools use the embedding the nodes use.
+ *
+ ***************************************************************************************************/
+#ifndef HYPEREMBED_H
+#define HYPEREMBED_H
+
+#if __STDC_VERSION__ < 199901L
+#error Compile with C99 or higher!
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Includes -------------------------------------------------------------------------------------- */
+#include <stdbool.h>
+
+
+/* Public Macros --------------------------------------------------------------------------------- */
+#define HYPER_LATTICE_R         (2.6339157938f)
+#define HYPER_CELL_MARGIN       (0.25f)	/* Distance past a cell's edge to leave, in cells */
+#define HYPER_CELL_CONFIRM      (5)		/* Updates in a new cell before it is adopted */
+
+
+/* Public Types ---------------------------------------------------------------------------------- */
+typedef struct {
+	float    x, y, z;                /* Lattice cell the coordinate was assigned from, NAN if none */
+	float    next_x, next_y, next_z; /* Lattice cell the node appears to be moving into */
+	unsigned next_count;             /* Consecutive updates the node was seen in the next cell */
+} HyperCell;
+
+
+/* Public Functions ------------------------------------------------------------------------------ */
+void  hyper_embed     (float, float, float, float*, float*);
+float hyper_dist      (float, float, float, float);
+float hyper_rate      (float, float, float, float, float, float);
+void  hyper_cell_set  (HyperCell*, float, float, float);
+bool  hyper_cell_moved(HyperCell*, float, float, float);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HYPEREMBED_H
+/******************************************* END OF FILE *******************************************/
@@ -0,0 +1,225 @@
+/************************************************************************************************//**
+ * @file		hypergw.c
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ ***************************************************************************************************/
+#include <math.h>
+#include <string.h>
+
+#include "hyperembed.h"
+#include "hypergw.h"
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Public Functions                                                                                //
+// ----------------------------------------------------------------------------------------------- //
+/* hypergw_init *********************************************************************************//**
+ * @brief		Empties the gateway table. */
+void hypergw_init(HyperGwTable* t)
+{
+	memset(t, 0, sizeof(*t));
+}
+
+
+/* hypergw_adv **********************************************************************************//**
+ * @brief		Copies up to max healthy gateways to advertise at time now in ms. Successive calls
+ * 				rotate through the table so that every gateway is eventually advertised. Returns the
+ * 				number of gateways copied. */
+unsigned hypergw_adv(HyperGwTable* t, uint32_t now, HyperGwAdv* advs, unsigned max)
+{
+	unsigned count = 0;
+	unsigned i;
+
+	for(i = 0; i < HYPER_MAX_GATEWAYS && count < max; i++)
+	{
+		const HyperGateway* gw = &t->gws[(t->next + i) % HYPER_MAX_GATEWAYS];
+
+		if(hypergw_fresh(gw, now))
+		{
+			uint32_t age = (now - gw->origin) / 1000 + HYPER_GW_HOP_AGE_S;
+
+			advs[count]     = gw->adv;
+			advs[count].age = age < UINT8_MAX ? age : UINT8_MAX;
+			count++;
+		}
+	}
+
+	t->next = (t->next + 1) % HYPER_MAX_GATEWAYS;
+	return count;
+}
+
+
+/* hypergw_rx ***********************************************************************************//**
+ * @brief		Updates the table from gateway announcements received at time now in ms. An
+ * 				announcement refreshes a gateway only if the gateway originated it after the
+ * 				announcement already known. Forwarded copies only ever get older, so neighbors
+ * 				repeating an announcement never keep each other's copies fresh and a lost gateway
+ * 				expires everywhere. A gateway that rebooted is accepted again as soon as its new
+ * 				announcements arrive. */
+void hypergw_rx(HyperGwTable* t, uint32_t now, const HyperGwAdv* advs, unsigned count)
+{
+	unsigned i, j;
+
+	for(i = 0; i < count; i++)
+	{
+		const HyperGwAdv* adv    = &advs[i];
+		HyperGateway*     gw     = 0;
+		HyperGateway*     old    = &t->gws[0];
+		uint32_t          origin = now - adv->age * 1000u;
+
+		if(!isfinite(adv->coord.r) || !isfinite(adv->coord.t) || adv->prefix_len > 128 ||
+		   now - origin >= HYPER_GW_TIMEOUT_MS)
+		{
+			continue;
+		}
+
+		/* Find the gateway or else the least recently refreshed entry */
+		for(j = 0; j < HYPER_MAX_GATEWAYS; j++)
+		{
+			HyperGateway* ptr = &t->gws[j];
+
+			if(ptr->valid && memcmp(ptr->adv.addr, adv->addr, sizeof(adv->addr)) == 0)
+			{
+				gw = ptr;
+				break;
+			}
+			else if(old->valid && (!ptr->valid || now - ptr->origin > now - old->origin))
+			{
+				old = ptr;
+			}
+		}
+
+		if(gw)
+		{
+			if(!hypergw_fresh(gw, now) || (int32_t)(origin - gw->origin) > 0)
+			{
+				gw->adv    = *adv;
+				gw->origin = origin;
+			}
+		}
+		else
+		{
+			old->adv    = *adv;
+			old->origin = origin;
+			old->valid  = true;
+		}
+	}
+}
+
+
+/* hypergw_fresh ********************************************************************************//**
+ * @brief		Returns true if the gateway originated its latest known announcement recently. */
+bool hypergw_fresh(const HyperGateway* gw, uint32_t now)
+{
+	return gw->valid && now - gw->origin < HYPER_GW_TIMEOUT_MS;
+}
+
+
+/* hypergw_serves *******************************************************************************//**
+ * @brief		Returns true if the 16 byte IPv6 address is within the gateway's prefix. */
+bool hypergw_serves(const HyperGwAdv* adv, const uint8_t* addr)
+{
+	unsigned bytes = adv->prefix_len / 8;
+	unsigned bits  = adv->prefix_len % 8;
+
+	if(adv->prefix_len == 0 || memcmp(adv->prefix, addr, bytes) != 0)
+	{
+		return false;
+	}
+
+	return bits == 0 || ((adv->prefix[bytes] ^ addr[bytes]) & (0xFF00u >> bits)) == 0;
+}
+
+
+/* hypergw_uplink *******************************************************************************//**
+ * @brief		Returns true if a healthy gateway serves the 16 byte IPv6 address. */
+bool hypergw_uplink(const HyperGwTable* t, uint32_t now, const uint8_t* addr)
+{
+	unsigned i;
+
+	for(i = 0; i < HYPER_MAX_GATEWAYS; i++)
+	{
+		if(hypergw_fresh(&t->gws[i], now) && hypergw_serves(&t->gws[i].adv, addr))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/* hypergw_healthy ******************************************************************************//**
+ * @brief		Returns true if the coordinate belongs to a gateway whose announcements are fresh. */
+bool hypergw_healthy(const HyperGwTable* t, uint32_t now, const Hypercoord* coord)
+{
+	unsigned i;
+
+	for(i = 0; i < HYPER_MAX_GATEWAYS; i++)
+	{
+		const HyperGateway* gw = &t->gws[i];
+
+		if(hypergw_fresh(gw, now) && gw->adv.coord.r == coord->r && gw->adv.coord.t == coord->t)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/* hypergw_rank *********************************************************************************//**
+ * @brief		Copies the healthy gateways serving the address to advs, nearest to the coordinate
+ * 				from first, and returns how many were copied. advs must hold HYPER_MAX_GATEWAYS. */
+unsigned hypergw_rank(
+	const HyperGwTable* t,
+	uint32_t            now,
+	const uint8_t*      addr,
+	const Hypercoord*   from,
+	HyperGwAdv*         advs)
+{
+	float    dist[HYPER_MAX_GATEWAYS];
+	unsigned count = 0;
+	unsigned i, j;
+
+	for(i = 0; i < HYPER_MAX_GATEWAYS; i++)
+	{
+		const HyperGateway* gw = &t->gws[i];
+
+		if(!hypergw_fresh(gw, now) || !hypergw_serves(&gw->adv, addr))
+		{
+			continue;
+		}
+
+		float d = hyper_dist(from->r, from->t, gw->adv.coord.r, gw->adv.coord.t);
+
+		/* Insertion sort. The table only holds a few gateways */
+		for(j = count; j > 0 && d < dist[j - 1]; j--)
+		{
+			dist[j] = dist[j - 1];
+			advs[j] = advs[j - 1];
+		}
+
+		dist[j] = d;
+		advs[j] = gw->adv;
+		count++;
+	}
+
+	return count;
+}
+
+
+/******************************************* END OF FILE *******************************************/
@@ -0,0 +1,101 @@
+/************************************************************************************************//**
+ * @file		hypergw.h
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ * @brief		Table of the gateways a node has heard announced. A gateway is a node with a link to
+ * 				a border router host. The table ages out gateways that stop announcing and ranks the
+ * 				gateways that serve a destination by distance. Locking and the clock are left to the
+ * 				caller so that gateway failover can be simulated on the host.
+ *
+ ***************************************************************************************************/
+#ifndef HYPERGW_H
+#define HYPERGW_H
+
+#if __STDC_VERSION__ < 199901L
+#error Compile with C99 or higher!
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Public Includes ------------------------------------------------------------------------------- */
+#include <stdbool.h>
+#include <stdint.h>
+#include <zephyr.h>
+
+
+/* Public Macros --------------------------------------------------------------------------------- */
+#define HYPER_MAX_GATEWAYS          (4)         /* Gateways tracked by each node */
+#define HYPER_GW_TIMEOUT_MS         (45*1000)   /* Gateway is lost if its announcement is older */
+#define HYPER_GW_HOP_AGE_S          (1)         /* Age added to an announcement per hop */
+
+/* Gateways advertised per enhanced beacon. An announcement with its prefix is 35 bytes, so only one
+ * fits next to the other IEs. Rotating through the table still advertises every gateway. */
+#define HYPER_MAX_GW_ADVS           (1)
+
+
+/* Public Types ---------------------------------------------------------------------------------- */
+typedef struct __packed {
+	float r;
+	float t;
+} Hypercoord;
+
+
+/* Gateway announcement carried in enhanced beacons. Gateways originate an announcement with age 0
+ * periodically while their host link is up. Nodes forward the announcements of the gateways they
+ * know about in their own beacons with the age increased by the time they held it plus one hop, so
+ * a forwarded copy is always older than the copy it came from. The prefix is learned from the
+ * host's heartbeat and covers the addresses reachable through the gateway. */
+typedef struct __packed {
+	uint8_t    addr[8];		/* Link layer address of the gateway */
+	Hypercoord coord;
+	uint8_t    seq;
+	uint8_t    age;			/* Time in s since the gateway originated the announcement */
+	uint8_t    prefix[16];
+	uint8_t    prefix_len;	/* In bits. 0 if the gateway serves no addresses */
+} HyperGwAdv;
+
+
+typedef struct {
+	HyperGwAdv adv;
+	uint32_t   origin;		/* Time in ms when the gateway originated the latest announcement */
+	bool       valid;
+} HyperGateway;
+
+
+typedef struct {
+	HyperGateway gws[HYPER_MAX_GATEWAYS];
+	unsigned     next;		/* Entry the next advertisement starts from */
+} HyperGwTable;
+
+
+/* Public Functions ------------------------------------------------------------------------------ */
+void     hypergw_init   (HyperGwTable*);
+unsigned hypergw_adv    (HyperGwTable*, uint32_t, HyperGwAdv*, unsigned);
+void     hypergw_rx     (HyperGwTable*, uint32_t, const HyperGwAdv*, unsigned);
+bool     hypergw_fresh  (const HyperGateway*, uint32_t);
+bool     hypergw_serves (const HyperGwAdv*, const uint8_t*);
+bool     hypergw_uplink (const HyperGwTable*, uint32_t, const uint8_t*);
+bool     hypergw_healthy(const HyperGwTable*, uint32_t, const Hypercoord*);
+unsigned hypergw_rank   (const HyperGwTable*, uint32_t, const uint8_t*, const Hypercoord*,
+                         HyperGwAdv*);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HYPERGW_H
+/******************************************* END OF FILE *******************************************/
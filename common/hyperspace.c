@@ -19,6 +19,7 @@
 #include <zephyr.h>
 
 #include "calc.h"
+#include "hyperembed.h"
 #include "hyperspace.h"
 #include "location.h"
 #include "pool.h"
@@ -30,14 +31,15 @@ LOG_MODULE_REGISTER(hyperspace, LOG_LEVEL_DBG);
 
 
 /* Private Constants ----------------------------------------------------------------------------- */
-#define HYPER_LATTICE_R					(2.6339157938f)
-#define NUM_HYPERROUTES					(16)
 // #define MAX_HYPER_COORD_REQUESTS		(1)
 #define MAX_HYPER_COORD_REQUESTS		(3)
 #define COORD_REQUEST_TIMEOUT_MS		(30*1000)	/* Coordinate request timeout in seconds */
 #define HYPER_ROUTE_TIMEOUT_MS			(5*60*1000)	/* Hyperspace route timeout in ms */
+#define HYPER_CORRESPONDENT_TIMEOUT_MS	(60*1000)	/* Destinations active within this time are notified */
 #define PACKET_CACHE_TABLE_SIZE			(64)
 #define PACKET_CACHE_ENTRY_TIMEOUT_MS	(2*60*1000)	/* 2 min timeout */
+#define HYPER_GW_PERIOD_MS				(10*1000)	/* Gateway announcement period */
+#define HYPER_GW_HOST_TIMEOUT_MS		(30*1000)	/* Host link is down if silent this long */
 
 
 /* Private Types --------------------------------------------------------------------------------- */
@@ -62,16 +64,25 @@ static void        hyperspace_route_remove(HyperRoute*);
 static void        hyperspace_route_clean (void);
 static HyperRoute* hyperspace_route_find  (struct in6_addr*);
 
+static struct net_pkt*      create_coord_pkt (struct net_if*, struct in6_addr*, uint8_t, uint16_t, uint16_t);
 static struct net_pkt*      create_coord_req (struct net_if*, struct in6_addr*, uint16_t, uint16_t);
+static struct net_pkt*      create_coord_upd (HyperRoute*);
 static void                 coord_req_timeout(struct k_work*);
+static void                 coord_notify     (struct k_work*);
 
 // static struct net_ipv6_hdr* net_pkt_get_ipv6_hdr   (struct net_pkt*);
 // static HyperOpt*            net_pkt_get_hyperopt   (struct net_pkt*);
 static bool                 net_pkt_get_frag_offset(struct net_pkt*, uint16_t*);
 
+static bool      hyperspace_is_uplink      (const struct in6_addr*);
+static Neighbor* hyperspace_gateway_route  (const struct in6_addr*, Hypercoord*, uint8_t*);
+static bool      hyperspace_gateway_healthy(const Hypercoord*);
+static bool      hyperspace_gateway_serves (const struct in6_addr*);
+static void      hyperspace_gateway_timeout(struct k_work*);
+
 static Neighbor* hyperspace_closest  (const Hypercoord*);
-static float     hyperspace_dist     (float, float, float, float);
-static void      hyperspace_translate(double[2], double, double);
+static bool      hyperspace_is_nbr   (const struct in6_addr*);
+static void      hyperspace_stat_max (atomic_t*, uint32_t);
 
 
 /* Private Variables ----------------------------------------------------------------------------- */
@@ -91,10 +102,19 @@ Pool hyperroute_pool;
  * @brief		Initializes hyperspace routing. */
 void hyperspace_init(void)
 {
-	hyperspace.coord.r   = NAN;
-	hyperspace.coord.t   = NAN;
-	hyperspace.coord_seq = 0;
-	hyperspace.last_loc  = make_vec3(NAN, NAN, NAN);
+	hyperspace.coord.r    = NAN;
+	hyperspace.coord.t    = NAN;
+	hyperspace.coord_seq  = 0;
+	hyperspace.last_loc   = make_vec3(NAN, NAN, NAN);
+	hyper_cell_set(&hyperspace.cell, NAN, NAN, NAN);
+
+	hypergw_init(&hyperspace.gateways);
+	hyperspace.is_gateway      = false;
+	hyperspace.host_prefix_len = 0;
+	atomic_set(&hyperspace.host_seen, 0);
+	k_work_init_delayable(&hyperspace.gw_work, hyperspace_gateway_timeout);
+	k_work_init(&hyperspace.notify_work, coord_notify);
+	hyperspace_stats_reset();
 
 	hyperspace_pkt_cache_init();
 
@@ -106,10 +126,19 @@ void hyperspace_init(void)
  * @brief		Initializes hyperspace routing as the root node. */
 void hyperspace_init_root(void)
 {
-	hyperspace.coord.r   = 0;
-	hyperspace.coord.t   = 0;
-	hyperspace.coord_seq = 0;
-	hyperspace.last_loc  = make_vec3(0, 0, 0);
+	hyperspace.coord.r    = 0;
+	hyperspace.coord.t    = 0;
+	hyperspace.coord_seq  = 0;
+	hyperspace.last_loc   = make_vec3(0, 0, 0);
+	hyper_cell_set(&hyperspace.cell, 0, 0, 0);
+
+	hypergw_init(&hyperspace.gateways);
+	hyperspace.is_gateway      = false;
+	hyperspace.host_prefix_len = 0;
+	atomic_set(&hyperspace.host_seen, 0);
+	k_work_init_delayable(&hyperspace.gw_work, hyperspace_gateway_timeout);
+	k_work_init(&hyperspace.notify_work, coord_notify);
+	hyperspace_stats_reset();
 
 	hyperspace_pkt_cache_init();
 
@@ -142,81 +171,156 @@ float hyperspace_coord_t(void)
 
 
 /* hyperspace_update ****************************************************************************//**
- * @brief		Updates this node's hyperspace coordinate. */
+ * @brief		Updates this node's hyperspace coordinate. The coordinate is assigned from the lattice
+ * 				cell the node is in and only changes once the node has settled in a new cell. */
 void hyperspace_update(float x, float y, float z)
 {
 	Vec3 loc = make_vec3(x, y, z);
 
+	k_mutex_lock(&hyperspace.route_mutex, K_FOREVER);
+
 	if(!isfinite(x) || !isfinite(y) || !isfinite(z))
 	{
 		hyperspace.last_loc = loc;
 		hyperspace.coord.r  = NAN;
 		hyperspace.coord.t  = NAN;
+		hyper_cell_set(&hyperspace.cell, NAN, NAN, NAN);
 	}
-	else if(!isfinite(hyperspace.last_loc.x) ||
-	        !isfinite(hyperspace.last_loc.y) ||
-	        !isfinite(hyperspace.last_loc.z) ||
-	        vec3_dist(hyperspace.last_loc, loc) > 2.0f * LATTICE_R)
+	else if(hyper_cell_moved(&hyperspace.cell, x / LATTICE_R, y / LATTICE_R, z / LATTICE_R))
 	{
 		hyperspace.last_loc = loc;
 
-		double v[2] = { 0, 0 };
-		x = roundf(x / LATTICE_R) * HYPER_LATTICE_R;
-		y = roundf(y / LATTICE_R) * HYPER_LATTICE_R;
-		z = roundf(z / LATTICE_R) * HYPER_LATTICE_R;
+		float r, t;
+		hyper_embed(hyperspace.cell.x, hyperspace.cell.y, hyperspace.cell.z, &r, &t);
 
-		/* x > y > z */
-		if(x >= y && y >= z)
-		{
-			hyperspace_translate(v, z, calc_deg_to_rad_f(120));
-			hyperspace_translate(v, y, calc_deg_to_rad_f(60));
-			hyperspace_translate(v, x, calc_deg_to_rad_f(0));
-		}
-		/* x > z > y */
-		else if(x >= z && z >= y)
-		{
-			hyperspace_translate(v, y, calc_deg_to_rad_f(60));
-			hyperspace_translate(v, z, calc_deg_to_rad_f(120));
-			hyperspace_translate(v, x, calc_deg_to_rad_f(0));
-		}
-		/* y > x > z */
-		else if(y >= x && x >= z)
-		{
-			hyperspace_translate(v, z, calc_deg_to_rad_f(120));
-			hyperspace_translate(v, x, calc_deg_to_rad_f(0));
-			hyperspace_translate(v, y, calc_deg_to_rad_f(60));
-		}
-		/* y > z > x */
-		else if(y >= z && z >= x)
+		hyperspace.coord.r = r;
+		hyperspace.coord.t = t;
+		hyperspace.coord_seq++;
+
+		/* Tell the nodes this node is talking to about the new coordinate rather than letting them
+		 * send to the old coordinate until their routes time out. */
+		k_work_submit(&hyperspace.notify_work);
+
+		// if(hyperspace.on_coord_update)
+		// {
+		// 	hyperspace.on_coord_update(hyperspace.coord.r, hyperspace.coord.t, loc.x, loc.y, loc.z);
+		// }
+	}
+
+	k_mutex_unlock(&hyperspace.route_mutex);
+}
+
+
+/* hyperspace_snapshot **************************************************************************//**
+ * @brief		Copies this node's coordinate and valid routes which are saved across reboots. */
+void hyperspace_snapshot(HyperSnapshot* s)
+{
+	k_mutex_lock(&hyperspace.route_mutex, K_FOREVER);
+
+	s->coord      = hyperspace.coord;
+	s->coord_seq  = hyperspace.coord_seq;
+	s->last_loc   = hyperspace.last_loc;
+	s->num_routes = 0;
+
+	unsigned i;
+	for(i = 0; i < NUM_HYPERROUTES; i++)
+	{
+		if(pool_idx_is_reserved(&hyperroute_pool, i))
 		{
-			hyperspace_translate(v, x, calc_deg_to_rad_f(0));
-			hyperspace_translate(v, z, calc_deg_to_rad_f(120));
-			hyperspace_translate(v, y, calc_deg_to_rad_f(60));
+			HyperRoute*      ptr = pool_entry(&hyperroute_pool, i);
+			HyperSavedRoute* dst = &s->routes[s->num_routes];
+
+			if(ptr->valid)
+			{
+				memmove(&dst->addr, &ptr->addr, sizeof(struct in6_addr));
+				dst->coord     = ptr->coord;
+				dst->coord_seq = ptr->coord_seq;
+				dst->iface     = net_if_get_by_iface(ptr->iface);
+				s->num_routes++;
+			}
 		}
-		/* z > x > y */
-		else if(z >= x && x >= y)
+	}
+
+	k_mutex_unlock(&hyperspace.route_mutex);
+}
+
+
+/* hyperspace_restore ***************************************************************************//**
+ * @brief		Restores this node's coordinate and routes saved before a reboot. The coordinate
+ * 				sequence number continues from the saved value so that other nodes accept this
+ * 				node's next coordinate update. The routing lock is held throughout as
+ * 				hyperspace_route and hyperspace_snapshot use the routes and the coordinate. The route
+ * 				table helpers take the lock again, which is fine as Zephyr mutexes are recursive. */
+void hyperspace_restore(const HyperSnapshot* s)
+{
+	k_mutex_lock(&hyperspace.route_mutex, K_FOREVER);
+
+	hyperspace.coord      = s->coord;
+	hyperspace.coord_seq  = s->coord_seq;
+	hyperspace.last_loc   = s->last_loc;
+	hyper_cell_set(&hyperspace.cell,
+		roundf(s->last_loc.x / LATTICE_R),
+		roundf(s->last_loc.y / LATTICE_R),
+		roundf(s->last_loc.z / LATTICE_R));
+
+	unsigned i;
+	for(i = 0; i < calc_min_uint(s->num_routes, NUM_HYPERROUTES); i++)
+	{
+		struct in6_addr addr = s->routes[i].addr;
+
+		if(hyperspace_route_find(&addr))
 		{
-			hyperspace_translate(v, y, calc_deg_to_rad_f(60));
-			hyperspace_translate(v, x, calc_deg_to_rad_f(0));
-			hyperspace_translate(v, z, calc_deg_to_rad_f(120));
+			continue;
 		}
-		/* z > y > x */
-		else if(z >= y && y >= x)
+
+		HyperRoute* route = hyperspace_route_alloc(&addr, net_if_get_by_index(s->routes[i].iface));
+
+		if(!route)
 		{
-			hyperspace_translate(v, x, calc_deg_to_rad_f(0));
-			hyperspace_translate(v, y, calc_deg_to_rad_f(60));
-			hyperspace_translate(v, z, calc_deg_to_rad_f(120));
+			break;
 		}
 
-		hyperspace.coord.r = v[0];
-		hyperspace.coord.t = v[1];
-		hyperspace.coord_seq++;
-
-		// if(hyperspace.on_coord_update)
-		// {
-		// 	hyperspace.on_coord_update(hyperspace.coord.r, hyperspace.coord.t, loc.x, loc.y, loc.z);
-		// }
+		route->coord     = s->routes[i].coord;
+		route->coord_seq = s->routes[i].coord_seq;
+		route->valid     = true;
+		k_work_init_delayable(&route->retry_timer, coord_req_timeout);
 	}
+
+	k_mutex_unlock(&hyperspace.route_mutex);
+}
+
+
+/* hyperspace_stats *****************************************************************************//**
+ * @brief		Copies the routing statistics. */
+void hyperspace_stats(HyperStats* stats)
+{
+	stats->greedy        = atomic_get(&hyperspace.stats.greedy);
+	stats->floods        = atomic_get(&hyperspace.stats.floods);
+	stats->minima        = atomic_get(&hyperspace.stats.minima);
+	stats->delivered     = atomic_get(&hyperspace.stats.delivered);
+	stats->hops_total    = atomic_get(&hyperspace.stats.hops_total);
+	stats->hops_max      = atomic_get(&hyperspace.stats.hops_max);
+	stats->coord_reqs    = atomic_get(&hyperspace.stats.coord_reqs);
+	stats->coord_retries = atomic_get(&hyperspace.stats.coord_retries);
+	stats->coord_fails   = atomic_get(&hyperspace.stats.coord_fails);
+	stats->coord_updates = atomic_get(&hyperspace.stats.coord_updates);
+}
+
+
+/* hyperspace_stats_reset ***********************************************************************//**
+ * @brief		Clears the routing statistics. */
+void hyperspace_stats_reset(void)
+{
+	atomic_clear(&hyperspace.stats.greedy);
+	atomic_clear(&hyperspace.stats.floods);
+	atomic_clear(&hyperspace.stats.minima);
+	atomic_clear(&hyperspace.stats.delivered);
+	atomic_clear(&hyperspace.stats.hops_total);
+	atomic_clear(&hyperspace.stats.hops_max);
+	atomic_clear(&hyperspace.stats.coord_reqs);
+	atomic_clear(&hyperspace.stats.coord_retries);
+	atomic_clear(&hyperspace.stats.coord_fails);
+	atomic_clear(&hyperspace.stats.coord_updates);
 }
 
 
@@ -287,14 +391,19 @@ int hyperspace_send(struct net_pkt* pkt)
 		return NET_DROP;
 	}
 
-	if(hdr->dst.s6_addr[15] == 1)
-	{
-		__asm("nop");
-	}
-
 	/* Set source coordinate */
 	hyperopt->src     = hyperspace.coord;
 	hyperopt->src_seq = hyperspace.coord_seq;
+
+	Neighbor* nbr = 0;
+
+	/* Steer uplink traffic to the nearest reachable gateway serving the destination */
+	if(hyperspace_is_uplink(&hdr->dst) &&
+	   (nbr = hyperspace_gateway_route(&hdr->dst, &hyperopt->dest, &hyperopt->dest_seq)) != 0)
+	{
+		goto forward;
+	}
+
 	HyperRoute* route = hyperspace_route_find(&hdr->dst);
 
 	/* No route to destination. Create a blank hyperspace routing entry to the destination. */
@@ -319,12 +428,13 @@ int hyperspace_send(struct net_pkt* pkt)
 		}
 
 		/* Enqueue coord request and start a timeout */
+		atomic_inc(&hyperspace.stats.coord_reqs);
 		net_if_queue_tx(route->iface, req);
 		k_work_init_delayable(&route->retry_timer, coord_req_timeout);
 		k_work_schedule(&route->retry_timer, K_MSEC(COORD_REQUEST_TIMEOUT_MS));
 	}
 
-	Neighbor* nbr = 0;
+	route->last_active = k_uptime_get();
 
 	/* If unknown dest coordinates, broadcast the packet */
 	if(!isfinite(route->coord.r) || !isfinite(route->coord.t))
@@ -334,6 +444,7 @@ int hyperspace_send(struct net_pkt* pkt)
 		net_pkt_lladdr_dst(pkt)->len  = 8;
 
 		LOG_DBG("tx to bcast");
+		atomic_inc(&hyperspace.stats.floods);
 		return NET_OK;
 	}
 	/* Otherwise, setup the packet to be forwarded to the closest neighbor */
@@ -344,6 +455,8 @@ int hyperspace_send(struct net_pkt* pkt)
 		nbr = hyperspace_closest(&route->coord);
 	}
 
+	forward:
+
 	/* If a neighbor is closer, forward to neighbor */
 	if(nbr)
 	{
@@ -354,6 +467,7 @@ int hyperspace_send(struct net_pkt* pkt)
 		LOG_DBG("tx to %02X:%02X:%02X:%02X:%02X:%02X:%02X:%02X",
 			nbr->address[0], nbr->address[1], nbr->address[2], nbr->address[3],
 			nbr->address[4], nbr->address[5], nbr->address[6], nbr->address[7]);
+		atomic_inc(&hyperspace.stats.greedy);
 	}
 	/* Otherwise, this node is the closest. The destination node is within range of this node. */
 	else
@@ -363,6 +477,11 @@ int hyperspace_send(struct net_pkt* pkt)
 		net_pkt_lladdr_dst(pkt)->len  = 0;
 
 		LOG_DBG("tx to local");
+
+		if(!hyperspace_is_nbr(&hdr->dst))
+		{
+			atomic_inc(&hyperspace.stats.minima);
+		}
 	}
 
 	return NET_OK;
@@ -417,11 +536,6 @@ int hyperspace_recv(struct net_pkt* pkt)
 		return NET_DROP;	/* -EIO */
 	}
 
-	if(hdr->dst.s6_addr[15] == 1)
-	{
-		__asm("nop");
-	}
-
 	/* Update an existing hyperspace routing entry if it exists */
 	HyperRoute* route = hyperspace_route_find(&hdr->src);
 
@@ -439,6 +553,8 @@ int hyperspace_recv(struct net_pkt* pkt)
 		}
 	}
 
+	route->last_active = k_uptime_get();
+
 	/* Update route back to the packet source */
 	if((!route->valid || (int)(hyperopt->src_seq - route->coord_seq) > 0) &&
 	   (isfinite(hyperopt->src.r) && isfinite(hyperopt->src.t)))
@@ -458,6 +574,23 @@ int hyperspace_recv(struct net_pkt* pkt)
 		return NET_DROP;
 	}
 
+	/* Each router decrements the hop limit. The hop from the source is not counted. The path length
+	 * is only known if the source's initial hop limit is. Mesh nodes send unicast packets with the
+	 * interface's hop limit, which router advertisements leave unchanged, so it is the same on
+	 * every node. Hosts behind a gateway and ND packets start from their own hop limit and are not
+	 * counted. */
+	uint8_t hop_limit = net_if_ipv6_get_hop_limit(net_pkt_iface(pkt));
+
+	if(isfinite(hyperopt->dest.r) && isfinite(hyperopt->dest.t) && hdr->hop_limit <= hop_limit &&
+	   !hyperspace_is_uplink(&hdr->src))
+	{
+		uint32_t hops = hop_limit - hdr->hop_limit + 1;
+
+		atomic_inc(&hyperspace.stats.delivered);
+		atomic_add(&hyperspace.stats.hops_total, hops);
+		hyperspace_stat_max(&hyperspace.stats.hops_max, hops);
+	}
+
 	/* TODO: set packet source lladdr? */
 	LOG_DBG("recv");
 	return NET_OK;
@@ -524,26 +657,19 @@ int hyperspace_route(struct net_pkt* pkt)
 		return -EIO;
 	}
 
-	/* Todo: this is terrible. Need ND across SPIS_IF to get rid of this. This code is here to
-	 * prevent packets addressed to the other side of the SPIS_IF from being transmitted to the
-	 * local mesh.
-	 *
-	 * This also prevents routing multicast packets that match the lower 8 bytes (which is actually
-	 * desirable). */
-	if(hdr->dst.s6_addr[8]  == 0 &&
-	   hdr->dst.s6_addr[9]  == 0 &&
-	   hdr->dst.s6_addr[10] == 0 &&
-	   hdr->dst.s6_addr[11] == 0 &&
-	   hdr->dst.s6_addr[12] == 0 &&
-	   hdr->dst.s6_addr[13] == 0 &&
-	   hdr->dst.s6_addr[14] == 0 &&
-	   hdr->dst.s6_addr[15] == 1)
+	/* Uplink packets are addressed to a host behind a gateway, as learned from the prefixes the
+	 * gateways announce. A gateway whose host serves the destination hands the packet to the IPv6
+	 * stack which forwards it to the host. Other nodes forward it towards a gateway. */
+	bool uplink = hyperspace_is_uplink(&hdr->dst);
+
+	if(uplink && hyperspace_gateway_serves(&hdr->dst))
 	{
 		return NET_DROP;
 	}
 
-	/* Update an existing hyperspace routing entry if it exists */
-	HyperRoute* dest_route = hyperspace_route_find(&hdr->dst);
+	/* Update an existing hyperspace routing entry if it exists. The destination coordinate of an
+	 * uplink packet is a gateway rather than the destination's coordinate. */
+	HyperRoute* dest_route = uplink ? 0 : hyperspace_route_find(&hdr->dst);
 	HyperRoute* src_route  = hyperspace_route_find(&hdr->src);
 
 	if(dest_route)
@@ -601,8 +727,27 @@ int hyperspace_route(struct net_pkt* pkt)
 		return NET_DROP;
 	}
 
+	Neighbor* nbr = 0;
+
+	/* Forward uplink packets towards the gateway in the packet's destination coordinate. If that
+	 * gateway has been lost or no neighbor is closer to it, fail over to the next gateway serving
+	 * the destination. Never flood uplink packets. */
+	if(uplink)
+	{
+		if(hyperspace_gateway_healthy(&hyperopt->dest))
+		{
+			nbr = hyperspace_closest(&hyperopt->dest);
+		}
+
+		if(!nbr && !(nbr = hyperspace_gateway_route(&hdr->dst, &hyperopt->dest, &hyperopt->dest_seq)))
+		{
+			LOG_DBG("DROP: no gateway reachable");
+			atomic_inc(&hyperspace.stats.minima);
+			return NET_DROP;
+		}
+	}
 	/* Send to all connected nodes if no destination coordinates */
-	if(!isfinite(hyperopt->dest.r) || !isfinite(hyperopt->dest.t))
+	else if(!isfinite(hyperopt->dest.r) || !isfinite(hyperopt->dest.t))
 	{
 		/* Forward to all connected nodes */
 		net_pkt_lladdr_dst(pkt)->addr = tsch_bcast_addr();
@@ -611,15 +756,14 @@ int hyperspace_route(struct net_pkt* pkt)
 
 		pkt->iface = iface;
 		net_if_queue_tx(iface, pkt);
+		atomic_inc(&hyperspace.stats.floods);
 		return NET_OK;
 	}
-
-	/* TODO: forward packet to spis_if if opt->dest.r == 0.0f && opt->dest.t == 0.0f
-	 * Set packet iface = spis_if. */
-
 	/* Search for the hyperspace neighbor closest to the destination */
-	/* Todo: what if nbr is 0? */
-	Neighbor* nbr = hyperspace_closest(&hyperopt->dest);
+	else
+	{
+		nbr = hyperspace_closest(&hyperopt->dest);
+	}
 
 	if(nbr)
 	{
@@ -630,6 +774,7 @@ int hyperspace_route(struct net_pkt* pkt)
 		LOG_DBG("route to %02X:%02X:%02X:%02X:%02X:%02X:%02X:%02X",
 			nbr->address[0], nbr->address[1], nbr->address[2], nbr->address[3],
 			nbr->address[4], nbr->address[5], nbr->address[6], nbr->address[7]);
+		atomic_inc(&hyperspace.stats.greedy);
 	}
 	else
 	{
@@ -638,6 +783,11 @@ int hyperspace_route(struct net_pkt* pkt)
 		net_pkt_lladdr_dst(pkt)->len  = 0;
 
 		LOG_DBG("route to local");
+
+		if(!hyperspace_is_nbr(&hdr->dst))
+		{
+			atomic_inc(&hyperspace.stats.minima);
+		}
 	}
 
 	pkt->iface = iface;
@@ -788,11 +938,13 @@ static bool net_pkt_get_frag_offset(struct net_pkt* pkt, uint16_t* offset)
 }
 
 
-/* create_coord_req *****************************************************************************//**
- * @brief		*/
-static struct net_pkt* create_coord_req(
+/* create_coord_pkt *****************************************************************************//**
+ * @brief		Creates an ICMPv6 echo packet carrying this node's coordinate. The packet is broadcast
+ * 				with an unknown destination coordinate. */
+static struct net_pkt* create_coord_pkt(
 	struct net_if* iface,
 	struct in6_addr* dest,
+	uint8_t type,
 	uint16_t identifier,
 	uint16_t sequence)
 {
@@ -817,7 +969,7 @@ static struct net_pkt* create_coord_req(
 	{
 		goto drop;
 	}
-	else if(net_icmpv6_create(pkt, NET_ICMPV6_ECHO_REQUEST, 0) != 0)
+	else if(net_icmpv6_create(pkt, type, 0) != 0)
 	{
 		goto drop;
 	}
@@ -855,10 +1007,11 @@ static struct net_pkt* create_coord_req(
 		goto drop;
 	}
 
-	opt->src.r  = hyperspace.coord.r;
-	opt->src.t  = hyperspace.coord.t;
-	opt->dest.r = NAN;
-	opt->dest.t = NAN;
+	opt->src.r   = hyperspace.coord.r;
+	opt->src.t   = hyperspace.coord.t;
+	opt->src_seq = hyperspace.coord_seq;
+	opt->dest.r  = NAN;
+	opt->dest.t  = NAN;
 	return pkt;
 
 	drop:
@@ -867,6 +1020,54 @@ static struct net_pkt* create_coord_req(
 }
 
 
+/* create_coord_req *****************************************************************************//**
+ * @brief		Creates a coordinate request. The destination replies with its coordinate. */
+static struct net_pkt* create_coord_req(
+	struct net_if* iface,
+	struct in6_addr* dest,
+	uint16_t identifier,
+	uint16_t sequence)
+{
+	return create_coord_pkt(iface, dest, NET_ICMPV6_ECHO_REQUEST, identifier, sequence);
+}
+
+
+/* create_coord_upd *****************************************************************************//**
+ * @brief		Creates a coordinate update to the destination of a route. The update is an unsolicited
+ * 				echo reply so the destination updates its route back to this node from the packet's
+ * 				hyperspace option without answering. The update is routed to the destination's
+ * 				coordinate instead of being broadcast. */
+static struct net_pkt* create_coord_upd(HyperRoute* route)
+{
+	struct net_pkt* pkt = create_coord_pkt(
+		route->iface, &route->addr, NET_ICMPV6_ECHO_REPLY, 0, hyperspace.coord_seq);
+
+	if(!pkt)
+	{
+		return 0;
+	}
+
+	HyperOpt* opt = net_pkt_get_hyperopt(pkt);
+	opt->dest     = route->coord;
+	opt->dest_seq = route->coord_seq;
+
+	Neighbor* nbr = hyperspace_closest(&route->coord);
+
+	if(nbr)
+	{
+		net_pkt_lladdr_dst(pkt)->addr = nbr->address;
+	}
+	else
+	{
+		net_pkt_lladdr_dst(pkt)->addr = 0;
+		net_pkt_lladdr_dst(pkt)->type = 0;
+		net_pkt_lladdr_dst(pkt)->len  = 0;
+	}
+
+	return pkt;
+}
+
+
 /* coord_req_timeout ****************************************************************************//**
  * @brief		*/
 static void coord_req_timeout(struct k_work* work)
@@ -883,6 +1084,7 @@ static void coord_req_timeout(struct k_work* work)
 		req = create_coord_req(route->iface, &route->addr, 0, route->requests);
 		if(req)
 		{
+			atomic_inc(&hyperspace.stats.coord_retries);
 			net_if_queue_tx(route->iface, req);
 			k_work_schedule(&route->retry_timer, K_MSEC(COORD_REQUEST_TIMEOUT_MS));
 			k_mutex_unlock(&hyperspace.route_mutex);
@@ -897,6 +1099,7 @@ static void coord_req_timeout(struct k_work* work)
 	else
 	{
 		LOG_DBG("route timeout");
+		atomic_inc(&hyperspace.stats.coord_fails);
 		hyperspace_route_remove(route);
 	}
 
@@ -904,14 +1107,65 @@ static void coord_req_timeout(struct k_work* work)
 }
 
 
+/* coord_notify *********************************************************************************//**
+ * @brief		Sends this node's coordinate to every destination this node has exchanged packets with
+ * 				recently. Only destinations with a known coordinate are notified. Destinations without
+ * 				a coordinate learn this node's coordinate from their pending coordinate request. */
+static void coord_notify(struct k_work* work)
+{
+	if(!isfinite(hyperspace.coord.r) || !isfinite(hyperspace.coord.t))
+	{
+		return;
+	}
+
+	k_mutex_lock(&hyperspace.route_mutex, K_FOREVER);
+
+	int64_t  current = k_uptime_get();
+	unsigned count   = 0;
+	unsigned i;
+
+	for(i = 0; i < NUM_HYPERROUTES; i++)
+	{
+		if(pool_idx_is_reserved(&hyperroute_pool, i))
+		{
+			HyperRoute* ptr = pool_entry(&hyperroute_pool, i);
+
+			if(!ptr->valid || current - ptr->last_active >= HYPER_CORRESPONDENT_TIMEOUT_MS)
+			{
+				continue;
+			}
+
+			struct net_pkt* upd = create_coord_upd(ptr);
+
+			if(!upd)
+			{
+				LOG_ERR("failed allocating hyperspace coord update");
+				break;
+			}
+
+			net_if_queue_tx(ptr->iface, upd);
+			atomic_inc(&hyperspace.stats.coord_updates);
+			count++;
+		}
+	}
+
+	k_mutex_unlock(&hyperspace.route_mutex);
+
+	LOG_DBG("coord %u sent to %u correspondents", hyperspace.coord_seq, count);
+}
+
+
 /* hypernbr_closest *****************************************************************************//**
- * @brief		Returns the hyperspace neighbors closest to the specified coordinates.
+ * @brief		Returns the hyperspace neighbor that makes the most progress towards the specified
+ * 				coordinates per expected transmission. Only neighbors closer to the coordinates than
+ * 				this node are considered so that packets still make progress every hop.
  * @TODO:		return the closest 'connected' neighbor. */
 static Neighbor* hyperspace_closest(const Hypercoord* coord)
 {
-	/* Find the neighbor closest to the destination */
-	float     min_dist = hyperspace_dist(hyperspace.coord.r, hyperspace.coord.t, coord->r, coord->t);
-	Neighbor* min_nbr  = 0;
+	/* Find the neighbor with the best progress to the destination over its link */
+	float     dist     = hyper_dist(hyperspace.coord.r, hyperspace.coord.t, coord->r, coord->t);
+	float     max_rate = 0;
+	Neighbor* max_nbr  = 0;
 	unsigned  i;
 
 	for(i = 0; i < loc_nbrs_size(); i++)
@@ -920,17 +1174,53 @@ static Neighbor* hyperspace_closest(const Hypercoord* coord)
 
 		if(ptr)
 		{
-			float dist = hyperspace_dist(ptr->r, ptr->t, coord->r, coord->t);
+			float rate = hyper_rate(dist, ptr->r, ptr->t, coord->r, coord->t,
+				tsch_link_etx(ptr->address));
 
-			if(dist < min_dist)
+			if(rate > max_rate)
 			{
-				min_dist = dist;
-				min_nbr  = ptr;
+				max_rate = rate;
+				max_nbr  = ptr;
 			}
 		}
 	}
 
-	return min_nbr;
+	return max_nbr;
+}
+
+
+/* hyperspace_is_nbr ****************************************************************************//**
+ * @brief		Returns true if the destination is a neighbor. A packet with no neighbor closer to its
+ * 				destination is sent straight to the destination's link layer address which only
+ * 				reaches the destination if it is a neighbor. */
+static bool hyperspace_is_nbr(const struct in6_addr* addr)
+{
+	unsigned i;
+
+	for(i = 0; i < loc_nbrs_size(); i++)
+	{
+		Neighbor* ptr = loc_nbrs(i);
+
+		if(ptr && memcmp(ptr->address, &addr->s6_addr[8], sizeof(ptr->address)) == 0)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/* hyperspace_stat_max **************************************************************************//**
+ * @brief		Raises a counter to val if val is larger. */
+static void hyperspace_stat_max(atomic_t* stat, uint32_t val)
+{
+	atomic_val_t old = atomic_get(stat);
+
+	while(val > (uint32_t)old && !atomic_cas(stat, old, val))
+	{
+		old = atomic_get(stat);
+	}
 }
 
 
@@ -1104,6 +1394,184 @@ static void hyperspace_pkt_cache_update(void)
 
 
 
+// ----------------------------------------------------------------------------------------------- //
+// Hyperspace Gateways                                                                             //
+// ----------------------------------------------------------------------------------------------- //
+/* hyperspace_gateway_heartbeat *****************************************************************//**
+ * @brief		Called whenever the border router host sends a heartbeat with the prefix of the
+ * 				addresses it serves. The first call makes this node a gateway. */
+void hyperspace_gateway_heartbeat(const uint8_t* prefix, uint8_t prefix_len)
+{
+	if(prefix_len > 128)
+	{
+		return;
+	}
+
+	k_spinlock_key_t key = k_spin_lock(&hyperspace.gw_lock);
+	memmove(hyperspace.host_prefix, prefix, sizeof(hyperspace.host_prefix));
+	hyperspace.host_prefix_len = prefix_len;
+	k_spin_unlock(&hyperspace.gw_lock, key);
+
+	atomic_set(&hyperspace.host_seen, k_uptime_get_32());
+
+	if(!hyperspace.is_gateway)
+	{
+		LOG_INF("gateway host link up");
+		hyperspace.is_gateway = true;
+		k_work_schedule(&hyperspace.gw_work, K_NO_WAIT);
+	}
+}
+
+
+/* hyperspace_gateway_adv ***********************************************************************//**
+ * @brief		Copies up to max healthy gateways to advertise in an enhanced beacon. Returns the
+ * 				number of gateways copied. Safe to call from the slot ISR. */
+unsigned hyperspace_gateway_adv(HyperGwAdv* advs, unsigned max)
+{
+	k_spinlock_key_t key   = k_spin_lock(&hyperspace.gw_lock);
+	unsigned         count = hypergw_adv(&hyperspace.gateways, k_uptime_get_32(), advs, max);
+
+	k_spin_unlock(&hyperspace.gw_lock, key);
+	return count;
+}
+
+
+/* hyperspace_gateway_rx ************************************************************************//**
+ * @brief		Updates the gateway table from gateway announcements. Safe to call from the slot
+ * 				ISR. */
+void hyperspace_gateway_rx(const HyperGwAdv* advs, unsigned count)
+{
+	k_spinlock_key_t key = k_spin_lock(&hyperspace.gw_lock);
+	hypergw_rx(&hyperspace.gateways, k_uptime_get_32(), advs, count);
+	k_spin_unlock(&hyperspace.gw_lock, key);
+}
+
+
+/* hyperspace_gateway_timeout *******************************************************************//**
+ * @brief		Announces this gateway every HYPER_GW_PERIOD_MS while the host keeps sending
+ * 				heartbeats. Once the host goes silent no new announcements are originated, the
+ * 				copies held by other nodes age out and they fail over to another gateway. */
+static void hyperspace_gateway_timeout(struct k_work* work)
+{
+	static uint8_t seq = 0;
+
+	uint32_t       now   = k_uptime_get_32();
+	struct net_if* iface = net_if_get_first_by_type(&NET_L2_GET_NAME(TSCH_L2));
+
+	if(now - (uint32_t)atomic_get(&hyperspace.host_seen) >= HYPER_GW_HOST_TIMEOUT_MS)
+	{
+		/* The next heartbeat makes this node a gateway again */
+		LOG_WRN("gateway host link down");
+		hyperspace.is_gateway = false;
+		return;
+	}
+
+	if(iface && isfinite(hyperspace.coord.r) && isfinite(hyperspace.coord.t))
+	{
+		HyperGwAdv adv;
+
+		memmove(adv.addr, net_if_get_link_addr(iface)->addr, sizeof(adv.addr));
+		adv.coord = hyperspace.coord;
+		adv.seq   = ++seq;
+		adv.age   = 0;
+
+		k_spinlock_key_t key = k_spin_lock(&hyperspace.gw_lock);
+		memmove(adv.prefix, hyperspace.host_prefix, sizeof(adv.prefix));
+		adv.prefix_len = hyperspace.host_prefix_len;
+		hypergw_rx(&hyperspace.gateways, now, &adv, 1);
+		k_spin_unlock(&hyperspace.gw_lock, key);
+	}
+
+	k_work_schedule(&hyperspace.gw_work, K_MSEC(HYPER_GW_PERIOD_MS));
+}
+
+
+/* hyperspace_gateway_route *********************************************************************//**
+ * @brief		Finds the neighbor to forward an uplink packet to. Tries the healthy gateways
+ * 				serving the destination from nearest to farthest and picks the first one that a
+ * 				neighbor is closer to than this node, so a packet fails over to the next gateway
+ * 				rather than getting stuck at a local minimum. Sets the gateway's coordinate and
+ * 				sequence number. Returns 0 if no gateway can be reached. */
+static Neighbor* hyperspace_gateway_route(
+	const struct in6_addr* dst,
+	Hypercoord*            coord,
+	uint8_t*               seq)
+{
+	HyperGwTable table;
+	HyperGwAdv   advs[HYPER_MAX_GATEWAYS];
+	unsigned     count, i;
+
+	/* Copy the table so that distances are computed outside of the spinlock */
+	k_spinlock_key_t key = k_spin_lock(&hyperspace.gw_lock);
+	memmove(&table, &hyperspace.gateways, sizeof(table));
+	k_spin_unlock(&hyperspace.gw_lock, key);
+
+	count = hypergw_rank(&table, k_uptime_get_32(), dst->s6_addr, &hyperspace.coord, advs);
+
+	for(i = 0; i < count; i++)
+	{
+		Neighbor* nbr = hyperspace_closest(&advs[i].coord);
+
+		if(nbr)
+		{
+			*coord = advs[i].coord;
+			*seq   = advs[i].seq;
+			return nbr;
+		}
+	}
+
+	return 0;
+}
+
+
+/* hyperspace_gateway_healthy *******************************************************************//**
+ * @brief		Returns true if the coordinate belongs to a healthy gateway. */
+static bool hyperspace_gateway_healthy(const Hypercoord* coord)
+{
+	k_spinlock_key_t key     = k_spin_lock(&hyperspace.gw_lock);
+	bool             healthy = hypergw_healthy(&hyperspace.gateways, k_uptime_get_32(), coord);
+
+	k_spin_unlock(&hyperspace.gw_lock, key);
+	return healthy;
+}
+
+
+/* hyperspace_gateway_serves ********************************************************************//**
+ * @brief		Returns true if this node is a gateway and its host serves the address. */
+static bool hyperspace_gateway_serves(const struct in6_addr* addr)
+{
+	HyperGwAdv host;
+
+	if(!hyperspace.is_gateway ||
+	   k_uptime_get_32() - (uint32_t)atomic_get(&hyperspace.host_seen) >= HYPER_GW_HOST_TIMEOUT_MS)
+	{
+		return false;
+	}
+
+	k_spinlock_key_t key = k_spin_lock(&hyperspace.gw_lock);
+	memmove(host.prefix, hyperspace.host_prefix, sizeof(host.prefix));
+	host.prefix_len = hyperspace.host_prefix_len;
+	k_spin_unlock(&hyperspace.gw_lock, key);
+
+	return hypergw_serves(&host, addr->s6_addr);
+}
+
+
+/* hyperspace_is_uplink *************************************************************************//**
+ * @brief		Returns true if the address is on the other side of a gateway, that is within the
+ * 				prefix a healthy gateway announced for its host. */
+static bool hyperspace_is_uplink(const struct in6_addr* addr)
+{
+	k_spinlock_key_t key    = k_spin_lock(&hyperspace.gw_lock);
+	bool             uplink = hypergw_uplink(&hyperspace.gateways, k_uptime_get_32(), addr->s6_addr);
+
+	k_spin_unlock(&hyperspace.gw_lock, key);
+	return uplink;
+}
+
+
+
+
 // ----------------------------------------------------------------------------------------------- //
 // Hyperspace Routing Table                                                                        //
 // ----------------------------------------------------------------------------------------------- //
@@ -1118,12 +1586,13 @@ static HyperRoute* hyperspace_route_alloc(struct in6_addr* addr, struct net_if*
 	if(route)
 	{
 		memmove(&route->addr, addr, sizeof(struct in6_addr));
-		route->coord.r   = NAN;
-		route->coord.t   = NAN;
-		route->requests  = 0;
-		route->last_used = k_uptime_get();
-		route->iface     = iface;
-		route->valid     = false;
+		route->coord.r     = NAN;
+		route->coord.t     = NAN;
+		route->requests    = 0;
+		route->last_used   = k_uptime_get();
+		route->last_active = route->last_used;
+		route->iface       = iface;
+		route->valid       = false;
 	}
 
 	k_mutex_unlock(&hyperspace.route_mutex);
@@ -1196,55 +1665,4 @@ static HyperRoute* hyperspace_route_find(struct in6_addr* addr)
 }
 
 
-/* hyperspace_dist ******************************************************************************//**
- * @brief		Computes the hyperbolic distance between two hyperbolic coordinates. */
-static float hyperspace_dist(float r1, float t1, float r2, float t2)
-{
-	return acosh(cosh(r1)*cosh(r2) - sinh(r1)*sinh(r2)*cos(t2 - t1));
-}
-
-
-/* hyperspace_translate *************************************************************************//**
- * @brief		Translates the vector v = [r, theta] 'a' units in the 't0' angle. */
-static void hyperspace_translate(double v[2], double a, double t0)
-{
-	if(a == 0)
-	{
-		return;
-	}
-
-	/* 	Translate 'a' units along the x axis
-	 *
-	 * 		    | cosh(a) 0 sinh(a) |
-	 * 		M = | 0       1 0       |
-	 * 		    | sinh(a) 0 cosh(a) |
-	 *
-	 * 	Parameter conversion between (r, theta) and (x,y,z)
-	 *
-	 * 		    | sinh(r)*cos(theta) | (x)
-	 * 		v = | sinh(r)*sin(theta) | (y)
-	 * 		    | cosh(r)            | (z)
-	 *
-	 * 		r = acosh(z)
-	 * 		t = atan(y/x)
-	 *
-	 * 	Translation and conversion:
-	 *
-	 * 		        | cosh(a)*sinh(r)*cos(theta) + sinh(a)*cosh(r) |
-	 * 		M * v = | sinh(r)*sin(theta)                           |
-	 * 		        | sinh(a)*sinh(r)*cos(theta) + cosh(a)*cosh(r) |
-	 *
-	 * 		r = acosh(sinh(a)*sinh(r)*cos(theta) + cosh(a)*cosh(r))
-	 * 		t = atan(sinh(r)*sin(theta) / cosh(a)*sinh(r)*cos(theta) + sinh(a)*cosh(r))
-	 */
-	double r = acosh(sinh(a) * sinh(v[0]) * cos(v[1] - t0) + cosh(a) * cosh(v[0]));
-	double y = sinh(v[0]) * sin(v[1] - t0);
-	double x = cosh(a) * sinh(v[0]) * cos(v[1] - t0) + sinh(a) * cosh(v[0]);
-	double theta = calc_mapd_2pi(atan2(y, x) + t0);
-
-	v[0] = r;
-	v[1] = theta;
-}
-
-
 /******************************************* END OF FILE *******************************************/
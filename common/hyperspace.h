@@ -30,11 +30,14 @@ extern "C" {
 
 #include <net/net_pkt.h>
 
+#include "hyperembed.h"
+#include "hypergw.h"
 #include "matrix.h"
 
 
 /* Public Macros --------------------------------------------------------------------------------- */
 #define HYPERSPACE_COORD_OPT_TYPE	(0x22)
+#define NUM_HYPERROUTES				(16)
 #define PACKET_CACHE_TABLE_SIZE		(64)
 #define PACKET_CACHE_ENTRY_TIMEOUT	(2*60*1000)	/* 2 min timeout */
 
@@ -50,12 +53,6 @@ typedef struct __packed {
 } Hyperspace_Coord_Update;
 
 
-typedef struct __packed {
-	float r;
-	float t;
-} Hypercoord;
-
-
 /* TODO: source and destination coords need their own sequence counter */
 /*                                 +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
  *                                 | Opt Type      | Opt Length    |
@@ -83,6 +80,7 @@ typedef struct {
 	struct in6_addr addr;
 	Hypercoord coord;
 	int64_t last_used;	/* The timestamp this routing entry was last used */
+	int64_t last_active;	/* The timestamp a packet was last exchanged with the destination */
 	struct k_work_delayable retry_timer;
 	struct net_if* iface;
 	uint8_t requests;	/* Number of requests sent */
@@ -102,12 +100,76 @@ typedef struct {
 } HyperNbr;
 
 
+typedef struct {
+	struct in6_addr addr;
+	Hypercoord coord;
+	uint8_t    coord_seq;
+	uint8_t    iface;		/* Interface index */
+} HyperSavedRoute;
+
+
+typedef struct {
+	Hypercoord coord;
+	uint8_t    coord_seq;
+	uint8_t    num_routes;
+	Vec3       last_loc;
+	HyperSavedRoute routes[NUM_HYPERROUTES];
+} HyperSnapshot;
+
+
+/* Routing statistics. A local minimum is a packet with a known destination coordinate that reached a
+ * node with no neighbor closer to the destination while the destination is not a neighbor either.
+ * Hops are counted for unique packets sent by other mesh nodes and delivered to this node with a
+ * known destination coordinate. Packets from hosts behind a gateway are not counted as their initial
+ * hop limit is not known. */
+typedef struct {
+	uint32_t greedy;        /* Packets forwarded to a neighbor closer to the destination */
+	uint32_t floods;        /* Packets broadcast because the destination coordinate is unknown */
+	uint32_t minima;        /* Packets stuck at a local minimum */
+	uint32_t delivered;     /* Packets from mesh nodes delivered to this node */
+	uint32_t hops_total;    /* Total hops travelled by delivered packets */
+	uint32_t hops_max;      /* Most hops travelled by a delivered packet */
+	uint32_t coord_reqs;    /* Coordinate requests sent for new destinations */
+	uint32_t coord_retries; /* Coordinate requests reissued after a timeout */
+	uint32_t coord_fails;   /* Destinations dropped after every coordinate request timed out */
+	uint32_t coord_updates; /* Coordinate updates sent to correspondents */
+} HyperStats;
+
+
+/* Routing statistics as they are counted. Packets are routed from the rx and tx threads and
+ * coordinate requests from the system work queue so each counter is atomic. */
+typedef struct {
+	atomic_t greedy;
+	atomic_t floods;
+	atomic_t minima;
+	atomic_t delivered;
+	atomic_t hops_total;
+	atomic_t hops_max;
+	atomic_t coord_reqs;
+	atomic_t coord_retries;
+	atomic_t coord_fails;
+	atomic_t coord_updates;
+} HyperCounters;
+
+
 typedef struct {
 	Hypercoord  coord;
 	uint8_t     coord_seq;
-	Vec3        last_loc;
+	Vec3        last_loc;	/* Location when the coordinate was last assigned */
+	HyperCell   cell;		/* Lattice cell the coordinate was assigned from */
 	struct k_mutex nbr_mutex;
 	struct k_mutex route_mutex;
+
+	/* Gateways are updated from enhanced beacons in the slot ISR so a spinlock guards them */
+	HyperGwTable     gateways;
+	struct k_spinlock gw_lock;
+	struct k_work_delayable gw_work;
+	struct k_work notify_work;	/* Sends this node's new coordinate to active correspondents */
+	bool        is_gateway;	/* True if this node has a link to a border router host */
+	uint8_t     host_prefix[16];	/* Addresses reachable through the host. Guarded by gw_lock */
+	uint8_t     host_prefix_len;
+	atomic_t    host_seen;	/* Uptime in ms when the host was last heard */
+	HyperCounters stats;
 } Hyperspace;
 
 
@@ -124,6 +186,14 @@ uint8_t   hyperspace_coord_seq  (void);
 float     hyperspace_coord_r    (void);
 float     hyperspace_coord_t    (void);
 void      hyperspace_update     (float, float, float);
+void      hyperspace_snapshot   (HyperSnapshot*);
+void      hyperspace_restore    (const HyperSnapshot*);
+void      hyperspace_stats      (HyperStats*);
+void      hyperspace_stats_reset(void);
+
+void      hyperspace_gateway_heartbeat(const uint8_t*, uint8_t);
+unsigned  hyperspace_gateway_adv      (HyperGwAdv*, unsigned);
+void      hyperspace_gateway_rx       (const HyperGwAdv*, unsigned);
 
 struct net_ipv6_hdr* net_pkt_get_ipv6_hdr(struct net_pkt*);
 HyperOpt*            net_pkt_get_hyperopt(struct net_pkt*);
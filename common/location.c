@@ -15,7 +15,9 @@
  ***************************************************************************************************/
 #include <nrfx/hal/nrf_timer.h>
 #include <nrfx/hal/nrf_ppi.h>
+#include <net/socket.h>
 #include <stdio.h>
+#include <sys/ring_buffer.h>
 
 #include "backoff.h"
 #include "byteorder.h"
@@ -25,9 +27,14 @@
 #include "ieee_802_15_4.h"
 #include "iir.h"
 #include "location.h"
+#include "loccapture.h"
+#include "loccell.h"
+#include "locsolve.h"
 #include "matrix.h"
 #include "nrf52.h"
+#include "prng.h"
 #include "timeslot.h"
+#include "trace.h"
 #include "tsch.h"
 
 #include "logging/log.h"
@@ -51,13 +58,28 @@ LOG_MODULE_REGISTER(location, LOG_LEVEL_INF);
 #define LOC_MEASURE_DIST_TIMEOUT	(30000)		/* Distance measurement timeout in ms */
 #define LOC_UPDATE_TIMEOUT			(60000)
 #define LOC_SEARCH_NBRHOOD_COUNT	(4*4)		/* Number of cells required to build a nbrhood */
-#define LOC_KS						(1.0f)
-// #define LOC_KG					(LOC_KS) / (5.0f*LATTICE_R - 1.0f)
-#define LOC_KG						(0.2f)
-// #define LOG_KG						(0.06f)
-#define LOC_B						(2.0f)
-#define LOC_M						(1.0f)
-#define LOC_DT						(0.01f)
+#define LOC_IIR_ALPHA				(0.965f)	/* Location filter coefficient for a nominal solution */
+#define LOC_SIGMA_NOMINAL			(0.3f)		/* Solution standard deviation in m for LOC_IIR_ALPHA */
+#define LOC_RANGE_SIGMA				(0.1f)		/* Standard deviation of a LOS range in m */
+#define LOC_NLOS_SIGMA				(4.0f)		/* Standard deviation multiplier of a NLOS range */
+#define LOC_MIN_RANGES				(4)			/* Ranges or pseudoranges required for a 3D fix */
+#define LOC_CYCLES_PER_US			(64)		/* DWT cycle counter frequency in MHz */
+#define LOC_GDOP_BIAS				(0.5f)		/* Max fraction a PDOP gain shortens the start timer */
+#define LOC_GDOP_LOW_GAIN			(0.25f)		/* Beacons below this PDOP gain back off faster */
+
+/* The location schedule grows by a group of 4 cells per slotframe when more than LOC_SCHED_GROW of
+ * cells are contended and shrinks when fewer than LOC_SCHED_SHRINK are. A cell is contended if
+ * beacons conflicted or this node's beacon was backing off. */
+#define LOC_SCHED_ALPHA				(0.97f)		/* Contention filter coefficient per cell */
+#define LOC_SCHED_GROW				(0.3f)
+#define LOC_SCHED_SHRINK			(0.05f)
+#define LOC_SCHED_PERIOD			(8*4)		/* Cells between schedule decisions */
+#define LOC_SCHED_CYCLE				(8)			/* Slotframes per cycle of beacon directions */
+
+#define LOC_CAPTURE_RING_SIZE		(2048)		/* Bytes of captured updates waiting to be sent */
+#define LOC_CAPTURE_SYNC_PERIOD		(32)		/* Captured updates between sync records */
+#define LOC_CAPTURE_POLL_MS			(50)		/* Time in ms between replay record checks */
+#define LOC_DIST_DEPTH				(4)			/* Measured distances waiting to be handled */
 
 
 /* Private Types --------------------------------------------------------------------------------- */
@@ -115,8 +137,11 @@ typedef struct {
 	unsigned    start_timer;   /* Todo: beacon timer based on distance */
 	unsigned    index;
 	uint32_t    tx_hist;       /* Bits [0-31] indicating this node's beacon tx history */
+	float       gain;          /* [0-1] PDOP improvement this beacon brings to its cells */
 	bool        allow_beaconing;
 	Backoff     backoff;
+	Prng        rng;           /* Randomizes the start timer */
+	struct k_spinlock lock;    /* Guards the beacon against loc_slot */
 } Beacon;
 
 // typedef struct {
@@ -127,21 +152,24 @@ typedef struct {
 // 	uint8_t    class;
 // } Neighbor;
 
+/* The schedules in effect as published to slot context by sched_publish */
 typedef struct {
-	uint8_t  dir;           /* This location update's direction                             */
-	uint8_t  slot;          /* This location update's slot                                  */
-	uint8_t  offset;        /* The offset for when this beacon should transmit              */
-	uint8_t  conflicts;     /* Bits [0-5] indicating which beacons conflicted               */
-	uint8_t  shouldtx;      /* Boolean indicating if this node should transmit in this slot */
-	uint32_t new_nbrhood;   /* Bits [0-5] indicating which new_nbrs are valid               */
-	uint32_t adj;           /* Bits [0-13] indicating which tstamps are valid               */
-	Neighbor new_nbrs[6];   /* Neighbors received during this location update               */
-	int32_t  tstamps[21];   /* Compact, upper-triangular, column-wise matrix of timestamps  */
-} LocUpdate;
+	LocSchedule cur;
+	LocSchedule next;        /* Takes effect at next.start if pending */
+	bool        pending;
+} LocSchedView;
+
+/* A distance measured in slot context by loc_dist_measured */
+typedef struct {
+	uint8_t        addr[8];
+	uint32_t       d0j;
+	DW1000_Rx_Diag diag;    /* Receive diagnostics of the ACK that closed the measurement */
+} LocDist;
 
 typedef struct {
 	LocState  current_state;
 	LocState  next_state;
+	atomic_t  slot_state;        /* current_state as published to loc_slot */
 	unsigned  search_count;
 	struct k_work_delayable timeout_work;
 
@@ -158,6 +186,47 @@ typedef struct {
 	Neighbor  neighbors[20];
 	uint8_t   dropcount[20];
 	LocUpdate update;            /* Temporary loc update */
+
+	LocSchedule sched;           /* Active location schedule */
+	LocSchedule sched_next;      /* Schedule that takes effect at sched_next.start */
+	LocSchedule sched_rx;        /* Schedule received in an enhanced beacon */
+	bool        sched_pending;   /* True if sched_next is valid */
+	atomic_t    sched_rx_ready;  /* True if sched_rx is waiting to be handled */
+	LocSchedView sched_view[2];  /* Double buffer of the schedules read in slot context */
+	atomic_t    sched_view_rd;   /* Index of the sched_view that slot context reads */
+	unsigned    sched_count;     /* Cells since the last schedule decision */
+	iir         contention;      /* Filtered fraction of contended cells */
+
+	/* Location cells are acquired by loc_slot and solved by solve_work. Acquired cells are handed
+	 * off through a double buffer: loc_slot writes cells[cell_wr] and the solver reads
+	 * cells[cell_rd]. Bit i of cell_pending is set while cells[i] waits to be solved. */
+	LocUpdate cells[2];
+	LocEvent  cell_events[2];
+	unsigned  cell_wr;
+	unsigned  cell_rd;
+	atomic_t  cell_pending;
+	struct k_work solve_work;
+	struct k_work dist_work;
+	struct k_msgq dist_msgq;     /* Distances handed from slot context to dist_work */
+	LocTiming timing;
+
+	atomic_t    capture_count;   /* Number of location updates left to capture */
+	uint32_t    capture_seq;
+	uint32_t    capture_dropped; /* Captured updates dropped since the last sent update */
+	LocCapCodec capture_codec;
+	struct k_mutex capture_lock; /* Guards loc_capture_ring */
+	struct k_sem   capture_sem;  /* Given when a record is queued in loc_capture_ring */
+
+#if defined(CONFIG_LOC_REPLAY)
+	/* Captured updates received on LOC_CAPTURE_PORT are replayed through loc_handle by replay_work.
+	 * The first replayed sync record stops live location updates and replaces the location state
+	 * so that the node runs the captured updates exactly as the captured node did. */
+	LocCapCodec replay_codec;
+	atomic_t    replay_ready;    /* True if loc_replay_buf holds a record waiting to be replayed */
+	size_t      replay_len;
+	bool        replaying;
+	struct k_work replay_work;
+#endif
 } Location;
 
 typedef struct {
@@ -179,18 +248,37 @@ typedef struct {
 
 /* Private Functions ----------------------------------------------------------------------------- */
 static        void loc_set           (Location*, float, float, float);
-static        bool loc_filter        (Location*, float, float, float);
+static        bool loc_filter        (Location*, float, float, float, float);
 static        void loc_clear         (Location*);
 static        Vec3 loc_get           (Location*);
 static inline bool loc_is_finite     (Location*);
 static        void loc_handle_timeout(struct k_work*);
-
+static        void loc_handle_solve  (struct k_work*);
+static        void loc_handle_dist   (struct k_work*);
+static        bool loc_apply_dist    (Location*, const LocDist*);
+static        void loc_defer         (Location*, LocEvent, const LocUpdate*, uint32_t);
+#if defined(CONFIG_LOC_REPLAY)
+static        void loc_handle_replay (struct k_work*);
+#endif
+
+static void     loc_handle_capture(Location*, LocEvent, LocUpdate*);
+static void     loc_capture_update(Location*, LocEvent, LocUpdate*);
+static unsigned loc_capture_get   (uint8_t*, unsigned);
+static void     capture_nbr       (LocCapNbr*, const Neighbor*);
+static void     capture_update    (LocCapUpdate*, const LocUpdate*);
+static void     capture_state     (LocCapState*, Location*);
+#if defined(CONFIG_LOC_REPLAY)
+static void     restore_nbr       (Neighbor*, const LocCapNbr*);
+static void     restore_update    (LocUpdate*, const LocCapUpdate*);
+static void     restore_state     (Location*, const LocCapState*);
+#endif
 static void     loc_handle     (Location*, LocEvent, LocUpdate*);
 static void     create_tx_frame(Location*, LocUpdate*, Ieee154_Frame*, uint8_t*, unsigned);
 static uint64_t loc_start_tx   (Location*, LocUpdate*, unsigned, Ieee154_Frame*, uint64_t);
 static void     loc_start_rx   (Location*, unsigned, uint64_t);
 static uint64_t rx_start_read  (Location*, LocUpdate*, unsigned, uint32_t, Ieee154_Frame*, uint64_t);
 static bool     rx_finish_read (Location*, LocUpdate*, unsigned, uint32_t, Ieee154_Frame*, float);
+static bool     rx_in_cell     (const LocUpdate*, unsigned, const Ieee154_Frame*);
 static uint32_t wait_for_trx   (Location*);
 
 static void      prepare_tstamps         (LocUpdate*);
@@ -202,6 +290,8 @@ static void      verify_distances        (LocUpdate*);
 static uint32_t  local_outliers          (Location*, LocUpdate*);
 static uint32_t  update_outliers         (Location*, LocUpdate*);
 static uint32_t  update_mutual_nbrhood   (LocUpdate*);
+static void      update_nlos             (Location*, LocUpdate*);
+static uint32_t  update_los_adj          (LocUpdate*, unsigned, unsigned);
 static bool      update_is_coplanar      (LocUpdate*, uint32_t);
 static bool      is_root                 (Location*);
 static bool      nbrs_with_root          (Location*);
@@ -209,13 +299,28 @@ static bool      nbrs_with_root          (Location*);
 static void      optimize_beacons        (Location*);
 static float     compare_distances       (Location*, unsigned, Vec3);
 static void      join_beacons            (Location*);
+static float     cell_pdop               (Location*, unsigned, unsigned, unsigned, const Vec3*);
+static float     pdop_gain               (Location*, unsigned, Vec3);
+static bool      start_beacon_pdop       (Location*, unsigned, float);
 
 static Vec3      quantize_to_grid        (Vec3);
 static unsigned  index_from_point        (Vec3);
 static unsigned  asn_to_slot             (TsSlotframe*, uint64_t);
-static unsigned  asn_to_dir              (TsSlotframe*, uint64_t);
+static unsigned  asn_to_group            (TsSlotframe*, uint64_t);
+static unsigned  asn_to_dir              (Location*, TsSlotframe*, uint64_t);
+
+static const LocSchedView* sched_view   (Location*);
+static void                sched_publish(Location*);
+static unsigned  sched_groups            (Location*, uint64_t);
+static unsigned  sched_lanes             (Location*, uint64_t);
+static unsigned  sched_index             (TsSlotframe*, unsigned, unsigned);
+static void      sched_add_cells         (TsSlotframe*, unsigned, unsigned);
+static void      sched_remove_cells      (TsSlotframe*, unsigned, unsigned);
+static void      sched_apply             (Location*);
+static void      sched_update            (Location*, LocUpdate*);
 
 static unsigned  compact_triu_index      (unsigned, unsigned);
+static float     range_sigma             (LocUpdate*, unsigned);
 static LocStatus compute_springs_location(Location*, LocUpdate*);
 static LocStatus compute_1line_location  (Location*, LocUpdate*);
 static LocStatus compute_2circle_location(Location*, LocUpdate*);
@@ -238,18 +343,18 @@ static void      frame_update_tstamp(Ieee154_Frame*, int32_t, unsigned);
 
 static void      beacon_init       (Beacon*);
 static unsigned  beacon_index      (Beacon*);
-static unsigned  beacon_offset     (Beacon*, unsigned, unsigned);
 static bool      beacon_enabled    (Beacon*);
-static bool      beacon_get_tx_hist(const Beacon*, uint8_t, uint8_t);
+static bool      beacon_enabled_locked(Beacon*);
+static bool      beacon_get_tx_hist(Beacon*, uint8_t, uint8_t);
 static void      beacon_set_tx_hist(Beacon*, uint8_t, uint8_t, bool);
-static bool      beacon_try        (Beacon*);
+static bool      beacon_try        (Beacon*, unsigned);
 static bool      beacon_start      (Beacon*, unsigned, float);
 static void      beacon_stop       (Beacon*);
 static void      beacon_set_index  (Beacon*, unsigned);
 static void      beacon_backoff    (Beacon*);
 static void      beacon_success    (Beacon*);
 static void      beacon_handle     (Beacon*, BeaconEvent, unsigned, float);
-static unsigned  beacon_rand       (float);
+static unsigned  beacon_rand       (Beacon*, float);
 
 
 /* Private Variables ----------------------------------------------------------------------------- */
@@ -313,53 +418,22 @@ static const uint8_t relpos[20][20] = {
 	{  15, 11, 1,  4,  16, 12, 6,  3,  10, 14, 7,  2,  9,  13, 8,  5,  17, 17, 17, 0,  }, /* | 19 */
 };
 
-static const uint8_t beacon_order[8][4][6] = {	/* Indexed: beacon_order[dir][slot][offset] */
-	/* 0   1   2   3   4   5     Beacon Offset */
-	{{ 0,  4,  13, 9,  18, 19 },      /* NE, 0 */
-	 { 1,  5,  12, 8,  19, 18 },      /* NE, 1 */
-	 { 2,  6,  15, 11, 17, 16 },      /* NE, 2 */
-	 { 3,  7,  14, 10, 16, 17 }},     /* NE, 3 */
-
-	{{ 0,  9,  14, 18, 15, 19 },      /* N,  0 */
-	 { 1,  8,  15, 19, 14, 18 },      /* N,  1 */
-	 { 2,  11, 13, 17, 12, 16 },      /* N,  2 */
-	 { 3,  10, 12, 16, 13, 17 }},     /* N,  3 */
-
-	{{ 0,  9,  5,  17, 14, 15 },      /* NW, 0 */
-	 { 1,  8,  4,  16, 15, 14 },      /* NW, 1 */
-	 { 2,  11, 7,  19, 13, 12 },      /* NW, 2 */
-	 { 3,  10, 6,  18, 12, 13 }},     /* NW, 3 */
-
-	{{ 0,  17, 7,  14, 6,  15 },      /*  W, 0 */
-	 { 1,  16, 6,  15, 7,  14 },      /*  W, 1 */
-	 { 2,  19, 4,  13, 5,  12 },      /*  W, 2 */
-	 { 3,  18, 5,  12, 4,  13 }},     /*  W, 3 */
-
-	{{ 0,  17, 8,  12, 7,  6  },      /* SW, 0 */
-	 { 1,  16, 9,  13, 6,  7  },      /* SW, 1 */
-	 { 2,  19, 10, 14, 4,  5  },      /* SW, 2 */
-	 { 3,  18, 11, 15, 5,  4  }},     /* SW, 3 */
-
-	{{ 0,  12, 7,  11, 6,  10 },      /* S,  0 */
-	 { 1,  13, 6,  10, 7,  11 },      /* S,  1 */
-	 { 2,  14, 4,  8,  5,  9  },      /* S,  2 */
-	 { 3,  15, 5,  9,  4,  8  }},     /* S,  3 */
-
-	{{ 0,  12, 16, 4,  11, 10 },      /* SE, 0 */
-	 { 1,  13, 17, 5,  10, 11 },      /* SE, 1 */
-	 { 2,  14, 18, 6,  8,  9  },      /* SE, 2 */
-	 { 3,  15, 19, 7,  9,  8  }},     /* SE, 3 */
-
-	{{ 0,  4,  11, 18, 10, 19 },      /*  E, 0 */
-	 { 1,  5,  10, 19, 11, 18 },      /*  E, 1 */
-	 { 2,  6,  8,  17, 9,  16 },      /*  E, 2 */
-	 { 3,  7,  9,  16, 8,  17 }},     /*  E, 3 */
-};
-
 
 
 Location location;
 
+RING_BUF_DECLARE(loc_capture_ring, LOC_CAPTURE_RING_SIZE);
+
+/* Captured updates are coded and replayed on the location work queue */
+static LocCapRecord loc_cap_record;
+static LocCapState  loc_cap_state;
+static uint8_t      loc_capture_tx[LOC_CAPTURE_MAX_LEN];
+#if defined(CONFIG_LOC_REPLAY)
+static LocUpdate    loc_replay_update;
+static uint8_t      loc_replay_buf[LOC_CAPTURE_MAX_LEN];
+#endif
+static char __aligned(4) loc_dist_buf[LOC_DIST_DEPTH * sizeof(LocDist)];
+
 uint8_t loc_rx_frame_data[IEEE154_STD_PACKET_LENGTH];
 uint8_t loc_tx_frame_data[IEEE154_STD_PACKET_LENGTH];
 Ieee154_Frame loc_rx_frame;
@@ -427,6 +501,7 @@ void loc_init(DW1000* dw1000, const uint8_t* address)
 {
 	location.current_state = LOCATION_INIT_STATE;
 	location.next_state    = LOCATION_INIT_STATE;
+	atomic_set(&location.slot_state, LOCATION_INIT_STATE);
 	location.search_count  = 0;
 	location.dw1000        = dw1000;
 	location.all_nbrhood   = 0;
@@ -437,11 +512,48 @@ void loc_init(DW1000* dw1000, const uint8_t* address)
 	memset(location.dropcount, 0, sizeof(location.dropcount));
 
 	beacon_init(&location.beacon);
-	iir_init(&location.fx, 0.965, NAN);
-	iir_init(&location.fy, 0.965, NAN);
-	iir_init(&location.fz, 0.965, NAN);
+	iir_init(&location.fx, LOC_IIR_ALPHA, NAN);
+	iir_init(&location.fy, LOC_IIR_ALPHA, NAN);
+	iir_init(&location.fz, LOC_IIR_ALPHA, NAN);
+
+	location.sched.seq     = 0;
+	location.sched.groups  = 1;
+	location.sched.lanes   = 1;
+	location.sched.start   = 0;
+	location.sched_pending = false;
+	location.sched_count   = 0;
+	atomic_clear(&location.sched_rx_ready);
+	atomic_clear(&location.sched_view_rd);
+	sched_publish(&location);
+	iir_init(&location.contention, LOC_SCHED_ALPHA, 0);
+
+	location.cell_wr = 0;
+	location.cell_rd = 0;
+	atomic_clear(&location.cell_pending);
+	memset(&location.timing, 0, sizeof(location.timing));
+
+	atomic_clear(&location.capture_count);
+	location.capture_seq     = 0;
+	location.capture_dropped = 0;
+	loc_cap_reset(&location.capture_codec);
+	k_mutex_init(&location.capture_lock);
+	k_sem_init(&location.capture_sem, 0, 1);
+	ring_buf_reset(&loc_capture_ring);
+
+#if defined(CONFIG_LOC_REPLAY)
+	loc_cap_reset(&location.replay_codec);
+	atomic_clear(&location.replay_ready);
+	location.replay_len = 0;
+	location.replaying  = false;
+	k_work_init(&location.replay_work, loc_handle_replay);
+#endif
+
+	k_msgq_init(&location.dist_msgq, loc_dist_buf, sizeof(LocDist), LOC_DIST_DEPTH);
+	ts_stats_register(loc_slot, "loc");
 
 	k_work_init_delayable(&location.timeout_work, loc_handle_timeout);
+	k_work_init(&location.solve_work, loc_handle_solve);
+	k_work_init(&location.dist_work,  loc_handle_dist);
 }
 
 
@@ -551,6 +663,170 @@ unsigned loc_beacon_index(void)
 }
 
 
+/* loc_timing ***********************************************************************************//**
+ * @brief		Returns the execution times of the location cell acquisition (slot context) and
+ * 				solve (work queue) stages. Times are measured with the DWT cycle counter at 64 MHz,
+ * 				the RTC behind k_cycle_get_32 only resolves ~30 us. */
+LocTiming loc_timing(void)
+{
+	return location.timing;
+}
+
+
+/* loc_capture **********************************************************************************//**
+ * @brief		Captures the next count location updates. A count of 0 stops capturing. */
+void loc_capture(uint32_t count)
+{
+	atomic_set(&location.capture_count, (atomic_val_t)calc_min_uint(count, INT32_MAX));
+}
+
+
+/* loc_capture_drain ****************************************************************************//**
+ * @brief		Thread that sends captured location updates to the border router host. The thread
+ * 				sleeps until an update is captured.
+ *
+ * 				With CONFIG_LOC_REPLAY, the thread also receives captured updates to replay from
+ * 				the border router host. Records from any other address are dropped. The replayed
+ * 				results are captured and sent to the host like live updates. Replaying replaces the
+ * 				node's location state, so replay is only built into bench firmwares. */
+void loc_capture_drain(void* p1, void* p2, void* p3)
+{
+	static uint8_t buf[LOC_CAPTURE_MAX_LEN];
+
+	struct sockaddr_in6 dst = { 0 };
+	dst.sin6_family = AF_INET6;
+	dst.sin6_port   = htons(LOC_CAPTURE_PORT);
+	inet_pton(AF_INET6, "fd00::1", &dst.sin6_addr);
+
+	int s = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+
+	if(s < 0)
+	{
+		LOG_ERR("failed to create capture socket %d", errno);
+		return;
+	}
+
+#if defined(CONFIG_LOC_REPLAY)
+	struct sockaddr_in6 local = { 0 };
+	local.sin6_family = AF_INET6;
+	local.sin6_port   = htons(LOC_CAPTURE_PORT);
+
+	if(bind(s, (struct sockaddr*)&local, sizeof(local)) < 0)
+	{
+		LOG_ERR("failed to bind capture socket %d", errno);
+		return;
+	}
+
+	struct pollfd fds = { .fd = s, .events = POLLIN };
+#endif
+
+	unsigned len;
+
+	while(1)
+	{
+#if defined(CONFIG_LOC_REPLAY)
+		if(poll(&fds, 1, LOC_CAPTURE_POLL_MS) > 0 && (fds.revents & POLLIN))
+		{
+			struct sockaddr_in6 src;
+			socklen_t srclen = sizeof(src);
+
+			/* Records arriving while the previous record is being replayed are dropped */
+			bool     busy = atomic_get(&location.replay_ready);
+			uint8_t* rx   = busy ? buf : loc_replay_buf;
+			ssize_t  n    = recvfrom(s, rx, LOC_CAPTURE_MAX_LEN, 0, (struct sockaddr*)&src, &srclen);
+
+			if(n <= 0)
+			{
+				continue;
+			}
+			else if(!net_ipv6_addr_cmp(&src.sin6_addr, &dst.sin6_addr))
+			{
+				LOG_WRN("replay record from unknown host dropped");
+			}
+			else if(busy)
+			{
+				LOG_WRN("replay busy");
+			}
+			else
+			{
+				location.replay_len = n;
+				atomic_set(&location.replay_ready, 1);
+				k_work_submit(&location.replay_work);
+			}
+		}
+#else
+		k_sem_take(&location.capture_sem, K_FOREVER);
+#endif
+
+		while((len = loc_capture_get(buf, sizeof(buf))) > 0)
+		{
+			sendto(s, buf, len, 0, (struct sockaddr*)&dst, sizeof(dst));
+		}
+	}
+}
+
+
+/* loc_schedule *********************************************************************************//**
+ * @brief		Returns the newest location schedule known to this node which is advertised in
+ * 				enhanced beacons. Called in slot context. */
+LocSchedule loc_schedule(void)
+{
+	const LocSchedView* v = sched_view(&location);
+
+	return v->pending ? v->next : v->cur;
+}
+
+
+/* loc_schedule_rx ******************************************************************************//**
+ * @brief		Handles a location schedule received in an enhanced beacon. The schedule is handed off
+ * 				to the location work queue which adopts it if it is newer. */
+void loc_schedule_rx(const LocSchedule* s)
+{
+	if(atomic_get(&location.sched_rx_ready))
+	{
+		return;
+	}
+
+	location.sched_rx = *s;
+	atomic_set(&location.sched_rx_ready, 1);
+}
+
+
+/* loc_snapshot *********************************************************************************//**
+ * @brief		Copies the location state that is saved across reboots. Must be called from the
+ * 				system work queue. The neighbors are only changed by location's work items, so the
+ * 				copy can't hold a half updated neighbor table. */
+void loc_snapshot(LocSnapshot* s)
+{
+	s->loc           = loc_get(&location);
+	s->all_nbrhood   = location.all_nbrhood;
+	s->local_nbrhood = location.local_nbrhood;
+	memmove(s->neighbors, location.neighbors, sizeof(s->neighbors));
+}
+
+
+/* loc_restore **********************************************************************************//**
+ * @brief		Restores location state saved before a reboot. The restored location seeds the filter
+ * 				and selects this node's location cell so that the first location cells can be used
+ * 				to join instead of searching. Neighbors that are no longer heard are dropped as usual.
+ * 				Only valid before location services are started. Returns true if restored. */
+bool loc_restore(const LocSnapshot* s)
+{
+	if(location.current_state != LOCATION_INIT_STATE || !vec3_is_finite(&s->loc))
+	{
+		return false;
+	}
+
+	loc_set(&location, s->loc.x, s->loc.y, s->loc.z);
+
+	location.all_nbrhood   = s->all_nbrhood;
+	location.local_nbrhood = s->local_nbrhood;
+	memmove(location.neighbors, s->neighbors, sizeof(location.neighbors));
+	memset(location.dropcount, 0, sizeof(location.dropcount));
+	return true;
+}
+
+
 /* loc_set **************************************************************************************//**
  * @brief		Unconditionally sets this node's current location. */
 static void loc_set(Location* loc, float x, float y, float z)
@@ -574,8 +850,10 @@ static void loc_set(Location* loc, float x, float y, float z)
 
 
 /* loc_filter ***********************************************************************************//**
- * @brief		Filters and updates this node's current location. */
-static bool loc_filter(Location* loc, float x, float y, float z)
+ * @brief		Filters and updates this node's current location. Sigma is the solver's estimated
+ * 				standard deviation of (x,y,z). Solutions less certain than LOC_SIGMA_NOMINAL move the
+ * 				filtered location proportionally less. Sigma is NAN if the solver has no estimate. */
+static bool loc_filter(Location* loc, float x, float y, float z, float sigma)
 {
 	if(!isfinite(x) || !isfinite(y) || !isfinite(z))
 	{
@@ -583,6 +861,17 @@ static bool loc_filter(Location* loc, float x, float y, float z)
 		return false;
 	}
 
+	float gain = 1.0f - LOC_IIR_ALPHA;
+
+	if(isfinite(sigma) && sigma > LOC_SIGMA_NOMINAL)
+	{
+		gain *= (LOC_SIGMA_NOMINAL * LOC_SIGMA_NOMINAL) / (sigma * sigma);
+	}
+
+	iir_set_alpha(&loc->fx, 1.0f - gain);
+	iir_set_alpha(&loc->fy, 1.0f - gain);
+	iir_set_alpha(&loc->fz, 1.0f - gain);
+
 	if(!loc_is_finite(loc))
 	{
 		iir_set_value(&loc->fx, x);
@@ -650,6 +939,373 @@ static void loc_handle_timeout(struct k_work* work)
 }
 
 
+/* loc_handle_solve *****************************************************************************//**
+ * @brief		Work item which solves the location cells acquired by loc_slot in the order they were
+ * 				acquired. A buffer is released only after it has been solved. */
+static void loc_handle_solve(struct k_work* work)
+{
+	while(atomic_test_bit(&location.cell_pending, location.cell_rd))
+	{
+		unsigned r     = location.cell_rd;
+		uint32_t start = DWT->CYCCNT;
+
+		TRACE(TRACE_LOC_SOLVE_START, r);
+		update_nlos(&location, &location.cells[r]);
+		loc_handle_capture(&location, location.cell_events[r], &location.cells[r]);
+
+		LocTiming* t    = &location.timing;
+		t->solve_us     = (DWT->CYCCNT - start) / LOC_CYCLES_PER_US;
+		t->solve_max_us = calc_max_uint(t->solve_max_us, t->solve_us);
+		TRACE(TRACE_LOC_SOLVE_END, calc_min_uint(t->solve_us, UINT16_MAX));
+
+		location.cell_rd = r ^ 1;
+		atomic_clear_bit(&location.cell_pending, r);
+	}
+
+	sched_apply(&location);
+}
+
+
+/* loc_handle_dist ******************************************************************************//**
+ * @brief		Work item which applies the distances measured by loc_dist_measured and raises
+ * 				LOCATION_DIST_MEASURED_EVENT for each distance that completes the location update. */
+static void loc_handle_dist(struct k_work* work)
+{
+	LocDist dist;
+
+	while(k_msgq_get(&location.dist_msgq, &dist, K_NO_WAIT) == 0)
+	{
+		if(loc_apply_dist(&location, &dist))
+		{
+			loc_handle_capture(&location, LOCATION_DIST_MEASURED_EVENT, &location.update);
+		}
+	}
+}
+
+
+#if defined(CONFIG_LOC_REPLAY)
+/* loc_handle_replay ****************************************************************************//**
+ * @brief		Work item which replays a captured update received by loc_capture_drain. The update
+ * 				is handled exactly as on the captured node and the result is captured and sent back.
+ * 				The first sync record stops live location updates on this node; reboot the node to
+ * 				resume them. Only built with CONFIG_LOC_REPLAY. */
+static void loc_handle_replay(struct k_work* work)
+{
+	LocCapRecord* rec = &loc_cap_record;
+
+	int ret = loc_cap_decode(
+		&location.replay_codec, rec, &loc_cap_state, loc_replay_buf, location.replay_len);
+
+	if(ret < 0)
+	{
+		LOG_WRN("replay record rejected %d", ret);
+		goto done;
+	}
+	else if(rec->event != LOCATION_CELL_DONE_EVENT && rec->event != LOCATION_CELL_SKIP_EVENT &&
+	        rec->event != LOCATION_DIST_MEASURED_EVENT)
+	{
+		LOG_WRN("replay event %d ignored", rec->event);
+		goto done;
+	}
+
+	if(rec->flags & LOC_CAPTURE_SYNC)
+	{
+		if(!location.replaying)
+		{
+			LOG_INF("replaying captured location updates");
+			loc_handle(&location, LOCATION_STOP_EVENT, 0);
+			loc_cap_reset(&location.capture_codec);
+			location.replaying = true;
+		}
+
+		restore_state(&location, &loc_cap_state);
+	}
+
+	if(location.replaying)
+	{
+		/* Distance measurements complete the update held in location.update */
+		LocEvent   e = rec->event;
+		LocUpdate* u = (e == LOCATION_DIST_MEASURED_EVENT) ? &location.update : &loc_replay_update;
+
+		restore_update(u, &rec->update);
+		loc_capture_update(&location, e, u);
+	}
+
+	done:
+		atomic_clear(&location.replay_ready);
+}
+#endif
+
+
+/* loc_defer ************************************************************************************//**
+ * @brief		Hands off an acquired location cell to the solver. The cell is dropped if the solver
+ * 				is still working on both buffers. Start is the cycle count when the cell started and
+ * 				is used to record the acquisition time. */
+static void loc_defer(Location* loc, LocEvent e, const LocUpdate* update, uint32_t start)
+{
+	unsigned w = loc->cell_wr;
+
+	if(atomic_test_bit(&loc->cell_pending, w))
+	{
+		LOG_WRN("solver overrun");
+		TRACE(TRACE_LOC_OVERRUN, w);
+		loc->timing.overruns++;
+	}
+	else
+	{
+		memmove(&loc->cells[w], update, sizeof(LocUpdate));
+		loc->cell_events[w] = e;
+		loc->cell_wr        = w ^ 1;
+		atomic_set_bit(&loc->cell_pending, w);
+		k_work_submit(&loc->solve_work);
+	}
+
+	loc->timing.acquire_us     = (DWT->CYCCNT - start) / LOC_CYCLES_PER_US;
+	loc->timing.acquire_max_us = calc_max_uint(loc->timing.acquire_max_us, loc->timing.acquire_us);
+}
+
+
+/* loc_handle_capture ***************************************************************************//**
+ * @brief		Handles an event for the location state machine and captures the update and the
+ * 				resulting location state if capturing is enabled. */
+static void loc_handle_capture(Location* loc, LocEvent e, LocUpdate* update)
+{
+	if(atomic_get(&loc->capture_count) <= 0)
+	{
+		/* The host needs a sync record when capturing starts again */
+		loc_cap_reset(&loc->capture_codec);
+		loc_handle(loc, e, update);
+		return;
+	}
+
+	loc_capture_update(loc, e, update);
+	atomic_dec(&loc->capture_count);
+}
+
+
+/* loc_capture_update ***************************************************************************//**
+ * @brief		Handles an event for the location state machine and queues a record of the update and
+ * 				the resulting location state for loc_capture_drain. The update and, for sync records,
+ * 				the location state are copied before the update is handled because handling modifies
+ * 				them. A sync record is sent first, after records were dropped and periodically so that
+ * 				the host recovers from lost datagrams. */
+static void loc_capture_update(Location* loc, LocEvent e, LocUpdate* update)
+{
+	LocCapRecord* rec  = &loc_cap_record;
+	bool          sync = !loc_cap_synced(&loc->capture_codec) || loc->capture_dropped ||
+	                     (loc->capture_seq % LOC_CAPTURE_SYNC_PERIOD) == 0;
+
+	capture_update(&rec->update, update);
+
+	if(sync)
+	{
+		capture_state(&loc_cap_state, loc);
+	}
+
+	uint32_t start = DWT->CYCCNT;
+
+	loc_handle(loc, e, update);
+
+	Vec3 p = loc_get(loc);
+
+	rec->event         = e;
+	rec->state         = loc->current_state;
+	rec->beacon_index  = beacon_index(&loc->beacon);
+	rec->seq           = loc->capture_seq++;
+	rec->dropped       = loc->capture_dropped;
+	rec->uptime        = k_uptime_get_32();
+	rec->solve_us      = (DWT->CYCCNT - start) / LOC_CYCLES_PER_US;
+	rec->x             = p.x;
+	rec->y             = p.y;
+	rec->z             = p.z;
+	rec->all_nbrhood   = loc->all_nbrhood;
+	rec->local_nbrhood = loc->local_nbrhood;
+
+	int len = loc_cap_encode(&loc->capture_codec, rec, sync ? &loc_cap_state : 0,
+		loc_capture_tx, sizeof(loc_capture_tx));
+
+	k_mutex_lock(&loc->capture_lock, K_FOREVER);
+
+	if(len > 0 && ring_buf_space_get(&loc_capture_ring) >= len + sizeof(uint16_t))
+	{
+		uint16_t n = len;
+		ring_buf_put(&loc_capture_ring, (uint8_t*)&n, sizeof(n));
+		ring_buf_put(&loc_capture_ring, loc_capture_tx, len);
+		loc->capture_dropped = 0;
+		k_sem_give(&loc->capture_sem);
+	}
+	else
+	{
+		/* Later records would refer to this record so the next record must be a sync record */
+		loc_cap_reset(&loc->capture_codec);
+		loc->capture_dropped++;
+	}
+
+	k_mutex_unlock(&loc->capture_lock);
+}
+
+
+/* loc_capture_get ******************************************************************************//**
+ * @brief		Copies the oldest queued capture record into buf. Returns the length of the record or
+ * 				0 if there is none. */
+static unsigned loc_capture_get(uint8_t* buf, unsigned size)
+{
+	uint16_t len = 0;
+
+	k_mutex_lock(&location.capture_lock, K_FOREVER);
+
+	if(ring_buf_get(&loc_capture_ring, (uint8_t*)&len, sizeof(len)) == sizeof(len))
+	{
+		ring_buf_get(&loc_capture_ring, buf, calc_min_uint(len, size));
+	}
+
+	k_mutex_unlock(&location.capture_lock);
+
+	return calc_min_uint(len, size);
+}
+
+
+/* capture_nbr **********************************************************************************//**
+ * @brief		Copies a neighbor into a capture record. */
+static void capture_nbr(LocCapNbr* c, const Neighbor* n)
+{
+	memmove(c->address, n->address, sizeof(c->address));
+	c->x       = n->loc.x;
+	c->y       = n->loc.y;
+	c->z       = n->loc.z;
+	c->r       = n->r;
+	c->t       = n->t;
+	c->nbrhood = n->nbrhood;
+	c->class   = n->class;
+}
+
+
+#if defined(CONFIG_LOC_REPLAY)
+/* restore_nbr **********************************************************************************//**
+ * @brief		Copies a neighbor out of a capture record. */
+static void restore_nbr(Neighbor* n, const LocCapNbr* c)
+{
+	memmove(n->address, c->address, sizeof(n->address));
+	n->loc     = make_vec3(c->x, c->y, c->z);
+	n->r       = c->r;
+	n->t       = c->t;
+	n->nbrhood = c->nbrhood;
+	n->class   = c->class;
+}
+#endif
+
+
+/* capture_update *******************************************************************************//**
+ * @brief		Copies a location update into a capture record. New neighbors are delta coded against
+ * 				the last neighbor captured with the same neighbor table index. */
+static void capture_update(LocCapUpdate* c, const LocUpdate* u)
+{
+	unsigned i;
+
+	c->dir         = u->dir;
+	c->slot        = u->slot;
+	c->offset      = u->offset;
+	c->conflicts   = u->conflicts;
+	c->shouldtx    = u->shouldtx;
+	c->nlos        = u->nlos;
+	c->sigma       = u->sigma;
+	c->new_nbrhood = u->new_nbrhood;
+	c->adj         = u->adj;
+
+	for(i = 0; i < 6; i++)
+	{
+		c->index[i] = (u->dir < 8 && u->slot < 4) ? loccell_order[u->dir][u->slot][i] : i;
+		capture_nbr(&c->new_nbrs[i], &u->new_nbrs[i]);
+	}
+
+	memmove(c->tstamps, u->tstamps, sizeof(c->tstamps));
+}
+
+
+#if defined(CONFIG_LOC_REPLAY)
+/* restore_update *******************************************************************************//**
+ * @brief		Copies a location update out of a capture record. */
+static void restore_update(LocUpdate* u, const LocCapUpdate* c)
+{
+	unsigned i;
+
+	u->dir         = c->dir;
+	u->slot        = c->slot;
+	u->offset      = c->offset;
+	u->conflicts   = c->conflicts;
+	u->shouldtx    = c->shouldtx;
+	u->nlos        = c->nlos;
+	u->sigma       = c->sigma;
+	u->new_nbrhood = c->new_nbrhood;
+	u->adj         = c->adj;
+
+	for(i = 0; i < 6; i++)
+	{
+		restore_nbr(&u->new_nbrs[i], &c->new_nbrs[i]);
+	}
+
+	memmove(u->tstamps, c->tstamps, sizeof(u->tstamps));
+}
+#endif
+
+
+/* capture_state ********************************************************************************//**
+ * @brief		Copies the location and neighbor table state into a sync record. */
+static void capture_state(LocCapState* s, Location* loc)
+{
+	unsigned i;
+
+	s->state         = loc->current_state;
+	s->beacon_index  = beacon_index(&loc->beacon);
+	s->search_count  = calc_min_uint(loc->search_count, UINT8_MAX);
+	s->x             = iir_value(&loc->fx);
+	s->y             = iir_value(&loc->fy);
+	s->z             = iir_value(&loc->fz);
+	s->vx            = loc->vel.x;
+	s->vy            = loc->vel.y;
+	s->vz            = loc->vel.z;
+	s->all_nbrhood   = loc->all_nbrhood;
+	s->local_nbrhood = loc->local_nbrhood;
+	memmove(s->dropcount, loc->dropcount, sizeof(s->dropcount));
+
+	for(i = 0; i < LOC_CAPTURE_NUM_NBRS; i++)
+	{
+		capture_nbr(&s->neighbors[i], &loc->neighbors[i]);
+	}
+}
+
+
+#if defined(CONFIG_LOC_REPLAY)
+/* restore_state ********************************************************************************//**
+ * @brief		Replaces the location and neighbor table state with the state from a sync record. The
+ * 				beacon's backoff and transmit history are not captured and are left as they are. */
+static void restore_state(Location* loc, const LocCapState* s)
+{
+	unsigned i;
+
+	loc->current_state = s->state;
+	loc->next_state    = s->state;
+	atomic_set(&loc->slot_state, s->state);
+	loc->search_count  = s->search_count;
+	loc->vel           = make_vec3(s->vx, s->vy, s->vz);
+	loc->all_nbrhood   = s->all_nbrhood;
+	loc->local_nbrhood = s->local_nbrhood;
+	memmove(loc->dropcount, s->dropcount, sizeof(loc->dropcount));
+
+	iir_set_value(&loc->fx, s->x);
+	iir_set_value(&loc->fy, s->y);
+	iir_set_value(&loc->fz, s->z);
+
+	for(i = 0; i < LOC_CAPTURE_NUM_NBRS; i++)
+	{
+		restore_nbr(&loc->neighbors[i], &s->neighbors[i]);
+	}
+
+	beacon_set_index(&loc->beacon, s->beacon_index);
+}
+#endif
+
+
 /* loc_handle ***********************************************************************************//**
  * @brief		Handles events for the location state machine. */
 static void loc_handle(Location* loc, LocEvent e, LocUpdate* update)
@@ -672,11 +1328,9 @@ static void loc_handle(Location* loc, LocEvent e, LocUpdate* update)
 
 				loc->next_state = LOCATION_SEARCHING_NBRHOOD_STATE;
 
+				sched_apply(loc);
 				TsSlotframe* sf = ts_slotframe_add(1, TSCH_DEFAULT_NUM_SLOTS);
-				ts_slot_add(sf, 0, 0 * (sf->numslots / 4) + 2, loc_slot);
-				ts_slot_add(sf, 0, 1 * (sf->numslots / 4) + 2, loc_slot);
-				ts_slot_add(sf, 0, 2 * (sf->numslots / 4) + 2, loc_slot);
-				ts_slot_add(sf, 0, 3 * (sf->numslots / 4) + 2, loc_slot);
+				sched_add_cells(sf, 0, loc->sched.groups);
 			}
 			else if(e == LOCATION_START_ROOT_EVENT)
 			{
@@ -686,11 +1340,9 @@ static void loc_handle(Location* loc, LocEvent e, LocUpdate* update)
 				loc_set(loc, 0, 0, 0);
 				beacon_start(&loc->beacon, 0, 0);
 
+				sched_apply(loc);
 				TsSlotframe* sf = ts_slotframe_add(1, TSCH_DEFAULT_NUM_SLOTS);
-				ts_slot_add(sf, 0, 0 * (sf->numslots / 4) + 2, loc_slot);
-				ts_slot_add(sf, 0, 1 * (sf->numslots / 4) + 2, loc_slot);
-				ts_slot_add(sf, 0, 2 * (sf->numslots / 4) + 2, loc_slot);
-				ts_slot_add(sf, 0, 3 * (sf->numslots / 4) + 2, loc_slot);
+				sched_add_cells(sf, 0, loc->sched.groups);
 			}
 			break;
 
@@ -978,6 +1630,7 @@ static void loc_handle(Location* loc, LocEvent e, LocUpdate* update)
 				      LOG_DBG("neighbors = %X/%X", loc->local_nbrhood, loc->all_nbrhood);
 				ret = update_location (loc, update);
 				      update_beacon   (loc, update);
+				      sched_update    (loc, update);
 
 				LOG_DBG("beacon index = %d", beacon_index(&loc->beacon));
 
@@ -1003,17 +1656,15 @@ static void loc_handle(Location* loc, LocEvent e, LocUpdate* update)
 	}
 
 	loc->current_state = loc->next_state;
+	atomic_set(&loc->slot_state, loc->current_state);
 
 	/* State entry logic */
 	switch(loc->next_state)
 	{
 		case LOCATION_INIT_STATE: {
-			/* Remove the 4 location timeslot cells */
+			/* Remove the location timeslot cells */
 			TsSlotframe* sf = ts_slotframe_find(1);
-			ts_slot_remove(ts_slot_find(sf, 0 * (sf->numslots / 4) + 2));
-			ts_slot_remove(ts_slot_find(sf, 1 * (sf->numslots / 4) + 2));
-			ts_slot_remove(ts_slot_find(sf, 2 * (sf->numslots / 4) + 2));
-			ts_slot_remove(ts_slot_find(sf, 3 * (sf->numslots / 4) + 2));
+			sched_remove_cells(sf, 0, LOC_MAX_GROUPS);
 
 			/* Reset location state */
 			beacon_stop(&loc->beacon);
@@ -1289,32 +1940,59 @@ static void loc_handle(Location* loc, LocEvent e, LocUpdate* update)
  * 				This is used when the distance is explicitly measured instead of measured during a
  * 				location update. That is, this node initiates a distance measurement which causes
  * 				this node to send a frame to the destination node using a shared TSCH cell. This
- * 				function is called when the frame is ACK'd. */
-void loc_dist_measured(const uint8_t* dest, uint32_t d0j)
+ * 				function is called in slot context when the frame is ACK'd. The distance is handed
+ * 				to dist_work which owns the location state. */
+void loc_dist_measured(const uint8_t* dest, uint32_t d0j, const DW1000_Rx_Diag* diag)
 {
-	unsigned i;
+	LocDist dist = { .d0j = d0j, .diag = *diag };
+	memmove(dist.addr, dest, sizeof(dist.addr));
 
-	if(location.current_state != LOCATION_MEASURE_DIST_STATE)
+	if(k_msgq_put(&location.dist_msgq, &dist, K_NO_WAIT) != 0)
 	{
 		return;
 	}
 
-	if((location.update.new_nbrhood & 1) == 0)
+	k_work_submit(&location.dist_work);
+}
+
+
+/* loc_apply_dist *******************************************************************************//**
+ * @brief		Converts the pseudoranges of the pending location update to distances using the
+ * 				distance measured to the prime beacon. Returns true if the distance applies to the
+ * 				pending location update. */
+static bool loc_apply_dist(Location* loc, const LocDist* dist)
+{
+	unsigned i;
+	uint32_t d0j = dist->d0j;
+
+	if(loc->current_state != LOCATION_MEASURE_DIST_STATE)
+	{
+		return false;
+	}
+
+	if((loc->update.new_nbrhood & 1) == 0)
 	{
-		return;
+		return false;
 	}
 
-	if(memcmp(dest, &location.update.new_nbrs[0].address, 8) != 0)
+	if(memcmp(dist->addr, &loc->update.new_nbrs[0].address, 8) != 0)
 	{
-		return;
+		return false;
+	}
+
+	/* A NLOS ACK delays the leading edge and overestimates the distance. Don't use it; the
+	 * distance measurement is retried until LOC_MEASURE_DIST_TIMEOUT. */
+	if(dw1000_rx_is_nlos(loc->dw1000, &dist->diag))
+	{
+		return false;
 	}
 
 	/* Store the distance measured between the prime beacon (0) and this node (6). */
-	location.update.offset = 6;
-	location.update.tstamps[compact_triu_index(0, 6)] = d0j;
-	location.update.adj |= (1 << compact_triu_index(0, 6));
+	loc->update.offset = 6;
+	loc->update.tstamps[compact_triu_index(0, 6)] = d0j;
+	loc->update.adj |= (1 << compact_triu_index(0, 6));
 
-	LOG_INF("distance = %u. adj = %x", d0j, location.update.adj);
+	LOG_INF("distance = %u. adj = %x", d0j, loc->update.adj);
 
 	/* Column 6 stores pseudoranges to this node. Convert pseudoranges to distances. The algorithm is
 	 * as follows:
@@ -1333,13 +2011,13 @@ void loc_dist_measured(const uint8_t* dest, uint32_t d0j)
 	{
 		unsigned ij = compact_triu_index(i, 6);
 
-		if(location.update.adj & (1 << ij))
+		if(loc->update.adj & (1 << ij))
 		{
-			location.update.tstamps[ij] += d0j;
+			loc->update.tstamps[ij] += d0j;
 		}
 	}
 
-	loc_handle(&location, LOCATION_DIST_MEASURED_EVENT, &location.update);
+	return true;
 }
 
 
@@ -1347,23 +2025,36 @@ void loc_dist_measured(const uint8_t* dest, uint32_t d0j)
  * @brief		*/
 void loc_slot(TsSlot* ts)
 {
+	uint32_t start = DWT->CYCCNT;
+
 	dw1000_lock(location.dw1000);
 
 	LocUpdate update;
 
-	uint64_t asn  = ts_current_asn();
-	update.dir    = asn_to_dir    (ts->slotframe, asn);
-	update.slot   = asn_to_slot   (ts->slotframe, asn);
-	update.offset = beacon_offset(&location.beacon, update.dir, update.slot);
+	/* Pick the lane of this slotframe position that this node takes part in. The lane's cell is
+	 * run on its own channel and code, concurrently with the other lanes. */
+	uint64_t asn   = ts_current_asn();
+	unsigned pos   = asn_to_slot(ts->slotframe, asn);
+	unsigned index = beacon_index(&location.beacon);
+	update.dir     = asn_to_dir (&location, ts->slotframe, asn);
+	unsigned lane  = loccell_lane(update.dir, pos, sched_lanes(&location, asn),
+		index, location.all_nbrhood, asn / ts->slotframe->numslots);
+	update.slot    = loccell_slot(pos, lane);
+	update.offset  = loccell_offset(update.dir, update.slot, index);
 
 	LOG_DBG("start. asn = %d. dir = %d, slot = %d, offset = %d",
 		(uint32_t)asn, update.dir, update.slot, update.offset);
 
-	if(location.current_state == LOCATION_JOINED_STATE && update.offset >= 6)
+	TRACE(TRACE_LOC_SLOT, (update.dir << 8) | update.slot);
+
+	if(atomic_get(&location.slot_state) == LOCATION_JOINED_STATE && update.offset >= 6)
 	{
 		goto skip;
 	}
 
+	/* Switch to this cell's lane channel before any tx/rx is scheduled */
+	tsch_channel_hop_lane(ts, lane);
+
 	uint64_t t0 = dw1000_read_sys_tstamp(location.dw1000);
 	uint64_t t1 = calc_addmod_u64(t0, dw1000_us_to_ticks(LOC_TX_START_TIME), DW1000_TSTAMP_PERIOD);
 	uint64_t rxtstamp  = 0;
@@ -1371,15 +2062,20 @@ void loc_slot(TsSlot* ts)
 	bool     synced    = false;
 	float    rx_clk_offset;
 
+	ts_deadline_ref();
+
 	/* Note: this node could still be searching but have set the beacon index which means
 	 * update.offset could be >= 6 here. Todo: is this a state machine bug? */
 	update.conflicts   = 0;
-	update.shouldtx    = update.offset < 6 && beacon_try(&location.beacon);
+	update.shouldtx    = update.offset < 6 && beacon_try(&location.beacon, index);
 	update.new_nbrhood = 0;
 	update.adj         = 0;
+	update.nlos        = 0;
+	update.sigma       = NAN;
 
 	memset(update.new_nbrs, 0, sizeof(update.new_nbrs));
 	memset(update.tstamps,  0, sizeof(update.tstamps));
+	memset(update.diag,     0, sizeof(update.diag));
 
 	/* Initialize this node's beacon packet */
 	create_tx_frame(&location, &update, &loc_tx_frame, loc_tx_frame_data, sizeof(loc_tx_frame_data));
@@ -1478,14 +2174,14 @@ void loc_slot(TsSlot* ts)
 		dw1000_sync_drxb(location.dw1000, status);
 		dw1000_unlock   (location.dw1000);
 		beacon_set_tx_hist(&location.beacon, update.slot, update.dir, update.shouldtx);
-		loc_handle(&location, LOCATION_CELL_DONE_EVENT, &update);
+		loc_defer(&location, LOCATION_CELL_DONE_EVENT, &update, start);
 		return;
 
 	skip:
 		LOG_DBG("skip");
 		dw1000_unlock(location.dw1000);
 		beacon_set_tx_hist(&location.beacon, update.slot, update.dir, false);
-		loc_handle(&location, LOCATION_CELL_SKIP_EVENT, &update);
+		loc_defer(&location, LOCATION_CELL_SKIP_EVENT, &update, start);
 		return;
 }
 
@@ -1527,7 +2223,7 @@ static void create_tx_frame(
 	/* Append the expected beacons */
 	for(i = 0; i < 6; i++)
 	{
-		unsigned idx = beacon_order[update->dir][update->slot][i];
+		unsigned idx = loccell_order[update->dir][update->slot][i];
 
 		if(loc->all_nbrhood & (1 << idx))
 		{
@@ -1565,6 +2261,7 @@ static uint64_t loc_start_tx(
 	uint64_t       t1)
 {
 	int32_t tstamp;
+	ts_deadline(LOC_TX_START_TIME + LOC_GRID_LENGTH * j);
 	tstamp  = dw1000_us_to_ticks   (LOC_GRID_LENGTH * j);
 	tstamp += dw1000_set_trx_tstamp(loc->dw1000, t1 + tstamp);
 	tstamp += dw1000_ant_delay     (loc->dw1000);
@@ -1587,7 +2284,12 @@ static uint64_t loc_start_tx(
 
 	/* Send the packet to the dw1000 */
 	dw1000_write_tx_fctrl  (loc->dw1000, 0, len + 2);
-	dw1000_start_delayed_tx(loc->dw1000, false);
+
+	if(!dw1000_start_delayed_tx(loc->dw1000, false))
+	{
+		ts_deadline_missed();
+	}
+
 	dw1000_write_tx        (loc->dw1000, ieee154_ptr_start(tx), 0, len);
 
 	/* Set new_nbrs[j] with this node's address */
@@ -1614,10 +2316,15 @@ static void loc_start_rx(Location* loc, unsigned j, uint64_t t1)
 	t1 += dw1000_us_to_ticks(LOC_GRID_LENGTH * j);
 	t1 -= dw1000_us_to_ticks(LOC_RX_GUARD_TIME);
 
-	dw1000_set_trx_tstamp  (loc->dw1000, t1);	/* 20 us */
-	dw1000_start_delayed_rx(loc->dw1000);		/* 32 us (success) */
-}
-
+	ts_deadline(LOC_TX_START_TIME + LOC_GRID_LENGTH * j - LOC_RX_GUARD_TIME);
+	dw1000_set_trx_tstamp(loc->dw1000, t1);	/* 20 us */
+
+	if(!dw1000_start_delayed_rx(loc->dw1000))	/* 32 us (success) */
+	{
+		ts_deadline_missed();
+	}
+}
+
 
 /* rx_start_read ********************************************************************************//**
  * @brief		Reads the rx timestamp and the addressing fields for the received packet. */
@@ -1660,13 +2367,6 @@ static uint64_t rx_start_read(
 		goto error;
 	}
 
-	rxtstamp = dw1000_read_rx_tstamp(loc->dw1000);
-	rxtstamp = calc_submod_u64(rxtstamp, dw1000_ant_delay(loc->dw1000), DW1000_TSTAMP_PERIOD);
-	tjk      = calc_submod_u64(rxtstamp, t1, DW1000_TSTAMP_PERIOD);
-
-	/* Store tjk where j is the beacon that was just received and k is this node */
-	update->tstamps[compact_triu_index(j, 6)] = tjk;
-
 	/* Only interested in the source address. Absolute maximum number of bytes that need to be read
 	 * to guarantee that the source address has been read is:
 	 *
@@ -1683,6 +2383,21 @@ static uint64_t rx_start_read(
 	dw1000_read_rx(loc->dw1000, ieee154_set_length(&rx, 23), 0, 23);
 	ieee154_parse(&rx);
 
+	/* A beacon of another cell must neither sync this node nor end up in its beacon. Lanes run
+	 * their cells on different channels and codes but a strong beacon of another lane can still be
+	 * acquired. */
+	if(!rx_in_cell(update, j, &rx))
+	{
+		goto error;
+	}
+
+	rxtstamp = dw1000_read_rx_tstamp(loc->dw1000);
+	rxtstamp = calc_submod_u64(rxtstamp, dw1000_ant_delay(loc->dw1000), DW1000_TSTAMP_PERIOD);
+	tjk      = calc_submod_u64(rxtstamp, t1, DW1000_TSTAMP_PERIOD);
+
+	/* Store tjk where j is the beacon that was just received and k is this node */
+	update->tstamps[compact_triu_index(j, 6)] = tjk;
+
 	/* Progressively build the tx beacon */
 	void* src = ieee154_src_addr(&rx);
 	j -= (update->offset == 0 && update->shouldtx);
@@ -1743,7 +2458,8 @@ static bool rx_finish_read(
 	}
 
 	/* Finish reading the previous beacon */
-	uint32_t flen = dw1000_read_rx_finfo(loc->dw1000) & DW1000_RX_FINFO_RXFLEN_MASK;
+	uint32_t finfo = dw1000_read_rx_finfo(loc->dw1000);
+	uint32_t flen  = finfo & DW1000_RX_FINFO_RXFLEN_MASK;
 
 	/* Already read the first 23 bytes from rx_start_read() */
 	if(flen > 23)
@@ -1804,6 +2520,10 @@ static bool rx_finish_read(
 	/* Mark the neighbor as valid */
 	update->new_nbrhood |= (1 << offset);
 
+	/* Keep the raw receive diagnostics. update_nlos flags the beacon on the work queue if its
+	 * first path was attenuated, so the power estimates stay out of the slot. */
+	dw1000_read_rx_diag(loc->dw1000, finfo, &update->diag[offset]);
+
 	/* At this point, the packet has been verified. Start parsing. */
 	void*    src        = ieee154_src_addr(rx);
 	bool     same_prime = false;
@@ -1938,6 +2658,28 @@ static bool rx_finish_read(
 }
 
 
+/* rx_in_cell ***********************************************************************************//**
+ * @brief		Returns true if the received frame is a location beacon sent at offset j of this
+ * 				node's cell. Only needs the first bytes of the frame. Location beacons carry no IEs so
+ * 				the payload directly follows the addressing fields. */
+static bool rx_in_cell(const LocUpdate* update, unsigned j, const Ieee154_Frame* rx)
+{
+	if((ieee154_fctrl(rx) & IEEE154_IE_PRESENT) == IEEE154_IE_PRESENT ||
+	   ieee154_payload_start(rx) + offsetof(LocBeacon, _reserved) > ieee154_length(rx))
+	{
+		return false;
+	}
+
+	const uint8_t* payload = ieee154_payload_ptr(rx);
+	uint8_t        dso     = payload[offsetof(LocBeacon, dir_slot_offset)];
+
+	return payload[offsetof(LocBeacon, version)] == 22 &&
+	       ((dso >> 0) & 0x7) == j &&				/* bits [0-2]: offset */
+	       ((dso >> 3) & 0x3) == update->slot &&	/* bits [3-4]: slot   */
+	       ((dso >> 5) & 0x7) == update->dir;		/* bits [5-7]: dir    */
+}
+
+
 /* wait_for_trx *********************************************************************************//**
  * @brief		Waits for the previous DW1000 transaction (either transmit or receive) to complete.
  * 				Returns the final DW1000 system status register. */
@@ -2063,7 +2805,7 @@ static void update_neighbors(Location* loc, LocUpdate* update)
 	/* Update this node's neighborhood with the beacons from the current update */
 	for(i = 0; i < 6; i++)
 	{
-		const unsigned idx = beacon_order[update->dir][update->slot][i];
+		const unsigned idx = loccell_order[update->dir][update->slot][i];
 
 		/* Neighbor is valid */
 		if(update->new_nbrhood & (1 << i))
@@ -2127,7 +2869,7 @@ static void update_neighbors(Location* loc, LocUpdate* update)
 	/* Zero the adj entries corresponding to nodes that have inconsistent locations */
 	for(i = 0; i < 6; i++)
 	{
-		unsigned idx = beacon_order[update->dir][update->slot][i];
+		unsigned idx = loccell_order[update->dir][update->slot][i];
 
 		if((update->new_nbrhood & (1 << i)) && !(loc->local_nbrhood & (1 << idx)))
 		{
@@ -2234,7 +2976,7 @@ static void update_beacon(Location* loc, LocUpdate* update)
 
 		for(i = 0; i < 6; i++)
 		{
-			unsigned idx = beacon_order[update->dir][update->slot][i];
+			unsigned idx = loccell_order[update->dir][update->slot][i];
 
 			if(loc->all_nbrhood & (1 << idx))
 			{
@@ -2479,6 +3221,62 @@ static uint32_t update_mutual_nbrhood(LocUpdate* update)
 }
 
 
+/* update_nlos **********************************************************************************//**
+ * @brief		Flags the beacons whose receive diagnostics indicate a NLOS reception. Runs on the
+ * 				work queue before the update is solved so that loc_slot only reads the raw
+ * 				diagnostics. Offsets that weren't received have zero diagnostics and aren't
+ * 				flagged. */
+static void update_nlos(Location* loc, LocUpdate* update)
+{
+	unsigned i;
+
+	for(i = 0; i < sizeof(update->diag) / sizeof(update->diag[0]); i++)
+	{
+		if(dw1000_rx_is_nlos(loc->dw1000, &update->diag[i]))
+		{
+			update->nlos |= (1 << i);
+		}
+	}
+}
+
+
+/* update_los_adj *******************************************************************************//**
+ * @brief		Returns update->adj with the ranges in column col to beacons that were received NLOS
+ * 				removed. The NLOS ranges are kept if removing them would leave fewer than min valid
+ * 				ranges in the column, in which case the solver's own outlier checks apply. */
+static uint32_t update_los_adj(LocUpdate* update, unsigned col, unsigned min)
+{
+	unsigned i;
+	unsigned count = 0;
+	uint32_t nlos  = 0;
+
+	for(i = 0; i < 6; i++)
+	{
+		uint32_t bit = (i != col) ? (1 << compact_triu_index(i, col)) : 0;
+
+		if(update->adj & bit)
+		{
+			if(update->nlos & (1 << i))
+			{
+				nlos |= bit;
+			}
+			else
+			{
+				count++;
+			}
+		}
+	}
+
+	if(nlos && count >= min)
+	{
+		LOG_DBG("rejecting nlos ranges %x", update->nlos);
+		return update->adj & ~nlos;
+	}
+
+	return update->adj;
+}
+
+
 /* update_is_coplanar ***************************************************************************//**
  * @brief		Returns true if the beacons in a location update are coplanar.
  * 				Note: mutual_nbrhood represents offsets, not indices. */
@@ -2493,7 +3291,7 @@ static bool update_is_coplanar(LocUpdate* update, uint32_t mutual_nbrhood)
 	{
 		if(mutual_nbrhood & (1 << i))
 		{
-			unsigned index = beacon_order[update->dir][update->slot][i];
+			unsigned index = loccell_order[update->dir][update->slot][i];
 			unsigned pos   = relpos[update->slot][index];
 			if(pos <= 8)       { a_sheet++; }
 			else if(pos <= 12) { b_sheet++; }
@@ -2591,7 +3389,7 @@ static void optimize_beacons(Location* loc)
 
 		/* Start beaconing if this node is closer to the prime's ideal loction than the existing
 		 * prime. */
-		if(beacon_start(&loc->beacon, i, compare_distances(loc, i, prime)))
+		if(start_beacon_pdop(loc, i, compare_distances(loc, i, prime)))
 		{
 			return;
 		}
@@ -2606,7 +3404,7 @@ static void optimize_beacons(Location* loc)
 
 	/* Try and start beaconing if this node is closer to the ideal location than the existing beacon.
 	 * Stop beaconing if the other node is closer. */
-	if(!beacon_start(&loc->beacon, candidate, compare_distances(loc, candidate, ideal)))
+	if(!start_beacon_pdop(loc, candidate, compare_distances(loc, candidate, ideal)))
 	{
 		beacon_stop(&loc->beacon);
 		beacon_set_index(&loc->beacon, candidate);
@@ -2800,15 +3598,163 @@ static void join_beacons(Location* loc)
 		}
 	}
 
+	/* Pick the candidate that most improves the PDOP of the cells it would transmit in. The
+	 * candidate's position is this node's current location, if any, otherwise the ideal position
+	 * relative to the first 1-hop neighbor. */
+	unsigned best = 20;
+	float    gain = -1;
+
 	for(i = 0; i < 20; i++)
 	{
 		if(candidates & (1 << i))
 		{
-			LOG_DBG("candidate = %d", i);
-			beacon_start(&loc->beacon, i, 0);
-			return;
+			Vec3  p = loc_get(loc);
+			float g = 0;
+
+			for(j = 0; !loc_is_finite(loc) && j < 20; j++)
+			{
+				if(nbrhood_1_hop & (1 << j) && relpos[j][i] < 17)
+				{
+					p = vec3_add(quantize_to_grid(loc->neighbors[j].loc),
+					             vec3_scale(vectors[relpos[j][i]], LATTICE_R));
+					break;
+				}
+			}
+
+			if(vec3_is_finite(&p))
+			{
+				g = pdop_gain(loc, i, p);
+			}
+
+			LOG_DBG("candidate = %d, gain = %f", i, (double)g);
+
+			if(g > gain)
+			{
+				best = i;
+				gain = g;
+			}
+		}
+	}
+
+	if(best < 20)
+	{
+		beacon_start(&loc->beacon, best, 0);
+		loc->beacon.gain = gain;
+	}
+}
+
+
+/* cell_pdop ************************************************************************************//**
+ * @brief		Returns the position dilution of precision of the location cell (dir, slot) seen by a
+ * 				receiver at the centroid of the cell's beacons. The beacon at index is excluded if
+ * 				pos is null, otherwise its position is replaced by pos. Returns INFINITY if the cell
+ * 				can't provide a 3D location. See locsolve_pdop. */
+static float cell_pdop(Location* loc, unsigned dir, unsigned slot, unsigned index, const Vec3* pos)
+{
+	float    p[6][3];
+	unsigned i, n = 0;
+
+	for(i = 0; i < 6; i++)
+	{
+		unsigned idx = loccell_order[dir][slot][i];
+		Vec3     q;
+
+		if(idx == index)
+		{
+			if(!pos)
+			{
+				continue;
+			}
+
+			q = *pos;
+		}
+		else if(loc->all_nbrhood & (1 << idx) && vec3_is_finite(&loc->neighbors[idx].loc))
+		{
+			q = loc->neighbors[idx].loc;
 		}
+		else
+		{
+			continue;
+		}
+
+		p[n][0] = q.x;
+		p[n][1] = q.y;
+		p[n][2] = q.z;
+		n++;
+	}
+
+	return locsolve_pdop(p, n, LATTICE_R / 10.0f);
+}
+
+
+/* pdop_gain ************************************************************************************//**
+ * @brief		Returns the average fractional PDOP improvement, in [0,1], over all location cells in
+ * 				which a beacon at index located at pos would transmit. A cell that can only provide a
+ * 				3D location with the beacon counts as a gain of 1. */
+static float pdop_gain(Location* loc, unsigned index, Vec3 pos)
+{
+	unsigned dir, slot, i;
+	unsigned count = 0;
+	float    gain  = 0;
+
+	for(dir = 0; dir < 8; dir++)
+	{
+		for(slot = 0; slot < 4; slot++)
+		{
+			for(i = 0; i < 6 && loccell_order[dir][slot][i] != index; i++) { }
+
+			if(i >= 6)
+			{
+				continue;
+			}
+
+			float before = cell_pdop(loc, dir, slot, index, 0);
+			float after  = cell_pdop(loc, dir, slot, index, &pos);
+
+			if(!isfinite(after))
+			{
+				/* Cell can't provide a location either way */
+			}
+			else if(!isfinite(before))
+			{
+				gain += 1.0f;
+			}
+			else if(after < before)
+			{
+				gain += (before - after) / before;
+			}
+
+			count++;
+		}
+	}
+
+	return count ? gain / count : 0;
+}
+
+
+/* start_beacon_pdop ****************************************************************************//**
+ * @brief		Starts beaconing at index like beacon_start but shortens the start timer of nodes
+ * 				whose beacon would improve the PDOP of its cells the most. The gain is evaluated at
+ * 				this node's own location so that nodes contending for the same index differ by it.
+ * 				Distance is the result of compare_distances. A negative distance does not start
+ * 				beaconing. */
+static bool start_beacon_pdop(Location* loc, unsigned index, float distance)
+{
+	float gain = 0;
+
+	if(distance >= 0 && loc_is_finite(loc))
+	{
+		gain      = pdop_gain(loc, index, loc_get(loc));
+		distance *= 1.0f - LOC_GDOP_BIAS * gain;
 	}
+
+	if(beacon_start(&loc->beacon, index, distance))
+	{
+		loc->beacon.gain = gain;
+		return true;
+	}
+
+	return false;
 }
 
 
@@ -2859,44 +3805,7 @@ static Vec3 quantize_to_grid(Vec3 p)
  * @brief		Returns the beacon index that corresponds to the point. */
 static unsigned index_from_point(Vec3 q)
 {
-	static const uint8_t beacons[2][10] = {
-		{ 0,  4, 8,  12, 16, 1,  5,  9,  13, 17 },	/* A sheet beacons */
-		{ 2,  6, 10, 14, 18, 3,  7,  11, 15, 19 },	/* B sheet beacons */
-	};
-
-	/* Pattern per sheet:
-	 *
-	 * 		16 1  5  9  13 17 0  4  8      -  -  -  -  -  -  0  -  -
-	 * 		9  13 17 0  4  8  12 16 1      -  -  -  0  -  -  -  -  -
-	 * 		0  4  8  12 16 1  5  9  13     0  -  -  -  -  -  -  -  -
-	 * 		12 16 1  5  9  13 17 0  4      -  -  -  -  -  -  -  0  -
-	 * 		5  9  13 17 0  4  8  12 16     -  -  -  -  0  -  -  -  -
-	 * 		17 0  4  8  12 16 1  5  9      -  0  -  -  -  -  -  -  -
-	 * 		8  12 16 1  5  9  13 17 0      -  -  -  -  -  -  -  -  0
-	 * 		1  5  9  13 17 0  4  8  12     -  -  -  -  -  0  -  -  -
-	 * 		13 17 0  4  8  12 16 1  5      -  -  0  -  -  -  -  -  -
-	 *
-	 * 		y = 1/3 * x => 3y = x => x - 3y
-	 *
-	 * Since q is quantized (e.g. [5, 0, 0] with LATTICE_R = 5), divide by LATTICE_R to turn the
-	 * coordinates into indices. */
-	int x = roundf((q.x / LATTICE_R) - (q.y * (3.0f / LATTICE_R)));
-	int z = calc_mod_int(roundf(q.z / LATTICE_R), 4);
-
-	/* Every two levels alternates between normal and swapped sheets. For example:
-	 *
-	 *		z-level 0: 0  4  8  12 16 1  5  9  13 17
-	 *		z-level 2: 1  5  9  13 17 0  4  8  12 6
-	 *
-	 * The index is computed by offsetting the index by 5 every 2 sheets and wrapping the index.
-	 * Since z is in the domain [0,4), z/2 will have the range [0,1]. Therefore, adding z/2*5 and
-	 * wrapping the index will compute the correct index for normal and swapped sheets. */
-	int i = calc_mod_int(x + z/2*5, 10);
-
-	/* Alternate between A and B sheets */
-	int j = calc_mod_int(z, 2);
-
-	return beacons[j][i];
+	return loccell_index(q.x, q.y, q.z, LATTICE_R);
 }
 
 
@@ -2914,10 +3823,24 @@ static unsigned asn_to_slot(TsSlotframe* sf, uint64_t asn)
 }
 
 
+/* asn_to_group *********************************************************************************//**
+ * @brief		Converts asn to the group of location cells. Group g's cells are offset by
+ * 				g * numslots / (4 * LOC_MAX_GROUPS) from group 0's cells. See sched_index. */
+static unsigned asn_to_group(TsSlotframe* sf, uint64_t asn)
+{
+	unsigned quarter = sf->numslots / 4;
+	unsigned offset  = (asn % sf->numslots) % quarter;
+
+	return offset < 2 ? 0 : calc_min_uint((offset - 2) / (quarter / LOC_MAX_GROUPS), LOC_MAX_GROUPS-1);
+}
+
+
 /* asn_to_dir ***********************************************************************************//**
  * @brief		Converts asn to location beacon direction. Each group of 4 location cells iterates
  * 				between NE, N, NW, W, SW, S, SE, E directions. For example, in slotframe 0, the 4
- * 				prime beacons will transmit to neighbors in the NE.
+ * 				prime beacons will transmit to neighbors in the NE. With more than one group per
+ * 				slotframe, consecutive groups continue the iteration so the directions cycle
+ * 				faster.
  * @desc		Location is encoded in numbers [0-7]:
  *
  * 				0 = NE
@@ -2929,9 +3852,226 @@ static unsigned asn_to_slot(TsSlotframe* sf, uint64_t asn)
  * 				6 = SE
  * 				7 =  E
  */
-static unsigned asn_to_dir(TsSlotframe* sf, uint64_t asn)
+static unsigned asn_to_dir(Location* loc, TsSlotframe* sf, uint64_t asn)
 {
-	return (asn / sf->numslots) % 8;
+	unsigned groups = sched_groups(loc, asn);
+
+	return ((asn / sf->numslots) * groups + calc_min_uint(asn_to_group(sf, asn), groups-1)) % 8;
+}
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Location Schedule                                                                               //
+// ----------------------------------------------------------------------------------------------- //
+/* sched_view ***********************************************************************************//**
+ * @brief		Returns the schedules last published by sched_publish. Only for slot context, which
+ * 				the work queue can't preempt while the view is read. */
+static const LocSchedView* sched_view(Location* loc)
+{
+	return &loc->sched_view[atomic_get(&loc->sched_view_rd)];
+}
+
+
+/* sched_publish ********************************************************************************//**
+ * @brief		Publishes the schedules to slot context. The work queue owns sched, sched_next and
+ * 				sched_pending and calls this after changing them. The copy is written to the buffer
+ * 				that slot context isn't reading and then made current, so slot context never sees
+ * 				a partly written schedule. */
+static void sched_publish(Location* loc)
+{
+	unsigned w = atomic_get(&loc->sched_view_rd) ^ 1;
+
+	loc->sched_view[w].cur     = loc->sched;
+	loc->sched_view[w].next    = loc->sched_next;
+	loc->sched_view[w].pending = loc->sched_pending;
+	atomic_set(&loc->sched_view_rd, w);
+}
+
+
+/* sched_groups *********************************************************************************//**
+ * @brief		Returns the number of groups of location cells in effect at asn. Called in slot
+ * 				context. */
+static unsigned sched_groups(Location* loc, uint64_t asn)
+{
+	const LocSchedView* v = sched_view(loc);
+
+	if(v->pending && asn >= v->next.start)
+	{
+		return v->next.groups;
+	}
+
+	return v->cur.groups;
+}
+
+
+/* sched_lanes **********************************************************************************//**
+ * @brief		Returns the number of lanes in effect at asn. Lanes need distinct channels so the
+ * 				hopping sequence limits the lanes every node can run. Called in slot context. */
+static unsigned sched_lanes(Location* loc, uint64_t asn)
+{
+	const LocSchedView* v     = sched_view(loc);
+	unsigned            lanes = v->cur.lanes;
+
+	if(v->pending && asn >= v->next.start)
+	{
+		lanes = v->next.lanes;
+	}
+
+	return calc_min_uint(lanes, tsch_hopping_lanes(LOC_MAX_LANES));
+}
+
+
+/* sched_index **********************************************************************************//**
+ * @brief		Returns the slot index of a location cell. With a 100 slot slotframe, group 0 uses
+ * 				slots 2, 27, 52 and 77 and group 1 uses slots 14, 39, 64 and 89. */
+static unsigned sched_index(TsSlotframe* sf, unsigned group, unsigned slot)
+{
+	return slot * (sf->numslots / 4) + 2 + group * (sf->numslots / (4 * LOC_MAX_GROUPS));
+}
+
+
+/* sched_add_cells ******************************************************************************//**
+ * @brief		Adds the location cells of groups [from, to). */
+static void sched_add_cells(TsSlotframe* sf, unsigned from, unsigned to)
+{
+	unsigned g, s;
+
+	for(g = from; g < to; g++)
+	{
+		for(s = 0; s < 4; s++)
+		{
+			ts_slot_add(sf, 0, sched_index(sf, g, s), loc_slot);
+		}
+	}
+}
+
+
+/* sched_remove_cells ***************************************************************************//**
+ * @brief		Removes the location cells of groups [from, to). */
+static void sched_remove_cells(TsSlotframe* sf, unsigned from, unsigned to)
+{
+	unsigned g, s;
+
+	for(g = from; g < to; g++)
+	{
+		for(s = 0; s < 4; s++)
+		{
+			ts_slot_remove(ts_slot_find(sf, sched_index(sf, g, s)));
+		}
+	}
+}
+
+
+/* sched_apply **********************************************************************************//**
+ * @brief		Adopts a received schedule if it is newer than the newest known schedule. Ties are
+ * 				broken in favor of more cells. Then, switches to the next schedule once its start
+ * 				ASN is reached and adds or removes the cells that changed. */
+static void sched_apply(Location* loc)
+{
+	if(atomic_get(&loc->sched_rx_ready))
+	{
+		LocSchedule  rx  = loc->sched_rx;
+		LocSchedule* cur = loc->sched_pending ? &loc->sched_next : &loc->sched;
+		int          d   = (int8_t)(rx.seq - cur->seq);
+
+		atomic_clear(&loc->sched_rx_ready);
+
+		if(rx.groups >= 1 && rx.groups <= LOC_MAX_GROUPS &&
+		   rx.lanes  >= 1 && rx.lanes  <= LOC_MAX_LANES  &&
+		   (d > 0 || (d == 0 && rx.groups * rx.lanes > cur->groups * cur->lanes)))
+		{
+			LOG_INF("schedule %d: %d groups, %d lanes at asn %u",
+				rx.seq, rx.groups, rx.lanes, (uint32_t)rx.start);
+			loc->sched_next    = rx;
+			loc->sched_pending = true;
+			sched_publish(loc);
+		}
+	}
+
+	if(!loc->sched_pending || ts_asn_now() < loc->sched_next.start)
+	{
+		return;
+	}
+
+	TsSlotframe* sf = ts_slotframe_find(1);
+
+	if(loc->current_state != LOCATION_INIT_STATE && sf)
+	{
+		if(loc->sched_next.groups > loc->sched.groups)
+		{
+			sched_add_cells(sf, loc->sched.groups, loc->sched_next.groups);
+		}
+		else
+		{
+			sched_remove_cells(sf, loc->sched_next.groups, loc->sched.groups);
+		}
+	}
+
+	loc->sched         = loc->sched_next;
+	loc->sched_pending = false;
+	loc->sched_count   = 0;
+	sched_publish(loc);
+}
+
+
+/* sched_update *********************************************************************************//**
+ * @brief		Tracks location cell contention and proposes a new schedule when the contention is
+ * 				out of range. The new schedule starts at least one full cycle of beacon directions
+ * 				later so that it can be flooded to the rest of the network before it takes effect. */
+static void sched_update(Location* loc, LocUpdate* update)
+{
+	bool backoff = update->offset < 6 && !update->shouldtx;
+	bool contend = update->conflicts != 0 || backoff;
+
+	iir_filter(&loc->contention, contend ? 1.0f : 0.0f);
+
+	if(loc->sched_pending || ++loc->sched_count < LOC_SCHED_PERIOD)
+	{
+		return;
+	}
+
+	loc->sched_count = 0;
+
+	float    c      = iir_value(&loc->contention);
+	unsigned groups = loc->sched.groups;
+	unsigned lanes  = loc->sched.lanes;
+
+	/* Grow by adding groups first since every node hears the cells of a new group. Lanes are
+	 * added once the slotframe is full. Shrink in the reverse order. */
+	if(c > LOC_SCHED_GROW && groups < LOC_MAX_GROUPS)
+	{
+		groups++;
+	}
+	else if(c > LOC_SCHED_GROW && lanes < tsch_hopping_lanes(LOC_MAX_LANES))
+	{
+		lanes++;
+	}
+	else if(c < LOC_SCHED_SHRINK && lanes > 1)
+	{
+		lanes--;
+	}
+	else if(c < LOC_SCHED_SHRINK && groups > 1)
+	{
+		groups--;
+	}
+	else
+	{
+		return;
+	}
+
+	uint64_t cycle = TSCH_DEFAULT_NUM_SLOTS * LOC_SCHED_CYCLE;
+
+	loc->sched_next.seq    = loc->sched.seq + 1;
+	loc->sched_next.groups = groups;
+	loc->sched_next.lanes  = lanes;
+	loc->sched_next.start  = (ts_asn_now() / cycle + 2) * cycle;
+	loc->sched_pending     = true;
+	sched_publish(loc);
+
+	LOG_INF("contention %d%%. propose %d groups, %d lanes at asn %u",
+		(int)(c * 100), groups, lanes, (uint32_t)loc->sched_next.start);
 }
 
 
@@ -2956,6 +4096,14 @@ static unsigned compact_triu_index(unsigned i, unsigned j)
 }
 
 
+/* range_sigma **********************************************************************************//**
+ * @brief		Returns the standard deviation in m of ranges to the beacon at offset i. */
+static float range_sigma(LocUpdate* update, unsigned i)
+{
+	return (update->nlos & (1 << i)) ? LOC_RANGE_SIGMA * LOC_NLOS_SIGMA : LOC_RANGE_SIGMA;
+}
+
+
 /* compute_springs_location *********************************************************************//**
  * @brief		Computes the location of this node as if springs where attached to it and the
  * 				neighboring nodes. */
@@ -2964,7 +4112,7 @@ static LocStatus compute_springs_location(Location* loc, LocUpdate* update)
 	LOG_DBG("start");
 
 	float r[5];
-	Vec3  p[5];
+	float p[5][3];
 	unsigned i, j;
 
 	for(i = 0, j = 0; i < 6; i++)
@@ -2976,7 +4124,9 @@ static LocStatus compute_springs_location(Location* loc, LocUpdate* update)
 				DW1000_TIME_RES * SPEED_OF_LIGHT;
 
 			/* Get the beacon's reported location */
-			p[j] = update->new_nbrs[i].loc;
+			p[j][0] = update->new_nbrs[i].loc.x;
+			p[j][1] = update->new_nbrs[i].loc.y;
+			p[j][2] = update->new_nbrs[i].loc.z;
 
 			j++;
 		}
@@ -2988,48 +4138,21 @@ static LocStatus compute_springs_location(Location* loc, LocUpdate* update)
 		return LOCATION_SKIP_NUM_BEACONS;
 	}
 
-	float ax = 0, ay = 0, az = 0;
+	/* The springs' natural lengths are the distances measured during the location update. The
+	 * closest lattice point keeps the whole network from spinning and translating in space due to
+	 * errors in measurements. */
+	Vec3  x0   = loc_get(loc);
+	Vec3  g    = quantize_to_grid(x0);
+	float x[3] = { x0.x, x0.y, x0.z };
+	float v[3] = { loc->vel.x, loc->vel.y, loc->vel.z };
 
-	/* Compute spring forces between neighbors and this beacon. The spring's natural length is the
-	 * distance measured during the location update. */
-	for(i = 0; i < j; i++)
-	{
-		Vec3  v   = vec3_sub (loc_get(loc), p[i]);
-		float mag = vec3_norm(v);
+	locsolve_springs(p, r, j, (const float[3]){ g.x, g.y, g.z }, x, v);
 
-		if(isfinite(mag) && mag != 0)
-		{
-			Vec3 u = vec3_scale(v, 1.0f / mag);
-			ax += LOC_KS * (r[i] * u.x - v.x) / LOC_M;
-			ay += LOC_KS * (r[i] * u.y - v.y) / LOC_M;
-			az += LOC_KS * (r[i] * u.z - v.z) / LOC_M;
-		}
-	}
+	loc->vel.x = v[0];
+	loc->vel.y = v[1];
+	loc->vel.z = v[2];
 
-	Vec3 x0 = loc_get(loc);					/* This node's current location */
-	Vec3  g = quantize_to_grid(x0);			/* The closest lattice point to this node */
-	Vec3 ug = vec3_unit(vec3_sub(g, x0));	/* Unit vector from current location to lattice point */
-
-	/* Apply a constant attraction to the closest ideal point (ug: unit vector pointed from this
-	 * node's position x0 to the ideal point g). This constant attraction is to keep the whole
-	 * network from spinning and translating in space due to errors in measurements.
-	 *
-	 * Also apply damping which opposes this beacon's velocity (vel). */
-	ax += (LOC_KG * ug.x / LOC_M) - (LOC_B * loc->vel.x / LOC_M);
-	ay += (LOC_KG * ug.y / LOC_M) - (LOC_B * loc->vel.y / LOC_M);
-	az += (LOC_KG * ug.z / LOC_M) - (LOC_B * loc->vel.z / LOC_M);
-
-	/* Apply time step to acceleration to update this node's velocity */
-	loc->vel.x += ax * LOC_DT;
-	loc->vel.y += ay * LOC_DT;
-	loc->vel.z += az * LOC_DT;
-
-	/* Apply time step to velocity to update this node's position */
-	x0.x += loc->vel.x * LOC_DT;
-	x0.y += loc->vel.y * LOC_DT;
-	x0.z += loc->vel.z * LOC_DT;
-
-	loc_set(loc, x0.x, x0.y, x0.z);
+	loc_set(loc, x[0], x[1], x[2]);
 
 	// LOG_DBG("done");
 	LOG_INF("done");
@@ -3056,7 +4179,7 @@ static LocStatus compute_1line_location(Location* loc, LocUpdate* update)
 	float d = update->tstamps[compact_triu_index(0, update->offset)] *
 		DW1000_TIME_RES * SPEED_OF_LIGHT;
 
-	loc_filter(loc, d, 0, 0);
+	loc_filter(loc, d, 0, 0, NAN);
 
 	LOG_DBG("done");
 	return LOCATION_UPDATED;
@@ -3126,7 +4249,7 @@ static LocStatus compute_2circle_location(Location* loc, LocUpdate* update)
 	 *
 	 * Just take +y which is solm as compute_2circle_location is used only for bootstrapping which
 	 * places p0 at 0,0,0 and p1 along the x axis. */
-	loc_filter(loc, l/d * v1.x - h/d * v1.y + p[0].x, l/d * v1.y + h/d * v1.x + p[0].y, 0);
+	loc_filter(loc, l/d * v1.x - h/d * v1.y + p[0].x, l/d * v1.y + h/d * v1.x + p[0].y, 0, NAN);
 
 	LOG_DBG("done");
 	return LOCATION_UPDATED;
@@ -3147,7 +4270,7 @@ static LocStatus compute_3sphere_location(Location* loc, LocUpdate* update)
 
 	unsigned index[3];	/* Index of the other beacons */
 	float    r[3];		/* Measured distance between this node and the other beacons */
-	Vec3     p[3];		/* The reported position of the other beacons */
+	float    p[3][3];	/* The reported position of the other beacons */
 	unsigned i,j;
 
 	/* The intersection of 3 spheres results in 2 points. Therefore, the beacon index needs to be set
@@ -3164,14 +4287,16 @@ static LocStatus compute_3sphere_location(Location* loc, LocUpdate* update)
 		if(i != update->offset && update->adj & (1 << compact_triu_index(i, update->offset)))
 		{
 			/* Get the beacon's index */
-			index[j] = beacon_order[update->dir][update->slot][i];
+			index[j] = loccell_order[update->dir][update->slot][i];
 
 			/* Compute the distance between the beacon and this node */
 			r[j] = update->tstamps[compact_triu_index(i, update->offset)] *
 				DW1000_TIME_RES * SPEED_OF_LIGHT;
 
 			/* Get the beacon's reported location */
-			p[j] = update->new_nbrs[i].loc;
+			p[j][0] = update->new_nbrs[i].loc.x;
+			p[j][1] = update->new_nbrs[i].loc.y;
+			p[j][2] = update->new_nbrs[i].loc.z;
 
 			j++;
 		}
@@ -3184,43 +4309,22 @@ static LocStatus compute_3sphere_location(Location* loc, LocUpdate* update)
 		return LOCATION_SKIP_NUM_BEACONS;
 	}
 
-	Vec3  v1  = vec3_sub(p[1], p[0]);				/* Vector from first beacon to second beacon */
-	Vec3  v2  = vec3_sub(p[2], p[0]);				/* Vector from first beacon to third beacon  */
-	float d   = vec3_norm(v1);						/* Local x coordinate of v1 */
-
-	Vec3  u1  = vec3_scale(v1, 1.0f / d);			/* First unit vector is along v1 */
-	float e   = vec3_dot(v2, u1);					/* Local x coordinate of v2 */
-
-	Vec3  rej = vec3_sub(v2, vec3_scale(u1, e));	/* rej(v2,v1) = v2 - proj(v2,v1) = v2 - (e*u1) */
-	float f   = vec3_norm(rej);						/* Local y coordinate of v2 */
-	Vec3  u2  = vec3_scale(rej, 1.0f / f);			/* Second unit vector along rej */
-	Vec3  u3  = vec3_cross(u1, u2);					/* Third unit vector */
-
-	/* Solution for the particular case when p0 = (0,0,0), p1 = (d,0,0), p2 = (e,f,0) */
-	float l = (r[0]*r[0] - r[1]*r[1] + d*d) / (2.0f * d);
-	float w = (r[0]*r[0] - r[2]*r[2] - 2.0f*e*l + e*e + f*f) / (2.0f*f);
-	float h = sqrtf(r[0]*r[0] - l*l - w*w);
-
-	/* Solution for the general case: l*u1 + w*u2 +/- h*u3 + [x0,y0,z0]
-	 *
-	 * Use ideal vectors to determine which solution to pick. The triple product indicates if the
-	 * solution is along (+) or opposite (-) the u3 basis. The triple product is:
+	/* Use ideal vectors to determine which solution to pick. The triple product indicates if the
+	 * solution is along (+) or opposite (-) the normal of the beacons' plane. The triple product is:
 	 *
 	 * 		v0,3 . (v0,1 x v0,2)
 	 *
 	 * Note: order of indices is important. The particular order does not matter, just that the order
-	 * is consistent with the order used to compute the basis vectors u1 and u2. */
+	 * is consistent with the order of the beacons passed to locsolve_3sphere. */
 	Vec3 v01 = vectors[relpos[index[0]][index[1]]];
 	Vec3 v02 = vectors[relpos[index[0]][index[2]]];
 	Vec3 v03 = vectors[relpos[index[0]][beacon_index(&loc->beacon)]];
 	float triple = vec3_dot(v03, vec3_cross(v01, v02));
+	float sol[3];
 
-	Vec3 sol = p[0];
-	sol = vec3_add(sol, vec3_scale(u1, l));
-	sol = vec3_add(sol, vec3_scale(u2, w));
-	sol = vec3_add(sol, vec3_scale(u3, copysignf(h, triple)));
-
-	loc_filter(loc, sol.x, sol.y, sol.z);
+	/* loc_filter ignores the solution if the spheres do not intersect */
+	locsolve_3sphere(p, r, triple, sol);
+	loc_filter(loc, sol[0], sol[1], sol[2], NAN);
 
 	LOG_INF("done");
 	return LOCATION_UPDATED;
@@ -3284,65 +4388,48 @@ static LocStatus compute_toa_location(Location* loc, LocUpdate* update)
 	 *
 	 * 		R1 * x = Q1' * b
 	 */
-	Matrix A, B;
-	float A_data[5][3];
-	float B_data[5][1];
-	float tau[3];
-
-	Vec3  p0;
-	float d0;
-	unsigned i,j;
-
-	/* Find the first beacon */
-	for(i = 0; i < 6; i++)
-	{
-		if(i != update->offset && update->adj & (1 << compact_triu_index(i, update->offset)))
-		{
-			break;
-		}
-	}
+	float    p[6][3];
+	float    d[6];
+	float    sd[6];
+	LocSolve sol;
+	unsigned i, j;
 
-	p0 = update->new_nbrs[i].loc;
-	d0 = update->tstamps[compact_triu_index(i, update->offset)] * DW1000_TIME_RES * SPEED_OF_LIGHT;
+	/* Reject NLOS ranges if enough line of sight ranges remain */
+	uint32_t adj = update_los_adj(update, update->offset, LOC_MIN_RANGES);
 
-	/* Find subsequent beacons and fill in the A and b matrices */
-	for(i += 1, j = 0; i < 6; i++)
+	for(i = 0, j = 0; i < 6; i++)
 	{
-		if(i != update->offset && update->adj & (1 << compact_triu_index(i, update->offset)))
+		if(i != update->offset && adj & (1 << compact_triu_index(i, update->offset)))
 		{
-			Vec3  pi = update->new_nbrs[i].loc;
-			float di = update->tstamps[compact_triu_index(i, update->offset)] *
+			p[j][0] = update->new_nbrs[i].loc.x;
+			p[j][1] = update->new_nbrs[i].loc.y;
+			p[j][2] = update->new_nbrs[i].loc.z;
+			d[j]    = update->tstamps[compact_triu_index(i, update->offset)] *
 				DW1000_TIME_RES * SPEED_OF_LIGHT;
-
-			A_data[j][0]  = p0.x - pi.x;
-			A_data[j][1]  = p0.y - pi.y;
-			A_data[j][2]  = p0.z - pi.z;
-
-			B_data[j][0]  = calc_dop_f(p0.x, p0.x, pi.x, pi.x);	/* (p0.x)^2 - (pi.x)^2 */
-			B_data[j][0] += calc_dop_f(p0.y, p0.y, pi.y, pi.y);	/* (p0.y)^2 - (pi.y)^2 */
-			B_data[j][0] += calc_dop_f(p0.z, p0.z, pi.z, pi.z);	/* (p0.z)^2 - (pi.z)^2 */
-			B_data[j][0] += calc_dop_f(di, di, d0, d0);			/* (di)^2   - (d0)^2   */
-			B_data[j][0] *= 1.0f / 2.0f;
+			sd[j]   = range_sigma(update, i);
 			j++;
 		}
 	}
 
 	/* Computing time of arrival requires at least 4 non-coplanar beacons providing distance
-	 * measurements to this node. */
-	if(j < 4)
+	 * measurements to this node in addition to the first. */
+	if(j < 5)
 	{
 		LOG_DBG("skip: insufficient number of beacons. adj = %x", update->adj);
 		return LOCATION_SKIP_NUM_BEACONS;
 	}
 
-	mat_init(&A, j, 3, A_data);
-	mat_init(&B, j, 1, B_data);
+	if(!locsolve_toa(p, d, sd, j, &sol))
+	{
+		LOG_INF("nonfinite");
+		return LOCATION_TOA_NONFINITE;
+	}
+
+	update->sigma = sol.sigma;
 
-	mat_qr        (&A, tau);
-	mat_mult_qt   (&A, &B, tau);
-	mat_qr_backsub(&A, &B);
+	LOG_DBG("sigma = %f, chi2 = %f", (double)sol.sigma, (double)sol.chi2);
 
-	if(loc_filter(loc, B_data[0][0], B_data[1][0], B_data[2][0]))
+	if(loc_filter(loc, sol.x, sol.y, sol.z, update->sigma))
 	{
 		LOG_INF("updated");
 		return LOCATION_UPDATED;
@@ -3444,36 +4531,18 @@ static LocStatus compute_tdoa_location(Location* loc, LocUpdate* update)
 	 * 		ys = c + d*d0
 	 * 		zs - e + f*d0
 	 */
-	Matrix A, B;
-	float A_data[5][3];
-	float B_data[5][2];
-	float tau[3];
-
+	float    p[6][3];
+	float    pr[6];
+	float    sd[6];
+	LocSolve sol;
 	unsigned i, j;
 
-	/* Find the first neighbor */
-	for(i = 1; i < 6; i++)
-	{
-		if(update->adj & (1 << compact_triu_index(i, 6)))
-		{
-			break;
-		}
-	}
-
-	if(i >= 6)
-	{
-		return LOCATION_SKIP_INVALID_DIR_SLOT;
-	}
-
-	/* Location of the first neighbor */
-	Vec3 p0 = update->new_nbrs[i].loc;
+	/* Reject NLOS pseudoranges if enough line of sight pseudoranges remain */
+	uint32_t adj = update_los_adj(update, 6, LOC_MIN_RANGES);
 
-	/* Pseudorange stored in column 6: p1k = t1k - t01 - d01 */
-	float p0k = update->tstamps[compact_triu_index(i, 6)] * DW1000_TIME_RES * SPEED_OF_LIGHT;
-
-	for(i += 1, j = 0; i < 6; i++)
+	for(i = 1, j = 0; i < 6; i++)
 	{
-		if(update->adj & (1 << compact_triu_index(i, 6)))
+		if(adj & (1 << compact_triu_index(i, 6)))
 		{
 			/* Location of the i'th neighbor */
 			Vec3 pi = update->new_nbrs[i].loc;
@@ -3499,69 +4568,49 @@ static LocStatus compute_tdoa_location(Location* loc, LocUpdate* update)
 			 * two distances. Which means that 4 pseudoranges are required for 3 hyperbolas. Which
 			 * also means that 5 beacons are required for a 3D TDOA location update: 1 prime beacon
 			 * which provides a time reference, and 4 nonprime beacons providing 4 pseudoranges. */
-			float pik = update->tstamps[compact_triu_index(i, 6)] * DW1000_TIME_RES * SPEED_OF_LIGHT;
-
-			A_data[j][0]  = p0.x - pi.x;
-			A_data[j][1]  = p0.y - pi.y;
-			A_data[j][2]  = p0.z - pi.z;
-
-			B_data[j][0]  = calc_dop_f(p0.x, p0.x, pi.x, pi.x);	/* x0^2 - xi^2 */
-			B_data[j][0] += calc_dop_f(p0.y, p0.y, pi.y, pi.y);	/* y0^2 - yi^2 */
-			B_data[j][0] += calc_dop_f(p0.z, p0.z, pi.z, pi.z);	/* z0^2 - zi^2 */
-			B_data[j][0] += (pik - p0k) * (pik - p0k);
-			B_data[j][0] *= 1.0f / 2.0f;
-
-			B_data[j][1] = pik - p0k;
+			p[j][0] = pi.x;
+			p[j][1] = pi.y;
+			p[j][2] = pi.z;
+			pr[j]   = update->tstamps[compact_triu_index(i, 6)] * DW1000_TIME_RES * SPEED_OF_LIGHT;
+			sd[j]   = range_sigma(update, i);
 			j++;
 		}
 	}
 
+	if(j == 0)
+	{
+		return LOCATION_SKIP_INVALID_DIR_SLOT;
+	}
+
 	/* Computing TDOA location requires at least 3 differences of pseudoranges */
-	if(j < 3)
+	if(j < 4)
 	{
 		LOG_DBG("skip: insufficient number of beacons");
 		return LOCATION_SKIP_NUM_BEACONS;
 	}
 
-	mat_init(&A, j, 3, A_data);
-	mat_init(&B, j, 2, B_data);
-
-	mat_qr        (&A, tau);
-	mat_mult_qt   (&A, &B, tau);
-	mat_qr_backsub(&A, &B);
-
-	float m  = B_data[0][0] - p0.x;
-	float n  = B_data[1][0] - p0.y;
-	float o  = B_data[2][0] - p0.z;
-
-	/* Solve the quadratic equation */
-	float qa = (B_data[0][1] * B_data[0][1]) +
-	           (B_data[1][1] * B_data[1][1]) +
-	           (B_data[2][1] * B_data[2][1]) - 1.0f;
-	float qb = 2.0f * (m * B_data[0][1] + n * B_data[1][1] + o * B_data[2][1]);
-	float qc = m*m + n*n + o*o;
-	float qm;
-
-	calc_ax2_bx_c_f(qa, qb, qc, 0, &qm);
+	if(!locsolve_tdoa(p, pr, sd, j, &sol))
+	{
+		LOG_INF("nonfinite");
+		return LOCATION_TDOA_NONFINITE;
+	}
 
-	/* Todo: reject solutions far away from the neighbors */
 	/* Todo: what happens if this node moves to a new location? */
-	Vec3 sol = make_vec3(
-		B_data[0][0] + B_data[0][1] * qm,
-		B_data[1][0] + B_data[1][1] * qm,
-		B_data[2][0] + B_data[2][1] * qm);
-
 	for(i = 0; i < j; i++)
 	{
-		if(update->adj & (1 << compact_triu_index(i, 6)) &&
-		   vec3_dist(sol, update->new_nbrs[i].loc) > sqrtf(3.0f) * LATTICE_R)
+		if(vec3_dist(make_vec3(sol.x, sol.y, sol.z), make_vec3(p[i][0], p[i][1], p[i][2])) >
+		   sqrtf(3.0f) * LATTICE_R)
 		{
 			LOG_INF("ignore inaccurate location");
 			return LOCATION_SKIP_INACCURATE;
 		}
 	}
 
-	if(loc_filter(loc, sol.x, sol.y, sol.z))
+	update->sigma = sol.sigma;
+
+	LOG_DBG("sigma = %f, chi2 = %f", (double)sol.sigma, (double)sol.chi2);
+
+	if(loc_filter(loc, sol.x, sol.y, sol.z, update->sigma))
 	{
 		LOG_INF("updated");
 		return LOCATION_UPDATED;
@@ -3576,7 +4625,6 @@ static LocStatus compute_tdoa_location(Location* loc, LocUpdate* update)
 
 
 
-
 // ----------------------------------------------------------------------------------------------- //
 // Location Update Frame                                                                           //
 // ----------------------------------------------------------------------------------------------- //
@@ -3701,18 +4749,26 @@ static void frame_update_tstamp(Ieee154_Frame* frame, int32_t tstamp, unsigned o
 // Location Beacon                                                                                 //
 // ----------------------------------------------------------------------------------------------- //
 /* beacon_init **********************************************************************************//**
- * @brief		Initializes beacons in the silent state. */
+ * @brief		Initializes beacons in the silent state. The beacon is shared with loc_slot which
+ * 				reads its index, start timer, backoff and transmit history in slot context. Every
+ * 				access therefore goes through the functions below which hold b->lock. */
 static void beacon_init(Beacon* b)
 {
+	k_spinlock_key_t key = k_spin_lock(&b->lock);
+
 	if(b->current_state != BEACON_FORCED_STATE)
 	{
 		b->current_state   = BEACON_SILENT_STATE;
 		b->next_state      = BEACON_SILENT_STATE;
 		b->index           = 20;
 		b->tx_hist         = 0;	/* Todo */
+		b->gain            = 1.0f;
 	}
 
 	backoff_init(&b->backoff, 1, 32);
+	prng_init(&b->rng);
+
+	k_spin_unlock(&b->lock, key);
 }
 
 
@@ -3723,31 +4779,30 @@ static void beacon_init(Beacon* b)
  * 				floating point operations can be avoided to look up this node's index. */
 static unsigned beacon_index(Beacon* b)
 {
-	return b->index;
+	k_spinlock_key_t key   = k_spin_lock(&b->lock);
+	unsigned         index = b->index;
+
+	k_spin_unlock(&b->lock, key);
+	return index;
 }
 
 
-/* beacon_offset ********************************************************************************//**
- * @brief		Returns this node's beacon offset in a particular location update slot. */
-static unsigned beacon_offset(Beacon* b, unsigned dir, unsigned slot)
+/* beacon_enabled *******************************************************************************//**
+ * @brief		Returns true if transmitting location beacons is enabled. */
+static bool beacon_enabled(Beacon* b)
 {
-	unsigned i;
+	k_spinlock_key_t key     = k_spin_lock(&b->lock);
+	bool             enabled = beacon_enabled_locked(b);
 
-	for(i = 0; i < sizeof(beacon_order[0][0]) / sizeof(beacon_order[0][0][0]); i++)
-	{
-		if(beacon_order[dir][slot][i] == beacon_index(b))
-		{
-			return i;
-		}
-	}
-
-	return -1u;
+	k_spin_unlock(&b->lock, key);
+	return enabled;
 }
 
 
-/* beacon_enabled *******************************************************************************//**
- * @brief		Returns true if transmitting location beacons is enabled. */
-static bool beacon_enabled(Beacon* b)
+/* beacon_enabled_locked ************************************************************************//**
+ * @brief		Returns true if transmitting location beacons is enabled. A joining beacon counts its
+ * 				start timer down on each call. The caller holds b->lock. */
+static bool beacon_enabled_locked(Beacon* b)
 {
 	if(b->current_state == BEACON_JOINED_STATE || b->current_state == BEACON_FORCED_STATE)
 	{
@@ -3773,14 +4828,18 @@ static bool beacon_enabled(Beacon* b)
 /* beacon_get_tx_hist ***************************************************************************//**
  * @brief		Returns true if this node transmitted the last time the location update specified by
  * 				slot and dir was active. */
-static bool beacon_get_tx_hist(const Beacon* b, uint8_t slot, uint8_t dir)
+static bool beacon_get_tx_hist(Beacon* b, uint8_t slot, uint8_t dir)
 {
 	/*      0000 0000 0011 1111 1111 2222 2222 2233
 	 *      0123 4567 8901 2345 6789 0123 4567 8901
 	 *
 	 * dir  0000 1111 2222 3333 4444 5555 6666 7777
 	 * slot 0123 0123 0123 0123 0123 0123 0123 0123 */
-	return b->tx_hist & (1 << (slot + (dir * 4)));
+	k_spinlock_key_t key  = k_spin_lock(&b->lock);
+	bool             hist = b->tx_hist & (1 << (slot + (dir * 4)));
+
+	k_spin_unlock(&b->lock, key);
+	return hist;
 }
 
 
@@ -3796,16 +4855,23 @@ static void beacon_set_tx_hist(Beacon* b, uint8_t slot, uint8_t dir, bool did_tx
 	 * slot 0123 0123 0123 0123 0123 0123 0123 0123 */
 	uint32_t idx = slot + (dir * 4);
 
+	k_spinlock_key_t key = k_spin_lock(&b->lock);
 	b->tx_hist = (b->tx_hist & ~(1 << idx)) | ((did_tx != 0) << idx);
+	k_spin_unlock(&b->lock, key);
 }
 
 
 /* beacon_try ***********************************************************************************//**
- * @brief		Returns true if this node should transmit a beacon. Returns false if this node has
- * 				disabled transmitting beacons or if beacons are backing off because of a conflict. */
-static bool beacon_try(Beacon* b)
+ * @brief		Returns true if this node should transmit a beacon at index. Returns false if this
+ * 				node has disabled transmitting beacons, if beacons are backing off because of a
+ * 				conflict or if the beacon index changed since loc_slot picked its offset. */
+static bool beacon_try(Beacon* b, unsigned index)
 {
-	return beacon_enabled(b) && backoff_try(&b->backoff);
+	k_spinlock_key_t key = k_spin_lock(&b->lock);
+	bool             tx  = b->index == index && beacon_enabled_locked(b) && backoff_try(&b->backoff);
+
+	k_spin_unlock(&b->lock, key);
+	return tx;
 }
 
 
@@ -3816,6 +4882,7 @@ static bool beacon_start(Beacon* b, unsigned index, float distance)
 {
 	if(distance >= 0)
 	{
+		b->gain = 1.0f;
 		beacon_handle(b, BEACON_START_EVENT, index, distance);
 		return true;
 	}
@@ -3849,26 +4916,42 @@ static void beacon_success(Beacon* b)
 {
 	LOG_DBG("success");
 
+	k_spinlock_key_t key = k_spin_lock(&b->lock);
 	backoff_success(&b->backoff);
+	k_spin_unlock(&b->lock, key);
 
 	beacon_handle(b, BEACON_JOINED_EVENT, 0, 0);
 }
 
 
 /* beacon_backoff *******************************************************************************//**
- * @brief		Backs off on transmitting a beacon. This is required if there was a conflict. */
+ * @brief		Backs off on transmitting a beacon. This is required if there was a conflict. Beacons
+ * 				that contribute little to the PDOP of their cells back off twice as fast so that the
+ * 				conflict resolves in favor of the beacon with better geometry. */
 static void beacon_backoff(Beacon* b)
 {
 	LOG_DBG("backoff");
 
+	k_spinlock_key_t key = k_spin_lock(&b->lock);
+
 	backoff_fail(&b->backoff);
+
+	if(b->gain < LOC_GDOP_LOW_GAIN)
+	{
+		backoff_fail(&b->backoff);
+	}
+
+	k_spin_unlock(&b->lock, key);
 }
 
 
 /* beacon_handle ********************************************************************************//**
- * @brief		Handles a beacon event. */
+ * @brief		Handles a beacon event. The transition is made under b->lock so that loc_slot never
+ * 				sees a half updated beacon. */
 static void beacon_handle(Beacon* b, BeaconEvent e, unsigned index, float distance)
 {
+	k_spinlock_key_t key = k_spin_lock(&b->lock);
+
 	if(e == BEACON_FORCE_INDEX_EVENT && b->current_state != BEACON_FORCED_STATE)
 	{
 		LOG_INF("BEACON_FORCE_EVENT -> BEACON_FORCED_STATE index = %d", index);
@@ -3913,7 +4996,7 @@ static void beacon_handle(Beacon* b, BeaconEvent e, unsigned index, float distan
 
 				b->tx_hist     = 0;
 				b->index       = index;
-				b->start_timer = beacon_rand(distance);
+				b->start_timer = beacon_rand(b, distance);
 				b->next_state  = BEACON_JOINING_STATE;
 				backoff_reset(&b->backoff);
 			}
@@ -3933,7 +5016,7 @@ static void beacon_handle(Beacon* b, BeaconEvent e, unsigned index, float distan
 
 				b->tx_hist     = 0;
 				b->index       = index;
-				b->start_timer = beacon_rand(distance);
+				b->start_timer = beacon_rand(b, distance);
 				b->next_state  = BEACON_JOINING_STATE;
 				backoff_reset(&b->backoff);
 			}
@@ -3959,7 +5042,7 @@ static void beacon_handle(Beacon* b, BeaconEvent e, unsigned index, float distan
 
 				b->tx_hist     = 0;
 				b->index       = index;
-				b->start_timer = beacon_rand(distance);
+				b->start_timer = beacon_rand(b, distance);
 				b->next_state  = BEACON_JOINING_STATE;
 				backoff_reset(&b->backoff);
 			}
@@ -3972,6 +5055,8 @@ static void beacon_handle(Beacon* b, BeaconEvent e, unsigned index, float distan
 	}
 
 	b->current_state = b->next_state;
+
+	k_spin_unlock(&b->lock, key);
 }
 
 
@@ -3982,10 +5067,10 @@ static void beacon_handle(Beacon* b, BeaconEvent e, unsigned index, float distan
  * 				If a node is closer to the ideal point, it will start transmitting sooner, taking
  * 				priority over other nodes that are also trying to transmit but may be further
  * 				away. */
-static unsigned beacon_rand(float distance)
+static unsigned beacon_rand(Beacon* b, float distance)
 {
 	float x = distance / (LATTICE_R / 2);
-	float r = (float)(rand()) / (RAND_MAX + 1.0f);
+	float r = prng_float(&b->rng);
 
 	return (12.0f * x) + (4.0f * x * r);
 
@@ -30,6 +30,7 @@ extern "C" {
 #include <stdint.h>
 
 #include "dw1000.h"
+#include "loccell.h"
 #include "matrix.h"
 #include "timeslot.h"
 
@@ -93,6 +94,9 @@ extern "C" {
 
 // #define LATTICE_R		(5.0f)
 #define LATTICE_R		(2.5f)
+
+#define LOC_MAX_GROUPS  (2)		/* Max groups of 4 location cells per slotframe */
+
 // #define LATTICE_R		(3.0f)
 
 
@@ -107,6 +111,63 @@ typedef struct {
 } Neighbor;
 
 
+/* Input to the location pipeline acquired in one location cell */
+typedef struct {
+	uint8_t  dir;           /* This location update's direction                             */
+	uint8_t  slot;          /* This location update's slot                                  */
+	uint8_t  offset;        /* The offset for when this beacon should transmit              */
+	uint8_t  conflicts;     /* Bits [0-5] indicating which beacons conflicted               */
+	uint8_t  shouldtx;      /* Boolean indicating if this node should transmit in this slot */
+	uint8_t  nlos;          /* Bits [0-6] indicating which beacons were received NLOS       */
+	float    sigma;         /* Estimated standard deviation in m of the computed location   */
+	uint32_t new_nbrhood;   /* Bits [0-5] indicating which new_nbrs are valid               */
+	uint32_t adj;           /* Bits [0-13] indicating which tstamps are valid               */
+	Neighbor new_nbrs[6];   /* Neighbors received during this location update               */
+	int32_t  tstamps[21];   /* Compact, upper-triangular, column-wise matrix of timestamps  */
+	DW1000_Rx_Diag diag[7]; /* Raw receive diagnostics of each offset, see update_nlos      */
+} LocUpdate;
+
+
+typedef struct {
+	uint32_t acquire_us;        /* Last location cell acquisition time in slot context */
+	uint32_t acquire_max_us;    /* Worst case location cell acquisition time */
+	uint32_t solve_us;          /* Last location cell solve time on the work queue */
+	uint32_t solve_max_us;      /* Worst case location cell solve time */
+	uint32_t overruns;          /* Location cells dropped because the solver fell behind */
+} LocTiming;
+
+
+/* Location schedule. Each slotframe holds groups x 4 location cell positions and each position runs
+ * lanes cells concurrently, see loccell.h. The schedule takes effect at the start ASN which is
+ * always the start of a cycle of 8 slotframes. Schedules are flooded in enhanced beacons and a node
+ * adopts a schedule with a newer sequence number.
+ *
+ * 		                     1                   2                   3
+ * 		 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ * 		+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * 		|    SeqNum     |    Groups     |     Lanes     | Start ASN ... |
+ * 		+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * 		|  ...                                                          |
+ * 		+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * 		|  ...                                          |
+ * 		+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ */
+typedef struct __packed {
+	uint8_t  seq;
+	uint8_t  groups;
+	uint8_t  lanes;
+	uint64_t start;
+} LocSchedule;
+
+
+typedef struct {
+	Vec3     loc;               /* Filtered location */
+	uint32_t all_nbrhood;       /* Bits [0-19] indicating which neighbors[20] are valid */
+	uint32_t local_nbrhood;     /* Bits [0-19] indicating which neighbors report local locations */
+	Neighbor neighbors[20];
+} LocSnapshot;
+
+
 /* Public Functions ------------------------------------------------------------------------------ */
 void loc_init           (DW1000*, const uint8_t*);
 void loc_start          (void);
@@ -116,7 +177,7 @@ void loc_allow_beaconing(bool);
 void loc_force_index    (int);
 Vec3 loc_current        (void);
 void loc_set_hypercoord (float, float);
-void loc_dist_measured  (const uint8_t*, uint32_t);
+void loc_dist_measured  (const uint8_t*, uint32_t, const DW1000_Rx_Diag*);
 void loc_slot           (TsSlot*);
 
 /* Todo: Rename loc nbrs to loc beacons */
@@ -126,6 +187,17 @@ Neighbor* loc_nbrs      (unsigned);
 bool     loc_is_beacon   (void);
 unsigned loc_beacon_index(void);
 
+LocTiming loc_timing     (void);
+
+LocSchedule loc_schedule   (void);
+void        loc_schedule_rx(const LocSchedule*);
+
+void loc_snapshot       (LocSnapshot*);
+bool loc_restore        (const LocSnapshot*);
+
+void loc_capture        (uint32_t);
+void loc_capture_drain  (void*, void*, void*);
+
 // /* Loc Testing */
 // void loc_start_tx(void);
 // void loc_start_rx(void);
@@ -0,0 +1,568 @@
+/************************************************************************************************//**
+ * @file		loccapture.c
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ * @brief		A record is a LocCapHeader followed by
+ *
+ * 					1.	One entry for each bit set in nbr_mask: the neighbor table index, a byte of
+ * 						LOC_CAP_FIELD flags and the flagged fields in LocCapNbr order.
+ * 					2.	One int32 for each bit set in tstamp_mask.
+ * 					3.	For sync records, a LocCapSync followed by all 33 bytes of each neighbor in
+ * 						all_nbrhood.
+ *
+ * 				Fields are little endian.
+ *
+ ***************************************************************************************************/
+#include <errno.h>
+#include <string.h>
+#include <toolchain.h>
+
+#include "loccapture.h"
+
+
+/* Private Macros -------------------------------------------------------------------------------- */
+#define LOC_CAP_FIELD_ADDRESS   (0x01)
+#define LOC_CAP_FIELD_LOC       (0x02)
+#define LOC_CAP_FIELD_HCOORD    (0x04)
+#define LOC_CAP_FIELD_NBRHOOD   (0x08)
+#define LOC_CAP_FIELD_CLASS     (0x10)
+#define LOC_CAP_FIELD_ALL       (0x1F)
+
+#define LOC_CAP_NBR_MASK        (0x3Fu)			/* new_nbrs[6] */
+#define LOC_CAP_TSTAMP_MASK     (0x1FFFFFu)		/* tstamps[21] */
+#define LOC_CAP_TABLE_MASK      (0xFFFFFu)		/* neighbors[20] */
+
+
+/* Private Types --------------------------------------------------------------------------------- */
+typedef struct __packed {
+	char     magic[4];      /* "LOCU" */
+	uint8_t  version;
+	uint8_t  flags;
+	uint8_t  event;
+	uint8_t  state;
+	uint8_t  beacon_index;
+	uint8_t  dir;
+	uint8_t  slot;
+	uint8_t  offset;
+	uint8_t  conflicts;
+	uint8_t  shouldtx;
+	uint8_t  nlos;
+	uint8_t  nbr_mask;      /* Bits [0-5] indicating which new_nbrs follow */
+	uint32_t tstamp_mask;   /* Bits [0-20] indicating which tstamps follow */
+	uint32_t seq;
+	uint32_t dropped;
+	uint32_t uptime;
+	uint32_t solve_us;
+	uint32_t new_nbrhood;
+	uint32_t adj;
+	float    sigma;
+	float    x, y, z;
+	uint32_t all_nbrhood;
+	uint32_t local_nbrhood;
+} LocCapHeader;
+
+
+typedef struct __packed {
+	uint8_t  state;
+	uint8_t  beacon_index;
+	uint8_t  search_count;
+	uint8_t  _reserved;
+	float    x, y, z;
+	float    vx, vy, vz;
+	uint32_t all_nbrhood;
+	uint32_t local_nbrhood;
+	uint8_t  dropcount[LOC_CAPTURE_NUM_NBRS];
+} LocCapSync;
+
+
+/* Cursor over a record being written or read */
+typedef struct {
+	uint8_t* ptr;
+	uint8_t* end;
+	bool     ok;
+} LocCapBuf;
+
+
+/* Private Functions ----------------------------------------------------------------------------- */
+static void     loc_cap_put     (LocCapBuf*, const void*, size_t);
+static void     loc_cap_get     (LocCapBuf*, void*, size_t);
+static unsigned loc_cap_diff    (const LocCapNbr*, const LocCapNbr*);
+static void     loc_cap_put_nbr (LocCapBuf*, const LocCapNbr*, unsigned);
+static void     loc_cap_get_nbr (LocCapBuf*, LocCapNbr*, unsigned);
+
+
+/* Private Variables ----------------------------------------------------------------------------- */
+static const LocCapNbr loc_cap_zero;
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Location Capture Codec                                                                          //
+// ----------------------------------------------------------------------------------------------- //
+/* loc_cap_reset ********************************************************************************//**
+ * @brief		Forgets the delta coding state. The next record must be a sync record. */
+void loc_cap_reset(LocCapCodec* codec)
+{
+	codec->synced = false;
+	codec->seq    = 0;
+	codec->valid  = 0;
+}
+
+
+/* loc_cap_synced *******************************************************************************//**
+ * @brief		Returns true if records other than sync records can be coded. */
+bool loc_cap_synced(const LocCapCodec* codec)
+{
+	return codec->synced;
+}
+
+
+/* loc_cap_encode *******************************************************************************//**
+ * @brief		Encodes a record into buf. The record is a sync record if state is not null. A sync
+ * 				record is required while the codec is not synced. Returns the length of the record,
+ * 				-EINVAL if the record can't be encoded or -ENOSPC if buf is too small. */
+int loc_cap_encode(
+	LocCapCodec* codec, const LocCapRecord* rec, const LocCapState* state, uint8_t* buf, size_t len)
+{
+	const LocCapUpdate* u = &rec->update;
+
+	LocCapHeader hdr;
+	LocCapBuf    b = { buf, buf + len, true };
+	unsigned     i;
+
+	if(!state && !codec->synced)
+	{
+		return -EINVAL;
+	}
+
+	for(i = 0; i < 6; i++)
+	{
+		if(u->index[i] >= LOC_CAPTURE_NUM_NBRS)
+		{
+			return -EINVAL;
+		}
+	}
+
+	memmove(hdr.magic, "LOCU", sizeof(hdr.magic));
+	hdr.version       = LOC_CAPTURE_VERSION;
+	hdr.flags         = state ? LOC_CAPTURE_SYNC : 0;
+	hdr.event         = rec->event;
+	hdr.state         = rec->state;
+	hdr.beacon_index  = rec->beacon_index;
+	hdr.dir           = u->dir;
+	hdr.slot          = u->slot;
+	hdr.offset        = u->offset;
+	hdr.conflicts     = u->conflicts;
+	hdr.shouldtx      = u->shouldtx;
+	hdr.nlos          = u->nlos;
+	hdr.nbr_mask      = 0;
+	hdr.tstamp_mask   = 0;
+	hdr.seq           = rec->seq;
+	hdr.dropped       = rec->dropped;
+	hdr.uptime        = rec->uptime;
+	hdr.solve_us      = rec->solve_us;
+	hdr.new_nbrhood   = u->new_nbrhood;
+	hdr.adj           = u->adj;
+	hdr.sigma         = u->sigma;
+	hdr.x             = rec->x;
+	hdr.y             = rec->y;
+	hdr.z             = rec->z;
+	hdr.all_nbrhood   = rec->all_nbrhood;
+	hdr.local_nbrhood = rec->local_nbrhood;
+
+	for(i = 0; i < 6; i++)
+	{
+		if(loc_cap_diff(&u->new_nbrs[i], &loc_cap_zero))
+		{
+			hdr.nbr_mask |= (1 << i);
+		}
+	}
+
+	for(i = 0; i < 21; i++)
+	{
+		if(u->tstamps[i] != 0)
+		{
+			hdr.tstamp_mask |= (1u << i);
+		}
+	}
+
+	/* Sync records don't depend on earlier records */
+	if(state)
+	{
+		codec->valid = 0;
+	}
+
+	loc_cap_put(&b, &hdr, sizeof(hdr));
+
+	for(i = 0; i < 6; i++)
+	{
+		if(hdr.nbr_mask & (1 << i))
+		{
+			uint8_t  idx    = u->index[i];
+			unsigned fields = LOC_CAP_FIELD_ALL;
+
+			if(codec->valid & (1u << idx))
+			{
+				fields = loc_cap_diff(&u->new_nbrs[i], &codec->ref[idx]);
+			}
+
+			uint8_t f = (uint8_t)fields;
+			loc_cap_put    (&b, &idx, 1);
+			loc_cap_put    (&b, &f,   1);
+			loc_cap_put_nbr(&b, &u->new_nbrs[i], fields);
+
+			codec->ref[idx] = u->new_nbrs[i];
+			codec->valid   |= (1u << idx);
+		}
+	}
+
+	for(i = 0; i < 21; i++)
+	{
+		if(hdr.tstamp_mask & (1u << i))
+		{
+			loc_cap_put(&b, &u->tstamps[i], sizeof(u->tstamps[i]));
+		}
+	}
+
+	if(state)
+	{
+		LocCapSync sync;
+
+		sync.state         = state->state;
+		sync.beacon_index  = state->beacon_index;
+		sync.search_count  = state->search_count;
+		sync._reserved     = 0;
+		sync.x             = state->x;
+		sync.y             = state->y;
+		sync.z             = state->z;
+		sync.vx            = state->vx;
+		sync.vy            = state->vy;
+		sync.vz            = state->vz;
+		sync.all_nbrhood   = state->all_nbrhood & LOC_CAP_TABLE_MASK;
+		sync.local_nbrhood = state->local_nbrhood;
+		memmove(sync.dropcount, state->dropcount, sizeof(sync.dropcount));
+
+		loc_cap_put(&b, &sync, sizeof(sync));
+
+		for(i = 0; i < LOC_CAPTURE_NUM_NBRS; i++)
+		{
+			if(sync.all_nbrhood & (1u << i))
+			{
+				loc_cap_put_nbr(&b, &state->neighbors[i], LOC_CAP_FIELD_ALL);
+			}
+		}
+	}
+
+	if(!b.ok)
+	{
+		loc_cap_reset(codec);
+		return -ENOSPC;
+	}
+
+	codec->synced = true;
+	codec->seq    = rec->seq;
+	return (int)(b.ptr - buf);
+}
+
+
+/* loc_cap_decode *******************************************************************************//**
+ * @brief		Decodes a record. State receives the state from before the update if the record is a
+ * 				sync record and may be null. Returns 0 on success, -EBADMSG if the record is malformed,
+ * 				-ENOTSUP if the record has another version or -ESTALE if the record follows a lost
+ * 				record. The codec needs a sync record after any error. */
+int loc_cap_decode(
+	LocCapCodec* codec, LocCapRecord* rec, LocCapState* state, const uint8_t* buf, size_t len)
+{
+	LocCapUpdate* u = &rec->update;
+
+	LocCapHeader hdr;
+	LocCapBuf    b = { (uint8_t*)buf, (uint8_t*)buf + len, true };
+	unsigned     i;
+	int          ret = -EBADMSG;
+
+	loc_cap_get(&b, &hdr, sizeof(hdr));
+
+	if(!b.ok || memcmp(hdr.magic, "LOCU", sizeof(hdr.magic)) != 0)
+	{
+		goto error;
+	}
+	else if(hdr.version != LOC_CAPTURE_VERSION)
+	{
+		ret = -ENOTSUP;
+		goto error;
+	}
+	else if(!(hdr.flags & LOC_CAPTURE_SYNC) && (!codec->synced || hdr.seq != codec->seq + 1))
+	{
+		ret = -ESTALE;
+		goto error;
+	}
+	else if((hdr.nbr_mask & ~LOC_CAP_NBR_MASK) || (hdr.tstamp_mask & ~LOC_CAP_TSTAMP_MASK))
+	{
+		goto error;
+	}
+
+	if(hdr.flags & LOC_CAPTURE_SYNC)
+	{
+		codec->valid = 0;
+	}
+
+	rec->flags         = hdr.flags;
+	rec->event         = hdr.event;
+	rec->state         = hdr.state;
+	rec->beacon_index  = hdr.beacon_index;
+	rec->seq           = hdr.seq;
+	rec->dropped       = hdr.dropped;
+	rec->uptime        = hdr.uptime;
+	rec->solve_us      = hdr.solve_us;
+	rec->x             = hdr.x;
+	rec->y             = hdr.y;
+	rec->z             = hdr.z;
+	rec->all_nbrhood   = hdr.all_nbrhood;
+	rec->local_nbrhood = hdr.local_nbrhood;
+
+	memset(u, 0, sizeof(LocCapUpdate));
+	u->dir         = hdr.dir;
+	u->slot        = hdr.slot;
+	u->offset      = hdr.offset;
+	u->conflicts   = hdr.conflicts;
+	u->shouldtx    = hdr.shouldtx;
+	u->nlos        = hdr.nlos;
+	u->sigma       = hdr.sigma;
+	u->new_nbrhood = hdr.new_nbrhood;
+	u->adj         = hdr.adj;
+
+	for(i = 0; i < 6; i++)
+	{
+		if(hdr.nbr_mask & (1 << i))
+		{
+			uint8_t idx;
+			uint8_t fields;
+
+			loc_cap_get(&b, &idx,    1);
+			loc_cap_get(&b, &fields, 1);
+
+			if(!b.ok || idx >= LOC_CAPTURE_NUM_NBRS || (fields & ~LOC_CAP_FIELD_ALL) ||
+			   (!(codec->valid & (1u << idx)) && fields != LOC_CAP_FIELD_ALL))
+			{
+				goto error;
+			}
+
+			LocCapNbr* n = &u->new_nbrs[i];
+			*n = (codec->valid & (1u << idx)) ? codec->ref[idx] : loc_cap_zero;
+			loc_cap_get_nbr(&b, n, fields);
+
+			u->index[i]     = idx;
+			codec->ref[idx] = *n;
+			codec->valid   |= (1u << idx);
+		}
+	}
+
+	for(i = 0; i < 21; i++)
+	{
+		if(hdr.tstamp_mask & (1u << i))
+		{
+			loc_cap_get(&b, &u->tstamps[i], sizeof(u->tstamps[i]));
+		}
+	}
+
+	if(hdr.flags & LOC_CAPTURE_SYNC)
+	{
+		LocCapSync sync;
+		LocCapNbr  nbr;
+
+		loc_cap_get(&b, &sync, sizeof(sync));
+
+		if(!b.ok || (sync.all_nbrhood & ~LOC_CAP_TABLE_MASK))
+		{
+			goto error;
+		}
+
+		if(state)
+		{
+			memset(state, 0, sizeof(LocCapState));
+			state->state         = sync.state;
+			state->beacon_index  = sync.beacon_index;
+			state->search_count  = sync.search_count;
+			state->x             = sync.x;
+			state->y             = sync.y;
+			state->z             = sync.z;
+			state->vx            = sync.vx;
+			state->vy            = sync.vy;
+			state->vz            = sync.vz;
+			state->all_nbrhood   = sync.all_nbrhood;
+			state->local_nbrhood = sync.local_nbrhood;
+			memmove(state->dropcount, sync.dropcount, sizeof(state->dropcount));
+		}
+
+		for(i = 0; i < LOC_CAPTURE_NUM_NBRS; i++)
+		{
+			if(sync.all_nbrhood & (1u << i))
+			{
+				loc_cap_get_nbr(&b, state ? &state->neighbors[i] : &nbr, LOC_CAP_FIELD_ALL);
+			}
+		}
+	}
+
+	if(!b.ok || b.ptr != b.end)
+	{
+		goto error;
+	}
+
+	codec->synced = true;
+	codec->seq    = hdr.seq;
+	return 0;
+
+	error:
+		loc_cap_reset(codec);
+		return ret;
+}
+
+
+/* loc_cap_put **********************************************************************************//**
+ * @brief		Appends len bytes to the record. */
+static void loc_cap_put(LocCapBuf* b, const void* data, size_t len)
+{
+	if(!b->ok || (size_t)(b->end - b->ptr) < len)
+	{
+		b->ok = false;
+		return;
+	}
+
+	memmove(b->ptr, data, len);
+	b->ptr += len;
+}
+
+
+/* loc_cap_get **********************************************************************************//**
+ * @brief		Reads the next len bytes of the record. */
+static void loc_cap_get(LocCapBuf* b, void* data, size_t len)
+{
+	if(!b->ok || (size_t)(b->end - b->ptr) < len)
+	{
+		b->ok = false;
+		return;
+	}
+
+	memmove(data, b->ptr, len);
+	b->ptr += len;
+}
+
+
+/* loc_cap_diff *********************************************************************************//**
+ * @brief		Returns the LOC_CAP_FIELD flags of the fields that differ between a and b. Floats are
+ * 				compared bitwise so that a replay sees exactly the captured values. */
+static unsigned loc_cap_diff(const LocCapNbr* a, const LocCapNbr* b)
+{
+	unsigned fields = 0;
+
+	if(memcmp(a->address, b->address, sizeof(a->address)) != 0)
+	{
+		fields |= LOC_CAP_FIELD_ADDRESS;
+	}
+
+	if(memcmp(&a->x, &b->x, sizeof(a->x)) != 0 ||
+	   memcmp(&a->y, &b->y, sizeof(a->y)) != 0 ||
+	   memcmp(&a->z, &b->z, sizeof(a->z)) != 0)
+	{
+		fields |= LOC_CAP_FIELD_LOC;
+	}
+
+	if(memcmp(&a->r, &b->r, sizeof(a->r)) != 0 || memcmp(&a->t, &b->t, sizeof(a->t)) != 0)
+	{
+		fields |= LOC_CAP_FIELD_HCOORD;
+	}
+
+	if(a->nbrhood != b->nbrhood)
+	{
+		fields |= LOC_CAP_FIELD_NBRHOOD;
+	}
+
+	if(a->class != b->class)
+	{
+		fields |= LOC_CAP_FIELD_CLASS;
+	}
+
+	return fields;
+}
+
+
+/* loc_cap_put_nbr ******************************************************************************//**
+ * @brief		Appends the flagged fields of a neighbor. */
+static void loc_cap_put_nbr(LocCapBuf* b, const LocCapNbr* n, unsigned fields)
+{
+	if(fields & LOC_CAP_FIELD_ADDRESS)
+	{
+		loc_cap_put(b, n->address, sizeof(n->address));
+	}
+
+	if(fields & LOC_CAP_FIELD_LOC)
+	{
+		loc_cap_put(b, &n->x, sizeof(n->x));
+		loc_cap_put(b, &n->y, sizeof(n->y));
+		loc_cap_put(b, &n->z, sizeof(n->z));
+	}
+
+	if(fields & LOC_CAP_FIELD_HCOORD)
+	{
+		loc_cap_put(b, &n->r, sizeof(n->r));
+		loc_cap_put(b, &n->t, sizeof(n->t));
+	}
+
+	if(fields & LOC_CAP_FIELD_NBRHOOD)
+	{
+		loc_cap_put(b, &n->nbrhood, sizeof(n->nbrhood));
+	}
+
+	if(fields & LOC_CAP_FIELD_CLASS)
+	{
+		loc_cap_put(b, &n->class, sizeof(n->class));
+	}
+}
+
+
+/* loc_cap_get_nbr ******************************************************************************//**
+ * @brief		Reads the flagged fields of a neighbor. Fields that aren't flagged are left as is. */
+static void loc_cap_get_nbr(LocCapBuf* b, LocCapNbr* n, unsigned fields)
+{
+	if(fields & LOC_CAP_FIELD_ADDRESS)
+	{
+		loc_cap_get(b, n->address, sizeof(n->address));
+	}
+
+	if(fields & LOC_CAP_FIELD_LOC)
+	{
+		loc_cap_get(b, &n->x, sizeof(n->x));
+		loc_cap_get(b, &n->y, sizeof(n->y));
+		loc_cap_get(b, &n->z, sizeof(n->z));
+	}
+
+	if(fields & LOC_CAP_FIELD_HCOORD)
+	{
+		loc_cap_get(b, &n->r, sizeof(n->r));
+		loc_cap_get(b, &n->t, sizeof(n->t));
+	}
+
+	if(fields & LOC_CAP_FIELD_NBRHOOD)
+	{
+		loc_cap_get(b, &n->nbrhood, sizeof(n->nbrhood));
+	}
+
+	if(fields & LOC_CAP_FIELD_CLASS)
+	{
+		loc_cap_get(b, &n->class, sizeof(n->class));
+	}
+}
+
+
+/******************************************* END OF FILE *******************************************/
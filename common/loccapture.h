@@ -0,0 +1,135 @@
+/************************************************************************************************//**
+ * @file		loccapture.h
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ * @brief		Wire format of captured location updates. Each record holds the complete input to the
+ * 				location pipeline for one location cell or distance measurement and the location state
+ * 				that resulted from handling it. Records are sent as UDP datagrams on LOC_CAPTURE_PORT.
+ *
+ * 				Records are delta coded to keep capture traffic off the radio as much as possible.
+ * 				Timestamps and new neighbors that are zero are omitted, and each new neighbor only
+ * 				carries the fields that changed since the last neighbor sent with the same neighbor
+ * 				table index. A sync record additionally carries the complete location and neighbor
+ * 				table state from before the update and does not depend on earlier records, so a
+ * 				replay can start at any sync record. Records following a lost record can't be decoded
+ * 				until the next sync record.
+ *
+ ***************************************************************************************************/
+#ifndef LOCCAPTURE_H
+#define LOCCAPTURE_H
+
+#if __STDC_VERSION__ < 199901L
+#error Compile with C99 or higher!
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Includes -------------------------------------------------------------------------------------- */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/* Public Macros --------------------------------------------------------------------------------- */
+#define LOC_CAPTURE_PORT        (2203)
+#define LOC_CAPTURE_VERSION     (2)
+#define LOC_CAPTURE_SYNC        (0x01)	/* Record carries the state from before the update */
+#define LOC_CAPTURE_NUM_NBRS    (20)	/* Size of the neighbor table */
+
+/* Header, 6 new neighbors with all fields, 21 timestamps, sync state and a full neighbor table */
+#define LOC_CAPTURE_MAX_LEN     (68 + 6 * 35 + 21 * 4 + 56 + LOC_CAPTURE_NUM_NBRS * 33)
+
+
+/* Public Types ---------------------------------------------------------------------------------- */
+typedef struct {
+	uint8_t  address[8];
+	float    x, y, z;
+	float    r, t;
+	uint32_t nbrhood;
+	uint8_t  class;
+} LocCapNbr;
+
+
+/* Input to the location pipeline. Mirrors LocUpdate. Index holds the neighbor table index each of
+ * new_nbrs maps to and is only used to delta code new_nbrs. */
+typedef struct {
+	uint8_t   dir;
+	uint8_t   slot;
+	uint8_t   offset;
+	uint8_t   conflicts;
+	uint8_t   shouldtx;
+	uint8_t   nlos;
+	float     sigma;
+	uint32_t  new_nbrhood;
+	uint32_t  adj;
+	uint8_t   index[6];
+	LocCapNbr new_nbrs[6];
+	int32_t   tstamps[21];
+} LocCapUpdate;
+
+
+typedef struct {
+	uint8_t      flags;         /* LOC_CAPTURE_SYNC */
+	uint8_t      event;         /* Event the update was handled with */
+	uint8_t      state;         /* Location state after handling the update */
+	uint8_t      beacon_index;  /* Beacon index after handling the update */
+	uint32_t     seq;
+	uint32_t     dropped;       /* Records lost since the previous record because the sender fell behind */
+	uint32_t     uptime;        /* Time in ms the update was handled */
+	uint32_t     solve_us;      /* Time in us spent handling the update */
+	LocCapUpdate update;
+	float        x, y, z;       /* Filtered location after handling the update */
+	uint32_t     all_nbrhood;   /* Valid neighbors after handling the update */
+	uint32_t     local_nbrhood; /* Neighbors reporting local locations after handling the update */
+} LocCapRecord;
+
+
+/* Location and neighbor table state before an update. Only neighbors in all_nbrhood are sent. */
+typedef struct {
+	uint8_t   state;
+	uint8_t   beacon_index;
+	uint8_t   search_count;
+	float     x, y, z;          /* Filtered location */
+	float     vx, vy, vz;       /* Velocity of the location */
+	uint32_t  all_nbrhood;
+	uint32_t  local_nbrhood;
+	uint8_t   dropcount[LOC_CAPTURE_NUM_NBRS];
+	LocCapNbr neighbors[LOC_CAPTURE_NUM_NBRS];
+} LocCapState;
+
+
+/* Delta coding state. The encoder and the decoder of a stream each keep their own codec. */
+typedef struct {
+	bool      synced;           /* False until a sync record has been coded */
+	uint32_t  seq;              /* Sequence number of the last record coded */
+	uint32_t  valid;            /* Bits [0-19] indicating which ref are valid */
+	LocCapNbr ref[LOC_CAPTURE_NUM_NBRS];
+} LocCapCodec;
+
+
+/* Public Functions ------------------------------------------------------------------------------ */
+void loc_cap_reset (LocCapCodec*);
+bool loc_cap_synced(const LocCapCodec*);
+int  loc_cap_encode(LocCapCodec*, const LocCapRecord*, const LocCapState*, uint8_t*, size_t);
+int  loc_cap_decode(LocCapCodec*, LocCapRecord*, LocCapState*, const uint8_t*, size_t);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LOCCAPTURE_H
+/******************************************* END OF FILE *******************************************/
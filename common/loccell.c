@@ -0,0 +1,205 @@
+/************************************************************************************************//**
+ * @file		loccell.c
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ ***************************************************************************************************/
+#include <math.h>
+
+#include "loccell.h"
+
+
+/* Private Functions ----------------------------------------------------------------------------- */
+static int loccell_mod(int, int);
+
+
+/* Public Variables ------------------------------------------------------------------------------ */
+const uint8_t loccell_order[8][4][6] = {
+	/* 0   1   2   3   4   5     Beacon Offset */
+	{{ 0,  4,  13, 9,  18, 19 },      /* NE, 0 */
+	 { 1,  5,  12, 8,  19, 18 },      /* NE, 1 */
+	 { 2,  6,  15, 11, 17, 16 },      /* NE, 2 */
+	 { 3,  7,  14, 10, 16, 17 }},     /* NE, 3 */
+
+	{{ 0,  9,  14, 18, 15, 19 },      /* N,  0 */
+	 { 1,  8,  15, 19, 14, 18 },      /* N,  1 */
+	 { 2,  11, 13, 17, 12, 16 },      /* N,  2 */
+	 { 3,  10, 12, 16, 13, 17 }},     /* N,  3 */
+
+	{{ 0,  9,  5,  17, 14, 15 },      /* NW, 0 */
+	 { 1,  8,  4,  16, 15, 14 },      /* NW, 1 */
+	 { 2,  11, 7,  19, 13, 12 },      /* NW, 2 */
+	 { 3,  10, 6,  18, 12, 13 }},     /* NW, 3 */
+
+	{{ 0,  17, 7,  14, 6,  15 },      /*  W, 0 */
+	 { 1,  16, 6,  15, 7,  14 },      /*  W, 1 */
+	 { 2,  19, 4,  13, 5,  12 },      /*  W, 2 */
+	 { 3,  18, 5,  12, 4,  13 }},     /*  W, 3 */
+
+	{{ 0,  17, 8,  12, 7,  6  },      /* SW, 0 */
+	 { 1,  16, 9,  13, 6,  7  },      /* SW, 1 */
+	 { 2,  19, 10, 14, 4,  5  },      /* SW, 2 */
+	 { 3,  18, 11, 15, 5,  4  }},     /* SW, 3 */
+
+	{{ 0,  12, 7,  11, 6,  10 },      /* S,  0 */
+	 { 1,  13, 6,  10, 7,  11 },      /* S,  1 */
+	 { 2,  14, 4,  8,  5,  9  },      /* S,  2 */
+	 { 3,  15, 5,  9,  4,  8  }},     /* S,  3 */
+
+	{{ 0,  12, 16, 4,  11, 10 },      /* SE, 0 */
+	 { 1,  13, 17, 5,  10, 11 },      /* SE, 1 */
+	 { 2,  14, 18, 6,  8,  9  },      /* SE, 2 */
+	 { 3,  15, 19, 7,  9,  8  }},     /* SE, 3 */
+
+	{{ 0,  4,  11, 18, 10, 19 },      /*  E, 0 */
+	 { 1,  5,  10, 19, 11, 18 },      /*  E, 1 */
+	 { 2,  6,  8,  17, 9,  16 },      /*  E, 2 */
+	 { 3,  7,  9,  16, 8,  17 }},     /*  E, 3 */
+};
+
+
+/* loccell_index ********************************************************************************//**
+ * @brief		Returns the beacon index that corresponds to the lattice point (qx, qy, qz). */
+unsigned loccell_index(float qx, float qy, float qz, float lattice_r)
+{
+	static const uint8_t beacons[2][10] = {
+		{ 0,  4, 8,  12, 16, 1,  5,  9,  13, 17 },	/* A sheet beacons */
+		{ 2,  6, 10, 14, 18, 3,  7,  11, 15, 19 },	/* B sheet beacons */
+	};
+
+	/* Pattern per sheet:
+	 *
+	 * 		16 1  5  9  13 17 0  4  8      -  -  -  -  -  -  0  -  -
+	 * 		9  13 17 0  4  8  12 16 1      -  -  -  0  -  -  -  -  -
+	 * 		0  4  8  12 16 1  5  9  13     0  -  -  -  -  -  -  -  -
+	 * 		12 16 1  5  9  13 17 0  4      -  -  -  -  -  -  -  0  -
+	 * 		5  9  13 17 0  4  8  12 16     -  -  -  -  0  -  -  -  -
+	 * 		17 0  4  8  12 16 1  5  9      -  0  -  -  -  -  -  -  -
+	 * 		8  12 16 1  5  9  13 17 0      -  -  -  -  -  -  -  -  0
+	 * 		1  5  9  13 17 0  4  8  12     -  -  -  -  -  0  -  -  -
+	 * 		13 17 0  4  8  12 16 1  5      -  -  0  -  -  -  -  -  -
+	 *
+	 * 		y = 1/3 * x => 3y = x => x - 3y
+	 *
+	 * Since q is quantized (e.g. [5, 0, 0] with lattice_r = 5), divide by lattice_r to turn the
+	 * coordinates into indices. */
+	int x = roundf((qx / lattice_r) - (qy * (3.0f / lattice_r)));
+	int z = loccell_mod(roundf(qz / lattice_r), 4);
+
+	/* Every two levels alternates between normal and swapped sheets. For example:
+	 *
+	 *		z-level 0: 0  4  8  12 16 1  5  9  13 17
+	 *		z-level 2: 1  5  9  13 17 0  4  8  12 6
+	 *
+	 * The index is computed by offsetting the index by 5 every 2 sheets and wrapping the index.
+	 * Since z is in the domain [0,4), z/2 will have the range [0,1]. Therefore, adding z/2*5 and
+	 * wrapping the index will compute the correct index for normal and swapped sheets. */
+	int i = loccell_mod(x + z/2*5, 10);
+
+	/* Alternate between A and B sheets */
+	int j = loccell_mod(z, 2);
+
+	return beacons[j][i];
+}
+
+
+/* loccell_slot *********************************************************************************//**
+ * @brief		Returns the slot of the cell run by a lane at a slotframe position. */
+unsigned loccell_slot(unsigned pos, unsigned lane)
+{
+	return (pos ^ (lane << 1)) & 0x3;
+}
+
+
+/* loccell_offset *******************************************************************************//**
+ * @brief		Returns the offset a beacon index transmits at in a cell, or -1u if the index isn't
+ * 				one of the cell's beacons. */
+unsigned loccell_offset(unsigned dir, unsigned slot, unsigned index)
+{
+	unsigned i;
+
+	for(i = 0; i < sizeof(loccell_order[0][0]) / sizeof(loccell_order[0][0][0]); i++)
+	{
+		if(loccell_order[dir][slot][i] == index)
+		{
+			return i;
+		}
+	}
+
+	return -1u;
+}
+
+
+/* loccell_lane *********************************************************************************//**
+ * @brief		Returns the lane a node takes part in at a slotframe position. A node whose beacon
+ * 				index belongs to one of the lanes' cells takes that lane. Other nodes listen to the
+ * 				lane whose cell has the most beacons in nbrhood, a bitmask of known beacon indices.
+ * 				Ties go to the first lane starting at rotate % lanes so that nodes without neighbors
+ * 				listen to every lane in turn. */
+unsigned loccell_lane(
+	unsigned dir,
+	unsigned pos,
+	unsigned lanes,
+	unsigned index,
+	uint32_t nbrhood,
+	unsigned rotate)
+{
+	unsigned best  = 0;
+	int      count = -1;
+	unsigned i, l;
+
+	if(lanes <= 1)
+	{
+		return 0;
+	}
+
+	for(l = 0; l < lanes; l++)
+	{
+		if(loccell_offset(dir, loccell_slot(pos, l), index) != -1u)
+		{
+			return l;
+		}
+	}
+
+	for(l = 0; l < lanes; l++)
+	{
+		unsigned lane = (rotate + l) % lanes;
+		unsigned slot = loccell_slot(pos, lane);
+		int      n    = 0;
+
+		for(i = 0; i < 6; i++)
+		{
+			n += (nbrhood >> loccell_order[dir][slot][i]) & 1;
+		}
+
+		if(n > count)
+		{
+			best  = lane;
+			count = n;
+		}
+	}
+
+	return best;
+}
+
+
+/* loccell_mod **********************************************************************************//**
+ * @brief		Returns a mod b in [0, b). */
+static int loccell_mod(int a, int b)
+{
+	int r = a % b;
+
+	return r < 0 ? r + b : r;
+}
+
+
+/******************************************* END OF FILE *******************************************/
@@ -0,0 +1,60 @@
+/************************************************************************************************//**
+ * @file		loccell.h
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ * @brief		Location cells. A location cell is identified by its direction and slot and is
+ * 				transmitted by the six beacons listed in loccell_order. Each slotframe position can
+ * 				run up to LOC_MAX_LANES cells at once. Lane l at position p runs the cell of slot
+ * 				p ^ (2 * l) on its own channel and preamble code. The cells of slots p and p ^ 2 share
+ * 				no beacon index, so each node takes part in at most one lane at a time. Kept free of
+ * 				Zephyr so that the host tests use the assignment the nodes use.
+ *
+ ***************************************************************************************************/
+#ifndef LOCCELL_H
+#define LOCCELL_H
+
+#if __STDC_VERSION__ < 199901L
+#error Compile with C99 or higher!
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Public Includes ------------------------------------------------------------------------------- */
+#include <stdint.h>
+
+
+/* Public Macros --------------------------------------------------------------------------------- */
+#define LOC_MAX_LANES   (2)		/* Max location cells running concurrently per slotframe position */
+#define LOC_NUM_INDICES (20)	/* Number of beacon indices */
+
+
+/* Public Variables ------------------------------------------------------------------------------ */
+extern const uint8_t loccell_order[8][4][6];	/* Indexed: loccell_order[dir][slot][offset] */
+
+
+/* Public Functions ------------------------------------------------------------------------------ */
+unsigned loccell_index (float, float, float, float);
+unsigned loccell_slot  (unsigned, unsigned);
+unsigned loccell_offset(unsigned, unsigned, unsigned);
+unsigned loccell_lane  (unsigned, unsigned, unsigned, unsigned, uint32_t, unsigned);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LOCCELL_H
+/******************************************* END OF FILE *******************************************/
@@ -0,0 +1,584 @@
+/************************************************************************************************//**
+ * @file		locsolve.c
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ ***************************************************************************************************/
+#include <math.h>
+#include <stddef.h>
+
+#include "locsolve.h"
+
+
+/* Private Macros -------------------------------------------------------------------------------- */
+#define MAX_ROWS            (LOCSOLVE_MAX_BEACONS - 1)
+
+#define SPRING_KS           (1.0f)      /* Stiffness of the springs to the beacons */
+#define SPRING_KG           (0.2f)      /* Constant attraction to the closest lattice point */
+#define SPRING_B            (2.0f)      /* Damping */
+#define SPRING_M            (1.0f)      /* Mass of the node */
+#define SPRING_DT           (0.01f)     /* Time step in s */
+
+
+/* Private Functions ----------------------------------------------------------------------------- */
+static float row_weight(float, float);
+static bool  tdoa_solve(const float (*)[3], const float*, const float*, unsigned, LocSolve*);
+static bool  qr_reduce (float (*)[3], float (*)[2], unsigned, unsigned);
+static void  qr_backsub(float (*)[3], float (*)[2], unsigned);
+static float wls_sigma (float (*)[3], float, unsigned, bool);
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Public Functions                                                                                //
+// ----------------------------------------------------------------------------------------------- //
+/* locsolve_toa *********************************************************************************//**
+ * @brief		Solves for the location given the distances d in m to n beacons at p.
+ *
+ * 				Subtracting the sphere of each beacon from the sphere of the first beacon gives one
+ * 				linear equation per remaining beacon:
+ *
+ * 					(p0 - pi) . x = 1/2 * (|p0|^2 - |pi|^2 + di^2 - d0^2)
+ *
+ * 				An error e in a range d perturbs d^2/2 by about d*e. sd holds the standard deviation
+ * 				of each range in m. Each row is weighted by the inverse standard deviation of its
+ * 				right hand side so that long and NLOS ranges count less. A null sd weights every row
+ * 				equally. Requires 4 non-coplanar beacons. */
+bool locsolve_toa(const float (*p)[3], const float* d, const float* sd, unsigned n, LocSolve* sol)
+{
+	float a[MAX_ROWS][3];
+	float b[MAX_ROWS][2];
+	unsigned i, k;
+
+	if(n < 4 || n > LOCSOLVE_MAX_BEACONS)
+	{
+		return false;
+	}
+
+	for(i = 1; i < n; i++)
+	{
+		float w = sd ? row_weight(sd[i] * d[i], sd[0] * d[0]) : 1.0f;
+
+		b[i-1][0] = (d[i] - d[0]) * (d[i] + d[0]);
+
+		for(k = 0; k < 3; k++)
+		{
+			a[i-1][k]  = (p[0][k] - p[i][k]) * w;
+			b[i-1][0] += (p[0][k] - p[i][k]) * (p[0][k] + p[i][k]);
+		}
+
+		b[i-1][0] *= 0.5f * w;
+	}
+
+	if(!qr_reduce(a, b, n - 1, 1))
+	{
+		return false;
+	}
+
+	/* Rows [3, n-1) of Q'b are the weighted residuals of the least squares solution */
+	sol->chi2 = 0;
+	for(i = 3; i < n - 1; i++)
+	{
+		sol->chi2 += b[i][0] * b[i][0];
+	}
+
+	qr_backsub(a, b, 1);
+
+	sol->x     = b[0][0];
+	sol->y     = b[1][0];
+	sol->z     = b[2][0];
+	sol->sigma = wls_sigma(a, sol->chi2, n - 1, sd != NULL);
+
+	return isfinite(sol->x) && isfinite(sol->y) && isfinite(sol->z);
+}
+
+
+/* locsolve_tdoa ********************************************************************************//**
+ * @brief		Solves for the location given pseudoranges pr in m to n beacons at p. The
+ * 				pseudoranges share an unknown offset, so only their differences to the first
+ * 				beacon's are used:
+ *
+ * 					(p0 - pi) . x = 1/2 * (|p0|^2 - |pi|^2 + di0^2) + di0 * d0,  di0 = pri - pr0
+ *
+ * 				The least squares solution is linear in the distance d0 to the first beacon which is
+ * 				then found from |x - p0| = d0. Of the non-negative roots, the one with the smaller
+ * 				residual is picked.
+ *
+ * 				Errors ei and e0 in pri and pr0 perturb the right hand side by about (ei - e0) * di.
+ * 				The distances are unknown until solved, so with the range deviations sd the system is
+ * 				first solved unweighted and then again with the distances to that solution. A null sd
+ * 				weights every row equally. Requires 4 non-coplanar beacons. */
+bool locsolve_tdoa(const float (*p)[3], const float* pr, const float* sd, unsigned n, LocSolve* sol)
+{
+	float    w[LOCSOLVE_MAX_BEACONS];
+	unsigned i;
+
+	if(n < 4 || n > LOCSOLVE_MAX_BEACONS || !tdoa_solve(p, pr, 0, n, sol))
+	{
+		return false;
+	}
+
+	if(!sd)
+	{
+		return true;
+	}
+
+	for(i = 1; i < n; i++)
+	{
+		float dx = sol->x - p[i][0];
+		float dy = sol->y - p[i][1];
+		float dz = sol->z - p[i][2];
+		float di = fmaxf(sqrtf(dx*dx + dy*dy + dz*dz), 1.0f);
+
+		w[i] = row_weight(sd[i] * di, sd[0] * di);
+	}
+
+	return tdoa_solve(p, pr, w, n, sol);
+}
+
+
+
+
+/* locsolve_pdop ********************************************************************************//**
+ * @brief		Returns the position dilution of precision that n beacons at p give a receiver at
+ * 				their centroid. Beacons closer than min_dist to the centroid carry no direction and
+ * 				are skipped. Returns INFINITY if the beacons can't provide a 3D location.
+ *
+ * 				With u[i] the unit vector from beacon i to the receiver:
+ *
+ * 					M    = sum(u[i] * u[i]')
+ * 					PDOP = sqrt(trace(M^-1))
+ */
+float locsolve_pdop(const float (*p)[3], unsigned n, float min_dist)
+{
+	float    x[3] = { 0, 0, 0 };
+	float    m00 = 0, m01 = 0, m02 = 0, m11 = 0, m12 = 0, m22 = 0;
+	unsigned i, k;
+
+	if(n < 4)
+	{
+		return INFINITY;
+	}
+
+	for(i = 0; i < n; i++)
+	{
+		for(k = 0; k < 3; k++)
+		{
+			x[k] += p[i][k] / n;
+		}
+	}
+
+	for(i = 0; i < n; i++)
+	{
+		float ux = x[0] - p[i][0];
+		float uy = x[1] - p[i][1];
+		float uz = x[2] - p[i][2];
+		float d  = sqrtf(ux*ux + uy*uy + uz*uz);
+
+		if(d < min_dist)
+		{
+			continue;
+		}
+
+		ux /= d;
+		uy /= d;
+		uz /= d;
+
+		m00 += ux * ux; m01 += ux * uy; m02 += ux * uz;
+		m11 += uy * uy; m12 += uy * uz;
+		m22 += uz * uz;
+	}
+
+	/* trace(M^-1) is the sum of the diagonal cofactors divided by the determinant */
+	float c00 = m11 * m22 - m12 * m12;
+	float c11 = m00 * m22 - m02 * m02;
+	float c22 = m00 * m11 - m01 * m01;
+	float det = m00 * c00 - m01 * (m01 * m22 - m12 * m02) + m02 * (m01 * m12 - m11 * m02);
+
+	if(!(det > 1e-6f))
+	{
+		return INFINITY;
+	}
+
+	return sqrtf((c00 + c11 + c22) / det);
+}
+
+
+
+/* locsolve_3sphere *****************************************************************************//**
+ * @brief		Solves for the location given the distances d in m to the 3 beacons at p. The three
+ * 				spheres intersect in two points mirrored about the plane of the beacons. With u1
+ * 				along p1 - p0 and u2 along the rejection of p2 - p0 from u1, the solution on the side
+ * 				of u3 = u1 x u2 given by the sign of side is written to x. Returns false if the
+ * 				beacons are collinear or the spheres do not intersect. */
+bool locsolve_3sphere(const float (*p)[3], const float* d, float side, float* x)
+{
+	float v1[3], v2[3], u1[3], u2[3], u3[3];
+	float e = 0, f = 0, dd = 0;
+	unsigned k;
+
+	for(k = 0; k < 3; k++)
+	{
+		v1[k] = p[1][k] - p[0][k];
+		v2[k] = p[2][k] - p[0][k];
+		dd   += v1[k] * v1[k];
+	}
+
+	/* Local coordinates: p0 = (0,0,0), p1 = (dd,0,0), p2 = (e,f,0) */
+	dd = sqrtf(dd);
+
+	for(k = 0; k < 3; k++)
+	{
+		u1[k] = v1[k] / dd;
+		e    += v2[k] * u1[k];
+	}
+
+	for(k = 0; k < 3; k++)
+	{
+		u2[k] = v2[k] - e * u1[k];
+		f    += u2[k] * u2[k];
+	}
+
+	f = sqrtf(f);
+
+	for(k = 0; k < 3; k++)
+	{
+		u2[k] /= f;
+	}
+
+	u3[0] = u1[1] * u2[2] - u1[2] * u2[1];
+	u3[1] = u1[2] * u2[0] - u1[0] * u2[2];
+	u3[2] = u1[0] * u2[1] - u1[1] * u2[0];
+
+	float l = (d[0]*d[0] - d[1]*d[1] + dd*dd) / (2.0f * dd);
+	float w = (d[0]*d[0] - d[2]*d[2] - 2.0f*e*l + e*e + f*f) / (2.0f * f);
+	float h = copysignf(sqrtf(d[0]*d[0] - l*l - w*w), side);
+
+	for(k = 0; k < 3; k++)
+	{
+		x[k] = p[0][k] + l * u1[k] + w * u2[k] + h * u3[k];
+	}
+
+	return isfinite(x[0]) && isfinite(x[1]) && isfinite(x[2]);
+}
+
+
+/* locsolve_springs *****************************************************************************//**
+ * @brief		Advances the location x and velocity v by one time step of a spring model. A spring
+ * 				with the natural length d[i] pulls towards each of the n beacons at p. A constant
+ * 				attraction towards the closest lattice point g keeps the network from drifting and
+ * 				the velocity is damped. */
+void locsolve_springs(
+	const float (*p)[3],
+	const float* d,
+	unsigned     n,
+	const float* g,
+	float*       x,
+	float*       v)
+{
+	float    a[3] = { 0, 0, 0 };
+	float    ug[3];
+	float    norm = 0;
+	unsigned i, k;
+
+	for(i = 0; i < n; i++)
+	{
+		float r[3];
+		float mag = 0;
+
+		for(k = 0; k < 3; k++)
+		{
+			r[k] = x[k] - p[i][k];
+			mag += r[k] * r[k];
+		}
+
+		mag = sqrtf(mag);
+
+		if(isfinite(mag) && mag != 0)
+		{
+			for(k = 0; k < 3; k++)
+			{
+				a[k] += SPRING_KS * (d[i] * r[k] / mag - r[k]) / SPRING_M;
+			}
+		}
+	}
+
+	for(k = 0; k < 3; k++)
+	{
+		ug[k] = g[k] - x[k];
+		norm += ug[k] * ug[k];
+	}
+
+	norm = sqrtf(norm);
+
+	for(k = 0; k < 3; k++)
+	{
+		ug[k] = norm > 0 ? ug[k] / norm : 0;
+		a[k] += (SPRING_KG * ug[k] - SPRING_B * v[k]) / SPRING_M;
+		v[k] += a[k] * SPRING_DT;
+		x[k] += v[k] * SPRING_DT;
+	}
+}
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Private Functions                                                                               //
+// ----------------------------------------------------------------------------------------------- //
+/* row_weight ***********************************************************************************//**
+ * @brief		Returns the weight of a row given the standard deviations si and s0 of the terms of
+ * 				beacon i and the first beacon. The row is their difference, so its variance is the
+ * 				sum of theirs. */
+static float row_weight(float si, float s0)
+{
+	return 1.0f / sqrtf(fmaxf(si*si + s0*s0, 1e-6f));
+}
+
+
+/* tdoa_solve ***********************************************************************************//**
+ * @brief		Solves the TDOA system with the row weights w, indexed by beacon. A null w weights
+ * 				every row equally. See locsolve_tdoa. */
+static bool tdoa_solve(const float (*p)[3], const float* pr, const float* w, unsigned n,
+                       LocSolve* sol)
+{
+	float a[MAX_ROWS][3];
+	float b[MAX_ROWS][2];
+	float res[MAX_ROWS][2];
+	float roots[2];
+	unsigned num_roots = 0;
+	unsigned i, k;
+
+	for(i = 1; i < n; i++)
+	{
+		float wi    = w ? w[i] : 1.0f;
+		float delta = pr[i] - pr[0];
+
+		b[i-1][0] = delta * delta;
+		b[i-1][1] = delta * wi;
+
+		for(k = 0; k < 3; k++)
+		{
+			a[i-1][k]  = (p[0][k] - p[i][k]) * wi;
+			b[i-1][0] += (p[0][k] - p[i][k]) * (p[0][k] + p[i][k]);
+		}
+
+		b[i-1][0] *= 0.5f * wi;
+	}
+
+	if(!qr_reduce(a, b, n - 1, 2))
+	{
+		return false;
+	}
+
+	/* Rows [3, n-1) of Q'[b1 b2] are the weighted residuals once d0 is known. Save them before the
+	 * back substitution. */
+	for(i = 3; i < n - 1; i++)
+	{
+		res[i][0] = b[i][0];
+		res[i][1] = b[i][1];
+	}
+
+	qr_backsub(a, b, 2);
+
+	/* x = b1 + b2*d0 and |x - p0|^2 = d0^2 give qa*d0^2 + qb*d0 + qc = 0 */
+	float m    = b[0][0] - p[0][0];
+	float o    = b[1][0] - p[0][1];
+	float q    = b[2][0] - p[0][2];
+	float qa   = b[0][1]*b[0][1] + b[1][1]*b[1][1] + b[2][1]*b[2][1] - 1.0f;
+	float qb   = 2.0f * (m*b[0][1] + o*b[1][1] + q*b[2][1]);
+	float qc   = m*m + o*o + q*q;
+	float disc = qb*qb - 4.0f*qa*qc;
+
+	if(fabsf(qa) < 1e-6f)
+	{
+		roots[num_roots++] = -qc / qb;
+	}
+	else if(disc < 0)
+	{
+		/* Noise pushed the roots off the real axis. Take the closest approach. */
+		roots[num_roots++] = -qb / (2.0f * qa);
+	}
+	else
+	{
+		roots[num_roots++] = (-qb - sqrtf(disc)) / (2.0f * qa);
+		roots[num_roots++] = (-qb + sqrtf(disc)) / (2.0f * qa);
+	}
+
+	float d0   = -1.0f;
+	float best = INFINITY;
+
+	for(k = 0; k < num_roots; k++)
+	{
+		float chi2 = 0;
+
+		if(!(roots[k] >= 0))
+		{
+			continue;
+		}
+
+		for(i = 3; i < n - 1; i++)
+		{
+			float r = res[i][0] + res[i][1] * roots[k];
+			chi2 += r * r;
+		}
+
+		if(chi2 < best || (chi2 == best && roots[k] < d0))
+		{
+			best = chi2;
+			d0   = roots[k];
+		}
+	}
+
+	if(d0 < 0)
+	{
+		return false;
+	}
+
+	sol->x     = b[0][0] + b[0][1] * d0;
+	sol->y     = b[1][0] + b[1][1] * d0;
+	sol->z     = b[2][0] + b[2][1] * d0;
+	sol->chi2  = best;
+	sol->sigma = wls_sigma(a, best, n - 1, w != NULL);
+
+	return isfinite(sol->x) && isfinite(sol->y) && isfinite(sol->z);
+}
+
+
+/* qr_reduce ************************************************************************************//**
+ * @brief		Reduces the rows x 3 matrix a to its upper triangular R factor with Householder
+ * 				reflections and applies the same reflections to the cols columns of b, i.e. b becomes
+ * 				Q'b. Returns false if a does not have full rank, e.g. for coplanar beacons. */
+static bool qr_reduce(float (*a)[3], float (*b)[2], unsigned rows, unsigned cols)
+{
+	unsigned i, j, k;
+
+	for(k = 0; k < 3; k++)
+	{
+		float norm = 0;
+
+		for(i = k; i < rows; i++)
+		{
+			norm += a[i][k] * a[i][k];
+		}
+
+		norm = sqrtf(norm);
+
+		if(!(norm > 1e-6f))
+		{
+			return false;
+		}
+
+		/* v = a[k:][k] - alpha * e1, with the sign of alpha chosen to avoid cancellation */
+		float alpha = a[k][k] > 0 ? -norm : norm;
+		float vnorm;
+
+		a[k][k] -= alpha;
+		vnorm    = -alpha * a[k][k];	/* v'v / 2 */
+
+		for(j = k + 1; j < 3; j++)
+		{
+			float dot = 0;
+
+			for(i = k; i < rows; i++)
+			{
+				dot += a[i][k] * a[i][j];
+			}
+
+			for(i = k; i < rows; i++)
+			{
+				a[i][j] -= a[i][k] * dot / vnorm;
+			}
+		}
+
+		for(j = 0; j < cols; j++)
+		{
+			float dot = 0;
+
+			for(i = k; i < rows; i++)
+			{
+				dot += a[i][k] * b[i][j];
+			}
+
+			for(i = k; i < rows; i++)
+			{
+				b[i][j] -= a[i][k] * dot / vnorm;
+			}
+		}
+
+		a[k][k] = alpha;
+
+		for(i = k + 1; i < rows; i++)
+		{
+			a[i][k] = 0;
+		}
+	}
+
+	return true;
+}
+
+
+/* qr_backsub ***********************************************************************************//**
+ * @brief		Solves R * x = Q'b in place. The solution replaces the first 3 rows of b. */
+static void qr_backsub(float (*a)[3], float (*b)[2], unsigned cols)
+{
+	unsigned j;
+	int      i, k;
+
+	for(j = 0; j < cols; j++)
+	{
+		for(i = 2; i >= 0; i--)
+		{
+			for(k = i + 1; k < 3; k++)
+			{
+				b[i][j] -= a[i][k] * b[k][j];
+			}
+
+			b[i][j] /= a[i][i];
+		}
+	}
+}
+
+
+/* wls_sigma ************************************************************************************//**
+ * @brief		Returns the estimated standard deviation in m of a least squares solution. r is the
+ * 				3x3 upper triangular R factor of the system, chi2 is the sum of squared residuals and
+ * 				rows is the number of equations. The covariance of the solution is:
+ *
+ * 					cov = s^2 * (R' * R)^-1 = s^2 * R^-1 * R^-1'
+ *
+ * 				where s^2 = chi2 / (rows - 3). Weighted systems are whitened, so s^2 is at least 1
+ * 				and only inflates the covariance when the residuals are larger than the assumed range
+ * 				deviations. The returned value is sqrt(trace(cov)) = s * ||R^-1||_F. */
+static float wls_sigma(float (*r)[3], float chi2, unsigned rows, bool weighted)
+{
+	float i00 = 1.0f / r[0][0];
+	float i11 = 1.0f / r[1][1];
+	float i22 = 1.0f / r[2][2];
+	float i01 = -r[0][1] * i00 * i11;
+	float i12 = -r[1][2] * i11 * i22;
+	float i02 = (r[0][1] * r[1][2] - r[0][2] * r[1][1]) * i00 * i11 * i22;
+
+	float frob = i00*i00 + i11*i11 + i22*i22 + i01*i01 + i12*i12 + i02*i02;
+	float s2   = rows > 3 ? chi2 / (rows - 3) : 0;
+
+	if(weighted)
+	{
+		s2 = fmaxf(1.0f, s2);
+	}
+
+	return sqrtf(frob * s2);
+}
+
+
+/******************************************* END OF FILE *******************************************/
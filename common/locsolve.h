@@ -0,0 +1,62 @@
+/************************************************************************************************//**
+ * @file		locsolve.h
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ * @brief		Weighted least squares TOA and TDOA solvers, the 3 sphere intersection, the spring
+ * 				model and the PDOP of a beacon set used by location.c. Kept free of Zephyr and
+ * 				mistlib so that their accuracy and speed can be measured on the host with synthetic
+ * 				geometries.
+ *
+ ***************************************************************************************************/
+#ifndef LOCSOLVE_H
+#define LOCSOLVE_H
+
+#if __STDC_VERSION__ < 199901L
+#error Compile with C99 or higher!
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Public Includes ------------------------------------------------------------------------------- */
+#include <stdbool.h>
+
+
+/* Public Macros --------------------------------------------------------------------------------- */
+#define LOCSOLVE_MAX_BEACONS    (8)
+
+
+/* Public Types ---------------------------------------------------------------------------------- */
+typedef struct {
+	float x, y, z;
+	float sigma;        /* Estimated standard deviation of the solution in m */
+	float chi2;         /* Weighted sum of squared residuals */
+} LocSolve;
+
+
+/* Public Functions ------------------------------------------------------------------------------ */
+bool  locsolve_toa    (const float (*)[3], const float*, const float*, unsigned, LocSolve*);
+bool  locsolve_tdoa   (const float (*)[3], const float*, const float*, unsigned, LocSolve*);
+float locsolve_pdop   (const float (*)[3], unsigned, float);
+bool  locsolve_3sphere(const float (*)[3], const float*, float, float*);
+void  locsolve_springs(const float (*)[3], const float*, unsigned, const float*, float*, float*);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LOCSOLVE_H
+/******************************************* END OF FILE *******************************************/
@@ -0,0 +1,54 @@
+/************************************************************************************************//**
+ * @file		prng.c
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ ***************************************************************************************************/
+#include <random/rand32.h>
+
+#include "prng.h"
+
+
+/* Inline Function Instances --------------------------------------------------------------------- */
+extern uint32_t prng_next     (Prng*);
+extern uint32_t prng_range    (Prng*, uint32_t);
+extern float    prng_float    (Prng*);
+extern uint32_t prng_threshold(float);
+extern bool     prng_chance   (Prng*, uint32_t);
+
+
+/* prng_init ************************************************************************************//**
+ * @brief		Seeds a generator from the hardware RNG. Both the state and the stream are random so
+ * 				that generators on different nodes, and different generators on the same node, produce
+ * 				independent sequences. */
+void prng_init(Prng* p)
+{
+	uint64_t seed[2];
+
+	sys_rand_get(seed, sizeof(seed));
+	prng_seed(p, seed[0], seed[1]);
+}
+
+
+/* prng_seed ************************************************************************************//**
+ * @brief		Seeds a generator with an initial state and a stream selector. */
+void prng_seed(Prng* p, uint64_t state, uint64_t stream)
+{
+	p->state = 0;
+	p->inc   = (stream << 1u) | 1u;
+	prng_next(p);
+	p->state += state;
+	prng_next(p);
+}
+
+
+/******************************************* END OF FILE *******************************************/
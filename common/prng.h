@@ -0,0 +1,122 @@
+/************************************************************************************************//**
+ * @file		prng.h
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ * @brief		PCG32 pseudo random number generator (XSH RR variant). Each user owns a generator so
+ * 				that drawing a number is reentrant and never touches the shared libc rand() state.
+ * 				Generators are seeded from the hardware RNG so nodes running identical firmware do not
+ * 				produce identical sequences.
+ *
+ ***************************************************************************************************/
+#ifndef PRNG_H
+#define PRNG_H
+
+#if __STDC_VERSION__ < 199901L
+#error Compile with C99 or higher!
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Includes -------------------------------------------------------------------------------------- */
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/* Public Macros --------------------------------------------------------------------------------- */
+#define PRNG_MULTIPLIER (6364136223846793005ull)
+
+
+/* Public Types ---------------------------------------------------------------------------------- */
+typedef struct {
+	uint64_t state;
+	uint64_t inc;    /* Stream selector. Must be odd */
+} Prng;
+
+
+/* Public Functions ------------------------------------------------------------------------------ */
+       void     prng_init     (Prng*);
+       void     prng_seed     (Prng*, uint64_t, uint64_t);
+inline uint32_t prng_next     (Prng*);
+inline uint32_t prng_range    (Prng*, uint32_t);
+inline float    prng_float    (Prng*);
+inline uint32_t prng_threshold(float);
+inline bool     prng_chance   (Prng*, uint32_t);
+
+
+/* prng_next ************************************************************************************//**
+ * @brief		Returns the next 32 bit random number. */
+inline uint32_t prng_next(Prng* p)
+{
+	uint64_t old = p->state;
+
+	p->state = old * PRNG_MULTIPLIER + p->inc;
+
+	uint32_t xorshifted = ((old >> 18u) ^ old) >> 27u;
+	uint32_t rot        = old >> 59u;
+
+	return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
+
+
+/* prng_range ***********************************************************************************//**
+ * @brief		Returns a random number in [0, n). Uses a multiply and shift rather than a modulo. The
+ * 				bias is at most n / 2^32 which is negligible for the small ranges used here. */
+inline uint32_t prng_range(Prng* p, uint32_t n)
+{
+	return ((uint64_t)prng_next(p) * n) >> 32;
+}
+
+
+/* prng_float ***********************************************************************************//**
+ * @brief		Returns a random float in [0, 1). */
+inline float prng_float(Prng* p)
+{
+	return (prng_next(p) >> 8) * (1.0f / 16777216.0f);
+}
+
+
+/* prng_threshold *******************************************************************************//**
+ * @brief		Converts a probability into a threshold for prng_chance. Probabilities that are known
+ * 				at compile time fold into constants. */
+inline uint32_t prng_threshold(float probability)
+{
+	if(probability >= 1.0f)
+	{
+		return UINT32_MAX;
+	}
+	else if(probability <= 0.0f)
+	{
+		return 0;
+	}
+
+	return (uint32_t)(probability * 4294967296.0f);
+}
+
+
+/* prng_chance **********************************************************************************//**
+ * @brief		Returns true with the probability encoded in threshold. */
+inline bool prng_chance(Prng* p, uint32_t threshold)
+{
+	return prng_next(p) < threshold;
+}
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PRNG_H
+/******************************************* END OF FILE *******************************************/
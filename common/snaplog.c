@@ -0,0 +1,436 @@
+/************************************************************************************************//**
+ * @file		snaplog.c
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ ***************************************************************************************************/
+#include <errno.h>
+#include <string.h>
+#include <sys/crc.h>
+#include <toolchain.h>
+
+#include "snaplog.h"
+
+
+/* Private Macros -------------------------------------------------------------------------------- */
+#define SNAP_MAGIC                  (0x50414E53)	/* "SNAP" */
+#define SNAP_ERASED                 (0xFFFFFFFF)
+#define SNAP_CHUNK_SIZE             (64)
+
+
+/* Private Types --------------------------------------------------------------------------------- */
+/* Header of a record in the snapshot log. The CRC covers version, length, seq and the data. */
+typedef struct __packed {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t length;
+	uint32_t seq;
+	uint32_t crc;
+} SnapHeader;
+
+
+/* Private Functions ----------------------------------------------------------------------------- */
+static int      snap_log_crc     (SnapLog*, uint32_t, const SnapHeader*, uint32_t*);
+static bool     snap_log_valid   (SnapLog*, uint32_t, SnapHeader*);
+static uint32_t snap_log_advance (SnapLog*, uint32_t);
+static uint32_t snap_log_spare   (SnapLog*);
+static int      snap_log_program (SnapLog*, uint32_t, const SnapHeader*, const void*);
+
+static int      snap_ram_read    (const SnapStore*, uint32_t, void*, size_t);
+static int      snap_ram_write   (const SnapStore*, uint32_t, const void*, size_t);
+static int      snap_ram_erase   (const SnapStore*, uint32_t, size_t);
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Snapshot Log                                                                                    //
+// ----------------------------------------------------------------------------------------------- //
+/* snap_log_init ********************************************************************************//**
+ * @brief		Initializes a snapshot log on the store and finds the latest valid record. The store
+ * 				needs at least two pages so that one of them can be kept erased.
+ * @param[in]	version: version of the record data. Records with other versions are ignored.
+ * @param[in]	length: length in bytes of the record data. */
+int snap_log_init(SnapLog* log, const SnapStore* store, uint16_t version, uint16_t length)
+{
+	SnapHeader hdr;
+
+	log->store        = store;
+	log->version      = version;
+	log->length       = length;
+	log->record_size  = (sizeof(SnapHeader) + length + 3) & ~3u;
+	log->latest       = 0;
+	log->next         = 0;
+	log->seq          = 0;
+	log->found        = false;
+	log->spare_erased = false;
+
+	if(store->num_pages < 2 || log->record_size > store->page_size)
+	{
+		return -EINVAL;
+	}
+
+	unsigned p, i;
+	unsigned per_page = store->page_size / log->record_size;
+
+	for(p = 0; p < store->num_pages; p++)
+	{
+		for(i = 0; i < per_page; i++)
+		{
+			uint32_t off = p * store->page_size + i * log->record_size;
+
+			if(store->read(store, off, &hdr, sizeof(hdr)) < 0 || hdr.magic == SNAP_ERASED)
+			{
+				break;
+			}
+
+			if(snap_log_valid(log, off, &hdr) && (!log->found || (int32_t)(hdr.seq - log->seq) > 0))
+			{
+				log->found  = true;
+				log->latest = off;
+				log->seq    = hdr.seq;
+			}
+		}
+	}
+
+	if(log->found)
+	{
+		log->next = snap_log_advance(log, log->latest);
+	}
+
+	return 0;
+}
+
+
+/* snap_log_read ********************************************************************************//**
+ * @brief		Reads the data of the latest record. Returns -ENOENT if the log is empty. */
+int snap_log_read(SnapLog* log, void* data)
+{
+	if(!log->found)
+	{
+		return -ENOENT;
+	}
+
+	return log->store->read(log->store, log->latest + sizeof(SnapHeader), data, log->length);
+}
+
+
+/* snap_log_write *******************************************************************************//**
+ * @brief		Appends a record to the log. If the next record's location was not left erased, for
+ * 				example because of a reset during a write, the log skips to the spare page. Returns
+ * 				-EAGAIN without writing if the log has to move onto the spare page and the spare page
+ * 				has not been erased. */
+int snap_log_write(SnapLog* log, const void* data)
+{
+	const SnapStore* store = log->store;
+
+	SnapHeader hdr;
+	uint32_t   off = log->next;
+	int        r;
+
+	if(off % store->page_size != 0)
+	{
+		r = store->read(store, off, &hdr, sizeof(hdr));
+
+		if(r < 0)
+		{
+			return r;
+		}
+
+		if(hdr.magic != SNAP_ERASED)
+		{
+			off = snap_log_spare(log);
+		}
+	}
+
+	if(off % store->page_size == 0 && !snap_log_spare_erased(log))
+	{
+		return -EAGAIN;
+	}
+
+	hdr.magic   = SNAP_MAGIC;
+	hdr.version = log->version;
+	hdr.length  = log->length;
+	hdr.seq     = log->seq + 1;
+	hdr.crc     = crc32_ieee_update(
+		crc32_ieee((const uint8_t*)&hdr.version, 8), data, log->length);
+
+	r = snap_log_program(log, off, &hdr, data);
+
+	if(off % store->page_size == 0)
+	{
+		log->spare_erased = false;
+	}
+
+	if(r < 0)
+	{
+		return r;
+	}
+
+	log->found  = true;
+	log->latest = off;
+	log->seq    = hdr.seq;
+	log->next   = snap_log_advance(log, off);
+	return 0;
+}
+
+
+/* snap_log_spare_erased ************************************************************************//**
+ * @brief		Returns true if the spare page is erased. The page is only read the first time after
+ * 				the log moves onto a new page. */
+bool snap_log_spare_erased(SnapLog* log)
+{
+	const SnapStore* store = log->store;
+
+	uint32_t chunk[SNAP_CHUNK_SIZE / 4];
+	uint32_t off = snap_log_spare(log);
+	uint32_t pos;
+	unsigned i;
+
+	if(log->spare_erased)
+	{
+		return true;
+	}
+
+	for(pos = 0; pos < store->page_size; pos += sizeof(chunk))
+	{
+		if(store->read(store, off + pos, chunk, sizeof(chunk)) < 0)
+		{
+			return false;
+		}
+
+		for(i = 0; i < sizeof(chunk) / 4; i++)
+		{
+			if(chunk[i] != SNAP_ERASED)
+			{
+				return false;
+			}
+		}
+	}
+
+	log->spare_erased = true;
+	return true;
+}
+
+
+/* snap_log_erase_spare *************************************************************************//**
+ * @brief		Erases the spare page. Erasing flash stalls the CPU so the caller must pick a time when
+ * 				that is harmless. */
+int snap_log_erase_spare(SnapLog* log)
+{
+	const SnapStore* store = log->store;
+
+	int r = store->erase(store, snap_log_spare(log), store->page_size);
+
+	if(r < 0)
+	{
+		return r;
+	}
+
+	log->spare_erased = true;
+	return 0;
+}
+
+
+/* snap_log_crc *********************************************************************************//**
+ * @brief		Computes the CRC of the record at off. */
+static int snap_log_crc(SnapLog* log, uint32_t off, const SnapHeader* hdr, uint32_t* crc)
+{
+	uint8_t  chunk[SNAP_CHUNK_SIZE];
+	uint32_t pos;
+	int      r;
+
+	*crc = crc32_ieee((const uint8_t*)&hdr->version, 8);
+
+	for(pos = 0; pos < hdr->length; pos += sizeof(chunk))
+	{
+		uint32_t len = hdr->length - pos < sizeof(chunk) ? hdr->length - pos : sizeof(chunk);
+
+		r = log->store->read(log->store, off + sizeof(SnapHeader) + pos, chunk, len);
+
+		if(r < 0)
+		{
+			return r;
+		}
+
+		*crc = crc32_ieee_update(*crc, chunk, len);
+	}
+
+	return 0;
+}
+
+
+/* snap_log_valid *******************************************************************************//**
+ * @brief		Returns true if the record at off is a complete record of this log's version. */
+static bool snap_log_valid(SnapLog* log, uint32_t off, SnapHeader* hdr)
+{
+	uint32_t crc;
+
+	return hdr->magic   == SNAP_MAGIC   &&
+	       hdr->version == log->version &&
+	       hdr->length  == log->length  &&
+	       snap_log_crc(log, off, hdr, &crc) == 0 && crc == hdr->crc;
+}
+
+
+/* snap_log_advance *****************************************************************************//**
+ * @brief		Returns the offset of the record after the record at off. Moves onto the start of the
+ * 				next page, wrapping around the store, if the record doesn't fit in the current page. */
+static uint32_t snap_log_advance(SnapLog* log, uint32_t off)
+{
+	const SnapStore* store = log->store;
+
+	uint32_t page = off / store->page_size;
+	uint32_t next = off - page * store->page_size + log->record_size;
+
+	if(next + log->record_size > store->page_size)
+	{
+		return ((page + 1) % store->num_pages) * store->page_size;
+	}
+	else
+	{
+		return off + log->record_size;
+	}
+}
+
+
+/* snap_log_spare *******************************************************************************//**
+ * @brief		Returns the offset of the spare page. This is the page the next record starts if the
+ * 				next record starts a page. Otherwise, it is the page after the current page. */
+static uint32_t snap_log_spare(SnapLog* log)
+{
+	const SnapStore* store = log->store;
+
+	if(log->next % store->page_size == 0)
+	{
+		return log->next;
+	}
+	else
+	{
+		return ((log->next / store->page_size + 1) % store->num_pages) * store->page_size;
+	}
+}
+
+
+/* snap_log_program *****************************************************************************//**
+ * @brief		Writes a record's header and data to off. The record is written in 4 byte aligned
+ * 				chunks and the last chunk is padded with 0xFF. */
+static int snap_log_program(SnapLog* log, uint32_t off, const SnapHeader* hdr, const void* data)
+{
+	uint8_t  chunk[SNAP_CHUNK_SIZE];
+	uint32_t total = sizeof(SnapHeader) + log->length;
+	uint32_t pos;
+	int      r;
+
+	for(pos = 0; pos < total; pos += sizeof(chunk))
+	{
+		uint32_t len = total - pos < sizeof(chunk) ? total - pos : sizeof(chunk);
+		uint32_t i;
+
+		memset(chunk, 0xFF, sizeof(chunk));
+
+		for(i = 0; i < len; i++)
+		{
+			uint32_t j = pos + i;
+			chunk[i] = j < sizeof(SnapHeader) ?
+				((const uint8_t*)hdr)[j] : ((const uint8_t*)data)[j - sizeof(SnapHeader)];
+		}
+
+		r = log->store->write(log->store, off + pos, chunk, (len + 3) & ~3u);
+
+		if(r < 0)
+		{
+			return r;
+		}
+	}
+
+	return 0;
+}
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// RAM Store                                                                                       //
+// ----------------------------------------------------------------------------------------------- //
+/* snap_ram_store *******************************************************************************//**
+ * @brief		Initializes a store backed by num_pages * page_size bytes of memory. Writes behave like
+ * 				NOR flash and can only clear bits so that interrupted or repeated writes look the same
+ * 				as they would on flash. The memory is not erased. */
+int snap_ram_store(SnapStore* store, uint8_t* mem, uint32_t page_size, uint32_t num_pages)
+{
+	if(page_size == 0 || page_size % 4 != 0)
+	{
+		return -EINVAL;
+	}
+
+	store->read      = snap_ram_read;
+	store->write     = snap_ram_write;
+	store->erase     = snap_ram_erase;
+	store->page_size = page_size;
+	store->num_pages = num_pages;
+	store->ctx       = mem;
+	return 0;
+}
+
+
+/* snap_ram_read ********************************************************************************//**
+ * @brief		*/
+static int snap_ram_read(const SnapStore* store, uint32_t off, void* data, size_t len)
+{
+	if(off + len > store->page_size * store->num_pages)
+	{
+		return -EINVAL;
+	}
+
+	memcpy(data, (const uint8_t*)store->ctx + off, len);
+	return 0;
+}
+
+
+/* snap_ram_write *******************************************************************************//**
+ * @brief		*/
+static int snap_ram_write(const SnapStore* store, uint32_t off, const void* data, size_t len)
+{
+	uint8_t* mem = (uint8_t*)store->ctx;
+	size_t   i;
+
+	if(off + len > store->page_size * store->num_pages || off % 4 != 0 || len % 4 != 0)
+	{
+		return -EINVAL;
+	}
+
+	for(i = 0; i < len; i++)
+	{
+		mem[off + i] &= ((const uint8_t*)data)[i];
+	}
+
+	return 0;
+}
+
+
+/* snap_ram_erase *******************************************************************************//**
+ * @brief		*/
+static int snap_ram_erase(const SnapStore* store, uint32_t off, size_t len)
+{
+	if(off + len > store->page_size * store->num_pages || off % store->page_size != 0 ||
+	   len % store->page_size != 0)
+	{
+		return -EINVAL;
+	}
+
+	memset((uint8_t*)store->ctx + off, 0xFF, len);
+	return 0;
+}
+
+
+/******************************************* END OF FILE *******************************************/
@@ -0,0 +1,83 @@
+/************************************************************************************************//**
+ * @file		snaplog.h
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ ***************************************************************************************************/
+#ifndef SNAPLOG_H
+#define SNAPLOG_H
+
+#if __STDC_VERSION__ < 199901L
+#error Compile with C99 or higher!
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Includes -------------------------------------------------------------------------------------- */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/* Public Types ---------------------------------------------------------------------------------- */
+/* Storage backend. The storage is divided into num_pages erasable pages of page_size bytes. Offsets
+ * are relative to the start of the storage. Erased storage reads as 0xFF. Writes must be multiples
+ * of 4 bytes. Each function returns 0 on success or a negative errno. */
+typedef struct SnapStore SnapStore;
+
+struct SnapStore {
+	int (*read) (const SnapStore*, uint32_t, void*, size_t);
+	int (*write)(const SnapStore*, uint32_t, const void*, size_t);
+	int (*erase)(const SnapStore*, uint32_t, size_t);
+	uint32_t page_size;
+	uint32_t num_pages;
+	const void* ctx;
+};
+
+
+/* A log of fixed size records. Records are appended to the current page and move onto the next page
+ * when the current page is full so that erases are spread across every page of the store. The
+ * latest record is the valid record with the largest sequence number. Writes never erase. The page
+ * the log moves onto next, the spare page, must be erased beforehand with snap_log_erase_spare so
+ * that the caller decides when the erase stalls the CPU. */
+typedef struct {
+	const SnapStore* store;
+	uint16_t version;       /* Records with a different version are ignored */
+	uint16_t length;        /* Length of a record's data in bytes */
+	uint32_t record_size;   /* Size of a record including its header, rounded up to 4 bytes */
+	uint32_t latest;        /* Offset of the latest record */
+	uint32_t next;          /* Offset the next record is written to */
+	uint32_t seq;           /* Sequence number of the latest record */
+	bool     found;         /* True if the store holds a valid record */
+	bool     spare_erased;  /* True if the spare page is known to be erased */
+} SnapLog;
+
+
+/* Public Functions ------------------------------------------------------------------------------ */
+int  snap_log_init        (SnapLog*, const SnapStore*, uint16_t, uint16_t);
+int  snap_log_read        (SnapLog*, void*);
+int  snap_log_write       (SnapLog*, const void*);
+bool snap_log_spare_erased(SnapLog*);
+int  snap_log_erase_spare (SnapLog*);
+
+int  snap_ram_store(SnapStore*, uint8_t*, uint32_t, uint32_t);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SNAPLOG_H
+/******************************************* END OF FILE *******************************************/
@@ -0,0 +1,386 @@
+/************************************************************************************************//**
+ * @file		snapshot.c
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ ***************************************************************************************************/
+#include "logging/log.h"
+LOG_MODULE_REGISTER(snapshot, LOG_LEVEL_INF);
+
+#include <drivers/flash.h>
+#include <errno.h>
+#include <math.h>
+#include <storage/flash_map.h>
+#include <string.h>
+#include <zephyr.h>
+
+#include "calc.h"
+#include "hyperspace.h"
+#include "location.h"
+#include "snapshot.h"
+#include "timeslot.h"
+#include "tsch.h"
+
+
+/* Private Macros -------------------------------------------------------------------------------- */
+#define SNAP_VERSION                (2)				/* Increment when NodeSnapshot changes */
+#define SNAP_FLASH_PAGE_SIZE        (4096)			/* nRF52832 flash page size */
+
+#define SNAP_SAVE_PERIOD_MS         (15*60*1000)	/* Save if the location moved */
+#define SNAP_REFRESH_PERIOD_MS      (60*60*1000)	/* Save even if nothing changed */
+#define SNAP_MAX_AGE_SLOTS          (75*60*400)		/* 75 min of 2.5 ms timeslots */
+#define SNAP_MOVED_DIST             (0.5f)			/* Distance in m that counts as moved */
+
+/* Flash operations stall the CPU so they wait for a gap between active timeslots that is long enough
+ * for the worst case nRF52832 page erase or word write times. */
+#define SNAP_ERASE_US               (85000)
+#define SNAP_WRITE_WORD_US          (41)
+#define SNAP_RETRY_MS               (20)			/* Time between checks for a long enough gap */
+
+
+/* Private Types --------------------------------------------------------------------------------- */
+typedef struct {
+	uint64_t      asn;      /* ASN when the snapshot was taken */
+	TschSnapshot  tsch;
+	LocSnapshot   loc;
+	HyperSnapshot hyper;
+} NodeSnapshot;
+
+
+typedef struct {
+	SnapStore    store;
+	SnapLog      log;
+	NodeSnapshot data;      /* Snapshot loaded on boot or being saved */
+	bool         ready;     /* True if the store was opened */
+	bool         pending;   /* True if data holds a loaded snapshot that has not been restored */
+	Vec3         saved_loc; /* Location in the latest saved snapshot */
+	uint8_t      saved_seq; /* Hyperspace coordinate sequence number in the latest saved snapshot */
+	int64_t      saved_at;  /* Uptime in ms of the latest save */
+	struct k_mutex mutex;
+	struct k_work_delayable save_work;
+	struct k_work_delayable erase_work;
+	struct k_work  save_now_work;
+	struct k_sem   save_now_done;
+} Snap;
+
+
+/* Private Functions ----------------------------------------------------------------------------- */
+static int      snap_flash_read     (const SnapStore*, uint32_t, void*, size_t);
+static int      snap_flash_write    (const SnapStore*, uint32_t, const void*, size_t);
+static int      snap_flash_erase    (const SnapStore*, uint32_t, size_t);
+
+static int      snap_write          (bool);
+static void     snap_handle_save    (struct k_work*);
+static void     snap_handle_save_now(struct k_work*);
+static void     snap_handle_erase   (struct k_work*);
+
+
+/* Private Variables ----------------------------------------------------------------------------- */
+static Snap snap;
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Flash Store                                                                                     //
+// ----------------------------------------------------------------------------------------------- //
+/* snap_flash_store *****************************************************************************//**
+ * @brief		Initializes a store backed by the flash area with the specified id. */
+int snap_flash_store(SnapStore* store, uint8_t id)
+{
+	const struct flash_area* fa;
+
+	int r = flash_area_open(id, &fa);
+
+	if(r < 0)
+	{
+		return r;
+	}
+
+	store->read      = snap_flash_read;
+	store->write     = snap_flash_write;
+	store->erase     = snap_flash_erase;
+	store->page_size = SNAP_FLASH_PAGE_SIZE;
+	store->num_pages = fa->fa_size / SNAP_FLASH_PAGE_SIZE;
+	store->ctx       = fa;
+	return 0;
+}
+
+
+/* snap_flash_read ******************************************************************************//**
+ * @brief		*/
+static int snap_flash_read(const SnapStore* store, uint32_t off, void* data, size_t len)
+{
+	return flash_area_read(store->ctx, off, data, len);
+}
+
+
+/* snap_flash_write *****************************************************************************//**
+ * @brief		*/
+static int snap_flash_write(const SnapStore* store, uint32_t off, const void* data, size_t len)
+{
+	return flash_area_write(store->ctx, off, data, len);
+}
+
+
+/* snap_flash_erase *****************************************************************************//**
+ * @brief		*/
+static int snap_flash_erase(const SnapStore* store, uint32_t off, size_t len)
+{
+	return flash_area_erase(store->ctx, off, len);
+}
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Node Snapshot                                                                                   //
+// ----------------------------------------------------------------------------------------------- //
+/* snap_init ************************************************************************************//**
+ * @brief		Opens the snapshot store and loads the latest snapshot. Only the network timing is
+ * 				restored immediately to speed up scanning. The rest of the snapshot isn't restored
+ * 				until this node synchronizes to a network since only the network's ASN tells whether
+ * 				the snapshot is stale. Must be called after tsch_init. */
+void snap_init(void)
+{
+	int r;
+
+	k_mutex_init(&snap.mutex);
+	k_work_init_delayable(&snap.save_work,  snap_handle_save);
+	k_work_init_delayable(&snap.erase_work, snap_handle_erase);
+	k_work_init(&snap.save_now_work, snap_handle_save_now);
+	k_sem_init(&snap.save_now_done, 0, 1);
+
+	snap.ready     = false;
+	snap.pending   = false;
+	snap.saved_loc = make_vec3(NAN, NAN, NAN);
+	snap.saved_seq = 0;
+	snap.saved_at  = 0;
+
+	r = snap_flash_store(&snap.store, FLASH_AREA_ID(storage));
+
+	if(r < 0)
+	{
+		LOG_ERR("could not open storage: %d", r);
+		return;
+	}
+
+	r = snap_log_init(&snap.log, &snap.store, SNAP_VERSION, sizeof(NodeSnapshot));
+
+	if(r < 0)
+	{
+		LOG_ERR("could not init snapshot log: %d", r);
+		return;
+	}
+
+	snap.ready   = true;
+	snap.pending = snap_log_read(&snap.log, &snap.data) == 0;
+
+	if(snap.pending)
+	{
+		LOG_INF("loaded snapshot %u. asn = %u", snap.log.seq, (uint32_t)snap.data.asn);
+		tsch_restore(&snap.data.tsch, snap.data.asn);
+	}
+
+	k_work_schedule(&snap.save_work,  K_MSEC(SNAP_SAVE_PERIOD_MS));
+	k_work_schedule(&snap.erase_work, K_NO_WAIT);
+}
+
+
+/* snap_restore *********************************************************************************//**
+ * @brief		Restores the snapshot loaded on boot. Must be called when this node synchronizes to a
+ * 				network and before location services are started. The snapshot is discarded if the
+ * 				network's ASN shows that it is older than SNAP_MAX_AGE_SLOTS or that the network
+ * 				restarted since the snapshot was taken. */
+void snap_restore(uint64_t asn)
+{
+	k_mutex_lock(&snap.mutex, K_FOREVER);
+
+	if(!snap.pending)
+	{
+		goto done;
+	}
+
+	snap.pending = false;
+
+	if(asn < snap.data.asn || asn - snap.data.asn > SNAP_MAX_AGE_SLOTS)
+	{
+		LOG_INF("stale snapshot. asn = %u. now = %u", (uint32_t)snap.data.asn, (uint32_t)asn);
+		goto done;
+	}
+
+	hyperspace_restore(&snap.data.hyper);
+
+	if(loc_restore(&snap.data.loc))
+	{
+		snap.saved_loc = snap.data.loc.loc;
+		snap.saved_seq = snap.data.hyper.coord_seq;
+		LOG_INF("restored snapshot %u", snap.log.seq);
+	}
+
+	done:
+		k_mutex_unlock(&snap.mutex);
+}
+
+
+/* snap_save ************************************************************************************//**
+ * @brief		Saves a snapshot now. Intended to be called before a planned reboot so the flash is
+ * 				written and, if needed, erased without waiting for a gap between timeslots. The
+ * 				snapshot is taken on the system work queue, which owns the location neighbors, and
+ * 				this waits until it is saved. */
+void snap_save(void)
+{
+	if(k_current_get() == k_work_queue_thread_get(&k_sys_work_q))
+	{
+		snap_write(true);
+		return;
+	}
+
+	k_work_submit(&snap.save_now_work);
+	k_sem_take(&snap.save_now_done, K_FOREVER);
+}
+
+
+/* snap_write ***********************************************************************************//**
+ * @brief		Saves a snapshot of this node's location, neighbors, hyperspace coordinate and routes.
+ * 				Nothing is saved if this node has no location or if the snapshot loaded on boot has
+ * 				not been restored yet. Unless forced, a snapshot is only saved if the location or
+ * 				coordinate changed or the latest snapshot needs refreshing, and only in a gap between
+ * 				timeslots. Returns -EBUSY if the save has to wait for a gap. */
+static int snap_write(bool force)
+{
+	int r = 0;
+
+	if(!snap.ready)
+	{
+		return 0;
+	}
+
+	k_mutex_lock(&snap.mutex, K_FOREVER);
+
+	if(snap.pending)
+	{
+		goto done;
+	}
+
+	tsch_snapshot      (&snap.data.tsch, force);
+	loc_snapshot       (&snap.data.loc);
+	hyperspace_snapshot(&snap.data.hyper);
+	snap.data.asn = ts_asn_now();
+
+	if(!vec3_is_finite(&snap.data.loc.loc))
+	{
+		goto done;
+	}
+
+	bool changed = !vec3_is_finite(&snap.saved_loc) ||
+	               vec3_dist(snap.saved_loc, snap.data.loc.loc) > SNAP_MOVED_DIST ||
+	               snap.saved_seq != snap.data.hyper.coord_seq ||
+	               k_uptime_get() - snap.saved_at >= SNAP_REFRESH_PERIOD_MS;
+
+	if(!force && !changed)
+	{
+		goto done;
+	}
+
+	if(!force && ts_idle_us() < snap.log.record_size / 4 * SNAP_WRITE_WORD_US)
+	{
+		r = -EBUSY;
+		goto done;
+	}
+
+	r = snap_log_write(&snap.log, &snap.data);
+
+	if(r == -EAGAIN && force && snap_log_erase_spare(&snap.log) == 0)
+	{
+		r = snap_log_write(&snap.log, &snap.data);
+	}
+
+	if(r < 0)
+	{
+		LOG_ERR("could not save snapshot: %d", r);
+		goto done;
+	}
+
+	snap.saved_loc = snap.data.loc.loc;
+	snap.saved_seq = snap.data.hyper.coord_seq;
+	snap.saved_at  = k_uptime_get();
+	LOG_INF("saved snapshot %u", snap.log.seq);
+
+	done:
+		k_mutex_unlock(&snap.mutex);
+		return r;
+}
+
+
+/* snap_handle_save *****************************************************************************//**
+ * @brief		Work item which periodically saves a snapshot. Keeps the spare page erased after
+ * 				each save so the next save never has to erase. */
+static void snap_handle_save(struct k_work* work)
+{
+	if(snap_write(false) == -EBUSY)
+	{
+		k_work_schedule(&snap.save_work, K_MSEC(SNAP_RETRY_MS));
+	}
+	else
+	{
+		k_work_schedule(&snap.save_work,  K_MSEC(SNAP_SAVE_PERIOD_MS));
+		k_work_schedule(&snap.erase_work, K_NO_WAIT);
+	}
+}
+
+
+/* snap_handle_save_now *************************************************************************//**
+ * @brief		Work item which saves a snapshot for snap_save. */
+static void snap_handle_save_now(struct k_work* work)
+{
+	snap_write(true);
+	k_sem_give(&snap.save_now_done);
+}
+
+
+/* snap_handle_erase ****************************************************************************//**
+ * @brief		Work item which erases the snapshot log's spare page in a gap between active timeslots
+ * 				that is longer than a page erase. Keeps checking for a gap until the page is erased. */
+static void snap_handle_erase(struct k_work* work)
+{
+	if(!snap.ready)
+	{
+		return;
+	}
+
+	k_mutex_lock(&snap.mutex, K_FOREVER);
+
+	if(snap_log_spare_erased(&snap.log))
+	{
+		goto done;
+	}
+
+	if(ts_idle_us() < SNAP_ERASE_US)
+	{
+		k_work_schedule(&snap.erase_work, K_MSEC(SNAP_RETRY_MS));
+		goto done;
+	}
+
+	int r = snap_log_erase_spare(&snap.log);
+
+	if(r < 0)
+	{
+		LOG_ERR("could not erase snapshot page: %d", r);
+	}
+
+	done:
+		k_mutex_unlock(&snap.mutex);
+}
+
+
+/******************************************* END OF FILE *******************************************/
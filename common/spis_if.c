@@ -40,6 +40,7 @@ LOG_MODULE_REGISTER(spis_if, LOG_LEVEL_DBG);
 #define SPIS_MTU			1280
 #define SPIS_READY_PIN		26
 #define SPIS_RX_STACK_SIZE	2048
+#define SPIS_HEARTBEAT_MAGIC	"HYGW"
 
 
 /* Private Types --------------------------------------------------------------------------------- */
@@ -67,6 +68,14 @@ struct net_spis_dev_api {
 	struct net_if_api iface_api;
 };
 
+/* Sent by the host periodically, padded to the 40 bytes of its first SPI transfer. The magic starts
+ * with version nibble 4 so it is never taken for an IPv6 packet. */
+struct net_spis_heartbeat {
+	char    magic[4];
+	uint8_t prefix_len;		/* Length in bits of the prefix of the addresses the host serves */
+	uint8_t prefix[16];
+} __packed;
+
 
 /* Private Functions ----------------------------------------------------------------------------- */
 static int               net_spis_dev_init (const struct device*);
@@ -330,6 +339,14 @@ static bool net_spis_handle_rx(struct net_if* iface, unsigned rxcount)
 	const struct device* dev = net_if_get_device(iface);
 	struct net_spis_dev_data* data = dev->data;
 
+	const struct net_spis_heartbeat* hb = (const struct net_spis_heartbeat*)data->rxbuf;
+
+	if(rxcount >= sizeof(*hb) && memcmp(hb->magic, SPIS_HEARTBEAT_MAGIC, sizeof(hb->magic)) == 0)
+	{
+		hyperspace_gateway_heartbeat(hb->prefix, hb->prefix_len);
+		return true;
+	}
+
 	unsigned version = data->rxbuf[0] & 0xF0;
 
 	if(version != 0x60)
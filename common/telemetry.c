@@ -0,0 +1,551 @@
+/************************************************************************************************//**
+ * @file		telemetry.c
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ ***************************************************************************************************/
+#include <errno.h>
+#include <math.h>
+#include <net/coap.h>
+#include <net/net_ip.h>
+#include <net/socket.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <zephyr.h>
+
+#include "calc.h"
+#include "hyperspace.h"
+#include "location.h"
+#include "telemetry.h"
+#include "tsch.h"
+
+#include "logging/log.h"
+LOG_MODULE_REGISTER(telemetry, LOG_LEVEL_INF);
+
+
+/* Private Macros -------------------------------------------------------------------------------- */
+#define TELEMETRY_CHECK_MS      (1000)			/* Time in ms between checking for changes */
+#define TELEMETRY_REFRESH_MS    (5*60*1000)		/* Unchanged resources are sent this often */
+#define TELEMETRY_LOC_DELTA     (0.25f)			/* Location change in m that is notified */
+#define TELEMETRY_ETX_DELTA     (0.5f)			/* Link ETX change that is notified */
+#define TELEMETRY_MAX_NBRS      (20)
+#define TELEMETRY_MAX_LEN       (1024)			/* Max payload length */
+
+
+/* Private Types --------------------------------------------------------------------------------- */
+typedef struct {
+	uint8_t addr[8];
+	Vec3    loc;
+	float   etx;
+} TelemetryNbr;
+
+
+typedef struct {
+	Vec3         loc;
+	unsigned     bindex;
+	Hypercoord   coord;
+	uint8_t      coord_seq;
+	uint32_t     nbrhood;   /* Bits indicating which nbrs are valid */
+	TelemetryNbr nbrs[TELEMETRY_MAX_NBRS];
+} TelemetryState;
+
+
+typedef struct {
+	int            sock;
+	struct k_mutex lock;
+	struct k_work_delayable check_work;
+	struct coap_resource*   resources[TELEMETRY_NUM];	/* Set by the first GET of each resource */
+	struct coap_observer    observers[TELEMETRY_NUM_OBSERVERS];
+	uint32_t       sent[TELEMETRY_NUM];	/* Uptime in ms each resource was last sent to observers */
+	TelemetryState last[TELEMETRY_NUM];	/* State each resource was last sent to observers with */
+	TelemetryState state;
+	char           payload[TELEMETRY_MAX_LEN];
+	uint8_t        data[TELEMETRY_MAX_LEN + 64];
+} Telemetry;
+
+
+/* Private Functions ----------------------------------------------------------------------------- */
+static void     telemetry_check  (struct k_work*);
+static void     telemetry_sample (TelemetryState*);
+static bool     telemetry_changed(TelemetryId, const TelemetryState*, const TelemetryState*);
+static bool     telemetry_moved  (Vec3, Vec3);
+static bool     telemetry_remove (struct coap_resource*, const struct sockaddr*);
+static int      telemetry_send   (struct coap_packet*, TelemetryId, int, const TelemetryState*);
+static int      telemetry_format (TelemetryId, const TelemetryState*, char*, unsigned);
+static unsigned telemetry_append (char*, unsigned, unsigned, const char*, ...);
+static unsigned telemetry_float  (char*, unsigned, unsigned, float);
+
+
+/* Private Variables ----------------------------------------------------------------------------- */
+const char* const telemetry_loc_path[]   = { "telemetry", "loc",   0 };
+const char* const telemetry_coord_path[] = { "telemetry", "coord", 0 };
+const char* const telemetry_nbrs_path[]  = { "telemetry", "nbrs",  0 };
+const char* const telemetry_links_path[] = { "telemetry", "links", 0 };
+
+static Telemetry telem;
+
+
+/* telemetry_init *******************************************************************************//**
+ * @brief		Starts checking the telemetry resources for changes. Notifications are sent from the
+ * 				CoAP server's socket. */
+void telemetry_init(int sock)
+{
+	telem.sock = sock;
+	memset(telem.resources, 0, sizeof(telem.resources));
+	memset(telem.observers, 0, sizeof(telem.observers));
+	k_mutex_init(&telem.lock);
+	k_work_init_delayable(&telem.check_work, telemetry_check);
+	k_work_schedule(&telem.check_work, K_MSEC(TELEMETRY_CHECK_MS));
+}
+
+
+/* telemetry_observed ***************************************************************************//**
+ * @brief		Returns true if a client is observing this node's location. */
+bool telemetry_observed(void)
+{
+	struct coap_resource* resource = telem.resources[TELEMETRY_LOC];
+
+	return resource && !sys_slist_is_empty(&resource->observers);
+}
+
+
+/* telemetry_reset ******************************************************************************//**
+ * @brief		Removes every observer at the specified address. Called when the address rejects a
+ * 				notification with a reset. Returns true if an observer was removed. */
+bool telemetry_reset(const struct sockaddr* addr)
+{
+	bool removed = false;
+
+	k_mutex_lock(&telem.lock, K_FOREVER);
+
+	for(unsigned i = 0; i < TELEMETRY_NUM; i++)
+	{
+		if(telem.resources[i])
+		{
+			removed |= telemetry_remove(telem.resources[i], addr);
+		}
+	}
+
+	k_mutex_unlock(&telem.lock);
+
+	return removed;
+}
+
+
+/* telemetry_get ********************************************************************************//**
+ * @brief		Replies with a telemetry resource. A GET with Observe=0 registers the client as an
+ * 				observer of the resource and replaces any earlier registration. Any other GET removes
+ * 				the client's registration. */
+int telemetry_get(
+	struct coap_resource* resource,
+	struct coap_packet* request,
+	struct sockaddr* addr,
+	socklen_t addr_len)
+{
+	struct coap_packet response;
+	TelemetryId id      = (TelemetryId)(uintptr_t)resource->user_data;
+	uint8_t     token[8];
+	uint8_t     type    = coap_header_get_type (request);
+	uint16_t    msg_id  = coap_header_get_id   (request);
+	uint8_t     tkl     = coap_header_get_token(request, token);
+	bool        observe = coap_request_is_observe(request);
+	int r;
+
+	k_mutex_lock(&telem.lock, K_FOREVER);
+
+	telem.resources[id] = resource;
+	telemetry_remove(resource, addr);
+	telemetry_sample(&telem.state);
+
+	if(observe)
+	{
+		struct coap_observer* observer = coap_observer_next_unused(
+			telem.observers, TELEMETRY_NUM_OBSERVERS);
+
+		/* Reply without the Observe option if the client could not be registered */
+		if(!observer)
+		{
+			LOG_WRN("no free observers");
+			observe = false;
+		}
+		else
+		{
+			coap_observer_init(observer, request, addr);
+			coap_register_observer(resource, observer);
+			telem.last[id] = telem.state;
+			telem.sent[id] = k_uptime_get_32();
+		}
+	}
+
+	if(type == COAP_TYPE_CON) {
+		type = COAP_TYPE_ACK;
+	} else {
+		type = COAP_TYPE_NON_CON;
+	}
+
+	r = coap_packet_init(&response, telem.data, sizeof(telem.data), 1, type, tkl, token,
+		COAP_RESPONSE_CODE_CONTENT, msg_id);
+	if(r < 0) {
+		goto end;
+	}
+
+	r = telemetry_send(&response, id, observe ? resource->age : -1, &telem.state);
+
+	/* Reply with an error rather than truncated JSON */
+	if(r == -ENOSPC) {
+		LOG_WRN("resource %d too large", id);
+		r = coap_packet_init(&response, telem.data, sizeof(telem.data), 1, type, tkl, token,
+			COAP_RESPONSE_CODE_INTERNAL_ERROR, msg_id);
+	}
+	if(r < 0) {
+		goto end;
+	}
+
+	r = sendto(telem.sock, response.data, response.offset, 0, addr, addr_len);
+
+	end:
+		k_mutex_unlock(&telem.lock);
+		return r;
+}
+
+
+/* telemetry_notify *****************************************************************************//**
+ * @brief		Sends a non-confirmable notification of a telemetry resource to an observer. */
+void telemetry_notify(struct coap_resource* resource, struct coap_observer* observer)
+{
+	struct coap_packet notification;
+	TelemetryId id = (TelemetryId)(uintptr_t)resource->user_data;
+	int r;
+
+	k_mutex_lock(&telem.lock, K_FOREVER);
+
+	r = coap_packet_init(&notification, telem.data, sizeof(telem.data), 1, COAP_TYPE_NON_CON,
+		observer->tkl, observer->token, COAP_RESPONSE_CODE_CONTENT, coap_next_id());
+	if(r < 0) {
+		goto end;
+	}
+
+	r = telemetry_send(&notification, id, resource->age, &telem.last[id]);
+	if(r < 0) {
+		LOG_WRN("failed formatting notification %d", r);
+		goto end;
+	}
+
+	r = sendto(telem.sock, notification.data, notification.offset, 0,
+		&observer->addr, sizeof(observer->addr));
+	if(r < 0) {
+		LOG_ERR("failed sending notification %d", errno);
+	}
+
+	end:
+		k_mutex_unlock(&telem.lock);
+}
+
+
+/* telemetry_check ******************************************************************************//**
+ * @brief		Notifies the observers of each resource that changed by more than its threshold or
+ * 				has not been sent for TELEMETRY_REFRESH_MS. Changes are held back while the mesh is
+ * 				congested. */
+static void telemetry_check(struct k_work* work)
+{
+	if(!tsch_congested())
+	{
+		k_mutex_lock(&telem.lock, K_FOREVER);
+
+		uint32_t now = k_uptime_get_32();
+		telemetry_sample(&telem.state);
+
+		for(unsigned i = 0; i < TELEMETRY_NUM; i++)
+		{
+			struct coap_resource* resource = telem.resources[i];
+
+			if(!resource || sys_slist_is_empty(&resource->observers))
+			{
+				continue;
+			}
+
+			if(telemetry_changed(i, &telem.state, &telem.last[i]) ||
+			   now - telem.sent[i] >= TELEMETRY_REFRESH_MS)
+			{
+				telem.last[i] = telem.state;
+				telem.sent[i] = now;
+				coap_resource_notify(resource);
+			}
+		}
+
+		k_mutex_unlock(&telem.lock);
+	}
+
+	k_work_schedule(&telem.check_work, K_MSEC(TELEMETRY_CHECK_MS));
+}
+
+
+/* telemetry_sample *****************************************************************************//**
+ * @brief		Reads the current location, coordinate, neighbors and links. */
+static void telemetry_sample(TelemetryState* s)
+{
+	s->loc       = loc_current();
+	s->bindex    = loc_beacon_index();
+	s->coord.r   = hyperspace_coord_r();
+	s->coord.t   = hyperspace_coord_t();
+	s->coord_seq = hyperspace_coord_seq();
+	s->nbrhood   = 0;
+
+	for(unsigned i = 0; i < calc_min_uint(loc_nbrs_size(), TELEMETRY_MAX_NBRS); i++)
+	{
+		Neighbor* nbr = loc_nbrs(i);
+
+		if(nbr)
+		{
+			s->nbrhood |= 1u << i;
+			memmove(s->nbrs[i].addr, nbr->address, 8);
+			s->nbrs[i].loc = nbr->loc;
+			s->nbrs[i].etx = tsch_link_etx(nbr->address);
+		}
+	}
+}
+
+
+/* telemetry_changed ****************************************************************************//**
+ * @brief		Returns true if a resource changed by more than its threshold between two states. */
+static bool telemetry_changed(TelemetryId id, const TelemetryState* a, const TelemetryState* b)
+{
+	switch(id) {
+	case TELEMETRY_LOC:
+		return a->bindex != b->bindex || telemetry_moved(a->loc, b->loc);
+
+	case TELEMETRY_COORD:
+		return a->coord_seq != b->coord_seq || isfinite(a->coord.r) != isfinite(b->coord.r);
+
+	case TELEMETRY_NBRS:
+	case TELEMETRY_LINKS:
+		if(a->nbrhood != b->nbrhood)
+		{
+			return true;
+		}
+
+		for(unsigned i = 0; i < TELEMETRY_MAX_NBRS; i++)
+		{
+			if((a->nbrhood & (1u << i)) == 0)
+			{
+				continue;
+			}
+
+			if(memcmp(a->nbrs[i].addr, b->nbrs[i].addr, 8) != 0)
+			{
+				return true;
+			}
+
+			if(id == TELEMETRY_NBRS && telemetry_moved(a->nbrs[i].loc, b->nbrs[i].loc))
+			{
+				return true;
+			}
+
+			if(id == TELEMETRY_LINKS && fabsf(a->nbrs[i].etx - b->nbrs[i].etx) > TELEMETRY_ETX_DELTA)
+			{
+				return true;
+			}
+		}
+		return false;
+
+	default:
+		return false;
+	}
+}
+
+
+/* telemetry_moved ******************************************************************************//**
+ * @brief		Returns true if a location moved by more than TELEMETRY_LOC_DELTA or became valid or
+ * 				invalid. */
+static bool telemetry_moved(Vec3 a, Vec3 b)
+{
+	bool valid = vec3_is_finite(&a);
+
+	return valid != vec3_is_finite(&b) || (valid && vec3_dist(a, b) > TELEMETRY_LOC_DELTA);
+}
+
+
+/* telemetry_remove *****************************************************************************//**
+ * @brief		Removes the observers of a resource at the specified address. Returns true if an
+ * 				observer was removed. */
+static bool telemetry_remove(struct coap_resource* resource, const struct sockaddr* addr)
+{
+	struct coap_observer* o;
+	struct coap_observer* tmp;
+	bool removed = false;
+
+	SYS_SLIST_FOR_EACH_CONTAINER_SAFE(&resource->observers, o, tmp, list)
+	{
+		if(net_sin6(&o->addr)->sin6_port == net_sin6(addr)->sin6_port &&
+		   net_ipv6_addr_cmp(&net_sin6(&o->addr)->sin6_addr, &net_sin6(addr)->sin6_addr))
+		{
+			coap_remove_observer(resource, o);
+			memset(o, 0, sizeof(*o));
+			removed = true;
+		}
+	}
+
+	return removed;
+}
+
+
+/* telemetry_send *******************************************************************************//**
+ * @brief		Appends the options and JSON payload of a resource to a response or notification.
+ * 				The Observe option is only appended if age is not negative. Returns -ENOSPC if the
+ * 				resource doesn't fit in TELEMETRY_MAX_LEN. */
+static int telemetry_send(struct coap_packet* pkt, TelemetryId id, int age, const TelemetryState* s)
+{
+	int len = telemetry_format(id, s, telem.payload, sizeof(telem.payload));
+	int r;
+
+	if(len < 0)
+	{
+		return len;
+	}
+
+	if(age >= 0)
+	{
+		r = coap_append_option_int(pkt, COAP_OPTION_OBSERVE, age);
+		if(r < 0) {
+			return r;
+		}
+	}
+
+	r = coap_append_option_int(pkt, COAP_OPTION_CONTENT_FORMAT, COAP_CONTENT_FORMAT_APP_JSON);
+	if(r < 0) {
+		return r;
+	}
+
+	r = coap_packet_append_payload_marker(pkt);
+	if(r < 0) {
+		return r;
+	}
+
+	return coap_packet_append_payload(pkt, telem.payload, len);
+}
+
+
+/* telemetry_format *****************************************************************************//**
+ * @brief		Writes a resource as JSON. Returns the length written or -ENOSPC if the JSON doesn't
+ * 				fit in the buffer. */
+static int telemetry_format(TelemetryId id, const TelemetryState* s, char* buf, unsigned size)
+{
+	unsigned len = 0;
+
+	switch(id) {
+	case TELEMETRY_LOC:
+		len = telemetry_append(buf, size, len, "{\"loc\":[");
+		len = telemetry_float (buf, size, len, s->loc.x);
+		len = telemetry_append(buf, size, len, ",");
+		len = telemetry_float (buf, size, len, s->loc.y);
+		len = telemetry_append(buf, size, len, ",");
+		len = telemetry_float (buf, size, len, s->loc.z);
+		len = telemetry_append(buf, size, len, "],\"bindex\":%u}", s->bindex);
+		break;
+
+	case TELEMETRY_COORD:
+		len = telemetry_append(buf, size, len, "{\"r\":");
+		len = telemetry_float (buf, size, len, s->coord.r);
+		len = telemetry_append(buf, size, len, ",\"t\":");
+		len = telemetry_float (buf, size, len, s->coord.t);
+		len = telemetry_append(buf, size, len, ",\"seq\":%u}", s->coord_seq);
+		break;
+
+	case TELEMETRY_NBRS:
+	case TELEMETRY_LINKS:
+		len = telemetry_append(buf, size, len, id == TELEMETRY_NBRS ? "{\"nbrs\":[" : "{\"links\":[");
+
+		for(unsigned i = 0; i < TELEMETRY_MAX_NBRS; i++)
+		{
+			const TelemetryNbr* nbr = &s->nbrs[i];
+
+			if((s->nbrhood & (1u << i)) == 0)
+			{
+				continue;
+			}
+
+			len = telemetry_append(buf, size, len, "%s[\"", (s->nbrhood & ((1u << i) - 1)) ? "," : "");
+
+			for(unsigned j = 0; j < 8; j++)
+			{
+				len = telemetry_append(buf, size, len, "%02x", nbr->addr[j]);
+			}
+
+			len = telemetry_append(buf, size, len, "\",");
+
+			if(id == TELEMETRY_NBRS)
+			{
+				len = telemetry_float (buf, size, len, nbr->loc.x);
+				len = telemetry_append(buf, size, len, ",");
+				len = telemetry_float (buf, size, len, nbr->loc.y);
+				len = telemetry_append(buf, size, len, ",");
+				len = telemetry_float (buf, size, len, nbr->loc.z);
+			}
+			else
+			{
+				len = telemetry_float(buf, size, len, nbr->etx);
+			}
+
+			len = telemetry_append(buf, size, len, "]");
+		}
+
+		len = telemetry_append(buf, size, len, "]}");
+		break;
+
+	default:
+		break;
+	}
+
+	return len < size ? (int)len : -ENOSPC;
+}
+
+
+/* telemetry_append *****************************************************************************//**
+ * @brief		Appends formatted text to a buffer at len. Returns the new length, or size once the
+ * 				text didn't fit. Later appends leave a full buffer unchanged. */
+static unsigned telemetry_append(char* buf, unsigned size, unsigned len, const char* fmt, ...)
+{
+	if(len >= size)
+	{
+		return size;
+	}
+
+	va_list args;
+	va_start(args, fmt);
+	int r = vsnprintf(&buf[len], size - len, fmt, args);
+	va_end(args);
+
+	return r < 0 || len + r >= size ? size : len + r;
+}
+
+
+/* telemetry_float ******************************************************************************//**
+ * @brief		Appends a float as a JSON value. NaN and infinity are written as strings. */
+static unsigned telemetry_float(char* buf, unsigned size, unsigned len, float x)
+{
+	if(isnan(x))
+	{
+		return telemetry_append(buf, size, len, "\"NaN\"");
+	}
+	else if(isinf(x))
+	{
+		return telemetry_append(buf, size, len, "\"Infinity\"");
+	}
+	else
+	{
+		return telemetry_append(buf, size, len, "%.3f", x);
+	}
+}
+
+
+/******************************************* END OF FILE *******************************************/
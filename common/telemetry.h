@@ -0,0 +1,100 @@
+/************************************************************************************************//**
+ * @file		telemetry.h
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ * @brief		Observable CoAP telemetry resources. Each resource is a JSON document:
+ *
+ * 				telemetry/loc    {"loc":[x,y,z],"bindex":n}
+ * 				telemetry/coord  {"r":r,"t":t,"seq":n}
+ * 				telemetry/nbrs   {"nbrs":[["<addr>",x,y,z],...]}
+ * 				telemetry/links  {"links":[["<addr>",etx],...]}
+ *
+ * 				A GET with Observe=0 registers the client as an observer. Observers are sent
+ * 				non-confirmable notifications only when a resource changes by more than its threshold
+ * 				or when it has not been sent for TELEMETRY_REFRESH_MS. Notifications are held back
+ * 				while the mesh is congested. A reset or a GET with Observe=1 removes the observer.
+ *
+ * 				A resource that doesn't fit in TELEMETRY_MAX_LEN is never sent truncated. A GET is
+ * 				answered with 5.00 and notifications are skipped until the resource fits again.
+ *
+ * 				Nodes announce themselves to the border router with a UDP report. Once observed, a
+ * 				node keeps announcing itself every TELEMETRY_ANNOUNCE_MS so that a border router that
+ * 				restarted and lost its observations finds the node again.
+ *
+ ***************************************************************************************************/
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#if __STDC_VERSION__ < 199901L
+#error Compile with C99 or higher!
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Includes -------------------------------------------------------------------------------------- */
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <net/coap.h>
+
+
+/* Public Macros --------------------------------------------------------------------------------- */
+#define TELEMETRY_NUM_OBSERVERS (8)
+#define TELEMETRY_ANNOUNCE_MS   (60*1000)		/* UDP announcement period while observed */
+
+/* Resource table entries. Add to a CoAP server's resource table. */
+#define TELEMETRY_RESOURCES                                                                         \
+	{ .path = telemetry_loc_path,   .get = telemetry_get, .notify = telemetry_notify,               \
+	  .user_data = (void*)TELEMETRY_LOC,   },                                                       \
+	{ .path = telemetry_coord_path, .get = telemetry_get, .notify = telemetry_notify,               \
+	  .user_data = (void*)TELEMETRY_COORD, },                                                       \
+	{ .path = telemetry_nbrs_path,  .get = telemetry_get, .notify = telemetry_notify,               \
+	  .user_data = (void*)TELEMETRY_NBRS,  },                                                       \
+	{ .path = telemetry_links_path, .get = telemetry_get, .notify = telemetry_notify,               \
+	  .user_data = (void*)TELEMETRY_LINKS, }
+
+
+/* Public Types ---------------------------------------------------------------------------------- */
+typedef enum {
+	TELEMETRY_LOC,
+	TELEMETRY_COORD,
+	TELEMETRY_NBRS,
+	TELEMETRY_LINKS,
+	TELEMETRY_NUM,
+} TelemetryId;
+
+
+/* Public Variables ------------------------------------------------------------------------------ */
+extern const char* const telemetry_loc_path[];
+extern const char* const telemetry_coord_path[];
+extern const char* const telemetry_nbrs_path[];
+extern const char* const telemetry_links_path[];
+
+
+/* Public Functions ------------------------------------------------------------------------------ */
+void telemetry_init    (int);
+bool telemetry_observed(void);
+bool telemetry_reset   (const struct sockaddr*);
+int  telemetry_get     (struct coap_resource*, struct coap_packet*, struct sockaddr*, socklen_t);
+void telemetry_notify  (struct coap_resource*, struct coap_observer*);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TELEMETRY_H
+/******************************************* END OF FILE *******************************************/
@@ -18,11 +18,13 @@
 #include <nrfx/hal/nrf_ppi.h>
 #include <nrfx/hal/nrf_rtc.h>
 #include <nrfx/hal/nrf_timer.h>
+#include <string.h>
 
 #include "calc.h"
 #include "compare.h"
 #include "pool.h"
 #include "timeslot.h"
+#include "trace.h"
 #include "utils.h"
 
 /* Zephyr */
@@ -47,8 +49,9 @@ LOG_MODULE_REGISTER(ts, LOG_LEVEL_NONE);
 // #define TS_PERIOD			(512000000ull * 36028797018ull)
 // #define TS_PERIOD			(18438809997803520000ull)
 #define TS_CELL_LENGTH_US	(2500)
-#define TS_NUM_SLOTS		(8)
+#define TS_NUM_SLOTS		(12)	/* 2 TSCH cells + up to 4 * LOC_MAX_GROUPS location cells */
 #define TS_NUM_SLOTFRAMES	(8)
+#define TS_CYCLES_PER_US	(64)	/* DWT cycle counter frequency in MHz */
 
 
 /* Private Types --------------------------------------------------------------------------------- */
@@ -76,6 +79,11 @@ TsSlot      tgrid_slots[TS_NUM_SLOTS];
 Pool        tgrid_slotframes_pool;
 Pool        tgrid_slots_pool;
 
+static TsStats  ts_stats[TS_NUM_STATS];
+static TsStats* ts_stats_current;	/* Statistics of the running slot handler or 0 */
+static uint32_t ts_stats_start;		/* Cycle count when the running slot handler started */
+static uint32_t ts_stats_ref;		/* Cycle count that the running handler's deadlines are relative to */
+
 
 // void RTC0_IRQHandler(void)			/* Non-Zephyr */
 ISR_DIRECT_DECLARE(ts_rtc_isr)	/* Zephyr */
@@ -139,6 +147,12 @@ void usleep(uint32_t delay)
  * @brief		Initializes the timeslot grid. */
 void ts_init(void)
 {
+	/* The slot statistics and deadlines are measured with the DWT cycle counter */
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL        |= DWT_CTRL_CYCCNTENA_Msk;
+
+	trace_init();
+
 	pool_init(&tgrid_slotframes_pool, tgrid_slotframes, TS_NUM_SLOTFRAMES, sizeof(TsSlotframe));
 	pool_init(&tgrid_slots_pool, tgrid_slots, TS_NUM_SLOTS, sizeof(TsSlot));
 
@@ -280,10 +294,34 @@ static void ts_slot_handler(void)
 		tgrid.last_asn  = ts_asn_now();
 		tgrid.last_asn += (int64_t)(slot->index - tgrid.last_asn % slot->slotframe->numslots);
 
+		ts_stats_current = 0;
+		ts_stats_start   = DWT->CYCCNT;
+		ts_stats_ref     = ts_stats_start;
+
+		for(unsigned i = 0; i < TS_NUM_STATS; i++)
+		{
+			if(ts_stats[i].handler == slot->handler)
+			{
+				ts_stats_current = &ts_stats[i];
+			}
+		}
+
 		NRF_P0->OUTSET = GPIO_OUTSET_PIN12_Set << GPIO_OUTSET_PIN12_Pos;
+		TRACE(TRACE_SLOT_START, slot->index);
 		slot->handler(slot);
+		TRACE(TRACE_SLOT_END, slot->index);
 		NRF_P0->OUTCLR = GPIO_OUTCLR_PIN12_Clear << GPIO_OUTCLR_PIN12_Pos;
 
+		if(ts_stats_current)
+		{
+			TsStats* s = ts_stats_current;
+			s->exec_us        = (DWT->CYCCNT - ts_stats_start) / TS_CYCLES_PER_US;
+			s->exec_max_us    = calc_max_uint(s->exec_max_us, s->exec_us);
+			s->exec_total_us += s->exec_us;
+			s->count++;
+			ts_stats_current  = 0;
+		}
+
 		LOG_DBG("done. dur = %u", (uint32_t)(ts_time_now() - now));
 	}
 
@@ -381,6 +419,30 @@ uint64_t ts_asn_now(void)
 }
 
 
+/* ts_idle_us ***********************************************************************************//**
+ * @brief		Returns the time in us until the next active slot starts. Returns 0 while a slot is
+ * 				still active and UINT32_MAX if no slot is scheduled. Used to fit operations that stall
+ * 				the CPU, like erasing flash, between slots. */
+uint32_t ts_idle_us(void)
+{
+	if(!ts_next())
+	{
+		return UINT32_MAX;
+	}
+
+	uint64_t now = ts_time_now();
+
+	if(calc_wrapdiff_u64(now, tgrid.last_time, TS_PERIOD) < TS_CELL_LENGTH_US)
+	{
+		return 0;
+	}
+
+	int64_t idle = calc_wrapdiff_u64(tgrid.next_time, now, TS_PERIOD);
+
+	return idle <= 0 ? 0 : idle >= UINT32_MAX ? UINT32_MAX : (uint32_t)idle;
+}
+
+
 /* ts_time_to_asn *******************************************************************************//**
  * @brief		Converts timestamp to ASN. */
 static uint64_t ts_time_to_asn(uint64_t time)
@@ -645,8 +707,10 @@ Link* ts_slots(TsSlotframe* sf)
  * @param[in]	sf: the slotframe to add the slot to.
  * @param[in]	flags: the slot's flags.
  * @param[in]	slot: the new slot's index.
- * @param[in]	handler: handler function called when the slot becomes active. */
-bool ts_slot_add(TsSlotframe* sf, uint8_t flags, uint16_t index, void (*handler)(TsSlot*))
+ * @param[in]	handler: handler function called when the slot becomes active.
+ * @return		the new slot or null if the slot could not be added. The slot's channel offset
+ * 				defaults to 0. */
+TsSlot* ts_slot_add(TsSlotframe* sf, uint8_t flags, uint16_t index, void (*handler)(TsSlot*))
 {
 	LOG_DBG("add %d to sf %d", index, sf->id);
 	if(!sf)
@@ -678,6 +742,7 @@ bool ts_slot_add(TsSlotframe* sf, uint8_t flags, uint16_t index, void (*handler)
 	/* Initialize the slot */
 	slot->slotframe = sf;
 	slot->index     = index;
+	slot->channel   = 0;
 	slot->flags     = flags;
 	slot->dropcount = 0;
 	slot->count     = 0;
@@ -1000,4 +1065,114 @@ static void ts_try_power_down(uint64_t tstamp)
 }
 
 
+/* ts_deadline_ref ******************************************************************************//**
+ * @brief		Marks the time the running slot handler's deadlines are relative to. Handlers call this
+ * 				after reading the radio time that their radio events are scheduled from. Otherwise,
+ * 				deadlines are relative to the start of the handler. */
+void ts_deadline_ref(void)
+{
+	ts_stats_ref = DWT->CYCCNT;
+}
+
+
+/* ts_deadline **********************************************************************************//**
+ * @brief		Records the slack of a radio event that is about to be scheduled us microseconds after
+ * 				the deadline reference. Must only be called from a slot handler. Time is measured with
+ * 				the DWT cycle counter that ts_init starts. */
+void ts_deadline(uint32_t us)
+{
+	TsStats* s = ts_stats_current;
+
+	if(s)
+	{
+		int32_t elapsed = (DWT->CYCCNT - ts_stats_ref) / TS_CYCLES_PER_US;
+
+		s->slack_us = (int32_t)us - elapsed;
+
+		if(s->deadlines == 0 || s->slack_us < s->slack_min_us)
+		{
+			s->slack_min_us = s->slack_us;
+		}
+
+		s->deadlines++;
+	}
+}
+
+
+/* ts_deadline_missed ***************************************************************************//**
+ * @brief		Records that the radio refused to schedule an event because it was too late. Must only
+ * 				be called from a slot handler. */
+void ts_deadline_missed(void)
+{
+	if(ts_stats_current)
+	{
+		ts_stats_current->missed++;
+	}
+}
+
+
+/* ts_stats_register ****************************************************************************//**
+ * @brief		Starts keeping execution statistics for a slot handler. Does nothing if the handler is
+ * 				already registered or there are no free statistics. Call during initialization before
+ * 				the handler's slots are added. */
+void ts_stats_register(void (*handler)(TsSlot*), const char* name)
+{
+	for(unsigned i = 0; i < TS_NUM_STATS; i++)
+	{
+		if(ts_stats[i].handler == handler)
+		{
+			break;
+		}
+		else if(ts_stats[i].handler == 0)
+		{
+			memset(&ts_stats[i], 0, sizeof(ts_stats[i]));
+			ts_stats[i].handler = handler;
+			ts_stats[i].name    = name;
+			break;
+		}
+	}
+}
+
+
+/* ts_stats_get *********************************************************************************//**
+ * @brief		Copies the i'th registered slot handler's statistics. Returns false if there is no i'th
+ * 				registered handler. */
+bool ts_stats_get(unsigned i, TsStats* stats)
+{
+	bool valid = false;
+
+	ts_lock();
+
+	if(i < TS_NUM_STATS && ts_stats[i].handler)
+	{
+		memmove(stats, &ts_stats[i], sizeof(TsStats));
+		valid = true;
+	}
+
+	ts_unlock();
+
+	return valid;
+}
+
+
+/* ts_stats_reset *******************************************************************************//**
+ * @brief		Clears the statistics of every registered slot handler. */
+void ts_stats_reset(void)
+{
+	ts_lock();
+
+	for(unsigned i = 0; i < TS_NUM_STATS; i++)
+	{
+		void (*handler)(TsSlot*) = ts_stats[i].handler;
+		const char* name         = ts_stats[i].name;
+
+		memset(&ts_stats[i], 0, sizeof(ts_stats[i]));
+		ts_stats[i].handler = handler;
+		ts_stats[i].name    = name;
+	}
+
+	ts_unlock();
+}
+
+
 /******************************************* END OF FILE *******************************************/
@@ -49,6 +49,8 @@ extern "C" {
 #define TS_PERIOD	(274877906944000000ull)
 // #define TS_PERIOD			(512000000ull * 36028797018ull)
 
+#define TS_NUM_STATS	(4)		/* Number of slot handlers that execution statistics are kept for */
+
 
 /* Public Types ---------------------------------------------------------------------------------- */
 typedef void (*TsPowerdown)(void);
@@ -62,7 +64,7 @@ struct TsSlot {
 	// void*        neighbor;	/* Pointer to this slot's neighbor */
 	TsSlotframe* slotframe;	/* Pointer to this slot's slotframe */
 	uint16_t     index;		/* Slot index in the slotframe */
-	// uint16_t     channel;	/* Slot channel offset */
+	uint16_t     channel;	/* Slot channel offset */
 	uint8_t      flags;		/* Tx/Rx/Shared/EB/Timekeeping flags */
 	uint8_t      dropcount;	/* Count of times no communications were heard on this slot */
 	uint8_t      count;
@@ -99,6 +101,24 @@ typedef struct {
 } TsGrid;
 
 
+/* Execution statistics of a slot handler. Slack is the time left before a scheduled radio event when
+ * the handler starts arming the radio. Negative slack means the handler was late by the cycle
+ * counter's estimate. Missed counts radio events the radio refused to schedule because their time
+ * had already passed. */
+typedef struct {
+	void (*handler)(TsSlot*);
+	const char* name;
+	uint32_t    count;          /* Number of times the handler ran */
+	uint32_t    exec_us;        /* Last execution time in us */
+	uint32_t    exec_max_us;
+	uint64_t    exec_total_us;
+	uint32_t    deadlines;      /* Number of radio events scheduled */
+	int32_t     slack_us;       /* Last slack in us */
+	int32_t     slack_min_us;
+	uint32_t    missed;
+} TsStats;
+
+
 /* Public Functions ------------------------------------------------------------------------------ */
 void         usleep(uint32_t);
 
@@ -114,6 +134,7 @@ uint64_t     ts_current_toffset    (int32_t);
 uint64_t     ts_current_asn        (void);
 uint64_t     ts_time_now           (void);
 uint64_t     ts_asn_now            (void);
+uint32_t     ts_idle_us            (void);
 void         ts_offset             (int32_t);
 void         ts_sync               (uint64_t, uint64_t);
 
@@ -125,9 +146,16 @@ uint16_t     ts_slotframe_next_free(TsSlotframe*, uint16_t);
 uint16_t     ts_slotframe_prev_free(TsSlotframe*, uint16_t);
 
 Link*        ts_slots      (TsSlotframe*);
-bool         ts_slot_add   (TsSlotframe*, uint8_t, uint16_t, void (*)(TsSlot*));
+TsSlot*      ts_slot_add   (TsSlotframe*, uint8_t, uint16_t, void (*)(TsSlot*));
 TsSlot*      ts_slot_find  (TsSlotframe*, uint16_t);
 void         ts_slot_remove(TsSlot*);
+
+void         ts_deadline_ref   (void);
+void         ts_deadline       (uint32_t);
+void         ts_deadline_missed(void);
+void         ts_stats_register (void (*)(TsSlot*), const char*);
+bool         ts_stats_get      (unsigned, TsStats*);
+void         ts_stats_reset    (void);
 // void         ts_slot_tx_append(TsSlot*, struct net_buf*);
 
 
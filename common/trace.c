@@ -0,0 +1,206 @@
+/************************************************************************************************//**
+ * @file		trace.c
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ ***************************************************************************************************/
+#include <nrf52.h>
+#include <net/socket.h>
+#include <string.h>
+#include <zephyr.h>
+
+#include "trace.h"
+#include "tsch.h"
+
+#include "logging/log.h"
+LOG_MODULE_REGISTER(trace, LOG_LEVEL_INF);
+
+
+/* Private Macros -------------------------------------------------------------------------------- */
+#define TRACE_DRAIN_MIN_MS      (100)	/* Shortest time in ms between drains */
+#define TRACE_DRAIN_MAX_MS      (1000)	/* Longest time in ms between drains */
+#define TRACE_DRAIN_MAX         (64)	/* Max entries per datagram */
+
+
+/* Private Types --------------------------------------------------------------------------------- */
+typedef struct {
+	TraceEntry entries[TRACE_SIZE];
+	atomic_t   head;    /* Total number of events written */
+	uint32_t   tail;    /* Total number of events read */
+} TraceRing;
+
+
+/* Private Functions ----------------------------------------------------------------------------- */
+static uint32_t trace_pending(void);
+
+
+/* Private Variables ----------------------------------------------------------------------------- */
+static TraceRing trace;
+
+
+/* trace_init ***********************************************************************************//**
+ * @brief		Starts the DWT cycle counter used to timestamp events and clears the ring. */
+void trace_init(void)
+{
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT       = 0;
+	DWT->CTRL        |= DWT_CTRL_CYCCNTENA_Msk;
+
+	memset(trace.entries, 0, sizeof(trace.entries));
+	atomic_clear(&trace.head);
+	trace.tail = 0;
+}
+
+
+/* trace_event **********************************************************************************//**
+ * @brief		Writes an event to the ring. Safe to call from any context including ISRs. The slot
+ * 				is claimed with an atomic increment. The id is written last so that the reader can
+ * 				tell whether the entry has been completely written. */
+void trace_event(uint16_t id, uint16_t arg)
+{
+	uint32_t    idx   = (uint32_t)atomic_inc(&trace.head);
+	TraceEntry* entry = &trace.entries[idx & (TRACE_SIZE - 1)];
+
+	entry->id     = TRACE_NONE;
+	__DMB();
+	entry->tstamp = DWT->CYCCNT;
+	entry->arg    = arg;
+	__DMB();
+	entry->id     = id;
+}
+
+
+/* trace_read ***********************************************************************************//**
+ * @brief		Copies up to max of the oldest unread events. Returns the number of events copied and
+ * 				adds the number of events that were overwritten before they could be read to lost.
+ * 				Must only be called from a single reader. */
+unsigned trace_read(TraceEntry* out, unsigned max, uint32_t* lost)
+{
+	uint32_t head  = (uint32_t)atomic_get(&trace.head);
+	unsigned count = 0;
+
+	if(head - trace.tail > TRACE_SIZE)
+	{
+		*lost     += head - trace.tail - TRACE_SIZE;
+		trace.tail = head - TRACE_SIZE;
+	}
+
+	while(trace.tail != head && count < max)
+	{
+		out[count] = trace.entries[trace.tail & (TRACE_SIZE - 1)];
+		__DMB();
+
+		/* Stop at an entry that is still being written. It is read on the next call. */
+		if(out[count].id == TRACE_NONE)
+		{
+			break;
+		}
+
+		/* A writer that wrapped around the ring may have overwritten the entry while it was being
+		 * copied. Writers claim an entry before writing it, so the head tells if that happened. */
+		if((uint32_t)atomic_get(&trace.head) - trace.tail > TRACE_SIZE)
+		{
+			head = (uint32_t)atomic_get(&trace.head);
+			*lost     += head - trace.tail - TRACE_SIZE;
+			trace.tail = head - TRACE_SIZE;
+			continue;
+		}
+
+		trace.tail++;
+		count++;
+	}
+
+	return count;
+}
+
+
+/* trace_pending ********************************************************************************//**
+ * @brief		Returns the number of events written but not read yet, including overwritten events. */
+static uint32_t trace_pending(void)
+{
+	return (uint32_t)atomic_get(&trace.head) - trace.tail;
+}
+
+
+/* trace_drain **********************************************************************************//**
+ * @brief		Thread that sends trace events to the border router host. Each drain sends datagrams
+ * 				until the ring is empty. The time to the next drain is how long the ring takes to
+ * 				fill halfway at the event rate since the previous drain. The rate follows the slot
+ * 				schedule since most events are written by the slot handlers. Drains are skipped while
+ * 				the mesh is congested. Events keep accumulating in the ring and the oldest are
+ * 				reported as lost. */
+void trace_drain(void* p1, void* p2, void* p3)
+{
+	static struct {
+		TraceHeader header;
+		TraceEntry  entries[TRACE_DRAIN_MAX];
+	} __packed msg;
+
+	uint32_t lost = 0;
+
+	struct sockaddr_in6 addr6 = { 0 };
+	addr6.sin6_family = AF_INET6;
+	addr6.sin6_port   = htons(TRACE_PORT);
+	inet_pton(AF_INET6, "fd00::1", &addr6.sin6_addr);
+
+	int s = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+
+	if(s < 0)
+	{
+		LOG_ERR("failed to create trace socket %d", errno);
+		return;
+	}
+
+	memmove(msg.header.magic, "TRCE", sizeof(msg.header.magic));
+	msg.header.version = TRACE_VERSION;
+
+	uint32_t period = TRACE_DRAIN_MAX_MS;
+
+	while(1)
+	{
+		k_sleep(K_MSEC(period));
+
+		/* Scale the period so that half the ring is written between drains at the recent rate */
+		uint32_t pending = trace_pending();
+
+		period = pending ? (TRACE_SIZE / 2) * period / pending : TRACE_DRAIN_MAX_MS;
+		period = MAX(TRACE_DRAIN_MIN_MS, MIN(period, TRACE_DRAIN_MAX_MS));
+
+		if(tsch_congested())
+		{
+			continue;
+		}
+
+		/* Drain at most a ring's worth so that events written while draining wait for the next
+		 * drain instead of keeping the thread busy */
+		unsigned count;
+		unsigned sent = 0;
+
+		while(sent < TRACE_SIZE && (count = trace_read(msg.entries, TRACE_DRAIN_MAX, &lost)) != 0)
+		{
+			msg.header.count = count;
+			msg.header.lost  = lost > UINT16_MAX ? UINT16_MAX : lost;
+			lost  = 0;
+			sent += count;
+
+			if(sendto(s, &msg, sizeof(msg.header) + count * sizeof(TraceEntry), 0,
+				(struct sockaddr*)&addr6, sizeof(addr6)) < 0)
+			{
+				lost += count;
+				break;
+			}
+		}
+	}
+}
+
+
+/******************************************* END OF FILE *******************************************/
@@ -0,0 +1,114 @@
+/************************************************************************************************//**
+ * @file		trace.h
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ * @brief		Binary event trace. Events are written to a fixed size ring of {timestamp, id, arg}
+ * 				entries. Writing an event is a handful of stores so tracing can stay enabled in the
+ * 				slot handlers without disturbing slot timing. The ring is a flight recorder: when it
+ * 				is full the oldest events are overwritten and counted as lost.
+ *
+ * 				Timestamps are DWT cycle counts (64 MHz) and wrap every 67 s. With
+ * 				CONFIG_TRACE_DRAIN, which is only on by default for nodes wired to the host, the
+ * 				drain thread sends the ring to the border router host in UDP datagrams on TRACE_PORT:
+ *
+ * 				+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * 				| Magic "TRCE"                                                  |
+ * 				+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * 				| Version       | Count         | Lost                          |
+ * 				+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * 				| Count entries of TraceEntry...                                |
+ * 				+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *
+ * 				All fields are little endian. Lost is the number of events overwritten before they
+ * 				could be drained since the previous datagram.
+ *
+ ***************************************************************************************************/
+#ifndef TRACE_H
+#define TRACE_H
+
+#if __STDC_VERSION__ < 199901L
+#error Compile with C99 or higher!
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Includes -------------------------------------------------------------------------------------- */
+#include <stdint.h>
+#include <zephyr.h>
+
+
+/* Public Macros --------------------------------------------------------------------------------- */
+#define TRACE_ENABLED       (1)		/* Set to 0 to compile out all trace events */
+#define TRACE_SIZE          (256)	/* Number of entries in the ring. Must be a power of 2. */
+#define TRACE_PORT          (2202)
+#define TRACE_VERSION       (1)
+#define TRACE_CYCLES_PER_US (64)
+
+#if TRACE_ENABLED
+#define TRACE(id, arg)      trace_event((id), (arg))
+#else
+#define TRACE(id, arg)
+#endif
+
+
+/* Public Types ---------------------------------------------------------------------------------- */
+typedef enum {
+	TRACE_NONE = 0,         /* Marks an entry that is being written */
+	TRACE_SLOT_START,       /* arg: slot index */
+	TRACE_SLOT_END,         /* arg: slot index */
+	TRACE_LOC_SLOT,         /* arg: location cell direction << 8 | slot */
+	TRACE_LOC_SOLVE_START,
+	TRACE_LOC_SOLVE_END,    /* arg: solve time in us */
+	TRACE_LOC_OVERRUN,
+	TRACE_SHARED_ADV,
+	TRACE_SHARED_TX,        /* arg: sequence number */
+	TRACE_SHARED_RX,
+	TRACE_TX_ACK,           /* arg: sequence number */
+	TRACE_TX_COLLISION,
+	TRACE_TX_DROP,
+	TRACE_RX_TIMEOUT,
+	TRACE_RX_COLLISION,
+	TRACE_QUEUE_DROP,       /* arg: traffic class */
+	TRACE_NUM_IDS,
+} TraceId;
+
+typedef struct __packed {
+	uint32_t tstamp;        /* DWT cycle count */
+	uint16_t id;
+	uint16_t arg;
+} TraceEntry;
+
+typedef struct __packed {
+	char     magic[4];
+	uint8_t  version;
+	uint8_t  count;
+	uint16_t lost;
+} TraceHeader;
+
+
+/* Public Functions ------------------------------------------------------------------------------ */
+void     trace_init (void);
+void     trace_event(uint16_t, uint16_t);
+unsigned trace_read (TraceEntry*, unsigned, uint32_t*);
+void     trace_drain(void*, void*, void*);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TRACE_H
+/******************************************* END OF FILE *******************************************/
@@ -27,12 +27,14 @@ LOG_MODULE_REGISTER(tsch, LOG_LEVEL_INF);
 #include <nrfx/hal/nrf_ppi.h>
 #include <nrfx/hal/nrf_gpiote.h>
 #include <nrfx/hal/nrf_timer.h>
+#include <math.h>
 #include <random/rand32.h>
 #include <stdlib.h>
 #include <zephyr.h>
 
 #include "bayesian.h"
 #include "calc.h"
+#include "codel.h"
 #include "config.h"
 #include "dw1000.h"
 #include "hyperspace.h"
@@ -41,8 +43,11 @@ LOG_MODULE_REGISTER(tsch, LOG_LEVEL_INF);
 #include "lowpan.h"
 #include "net_private.h"
 #include "pool.h"
+#include "snapshot.h"
 #include "timeslot.h"
+#include "trace.h"
 #include "tsch.h"
+#include "twr.h"
 
 
 /* Inline Function Instances --------------------------------------------------------------------- */
@@ -62,6 +67,32 @@ LOG_MODULE_REGISTER(tsch, LOG_LEVEL_INF);
 #define TSCH_RX_ACK_OFFSET_US       (1550)
 #define TSCH_RX_ACK_TIMEOUT_US      (300)
 
+#define TSCH_SCAN_TIMEOUT_MS        (60000)	/* The time in ms a scan slot listens for advertisements */
+#define TSCH_WARM_MAX_AGE_MS        (20000)	/* The time in ms the grid predicts the network's ASN */
+#define TSCH_WARM_WINDOW_MS         (260)	/* Directed scan window. Slightly longer than a slotframe */
+#define TSCH_WARM_REBOOT_SF         (8)		/* Slotframes (2 s) a planned reboot may take */
+#define TSCH_ADV_BURST_COUNT        (8)		/* Advertisements sent after hearing a join request */
+#define TSCH_ADV_PROBABILITY        (0.25f)	/* Probability a beacon advertises in the shared slot */
+
+#define TSCH_BULK_LENGTH            (256)	/* Packets longer than this in bytes are bulk traffic */
+#define TSCH_LOC_PORT               (2200)	/* UDP port of location reports */
+#define TSCH_TAG_NONE               (0)		/* Tag of frames that aren't part of a datagram */
+
+/* CoDel parameters. The shared slot comes around once per slotframe (250 ms) and a node transmits
+ * at most every third shared slot, so the target and interval are scaled up from the usual 5 ms and
+ * 100 ms to a few frame times. */
+#define TSCH_CODEL_TARGET_MS        (2500)	/* Acceptable standing queue delay */
+#define TSCH_CODEL_INTERVAL_MS      (10000)	/* Delay must stay above target this long to drop */
+
+#define TSCH_DSTWR_ENABLED          (1)		/* Set to 0 to range using single-sided TWR only */
+#define TSCH_DSTWR_MAX_AGE_MS       (10000)	/* Must be less than the DW1000 timestamp period */
+#define TSCH_TWR_NUM_NBRS           (8)		/* Neighbors whose last ranging exchange is kept */
+
+#define TSCH_NUM_LINKS              (20)	/* Neighbors with a link estimate */
+#define TSCH_LINK_ALPHA             (0.8f)	/* Weight of the previous PRR in the moving average */
+#define TSCH_LINK_MIN_PRR           (0.1f)	/* Limits the ETX of a failing link */
+#define TSCH_LINK_TIMEOUT_MS        (5*60*1000)	/* Estimates older than this are forgotten */
+
 
 /* Private Types --------------------------------------------------------------------------------- */
 typedef enum {
@@ -84,6 +115,47 @@ typedef enum {
 	TSCH_DISCONNECT_EVENT,
 } Tsch_Event;
 
+/* Traffic classes of the shared slot, from highest to lowest priority. Control traffic is always
+ * transmitted first. The remaining classes share the slot by weight so that bulk traffic still makes
+ * progress. When frames run out, frames of the lowest class are dropped first. */
+typedef enum {
+	TSCH_CLASS_CONTROL,     /* ICMPv6: RS/RA, NDP, hyperspace coordinate requests */
+	TSCH_CLASS_REALTIME,    /* Location reports and ranging */
+	TSCH_CLASS_DEFAULT,
+	TSCH_CLASS_BULK,        /* Large packets such as OTA blocks */
+	TSCH_NUM_CLASSES,
+} Tsch_Class;
+
+typedef struct {
+	struct k_queue queue[TSCH_NUM_CLASSES];   /* Frames waiting for the shared slot */
+	Codel          codel[TSCH_NUM_CLASSES];
+	uint8_t        credit[TSCH_NUM_CLASSES];  /* Frames a class may send in the current round */
+	uint32_t       drops[TSCH_NUM_CLASSES];   /* Frames dropped because frames ran out */
+} Tsch_Qos;
+
+/* The previous ranging exchange with a neighbor. The initiator stores the timestamps of its frame
+ * and the received ACK. The responder stores the timestamp of the transmitted ACK. Each role keeps
+ * the last exchange with up to TSCH_TWR_NUM_NBRS neighbors so that ranging to several neighbors
+ * in turn still closes every round trip. */
+typedef struct {
+	bool     valid;
+	uint8_t  seqnum;      /* Sequence number of the exchange                  */
+	uint8_t  addr[8];     /* Neighbor's address                               */
+	uint32_t uptime;      /* Uptime in ms of the exchange                     */
+	uint64_t txtstamp;    /* Initiator: frame tx. Responder: ACK tx.          */
+	uint64_t rxtstamp;    /* Initiator: ACK rx. Responder: unused.            */
+	uint32_t reply;       /* Initiator: responder's turnaround (TSCH_TRESP_IE) */
+} Tsch_Twr;
+
+/* Link estimate to a neighbor. The packet reception ratio is a moving average of the unicast
+ * attempts to the neighbor that were ACKed. The expected transmission count is its inverse. */
+typedef struct {
+	bool     valid;
+	uint8_t  addr[8];     /* Neighbor's address                               */
+	uint32_t uptime;      /* Uptime in ms of the last attempt                 */
+	float    prr;         /* Packet reception ratio                           */
+} Tsch_Link;
+
 
 /* Private Functions ----------------------------------------------------------------------------- */
 static int               tsch_dev_init (const struct device*);
@@ -93,6 +165,7 @@ static int               tsch_if_send  (struct net_if*, struct net_pkt*);
 static int               tsch_if_enable(struct net_if*, bool);
 static enum net_l2_flags tsch_if_flags (struct net_if*);
 static int               tsch_tx_pkt   (struct net_pkt*, TsSlot*, k_timeout_t, bool);
+static Tsch_Class        tsch_pkt_class(struct net_pkt*, struct net_ipv6_hdr*);
 
 static void              tsch_handle_prefix    (struct net_mgmt_event_callback*, uint32_t, struct net_if*);
 static void              tsch_send_ra_timeout  (struct k_work*);
@@ -102,6 +175,7 @@ static void              tsch_handle_sync_lost (struct k_work*);
 static void              tsch_handle_do_nothing(struct k_work*);
 
 static void     tsch_handle_event  (Tsch_Event);
+static bool     tsch_warm_channel  (Tsch_Channel*);
 
 static void     tsch_scan_slot     (TsSlot*);
 static void     tsch_adv_slot      (TsSlot*);
@@ -118,12 +192,34 @@ static void     tsch_handle_rx     (TsSlot*, Ieee154_Frame*);
 static void     tsch_handle_rx_data(TsSlot*, Ieee154_Frame*);
 static void     tsch_handle_ack    (TsSlot*, Ieee154_Frame*, Ieee154_Frame*);
 static bool     tsch_valid_addr    (TsSlot*, const Ieee154_Frame*);
-
-static Ieee154_Frame* tsch_reserve_frame(void);
-static void           tsch_release_frame(Ieee154_Frame*);
+static bool     tsch_twr_get       (const Tsch_Twr*, const uint8_t*, unsigned, Tsch_Twr*);
+static void     tsch_twr_put       (Tsch_Twr*, const Tsch_Twr*);
+static uint32_t tsch_dstwr_tof     (const Tsch_Twr*, const Tsch_Dstwr*, uint64_t);
+static void     tsch_dstwr_write   (uint8_t*, const Tsch_Dstwr*);
+static void     tsch_dstwr_read    (const uint8_t*, Tsch_Dstwr*);
+static void     tsch_link_update   (const Ieee154_Frame*, bool);
+
+static Ieee154_Frame* tsch_reserve_frame      (void);
+static Ieee154_Frame* tsch_reserve_class_frame(Tsch_Class, uint32_t);
+static void           tsch_release_frame      (Ieee154_Frame*);
+static void           tsch_queue_frame        (Ieee154_Frame*, Tsch_Class, uint32_t);
+static void           tsch_dequeue_frame      (TsSlot*);
+static bool           tsch_evict_frame        (Tsch_Class, const uint32_t*);
+static unsigned       tsch_drop_datagram      (Tsch_Class, uint32_t);
+static Ieee154_Frame* tsch_codel_dequeue      (Tsch_Class);
 
 
 /* Private Variables ----------------------------------------------------------------------------- */
+static Tsch_Twr tsch_twr_init[TSCH_TWR_NUM_NBRS];	/* Last exchanges this node initiated */
+static Tsch_Twr tsch_twr_resp[TSCH_TWR_NUM_NBRS];	/* Last exchanges this node responded to */
+static struct k_spinlock tsch_twr_lock;	/* Exchanges are updated in the slot ISR */
+static Tsch_Qos tsch_qos;
+static Tsch_Link tsch_links[TSCH_NUM_LINKS];
+static struct k_spinlock tsch_link_lock;	/* Links are updated in the slot ISR */
+
+/* Frames each class may send per round. Control traffic has strict priority and no weight. */
+static const uint8_t tsch_class_weight[TSCH_NUM_CLASSES] = { 0, 4, 2, 1 };
+
 static struct net_icmpv6_handler rs_input_handler = {
 	.type = NET_ICMPV6_RS, .code = 0, .handler = handle_rs_input,
 };
@@ -151,6 +247,9 @@ static struct net_if* tsch_iface;	/* TODO: utilize device struct */
 uint8_t       tsch_frame_data[TSCH_NUM_FRAMES][IEEE154_STD_PACKET_LENGTH];
 // uint8_t       tsch_frame_data[TSCH_NUM_FRAMES][255];
 Ieee154_Frame tsch_frames[TSCH_NUM_FRAMES];
+uint32_t      tsch_frame_queued[TSCH_NUM_FRAMES];	/* Time in ms a frame was queued */
+uint32_t      tsch_frame_tag[TSCH_NUM_FRAMES];		/* Datagram tag of a queued frame */
+Ieee154_Frame* volatile tsch_dist_frame;			/* Queued distance measurement frame */
 Pool          tsch_frame_pool;
 uint8_t       tsch_adv_frame_data[IEEE154_STD_PACKET_LENGTH];
 Ieee154_Frame tsch_adv_frame;
@@ -225,6 +324,7 @@ static void tsch_if_init(struct net_if* iface)
 	// net_if_flag_set(iface, NET_IF_NO_AUTO_START);
 
 	tsch_init();
+	snap_init();
 }
 
 
@@ -260,10 +360,13 @@ static int tsch_if_send(struct net_if* iface, struct net_pkt* pkt)
 
 	TsSlotframe* sf   = ts_slotframe_find(TSCH_SF_PRIO_0);
 	TsSlot*      slot = ts_slot_find(sf, 1);
-	if(tsch_tx_pkt(pkt, slot, K_MSEC(20000), false) != 0)
+	int err = tsch_tx_pkt(pkt, slot, K_MSEC(20000), false);
+
+	/* Returning an error lets the network stack release and account for the packet */
+	if(err != 0)
 	{
-		LOG_ERR("fail transmitting packet");
-		return 0;
+		LOG_ERR("fail transmitting packet: %d", err);
+		return err;
 	}
 
 	size_t len = net_pkt_get_len(pkt);
@@ -297,10 +400,20 @@ static int tsch_tx_pkt(struct net_pkt* pkt, TsSlot* slot, k_timeout_t timeout, b
 	net_pkt_cursor_restore(pkt, &cursor);
 
 	Ieee154_Frame* frame = 0;
+	Tsch_Class cls = tsch_pkt_class(pkt, hdr);
 	unsigned sent = 0;
 	uint8_t frags_bitmap[1280/64] = { 0 };
 	Bits frags = make_bits(frags_bitmap, (net_pkt_get_len(pkt) + 7) / 8);
 	uint32_t fragid = sys_rand32_get();
+	fragid += (fragid == TSCH_TAG_NONE);
+
+	/* Refuse new packets of a class whose queue delay is persistently above target. The sender
+	 * sees ENOBUFS instead of the packet silently displacing frames further down the queue. */
+	if(cls != TSCH_CLASS_CONTROL && tsch_qos.codel[cls].dropping)
+	{
+		LOG_WRN("class %d congested", cls);
+		return -ENOBUFS;
+	}
 
 	// if(net_pkt_lladdr_dst(pkt)->addr != 0)
 	// {
@@ -314,7 +427,7 @@ static int tsch_tx_pkt(struct net_pkt* pkt, TsSlot* slot, k_timeout_t timeout, b
 	// }
 
 	do {
-		frame = tsch_reserve_frame();
+		frame = tsch_reserve_class_frame(cls, fragid);
 		if(!frame)
 		{
 			LOG_ERR("fail allocating frame");
@@ -356,12 +469,12 @@ static int tsch_tx_pkt(struct net_pkt* pkt, TsSlot* slot, k_timeout_t timeout, b
 		if(!sent)
 		{
 			LOG_ERR("fail compressing frame");
-			break;
+			goto error;
 		}
 		else
 		{
 			LOG_INF("frame %p sent %d of %d", frame, sent, net_pkt_get_len(pkt));
-			k_queue_append(&slot->tx_queue, frame);
+			tsch_queue_frame(frame, cls, fragid);
 		}
 	} while(sent < net_pkt_get_len(pkt));
 
@@ -369,10 +482,95 @@ static int tsch_tx_pkt(struct net_pkt* pkt, TsSlot* slot, k_timeout_t timeout, b
 
 	return 0;
 
+	/* Withdraw the fragments already queued. The receiver can't reassemble the datagram without
+	 * the rest of it. Fragments already on the slot's tx queue may be in flight and are sent. */
 	error:
 		LOG_DBG("error");
-		tsch_release_frame(frame);
-		return -1;
+		if(frame)
+		{
+			tsch_release_frame(frame);
+		}
+		tsch_drop_datagram(cls, fragid);
+		return -ENOBUFS;
+}
+
+
+/* tsch_pkt_class *******************************************************************************//**
+ * @brief		Returns the traffic class of a packet. A socket priority or a DSCP set by the sender
+ * 				takes precedence. Otherwise the class is derived from the protocol, UDP port and
+ * 				length of the packet. */
+static Tsch_Class tsch_pkt_class(struct net_pkt* pkt, struct net_ipv6_hdr* hdr)
+{
+	struct net_pkt_cursor cursor;
+	uint8_t  prio    = net_pkt_priority(pkt);
+	uint8_t  dscp    = (((hdr->vtc & 0x0F) << 4) | (hdr->tcflow >> 4)) >> 2;
+	uint8_t  nexthdr = hdr->nexthdr;
+	uint8_t  extlen  = 0;
+	uint16_t src     = 0;
+	uint16_t dst     = 0;
+
+	/* Socket priority */
+	if(prio >= NET_PRIORITY_IC)
+	{
+		return TSCH_CLASS_CONTROL;
+	}
+	else if(prio >= NET_PRIORITY_CA)
+	{
+		return TSCH_CLASS_REALTIME;
+	}
+	else if(prio == NET_PRIORITY_BK)
+	{
+		return TSCH_CLASS_BULK;
+	}
+
+	/* DSCP. CS6/CS7 is network control, EF is expedited and CS1/LE is lower effort */
+	if(dscp >= 48)
+	{
+		return TSCH_CLASS_CONTROL;
+	}
+	else if(dscp == 46)
+	{
+		return TSCH_CLASS_REALTIME;
+	}
+	else if(dscp == 8 || dscp == 1)
+	{
+		return TSCH_CLASS_BULK;
+	}
+
+	/* Hyperspace coordinates are carried in a hop-by-hop options header */
+	net_pkt_cursor_backup(pkt, &cursor);
+	net_pkt_cursor_init(pkt);
+	net_pkt_skip(pkt, sizeof(struct net_ipv6_hdr));
+
+	if(nexthdr == NET_IPV6_NEXTHDR_HBHO)
+	{
+		net_pkt_read_u8(pkt, &nexthdr);
+		net_pkt_read_u8(pkt, &extlen);
+		net_pkt_skip(pkt, (extlen + 1) * 8 - 2);
+	}
+
+	if(nexthdr == IPPROTO_UDP)
+	{
+		net_pkt_read_be16(pkt, &src);
+		net_pkt_read_be16(pkt, &dst);
+	}
+
+	net_pkt_cursor_restore(pkt, &cursor);
+
+	if(nexthdr == IPPROTO_ICMPV6)
+	{
+		return TSCH_CLASS_CONTROL;
+	}
+	else if(src == TSCH_LOC_PORT || dst == TSCH_LOC_PORT)
+	{
+		return TSCH_CLASS_REALTIME;
+	}
+	else if(net_pkt_get_len(pkt) > TSCH_BULK_LENGTH)
+	{
+		return TSCH_CLASS_BULK;
+	}
+
+	return TSCH_CLASS_DEFAULT;
 }
 
 
@@ -407,6 +605,14 @@ void tsch_init(void)
 {
 	pool_init(&tsch_frame_pool, tsch_frames, TSCH_NUM_FRAMES, sizeof(tsch_frames[0]));
 
+	for(unsigned i = 0; i < TSCH_NUM_CLASSES; i++)
+	{
+		k_queue_init(&tsch_qos.queue[i]);
+		tsch_qos.credit[i] = tsch_class_weight[i];
+		tsch_qos.drops[i]  = 0;
+		codel_init(&tsch_qos.codel[i], TSCH_CODEL_TARGET_MS, TSCH_CODEL_INTERVAL_MS);
+	}
+
 	/* Initialize Tsch struct */
 	sys_rand_get(&tsch.dsn, sizeof(tsch.dsn));
 	sys_rand_get(&tsch.ebsn, sizeof(tsch.ebsn));
@@ -416,6 +622,12 @@ void tsch_init(void)
 
 	// backoff_init(&tsch.backoff, 2, 32);
 	bayes_init(&tsch.bayes_bcast, 10.0f);
+	prng_init(&tsch.rng);
+
+	memmove(tsch.hopping_seq, hopping_default_seq, hopping_default_len * sizeof(Tsch_Channel));
+	tsch.hopping_len = hopping_default_len;
+	tsch.warm.valid  = false;
+	atomic_clear(&tsch.adv_burst);
 
 	net_mgmt_init_event_callback(&tsch.prefix_cb, tsch_handle_prefix, NET_EVENT_IPV6_PREFIX_ADD);
 	net_mgmt_add_event_callback(&tsch.prefix_cb);
@@ -430,6 +642,9 @@ void tsch_init(void)
 	nrf_gpiote_event_enable(NRF_GPIOTE, 0);
 
 	ts_init();
+	ts_stats_register(tsch_scan_slot,   "scan");
+	ts_stats_register(tsch_adv_slot,    "adv");
+	ts_stats_register(tsch_shared_slot, "shared");
 
 	/* Initialize DW1000 */
 	dw1000_init            (&dw, DW1000_IRQ_PIN);
@@ -749,6 +964,10 @@ static enum net_verdict handle_rs_input(
 	 * 7.	Discard if the IP source address is the unspecified address and there is no source
 	 * 		link-layer address option in the message. */
 
+	/* A node that just joined is soliciting routers. Nodes tend to join in groups after a power
+	 * cycle so advertise more often for a short while to help the remaining nodes sync. */
+	atomic_set(&tsch.adv_burst, TSCH_ADV_BURST_COUNT);
+
 	/* Create RA */
 
 	/* +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
@@ -947,6 +1166,54 @@ void tsch_stop_scan(void)
 }
 
 
+/* tsch_congested *******************************************************************************//**
+ * @brief		Returns true if the shared slot is congested. Periodic senders should skip or slow
+ * 				down their transmissions while congested. */
+bool tsch_congested(void)
+{
+	for(unsigned i = TSCH_CLASS_CONTROL + 1; i < TSCH_NUM_CLASSES; i++)
+	{
+		if(tsch_qos.codel[i].dropping)
+		{
+			return true;
+		}
+	}
+
+	return pool_free(&tsch_frame_pool) == 0;
+}
+
+
+/* tsch_link_etx ********************************************************************************//**
+ * @brief		Returns the expected number of transmissions needed to deliver a frame to the neighbor.
+ * 				Neighbors without a recent estimate are assumed to be perfect links so that they are
+ * 				tried. */
+float tsch_link_etx(const uint8_t* addr)
+{
+	float    etx = 1.0f;
+	uint32_t now = k_uptime_get_32();
+
+	k_spinlock_key_t key = k_spin_lock(&tsch_link_lock);
+
+	for(unsigned i = 0; i < TSCH_NUM_LINKS; i++)
+	{
+		Tsch_Link* link = &tsch_links[i];
+
+		if(link->valid && memcmp(link->addr, addr, 8) == 0)
+		{
+			if(now - link->uptime < TSCH_LINK_TIMEOUT_MS)
+			{
+				etx = 1.0f / link->prr;
+			}
+			break;
+		}
+	}
+
+	k_spin_unlock(&tsch_link_lock, key);
+
+	return etx;
+}
+
+
 /* tsch_meas_dist *******************************************************************************//**
  * @brief		Starts a distance measurement between this node and the destination node. The
  *				destination node is assumed to be in the local neighborhood. */
@@ -975,9 +1242,127 @@ void tsch_meas_dist(const uint8_t* dest)
 	ieee154_set_seqnum     (tx, tsch.dsn++);
 	ieee154_set_addr       (tx, 0, dest, 8, 0, tsch.addr, 8);
 
+	/* Ask the responder to close the round trip of the previous exchange with it */
+	Tsch_Twr prev;
+
+	if(TSCH_DSTWR_ENABLED && tsch_twr_get(tsch_twr_init, dest, 8, &prev))
+	{
+		Tsch_Dstwr_Req req = { .seqnum = prev.seqnum };
+		uint8_t        buf[TSCH_DSTWR_REQ_IE_LEN];
+
+		le_set_u8(&buf[0], req.seqnum);
+
+		Ieee154_IE ie = ieee154_ie_first(tx);
+		ieee154_hie_append(&ie, TSCH_DSTWR_REQ_IE, buf, sizeof(buf));
+		ieee154_hie_append(&ie, IEEE154_HT2_IE, 0, 0);
+	}
+
 	LOG_DBG("tx dist meas: %p", tx);
 
-	k_queue_append(&slot->tx_queue, tx);
+	tsch_dist_frame = tx;
+	tsch_queue_frame(tx, TSCH_CLASS_REALTIME, TSCH_TAG_NONE);
+}
+
+
+/* tsch_channel_hop *****************************************************************************//**
+ * @brief		Switches the radio to the channel of the slot's cell for the current ASN. The channel
+ * 				is the entry of the hopping sequence at (ASN + channel offset) % hopping length.
+ * 				Must be called from the slot handler before the radio is started. The hopping
+ * 				sequence was checked with hopping_check when it was adopted so switching can't
+ * 				fail. */
+void tsch_channel_hop(TsSlot* slot)
+{
+	tsch_channel_hop_lane(slot, 0);
+}
+
+
+/* tsch_channel_hop_lane ************************************************************************//**
+ * @brief		Switches the radio to the channel of a lane of the slot's cell. Lane l uses the entry
+ * 				of the hopping sequence at (ASN + channel offset + l) % hopping length so that
+ * 				concurrent cells never share a channel and code. See tsch_hopping_lanes. */
+void tsch_channel_hop_lane(TsSlot* slot, unsigned lane)
+{
+	const Tsch_Channel* ch = hopping_channel(
+		tsch.hopping_seq, tsch.hopping_len, ts_current_asn(), slot->channel + lane);
+
+	dw1000_set_channel_code(&dw, ch->channel, ch->code);
+}
+
+
+/* tsch_hopping_lanes ***************************************************************************//**
+ * @brief		Returns how many lanes, up to max, the network's hopping sequence supports. */
+unsigned tsch_hopping_lanes(unsigned max)
+{
+	return hopping_lanes(tsch.hopping_seq, tsch.hopping_len, max);
+}
+
+
+/* tsch_warm_channel ****************************************************************************//**
+ * @brief		Returns true if the network's timing is still known from the last time this node was
+ * 				synchronized. If so, ch is set to the channel of the next advertising slot. The
+ * 				advertising slot is slot 0 with channel offset 0. If the network may be up to spread
+ * 				slotframes ahead of the prediction, each call tries the next offset so that every
+ * 				offset is listened to within spread + 1 scan windows. */
+static bool tsch_warm_channel(Tsch_Channel* ch)
+{
+	if(!tsch.warm.valid)
+	{
+		return false;
+	}
+
+	if(k_uptime_get() - tsch.warm.uptime > TSCH_WARM_MAX_AGE_MS)
+	{
+		LOG_INF("warm start expired");
+		tsch.warm.valid = false;
+		return false;
+	}
+
+	uint64_t asn = tsch.warm.asn + (ts_asn_now() - tsch.warm.local);
+	uint64_t sf  = asn / TSCH_DEFAULT_NUM_SLOTS + 1 + tsch.warm.probe;
+
+	tsch.warm.probe = (tsch.warm.probe + 1) % (tsch.warm.spread + 1);
+
+	*ch = *hopping_channel(tsch.hopping_seq, tsch.hopping_len, sf * TSCH_DEFAULT_NUM_SLOTS, 0);
+	return true;
+}
+
+
+/* tsch_snapshot ********************************************************************************//**
+ * @brief		Copies the network's hopping sequence which is saved across reboots. Planned is true if
+ * 				the snapshot is saved immediately before a reboot. */
+void tsch_snapshot(TschSnapshot* s, bool planned)
+{
+	s->planned     = planned;
+	s->hopping_len = tsch.hopping_len;
+	memmove(s->hopping_seq, tsch.hopping_seq, sizeof(s->hopping_seq));
+}
+
+
+/* tsch_restore *********************************************************************************//**
+ * @brief		Restores the network's hopping sequence so that scanning listens on the network's
+ * 				channels. If the snapshot was saved before a planned reboot, the network's ASN was asn
+ * 				at most TSCH_WARM_REBOOT_SF slotframes ago. The directed scan then only listens on the
+ * 				channels of those slotframes. Must be called after tsch_init. */
+void tsch_restore(const TschSnapshot* s, uint64_t asn)
+{
+	if(!hopping_check(s->hopping_seq, s->hopping_len, dwcfg.prf))
+	{
+		LOG_WRN("invalid saved hopping sequence");
+		return;
+	}
+
+	memmove(tsch.hopping_seq, s->hopping_seq, s->hopping_len * sizeof(Tsch_Channel));
+	tsch.hopping_len = s->hopping_len;
+
+	if(s->planned)
+	{
+		tsch.warm.valid  = true;
+		tsch.warm.asn    = asn;
+		tsch.warm.local  = ts_asn_now();
+		tsch.warm.uptime = k_uptime_get();
+		tsch.warm.spread = TSCH_WARM_REBOOT_SF;
+		tsch.warm.probe  = 0;
+	}
 }
 
 
@@ -1092,6 +1477,19 @@ static void tsch_handle_event(Tsch_Event id)
 		goto cleanup;
 	}
 
+	/* Remember the network timing when sync is lost so that rejoining can listen on the channel
+	 * the network is predicted to advertise on. */
+	if(tsch.next_state == TSCH_IDLE_STATE &&
+	   (tsch.state == TSCH_SYNCED_STATE || tsch.state == TSCH_CONNECTED_STATE))
+	{
+		tsch.warm.valid  = true;
+		tsch.warm.asn    = ts_asn_now();
+		tsch.warm.local  = tsch.warm.asn;
+		tsch.warm.uptime = k_uptime_get();
+		tsch.warm.spread = 0;
+		tsch.warm.probe  = 0;
+	}
+
 	tsch.state = tsch.next_state;
 
 	/* Next state logic */
@@ -1135,6 +1533,7 @@ static void tsch_handle_event(Tsch_Event id)
 				1,
 				tsch_shared_slot);
 
+			snap_restore(ts_current_asn());
 			loc_start();
 
 			/* Timeout immediately to transition to the CONNECTED state. */
@@ -1187,35 +1586,104 @@ static void tsch_scan_slot(TsSlot* slot)
 	uint64_t asn          = 0;
 	int32_t  local_tstamp = 0;
 	uint64_t toffset      = 0;
-	int64_t  duration     = 60000;
+	int64_t  duration     = TSCH_SCAN_TIMEOUT_MS;
+	int64_t  window;
+	bool     has_sync;
+	bool     has_sched;
+	uint8_t  hopping_len;
+	bool     hopping_bad;
+	LocSchedule  sched;
+	Tsch_Channel ch;
+	Tsch_Channel hopping_seq[TSCH_MAX_HOPPING_LEN];
 
 	while(duration > 0)
 	{
+		/* Directed scan. Listen on the channel the network is predicted to advertise on for one
+		 * slotframe. Otherwise, listen on the first entry of the hopping sequence. Networks cycle
+		 * their advertisements through every entry so the advertisement is eventually heard on
+		 * this channel. */
+		if(tsch_warm_channel(&ch))
+		{
+			window = duration < TSCH_WARM_WINDOW_MS ? duration : TSCH_WARM_WINDOW_MS;
+		}
+		else
+		{
+			ch     = tsch.hopping_seq[0];
+			window = duration;
+		}
+
+		dw1000_set_channel_code(&dw, ch.channel, ch.code);
+
 		int64_t now  = k_uptime_get();
-		local_tstamp = tsch_radio_rx(rx, -1ull, duration, &status);
+		local_tstamp = tsch_radio_rx(rx, -1ull, window, &status);
 		duration    -= k_uptime_delta(&now);
 
 		if((status & DW1000_SYS_STATUS_RXFCG) && ieee154_frame_type(rx) == IEEE154_FRAME_TYPE_BEACON)
 		{
-			ie = ieee154_ie_first(rx);
+			ie          = ieee154_ie_first(rx);
+			has_sync    = false;
+			has_sched   = false;
+			hopping_len = 0;
+			hopping_bad = false;
 
 			while(ieee154_ie_is_valid(&ie))
 			{
 				if(ieee154_ie_is_hie(&ie) && ieee154_ie_type(&ie) == TSCH_SYNC_IE)
 				{
-					if(tsch.on_scan_cb && tsch.on_scan_cb(rx))
+					Buffer* b = ieee154_ie_reset_buffer(&ie);
+					asn      = le_get_u64(buffer_pop_u64(b));
+					// asn     = le_get_u64(ieee154_ie_ptr_content(&ie));
+					has_sync = true;
+				}
+				else if(ieee154_ie_is_hie(&ie) && ieee154_ie_type(&ie) == TSCH_HOPPING_IE)
+				{
+					/* Sequences that are too long or hop to a channel this radio can't use are
+					 * rejected below rather than truncated so that every node hops the same. */
+					hopping_len = ieee154_ie_length_content(&ie) / sizeof(Tsch_Channel);
+					hopping_bad = !hopping_check(ieee154_ie_ptr_content(&ie), hopping_len,
+						dwcfg.prf);
+
+					if(!hopping_bad)
 					{
-						Buffer* b = ieee154_ie_reset_buffer(&ie);
-						asn     = le_get_u64(buffer_pop_u64(b));
-						// asn     = le_get_u64(ieee154_ie_ptr_content(&ie));
-						toffset = ts_current_toffset(local_tstamp);
-						LOG_DBG("asn = %d. toffset = %d", (uint32_t)asn, (uint32_t)toffset);
-						goto sync;
+						memmove(hopping_seq, ieee154_ie_ptr_content(&ie),
+							hopping_len * sizeof(Tsch_Channel));
 					}
 				}
+				else if(ieee154_ie_is_hie(&ie) && ieee154_ie_type(&ie) == TSCH_SCHED_IE &&
+				        ieee154_ie_length_content(&ie) == sizeof(LocSchedule))
+				{
+					has_sched = true;
+					memmove(&sched, ieee154_ie_ptr_content(&ie), sizeof(LocSchedule));
+				}
 
 				ieee154_ie_next(&ie);
 			}
+
+			/* Join the first network that is accepted. There is no benefit in listening for more
+			 * advertisements since the best parent is chosen after joining. */
+			if(hopping_bad)
+			{
+				LOG_WRN("invalid hopping sequence");
+			}
+			else if(has_sync && tsch.on_scan_cb && tsch.on_scan_cb(rx))
+			{
+				toffset = ts_current_toffset(local_tstamp);
+				LOG_DBG("asn = %d. toffset = %d", (uint32_t)asn, (uint32_t)toffset);
+
+				/* Adopt the network's hopping sequence and location schedule */
+				if(hopping_len > 0)
+				{
+					memmove(tsch.hopping_seq, hopping_seq, hopping_len * sizeof(Tsch_Channel));
+					tsch.hopping_len = hopping_len;
+				}
+
+				if(has_sched)
+				{
+					loc_schedule_rx(&sched);
+				}
+
+				goto sync;
+			}
 		}
 	}
 
@@ -1226,7 +1694,9 @@ static void tsch_scan_slot(TsSlot* slot)
 
 	sync:
 		/* Synchronize to the network */
+		LOG_INF("sync. asn = %u. predicted asn = %u", (uint32_t)asn, (uint32_t)ts_current_asn());
 		ts_sync(asn, toffset - TSCH_TX_OFFSET_US);
+		tsch.warm.valid = false;
 
 		tsch_handle_event(TSCH_SYNC_EVENT);
 		tsch_release_frame(rx);
@@ -1254,12 +1724,16 @@ static void tsch_adv_slot(TsSlot* slot)
 
 	Ieee154_Frame* frame = &tsch_adv_frame;
 
+	tsch_channel_hop(slot);
+
 	int32_t  local_tstamp;
 	uint32_t status = dw1000_read_status(&dw);
 	uint64_t tstamp = dw1000_read_sys_tstamp(&dw);
 	uint64_t asn    = ts_current_asn();
 	unsigned idx    = loc_beacon_index();
 
+	ts_deadline_ref();
+
 	/* Prime beacons (index 0, 1, 2, 3) transmit advertisements */
 	if(loc_is_beacon() && idx < 4)
 	{
@@ -1267,7 +1741,10 @@ static void tsch_adv_slot(TsSlot* slot)
 		{
 			LOG_DBG("start tx adv (%d). asn = %d", idx, (uint32_t)asn);
 
-			const char ssid[] = "Hyperspace";
+			const char  ssid[] = "Hyperspace";
+			LocSchedule sched  = loc_schedule();
+			HyperGwAdv  gws[HYPER_MAX_GW_ADVS];
+			unsigned    num_gws = hyperspace_gateway_adv(gws, HYPER_MAX_GW_ADVS);
 
 			ieee154_beacon_frame_init(frame, tsch_adv_frame_data, sizeof(tsch_adv_frame_data));
 			ieee154_set_seqnum       (frame, tsch.ebsn++);
@@ -1276,8 +1753,16 @@ static void tsch_adv_slot(TsSlot* slot)
 			Ieee154_IE ie = ieee154_ie_first(frame);
 			ieee154_hie_append(&ie, TSCH_SSID_IE, ssid, sizeof(ssid) - 1);
 			ieee154_hie_append(&ie, TSCH_SYNC_IE, &asn, sizeof(asn));
+			ieee154_hie_append(&ie, TSCH_HOPPING_IE,
+				tsch.hopping_seq, tsch.hopping_len * sizeof(Tsch_Channel));
+			ieee154_hie_append(&ie, TSCH_SCHED_IE, &sched, sizeof(sched));
+			if(num_gws)
+			{
+				ieee154_hie_append(&ie, TSCH_GW_IE, gws, num_gws * sizeof(gws[0]));
+			}
 			ieee154_hie_append(&ie, IEEE154_HT2_IE, 0, 0);
 
+			ts_deadline        (TSCH_TX_OFFSET_US);
 			tsch_radio_start_tx(frame, tstamp + dw1000_us_to_ticks(TSCH_TX_OFFSET_US));
 			tsch_radio_wait_tx (&status);
 		}
@@ -1290,6 +1775,7 @@ static void tsch_adv_slot(TsSlot* slot)
 		LOG_DBG("start rx adv. asn = %d", (uint32_t)asn);
 
 		dw1000_set_rx_timeout(&dw, TSCH_RX_TIMEOUT_US);
+		ts_deadline(TSCH_RX_OFFSET_US);
 
 		local_tstamp = tsch_radio_rx(
 			frame,
@@ -1339,9 +1825,12 @@ static void tsch_shared_slot(TsSlot* slot)
 {
 	dw1000_lock(&dw);
 
+	tsch_channel_hop(slot);
+
 	uint64_t asn    = ts_current_asn();
 	uint64_t tstamp = dw1000_read_sys_tstamp(&dw);
 
+	ts_deadline_ref();
 	nrf_ppi_group_enable(NRF_PPI, NRF_PPI_CHANNEL_GROUP2);
 
 	LOG_DBG("start shared slot. asn = %d", (uint32_t)asn);
@@ -1352,7 +1841,10 @@ static void tsch_shared_slot(TsSlot* slot)
 	 * clocks atleast once every 10s. */
 	if(tsch.shared_cell_state == TSCH_CELL_IDLE_STATE)
 	{
-		if(tsch.state == TSCH_CONNECTED_STATE && loc_is_beacon() && calc_randf() <= 0.25f)
+		tsch_dequeue_frame(slot);
+
+		if(tsch.state == TSCH_CONNECTED_STATE && loc_is_beacon() &&
+		   (atomic_get(&tsch.adv_burst) > 0 || prng_chance(&tsch.rng, prng_threshold(TSCH_ADV_PROBABILITY))))
 		{
 			tsch.shared_cell_state = TSCH_CELL_ADV_STATE;
 		}
@@ -1396,7 +1888,10 @@ static void tsch_shared_adv(TsSlot* slot, uint64_t tstamp, uint64_t asn)
 {
 	/* Todo: combine with tsch_adv_slot */
 	uint32_t status;
-	const char ssid[] = "Hyperspace";
+	const char  ssid[] = "Hyperspace";
+	LocSchedule sched  = loc_schedule();
+	HyperGwAdv  gws[HYPER_MAX_GW_ADVS];
+	unsigned    num_gws = hyperspace_gateway_adv(gws, HYPER_MAX_GW_ADVS);
 
 	Ieee154_Frame* frame = &tsch_adv_frame;
 
@@ -1407,15 +1902,29 @@ static void tsch_shared_adv(TsSlot* slot, uint64_t tstamp, uint64_t asn)
 	Ieee154_IE ie = ieee154_ie_first(frame);
 	ieee154_hie_append(&ie, TSCH_SSID_IE, ssid, sizeof(ssid) - 1);
 	ieee154_hie_append(&ie, TSCH_SYNC_IE, &asn, sizeof(asn));
+	ieee154_hie_append(&ie, TSCH_HOPPING_IE,
+		tsch.hopping_seq, tsch.hopping_len * sizeof(Tsch_Channel));
+	ieee154_hie_append(&ie, TSCH_SCHED_IE, &sched, sizeof(sched));
+	if(num_gws)
+	{
+		ieee154_hie_append(&ie, TSCH_GW_IE, gws, num_gws * sizeof(gws[0]));
+	}
 	ieee154_hie_append(&ie, IEEE154_HT2_IE, 0, 0);
 
+	ts_deadline        (TSCH_TX_OFFSET_US);
 	tsch_radio_start_tx(frame, tstamp + dw1000_us_to_ticks(TSCH_TX_OFFSET_US));
 	tsch_radio_wait_tx (&status);
+	TRACE(TRACE_SHARED_ADV, ieee154_seqnum(frame));
 
 	slot->dropcount = 0;
 	tsch.shared_cell_state = TSCH_CELL_COOL_OFF_STATE;
 	bayes_success(&tsch.bayes_bcast);
 
+	if(atomic_get(&tsch.adv_burst) > 0)
+	{
+		atomic_dec(&tsch.adv_burst);
+	}
+
 	tsch_release_frame(frame);
 }
 
@@ -1440,10 +1949,12 @@ static void tsch_shared_tx(TsSlot* slot, uint64_t tstamp, uint64_t asn)
 	}
 
 	uint64_t txtstamp;
+	ts_deadline(TSCH_TX_OFFSET_US);
 	txtstamp = tstamp + dw1000_us_to_ticks(TSCH_TX_OFFSET_US);
 	txtstamp = calc_addmod_u64(txtstamp, tsch_radio_start_tx(tx, txtstamp), DW1000_TSTAMP_PERIOD);
 
 	tsch_radio_wait_tx(&status);
+	TRACE(TRACE_SHARED_TX, tx ? ieee154_seqnum(tx) : 0);
 
 	/* Transmit beacon once */
 	if(ieee154_frame_type(tx) == IEEE154_FRAME_TYPE_BEACON)
@@ -1471,6 +1982,7 @@ static void tsch_shared_tx(TsSlot* slot, uint64_t tstamp, uint64_t asn)
 		LOG_DBG("start rx ack");
 
 		dw1000_set_rx_timeout(&dw, TSCH_RX_ACK_TIMEOUT_US);
+		ts_deadline(TSCH_RX_ACK_OFFSET_US);
 
 		tsch_radio_rx(ack, tstamp + dw1000_us_to_ticks(TSCH_RX_ACK_OFFSET_US), -1u, &status);
 
@@ -1506,27 +2018,85 @@ static void tsch_shared_tx(TsSlot* slot, uint64_t tstamp, uint64_t asn)
 
 		/* Todo: time sync to ACK packet */
 
-		Ieee154_IE ie = ieee154_ie_first(ack);
+		Ieee154_IE ie    = ieee154_ie_first(ack);
+		bool       tresp = false;
+		bool       ds    = false;
+		uint32_t   reply = 0;
+		Tsch_Dstwr dstwr;
 
 		while(ieee154_ie_is_valid(&ie))
 		{
 			if(ieee154_ie_is_hie(&ie) && ieee154_ie_type(&ie) == TSCH_TRESP_IE)
 			{
-				uint64_t rxtstamp;
-				rxtstamp = dw1000_read_rx_tstamp(&dw);
-				rxtstamp = calc_submod_u64(rxtstamp, dw1000_ant_delay(&dw), DW1000_TSTAMP_PERIOD);
+				reply = le_get_u32(ieee154_ie_ptr_content(&ie));
+				tresp = true;
+			}
+			else if(ieee154_ie_is_hie(&ie) && ieee154_ie_type(&ie) == TSCH_DSTWR_IE &&
+			        ieee154_ie_length_content(&ie) == TSCH_DSTWR_IE_LEN)
+			{
+				tsch_dstwr_read(ieee154_ie_ptr_content(&ie), &dstwr);
+				ds = true;
+			}
+
+			ieee154_ie_next(&ie);
+		}
 
-				float    rco  =  dw1000_rx_clk_offset(&dw);
-				uint32_t dur  =  le_get_u32(ieee154_ie_ptr_content(&ie)) * (1.0f - rco);
-				uint32_t dist = (calc_submod_u64(rxtstamp, txtstamp, DW1000_TSTAMP_PERIOD) - dur)/2;
+		if(tresp)
+		{
+			uint64_t rxtstamp;
+			rxtstamp = dw1000_read_rx_tstamp(&dw);
+			rxtstamp = calc_submod_u64(rxtstamp, dw1000_ant_delay(&dw), DW1000_TSTAMP_PERIOD);
+
+			const uint8_t* dest = ieee154_dest_addr(tx);
+			unsigned       len  = ieee154_length_dest_addr(tx);
+			uint32_t       dist;
+			Tsch_Twr       prev;
+
+			/* Only distance measurements are reported. Every other ACK just continues the round
+			 * trips below, which needs no further SPI transactions in the slot. */
+			if(tx == tsch_dist_frame)
+			{
+				/* The ACK closes the round trip started by the previous ACK from this neighbor.
+				 * Use DS-TWR which cancels the clock offset error accumulated over the long ACK
+				 * turnaround. Otherwise, fall back to SS-TWR corrected by the rx clock offset. */
+				if(TSCH_DSTWR_ENABLED && ds && tsch_twr_get(tsch_twr_init, dest, len, &prev) &&
+				   prev.seqnum == dstwr.seqnum)
+				{
+					dist = tsch_dstwr_tof(&prev, &dstwr, txtstamp);
+				}
+				else
+				{
+					dist = twr_ss_tof(calc_submod_u64(rxtstamp, txtstamp, DW1000_TSTAMP_PERIOD),
+						reply, dw1000_rx_clk_offset(&dw));
+				}
 
-				loc_dist_measured(ieee154_dest_addr(tx), dist);
+				/* The raw receive diagnostics are handed over with the distance. Location drops
+				 * the distance if the ACK was received NLOS. */
+				DW1000_Rx_Diag diag;
+				dw1000_read_rx_diag(&dw, dw1000_read_rx_finfo(&dw), &diag);
+				loc_dist_measured(dest, dist, &diag);
+				tsch_dist_frame = 0;
 			}
 
-			ieee154_ie_next(&ie);
+			/* Start the next round trip */
+			if(len == 8)
+			{
+				Tsch_Twr next = {
+					.valid    = ieee154_length_seqnum(tx),
+					.seqnum   = ieee154_seqnum(tx),
+					.uptime   = k_uptime_get_32(),
+					.txtstamp = txtstamp,
+					.rxtstamp = rxtstamp,
+					.reply    = reply,
+				};
+
+				memmove(next.addr, dest, 8);
+				tsch_twr_put(tsch_twr_init, &next);
+			}
 		}
 
 		LOG_DBG("success");
+		TRACE(TRACE_TX_ACK, ieee154_seqnum(tx));
 		tsch_handle_ack(slot, tx, ack);
 	}
 
@@ -1551,6 +2121,8 @@ static void tsch_shared_tx(TsSlot* slot, uint64_t tstamp, uint64_t asn)
 
 	collision:
 		LOG_INF("collision");
+		TRACE(TRACE_TX_COLLISION, slot->dropcount);
+		tsch_link_update(tx, false);
 		// backoff_fail(&tsch.backoff);
 		bayes_fail(&tsch.bayes_bcast);
 
@@ -1559,6 +2131,7 @@ static void tsch_shared_tx(TsSlot* slot, uint64_t tstamp, uint64_t asn)
 
 		if(++slot->dropcount >= 5)
 		{
+			TRACE(TRACE_TX_DROP, ieee154_seqnum(tx));
 			tx = k_queue_get(&slot->tx_queue, K_NO_WAIT);
 			tsch_release_frame(tx);
 			slot->dropcount = 0;
@@ -1590,6 +2163,7 @@ static void tsch_shared_rx(TsSlot* slot, uint64_t tstamp, uint64_t asn)
 	}
 
 	dw1000_set_rx_timeout(&dw, TSCH_RX_TIMEOUT_US);
+	ts_deadline(TSCH_RX_OFFSET_US);
 	local_tstamp = tsch_radio_rx(rx, tstamp + dw1000_us_to_ticks(TSCH_RX_OFFSET_US), -1u, &status);
 	rxtstamp     = dw1000_read_rx_tstamp(&dw);
 	rxtstamp     = calc_submod_u64(rxtstamp, dw1000_ant_delay(&dw), DW1000_TSTAMP_PERIOD);
@@ -1598,6 +2172,7 @@ static void tsch_shared_rx(TsSlot* slot, uint64_t tstamp, uint64_t asn)
 	if(status & (DW1000_SYS_STATUS_RXRFTO | DW1000_SYS_STATUS_RXPTO))
 	{
 		LOG_DBG("timed out");
+		TRACE(TRACE_RX_TIMEOUT, 0);
 		bayes_hole(&tsch.bayes_bcast);
 		goto drop;
 	}
@@ -1619,6 +2194,7 @@ static void tsch_shared_rx(TsSlot* slot, uint64_t tstamp, uint64_t asn)
 	}
 
 	k_work_reschedule(&tsch.sync_lost_work, K_MSEC(TSCH_SYNC_LOST_TIMEOUT));
+	TRACE(TRACE_SHARED_RX, ieee154_length(rx));
 
 	if(!tsch_valid_addr(slot, rx))
 	{
@@ -1669,10 +2245,65 @@ static void tsch_shared_rx(TsSlot* slot, uint64_t tstamp, uint64_t asn)
 			Ieee154_IE ie  = ieee154_ie_first(ack);
 			uint32_t   dur = calc_submod_u64(acktstamp, rxtstamp, DW1000_TSTAMP_PERIOD);
 			ieee154_hie_append(&ie, TSCH_TRESP_IE, &dur, sizeof(dur));
+
+			const uint8_t* src    = ieee154_src_addr(rx);
+			unsigned       len    = ieee154_length_src_addr(rx);
+			uint8_t        seqnum = ieee154_seqnum(rx);
+			bool           ds     = false;
+			Tsch_Dstwr_Req req    = { 0 };
+			Tsch_Twr       prev;
+
+			for(Ieee154_IE it = ieee154_ie_first(rx); ieee154_ie_is_valid(&it); ieee154_ie_next(&it))
+			{
+				if(ieee154_ie_is_hie(&it) && ieee154_ie_type(&it) == TSCH_DSTWR_REQ_IE &&
+				   ieee154_ie_length_content(&it) == TSCH_DSTWR_REQ_IE_LEN)
+				{
+					req.seqnum = le_get_u8(ieee154_ie_ptr_content(&it));
+					ds         = true;
+				}
+			}
+
+			/* Close the round trip started by the previous ACK to this initiator if the
+			 * initiator is continuing that exchange */
+			if(TSCH_DSTWR_ENABLED && ds && tsch_twr_get(tsch_twr_resp, src, len, &prev) &&
+			   prev.seqnum == req.seqnum)
+			{
+				Tsch_Dstwr dstwr = {
+					.seqnum = prev.seqnum,
+					.round  = calc_submod_u64(rxtstamp, prev.txtstamp, DW1000_TSTAMP_PERIOD),
+				};
+				uint8_t buf[TSCH_DSTWR_IE_LEN];
+
+				tsch_dstwr_write(buf, &dstwr);
+				ieee154_hie_append(&ie, TSCH_DSTWR_IE, buf, sizeof(buf));
+			}
+
 			ieee154_hie_append(&ie, IEEE154_HT2_IE, 0, 0);
 
+			/* Start the next round trip */
+			if(len == 8)
+			{
+				Tsch_Twr next = {
+					.valid    = ieee154_length_seqnum(rx),
+					.seqnum   = seqnum,
+					.uptime   = k_uptime_get_32(),
+					.txtstamp = acktstamp,
+				};
+
+				memmove(next.addr, src, 8);
+				tsch_twr_put(tsch_twr_resp, &next);
+			}
+
+			/* The ACK is scheduled from the rx timestamp which is TSCH_TX_OFFSET_US into the
+			 * sender's slot. Its deadline is only approximately TSCH_TX_ACK_OFFSET_US. */
+			ts_deadline(TSCH_TX_ACK_OFFSET_US);
 			dw1000_write_tx_fctrl(&dw, 0, ieee154_length(ack) + 2);
-			dw1000_start_delayed_tx(&dw, false);
+
+			if(!dw1000_start_delayed_tx(&dw, false))
+			{
+				ts_deadline_missed();
+			}
+
 			dw1000_write_tx(&dw, ieee154_ptr_start(ack), 0, ieee154_length(ack));
 			tsch_release_frame(ack);
 		}
@@ -1695,6 +2326,7 @@ static void tsch_shared_rx(TsSlot* slot, uint64_t tstamp, uint64_t asn)
 
 	collision:
 		LOG_DBG("collision");
+		TRACE(TRACE_RX_COLLISION, 0);
 		// backoff_fail(&tsch.backoff);
 		bayes_fail(&tsch.bayes_bcast);
 
@@ -1712,7 +2344,12 @@ static int32_t tsch_radio_start_tx(Ieee154_Frame* tx, uint64_t tstamp)
 	int32_t trx_offset = dw1000_set_trx_tstamp(&dw, tstamp) + dw1000_ant_delay(&dw);
 
 	dw1000_write_tx_fctrl  (&dw, 0, ieee154_length(tx) + 2);
-	dw1000_start_delayed_tx(&dw, false);
+
+	if(!dw1000_start_delayed_tx(&dw, false))
+	{
+		ts_deadline_missed();
+	}
+
 	dw1000_write_tx        (&dw, ieee154_ptr_start(tx), 0, ieee154_length(tx));
 
 	return trx_offset;
@@ -1738,8 +2375,12 @@ static int32_t tsch_radio_rx(Ieee154_Frame* rx, uint64_t tstamp, uint32_t timeou
 
 	if(tstamp != -1ull)
 	{
-		dw1000_set_trx_tstamp  (&dw, tstamp);
-		dw1000_start_delayed_rx(&dw);
+		dw1000_set_trx_tstamp(&dw, tstamp);
+
+		if(!dw1000_start_delayed_rx(&dw))
+		{
+			ts_deadline_missed();
+		}
 	}
 	else
 	{
@@ -1780,6 +2421,104 @@ static int32_t tsch_radio_rx(Ieee154_Frame* rx, uint64_t tstamp, uint32_t timeou
 
 
 
+/* tsch_twr_get *********************************************************************************//**
+ * @brief		Copies the previous ranging exchange with the neighbor at addr out of a table.
+ * 				Returns false if there is none or it is too old for its timestamps to unwrap. */
+static bool tsch_twr_get(const Tsch_Twr* table, const uint8_t* addr, unsigned len, Tsch_Twr* twr)
+{
+	bool     found = false;
+	uint32_t now   = k_uptime_get_32();
+
+	if(len != 8)
+	{
+		return false;
+	}
+
+	k_spinlock_key_t key = k_spin_lock(&tsch_twr_lock);
+
+	for(unsigned i = 0; i < TSCH_TWR_NUM_NBRS && !found; i++)
+	{
+		const Tsch_Twr* ptr = &table[i];
+
+		if(ptr->valid && memcmp(ptr->addr, addr, 8) == 0 &&
+		   now - ptr->uptime < TSCH_DSTWR_MAX_AGE_MS)
+		{
+			*twr  = *ptr;
+			found = true;
+		}
+	}
+
+	k_spin_unlock(&tsch_twr_lock, key);
+
+	return found;
+}
+
+
+/* tsch_twr_put *********************************************************************************//**
+ * @brief		Stores the latest ranging exchange with a neighbor in a table. A neighbor without an
+ * 				exchange replaces the exchange that is oldest. An invalid exchange forgets the
+ * 				neighbor's previous one. */
+static void tsch_twr_put(Tsch_Twr* table, const Tsch_Twr* twr)
+{
+	uint32_t  now  = k_uptime_get_32();
+	Tsch_Twr* slot = 0;
+	Tsch_Twr* lru  = &table[0];
+
+	k_spinlock_key_t key = k_spin_lock(&tsch_twr_lock);
+
+	for(unsigned i = 0; i < TSCH_TWR_NUM_NBRS && !slot; i++)
+	{
+		Tsch_Twr* ptr = &table[i];
+
+		if(ptr->valid && memcmp(ptr->addr, twr->addr, 8) == 0)
+		{
+			slot = ptr;
+		}
+		else if(!ptr->valid || (lru->valid && now - ptr->uptime > now - lru->uptime))
+		{
+			lru = ptr;
+		}
+	}
+
+	if(slot || twr->valid)
+	{
+		*(slot ? slot : lru) = *twr;
+	}
+
+	k_spin_unlock(&tsch_twr_lock, key);
+}
+
+
+/* tsch_dstwr_tof *******************************************************************************//**
+ * @brief		Computes the double-sided TWR time of flight in DW1000 ticks from the previous
+ * 				exchange and the responder's TSCH_DSTWR_IE. See twr_ds_tof. */
+static uint32_t tsch_dstwr_tof(const Tsch_Twr* prev, const Tsch_Dstwr* ds, uint64_t txtstamp)
+{
+	uint64_t round1 = calc_submod_u64(prev->rxtstamp, prev->txtstamp, DW1000_TSTAMP_PERIOD);
+	uint64_t reply2 = calc_submod_u64(txtstamp, prev->rxtstamp, DW1000_TSTAMP_PERIOD);
+
+	return twr_ds_tof(round1, prev->reply, ds->round, reply2);
+}
+
+
+/* tsch_dstwr_write *****************************************************************************//**
+ * @brief		Writes the TSCH_DSTWR_IE_LEN byte content of a TSCH_DSTWR_IE. */
+static void tsch_dstwr_write(uint8_t* buf, const Tsch_Dstwr* ds)
+{
+	le_set_u8 (&buf[0], ds->seqnum);
+	le_set_u64(&buf[1], ds->round);
+}
+
+
+/* tsch_dstwr_read ******************************************************************************//**
+ * @brief		Reads the TSCH_DSTWR_IE_LEN byte content of a TSCH_DSTWR_IE. */
+static void tsch_dstwr_read(const uint8_t* buf, Tsch_Dstwr* ds)
+{
+	ds->seqnum = le_get_u8 (&buf[0]);
+	ds->round  = le_get_u64(&buf[1]);
+}
+
+
 /* tsch_handle_rx *******************************************************************************//**
  * @brief		Handles receiving a frame. Currently only handles DATA frames. */
 static void tsch_handle_rx(TsSlot* slot, Ieee154_Frame* rx)
@@ -1812,6 +2551,31 @@ static void tsch_handle_rx(TsSlot* slot, Ieee154_Frame* rx)
 		LOG_DBG("EXT");
 	}
 
+	/* Flood the location schedule and gateways advertised by enhanced beacons */
+	if(type == IEEE154_FRAME_TYPE_BEACON)
+	{
+		Ieee154_IE ie;
+
+		for(ie = ieee154_ie_first(rx); ieee154_ie_is_valid(&ie); ieee154_ie_next(&ie))
+		{
+			if(ieee154_ie_is_hie(&ie) && ieee154_ie_type(&ie) == TSCH_SCHED_IE &&
+			   ieee154_ie_length_content(&ie) == sizeof(LocSchedule))
+			{
+				LocSchedule sched;
+				memmove(&sched, ieee154_ie_ptr_content(&ie), sizeof(sched));
+				loc_schedule_rx(&sched);
+			}
+			else if(ieee154_ie_is_hie(&ie) && ieee154_ie_type(&ie) == TSCH_GW_IE &&
+			        ieee154_ie_length_content(&ie) <= sizeof(HyperGwAdv) * HYPER_MAX_GW_ADVS)
+			{
+				HyperGwAdv gws[HYPER_MAX_GW_ADVS];
+				unsigned   len = ieee154_ie_length_content(&ie);
+				memmove(gws, ieee154_ie_ptr_content(&ie), len);
+				hyperspace_gateway_rx(gws, len / sizeof(HyperGwAdv));
+			}
+		}
+	}
+
 	if(type == IEEE154_FRAME_TYPE_DATA || type == IEEE154_FRAME_TYPE_BEACON)
 	{
 		LOG_DBG("rx (%p)", rx);
@@ -1880,6 +2644,7 @@ static void tsch_handle_ack(TsSlot* slot, Ieee154_Frame* tx, Ieee154_Frame* ack)
 	}
 
 	/* TODO: handle ack. Should probably handle all IEs here */
+	tsch_link_update(tx, true);
 
 	/* Remove the packet from the tx queue if the transmitted packet was the head of the queue.
 	 * Otherwise leave the tx queue untouched. This could happen if transmitting an empty packet
@@ -1896,6 +2661,54 @@ static void tsch_handle_ack(TsSlot* slot, Ieee154_Frame* tx, Ieee154_Frame* ack)
 }
 
 
+/* tsch_link_update *****************************************************************************//**
+ * @brief		Updates the link estimate to the destination of a unicast frame after an attempt. A
+ * 				neighbor without an estimate replaces the estimate that was updated least recently. */
+static void tsch_link_update(const Ieee154_Frame* tx, bool acked)
+{
+	if(ieee154_length_dest_addr(tx) != 8)
+	{
+		return;
+	}
+
+	const uint8_t* addr = ieee154_dest_addr(tx);
+	uint32_t       now  = k_uptime_get_32();
+	Tsch_Link*     link = 0;
+	Tsch_Link*     lru  = &tsch_links[0];
+
+	k_spinlock_key_t key = k_spin_lock(&tsch_link_lock);
+
+	for(unsigned i = 0; i < TSCH_NUM_LINKS && !link; i++)
+	{
+		Tsch_Link* ptr = &tsch_links[i];
+
+		if(ptr->valid && memcmp(ptr->addr, addr, 8) == 0)
+		{
+			link = ptr;
+		}
+		else if(!ptr->valid || (lru->valid && now - ptr->uptime > now - lru->uptime))
+		{
+			lru = ptr;
+		}
+	}
+
+	/* Start a new or stale estimate from a perfect link */
+	if(!link || now - link->uptime >= TSCH_LINK_TIMEOUT_MS)
+	{
+		link = link ? link : lru;
+		link->valid = true;
+		link->prr   = 1.0f;
+		memmove(link->addr, addr, 8);
+	}
+
+	link->prr    = TSCH_LINK_ALPHA * link->prr + (1.0f - TSCH_LINK_ALPHA) * (acked ? 1.0f : 0.0f);
+	link->prr    = link->prr < TSCH_LINK_MIN_PRR ? TSCH_LINK_MIN_PRR : link->prr;
+	link->uptime = now;
+
+	k_spin_unlock(&tsch_link_lock, key);
+}
+
+
 /* tsch_valid_addr ******************************************************************************//**
  * @brief		Returns true if the frame should be received by this node. */
 static bool tsch_valid_addr(TsSlot* slot, const Ieee154_Frame* frame)
@@ -1963,6 +2776,11 @@ static Ieee154_Frame* tsch_reserve_frame(void)
 {
 	Ieee154_Frame* frame = pool_reserve(&tsch_frame_pool);
 
+	if(!frame && tsch_evict_frame(TSCH_CLASS_CONTROL, 0))
+	{
+		frame = pool_reserve(&tsch_frame_pool);
+	}
+
 	if(!frame)
 	{
 		LOG_DBG("failed reserving frame. dropping old frame.");
@@ -1990,14 +2808,187 @@ static Ieee154_Frame* tsch_reserve_frame(void)
 }
 
 
+/* tsch_reserve_class_frame *********************************************************************//**
+ * @brief		Allocates a frame for a fragment of the datagram with the given class and tag. If no
+ * 				frames are free, the oldest queued datagram of the lowest class at or below the
+ * 				datagram's class is dropped. Returns null if only frames of higher classes or of the
+ * 				datagram itself are queued. */
+static Ieee154_Frame* tsch_reserve_class_frame(Tsch_Class cls, uint32_t tag)
+{
+	Ieee154_Frame* frame = pool_reserve(&tsch_frame_pool);
+
+	if(!frame && tsch_evict_frame(cls, &tag))
+	{
+		frame = pool_reserve(&tsch_frame_pool);
+	}
+
+	if(frame)
+	{
+		ieee154_frame_init(frame, tsch_frame_data[frame-tsch_frames], 0, sizeof(tsch_frame_data[0]));
+		LOG_DBG("reserved %p. free = %d", frame, pool_free(&tsch_frame_pool));
+	}
+	else
+	{
+		LOG_DBG("failed reserving class %d frame. free = %d", cls, pool_free(&tsch_frame_pool));
+	}
+
+	return frame;
+}
+
+
 /* tsch_release_frame ***************************************************************************//**
  * @brief		Deallocates a frame. */
 static void tsch_release_frame(Ieee154_Frame* frame)
 {
+	if(frame == tsch_dist_frame)
+	{
+		tsch_dist_frame = 0;
+	}
+
 	pool_release(&tsch_frame_pool, frame);
 
 	LOG_DBG("release %p. free = %d", frame, pool_free(&tsch_frame_pool));
 }
 
 
+/* tsch_queue_frame *****************************************************************************//**
+ * @brief		Queues a fragment of the datagram with the given tag for transmission in the shared
+ * 				slot. */
+static void tsch_queue_frame(Ieee154_Frame* frame, Tsch_Class cls, uint32_t tag)
+{
+	tsch_frame_queued[frame - tsch_frames] = k_uptime_get_32();
+	tsch_frame_tag   [frame - tsch_frames] = tag;
+	k_queue_append(&tsch_qos.queue[cls], frame);
+}
+
+
+/* tsch_dequeue_frame ***************************************************************************//**
+ * @brief		Moves the next frame to transmit onto the shared slot's tx queue. The slot's tx queue
+ * 				holds one frame at a time so that a higher class frame never waits behind the
+ * 				remaining fragments of a lower class packet. Control frames are dequeued first. The
+ * 				other classes are served round robin, each sending up to its weight in frames per
+ * 				round. */
+static void tsch_dequeue_frame(TsSlot* slot)
+{
+	Ieee154_Frame* frame;
+	unsigned i;
+
+	if(!k_queue_is_empty(&slot->tx_queue))
+	{
+		return;
+	}
+
+	if((frame = k_queue_get(&tsch_qos.queue[TSCH_CLASS_CONTROL], K_NO_WAIT)) != 0)
+	{
+		k_queue_append(&slot->tx_queue, frame);
+		return;
+	}
+
+	/* Two passes: the second pass starts a new round if every backlogged class used its credit */
+	for(unsigned pass = 0; pass < 2; pass++)
+	{
+		for(i = TSCH_CLASS_CONTROL + 1; i < TSCH_NUM_CLASSES; i++)
+		{
+			if(tsch_qos.credit[i] && (frame = tsch_codel_dequeue(i)) != 0)
+			{
+				tsch_qos.credit[i]--;
+				k_queue_append(&slot->tx_queue, frame);
+				return;
+			}
+		}
+
+		for(i = 0; i < TSCH_NUM_CLASSES; i++)
+		{
+			tsch_qos.credit[i] = tsch_class_weight[i];
+		}
+	}
+}
+
+
+/* tsch_codel_dequeue ***************************************************************************//**
+ * @brief		Dequeues a frame from a class queue applying CoDel (RFC 8289). A drop removes every
+ * 				queued fragment of the frame's datagram and counts as one drop. */
+static Ieee154_Frame* tsch_codel_dequeue(Tsch_Class cls)
+{
+	Codel*         c   = &tsch_qos.codel[cls];
+	uint32_t       now = k_uptime_get_32();
+	Ieee154_Frame* frame;
+
+	while((frame = k_queue_get(&tsch_qos.queue[cls], K_NO_WAIT)) != 0)
+	{
+		uint32_t sojourn = now - tsch_frame_queued[frame - tsch_frames];
+
+		if(!codel_drop(c, now, sojourn, k_queue_is_empty(&tsch_qos.queue[cls])))
+		{
+			return frame;
+		}
+
+		uint32_t tag = tsch_frame_tag[frame - tsch_frames];
+
+		tsch_release_frame(frame);
+		unsigned count = 1 + tsch_drop_datagram(cls, tag);
+
+		LOG_DBG("codel dropping class %d datagram. %u frames. delay %u ms", cls, count, sojourn);
+		TRACE(TRACE_QUEUE_DROP, cls);
+		tsch_qos.drops[cls] += count;
+	}
+
+	codel_empty(c);
+	return 0;
+}
+
+
+/* tsch_evict_frame *****************************************************************************//**
+ * @brief		Drops the oldest queued datagram of the lowest class at or below cls. All of its queued
+ * 				fragments are dropped since the rest of the datagram is useless without them. The
+ * 				datagram with tag own, if not null, is never evicted. Frames on the shared slot's tx
+ * 				queue may be in flight and are never evicted. Returns true if a frame was dropped. */
+static bool tsch_evict_frame(Tsch_Class cls, const uint32_t* own)
+{
+	for(int i = TSCH_NUM_CLASSES - 1; i >= (int)cls; i--)
+	{
+		/* A datagram's fragments are queued back to back so the datagram being queued is only at
+		 * the head of its queue if nothing older is queued in the class */
+		Ieee154_Frame* old = k_queue_peek_head(&tsch_qos.queue[i]);
+
+		if(!old || (own && tsch_frame_tag[old - tsch_frames] == *own))
+		{
+			continue;
+		}
+
+		unsigned count = tsch_drop_datagram(i, tsch_frame_tag[old - tsch_frames]);
+
+		if(count)
+		{
+			LOG_DBG("dropped class %d datagram. %u frames", i, count);
+			TRACE(TRACE_QUEUE_DROP, i);
+			tsch_qos.drops[i] += count;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/* tsch_drop_datagram ***************************************************************************//**
+ * @brief		Removes every frame of the datagram with the given tag from a class queue and releases
+ * 				them. Returns the number of frames dropped. */
+static unsigned tsch_drop_datagram(Tsch_Class cls, uint32_t tag)
+{
+	unsigned count = 0;
+
+	for(unsigned i = 0; i < TSCH_NUM_FRAMES; i++)
+	{
+		if(tsch_frame_tag[i] == tag && k_queue_remove(&tsch_qos.queue[cls], &tsch_frames[i]))
+		{
+			tsch_release_frame(&tsch_frames[i]);
+			count++;
+		}
+	}
+
+	return count;
+}
+
+
 /******************************************* END OF FILE *******************************************/
@@ -34,7 +34,10 @@ extern "C" {
 
 // #include "backoff.h"
 #include "bayesian.h"
+#include "hopping.h"
 #include "ieee_802_15_4.h"
+#include "prng.h"
+#include "timeslot.h"
 
 
 /* Public Macros --------------------------------------------------------------------------------- */
@@ -53,6 +56,11 @@ extern "C" {
 #define TSCH_SYNC_IE        (71)
 #define TSCH_HYPERBEACON_ID (72)
 #define TSCH_TRESP_IE       (73)
+#define TSCH_HOPPING_IE     (74)
+#define TSCH_DSTWR_IE       (75)
+#define TSCH_SCHED_IE       (76)
+#define TSCH_GW_IE          (77)
+#define TSCH_DSTWR_REQ_IE   (78)
 
 
 // ----------------------------------------------------------------------------------------------- //
@@ -235,6 +243,50 @@ typedef struct __packed {
 } Tsch_Header;
 
 
+/* Hopping Sequence IE. The payload is the hopping sequence, see Tsch_Channel in hopping.h. */
+
+
+/* Double-Sided TWR IE. Carried by an ACK to close the round trip started by the previous ACK sent
+ * to the same initiator, if the initiator requested it with a TSCH_DSTWR_REQ_IE. Round is the time
+ * in DW1000 ticks between transmitting the previous ACK and receiving the current frame, measured
+ * by the responder. SeqNum is the sequence number of the previous ACK. Fields are little endian and
+ * the IE content is TSCH_DSTWR_IE_LEN bytes.
+ *
+ * 		                     1                   2                   3
+ * 		 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ * 		+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * 		|    SeqNum     |                 Round ...                     |
+ * 		+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * 		|                           ... Round ...                       |
+ * 		+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * 		|  ... Round    |
+ * 		+-+-+-+-+-+-+-+-+
+ */
+#define TSCH_DSTWR_IE_LEN       (9)
+
+typedef struct {
+	uint8_t  seqnum;
+	uint64_t round;
+} Tsch_Dstwr;
+
+
+/* Double-Sided TWR Request IE. Carried by a distance measurement frame. SeqNum is the sequence
+ * number of the initiator's previous acknowledged frame to the same responder. The responder only
+ * closes the round trip if it acknowledged that frame. The IE content is TSCH_DSTWR_REQ_IE_LEN
+ * bytes.
+ *
+ * 		 0 1 2 3 4 5 6 7
+ * 		+-+-+-+-+-+-+-+-+
+ * 		|    SeqNum     |
+ * 		+-+-+-+-+-+-+-+-+
+ */
+#define TSCH_DSTWR_REQ_IE_LEN   (1)
+
+typedef struct {
+	uint8_t seqnum;
+} Tsch_Dstwr_Req;
+
+
 /* ADD Request
  * 		                     1                   2                   3
  * 		 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
@@ -679,6 +731,27 @@ typedef enum {
 // } Tsch;
 
 
+/* The predicted network timing. Recorded when synchronization is lost or restored from a snapshot
+ * saved before a reboot. The timeslot grid keeps running while unsynchronized so the network's ASN
+ * is predicted as asn plus the grid's ASNs since local, until the clocks drift apart. */
+typedef struct {
+	bool     valid;
+	uint64_t asn;       /* Network ASN when the timing was recorded                  */
+	uint64_t local;     /* Grid ASN when the timing was recorded                     */
+	int64_t  uptime;    /* Uptime in ms when the timing was recorded                 */
+	uint32_t spread;    /* Slotframes the network may be ahead of the predicted ASN  */
+	uint32_t probe;     /* Next slotframe offset in [0, spread] to listen for        */
+} Tsch_Warm;
+
+
+/* Network timing saved across reboots */
+typedef struct {
+	bool         planned;      /* True if saved immediately before a reboot */
+	uint8_t      hopping_len;
+	Tsch_Channel hopping_seq[TSCH_MAX_HOPPING_LEN];
+} TschSnapshot;
+
+
 typedef struct {
 	uint8_t dsn;
 	uint8_t ebsn;
@@ -690,6 +763,11 @@ typedef struct {
 	uint8_t bcast[8];
 	// Backoff backoff;
 	Bayesian bayes_bcast;
+	Prng     rng;
+	Tsch_Channel hopping_seq[TSCH_MAX_HOPPING_LEN];
+	uint8_t      hopping_len;
+	Tsch_Warm    warm;
+	atomic_t     adv_burst;	/* Number of advertisements left in the current burst */
 	bool (*on_scan_cb)(Ieee154_Frame*);
 	struct k_mutex state_mutex;
 	struct net_mgmt_event_callback prefix_cb;
@@ -713,7 +791,14 @@ void  tsch_power_up      (void);
 void  tsch_start_scan    (bool (*on_scan_cb)(Ieee154_Frame*));
 void  tsch_stop_scan     (void);
 // void tsch_sync          (Ieee154_Frame*);
+bool  tsch_congested     (void);
 void  tsch_meas_dist     (const uint8_t*);
+float tsch_link_etx      (const uint8_t*);
+void  tsch_channel_hop   (TsSlot*);
+void  tsch_channel_hop_lane(TsSlot*, unsigned);
+unsigned tsch_hopping_lanes(unsigned);
+void  tsch_snapshot      (TschSnapshot*, bool);
+void  tsch_restore       (const TschSnapshot*, uint64_t);
 
 // void tsch_notify_on_connect     (void (*on_connect)(void));
 // void tsch_notify_on_scan        (bool (*on_scan)(HyperNbr*, Ieee154_Frame*));
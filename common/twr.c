@@ -0,0 +1,58 @@
+/************************************************************************************************//**
+ * @file		twr.c
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ ***************************************************************************************************/
+#include "twr.h"
+
+
+/* twr_ss_tof ***********************************************************************************//**
+ * @brief		Computes the single-sided TWR time of flight in DW1000 ticks. Round is measured by the
+ * 				initiator and reply by the responder. The reply is converted to the initiator's clock
+ * 				with the rx clock offset rco of the responder relative to the initiator. The error is
+ * 				half the reply time times the error of rco so it grows with the reply time. */
+uint32_t twr_ss_tof(double round, double reply, float rco)
+{
+	double tof = (round - reply * (1.0 - rco)) / 2;
+
+	return tof > 0 ? (uint32_t)(tof + 0.5) : 0;
+}
+
+
+/* twr_ds_tof ***********************************************************************************//**
+ * @brief		Computes the asymmetric double-sided TWR time of flight in DW1000 ticks.
+ *
+ * 				Initiator   Responder
+ * 				  tx  ---.
+ * 				          `--> rx
+ * 				                 |  reply1
+ * 				  rx  <--.--- tx
+ * 				   |              |
+ * 				   |  reply2      |  round2
+ * 				   |              |
+ * 				  tx  ---.        |
+ * 				          `--> rx
+ *
+ * 				tof = (round1 * round2 - reply1 * reply2) / (round1 + round2 + reply1 + reply2)
+ *
+ * 				Unlike SS-TWR, the error does not grow with the reply times. The products exceed 64
+ * 				bits when reply2 spans slotframes, therefore the computation uses doubles. */
+uint32_t twr_ds_tof(double round1, double reply1, double round2, double reply2)
+{
+	double tof = (round1 * round2 - reply1 * reply2) / (round1 + round2 + reply1 + reply2);
+
+	return tof > 0 ? (uint32_t)(tof + 0.5) : 0;
+}
+
+
+/******************************************* END OF FILE *******************************************/
@@ -0,0 +1,46 @@
+/************************************************************************************************//**
+ * @file		twr.h
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ * @brief		Two-way ranging time of flight. Durations are in DW1000 ticks, each measured by the
+ * 				node's own clock. Kept free of Zephyr so that the clock error of single-sided and
+ * 				double-sided TWR can be compared on the host.
+ *
+ ***************************************************************************************************/
+#ifndef TWR_H
+#define TWR_H
+
+#if __STDC_VERSION__ < 199901L
+#error Compile with C99 or higher!
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Public Includes ------------------------------------------------------------------------------- */
+#include <stdint.h>
+
+
+/* Public Functions ------------------------------------------------------------------------------ */
+uint32_t twr_ss_tof(double, double, float);
+uint32_t twr_ds_tof(double, double, double, double);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TWR_H
+/******************************************* END OF FILE *******************************************/
@@ -0,0 +1,376 @@
+/************************************************************************************************//**
+ * @file		bayessim_test.c
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ * @brief		Monte-Carlo comparison of Bayesian broadcast in bayesian.c against the fixed constant
+ * 				estimator it replaced. Reports the throughput and delay of a shared slot versus the
+ * 				offered load.
+ *
+ * 				NUM_NODES nodes share one slot and hear each other. Packets arrive at every node at
+ * 				random with the offered load split evenly between the nodes. Every slot, each node
+ * 				with a packet queued transmits if bayes_try allows it. Every node then reports the
+ * 				slot's outcome as tsch_shared_slot does and advances its estimator. A bursty load
+ * 				adds BURST_PACKETS packets to every node at once, as an OTA block or a coordinate
+ * 				flood does.
+ *
+ ***************************************************************************************************/
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bayesian.h"
+
+
+/* Private Macros -------------------------------------------------------------------------------- */
+#define CHECK(cond)                                                                  \
+	do {                                                                             \
+		if(!(cond))                                                                  \
+		{                                                                            \
+			printf("%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __func__, #cond); \
+			return 1;                                                                \
+		}                                                                            \
+	} while(0)
+
+#define BAYES_LIMIT         (10.0f)		/* bayes_init in tsch_init */
+#define NUM_NODES           (20)
+#define NUM_SLOTS           (200000)
+#define QUEUE_LEN           (256)		/* Packets a node can queue. More are dropped */
+#define BURST_PERIOD        (4000)		/* Slots between bursts */
+#define BURST_PACKETS       (4)			/* Packets added to every node by a burst */
+#define BURST_LOAD          (0.05)		/* Offered load between bursts */
+
+
+/* Private Types --------------------------------------------------------------------------------- */
+/* The estimator before bayesian.c tracked outcomes. It adds 1/e every slot and never moves its
+ * limit. */
+typedef struct {
+	float v;
+	float limit;
+} Fixed;
+
+typedef struct {
+	Bayesian adaptive;
+	Fixed    fixed;
+	Prng     rng;
+	unsigned queue[QUEUE_LEN];  /* Arrival slot of each queued packet */
+	unsigned head;
+	unsigned len;
+} Node;
+
+typedef struct {
+	double   throughput;    /* Packets delivered per slot */
+	double   mean;          /* Mean delay in slots */
+	double   p99;           /* 99th percentile delay in slots */
+	double   collisions;    /* Fraction of slots that collided */
+	unsigned dropped;
+} Result;
+
+
+/* Private Functions ----------------------------------------------------------------------------- */
+static void   fixed_init  (Fixed*, float);
+static bool   fixed_try   (Fixed*, Prng*);
+static void   fixed_report(Fixed*, BayesOutcome);
+static bool   node_try    (Node*, bool);
+static void   node_report (Node*, bool, BayesOutcome);
+static void   enqueue     (Node*, unsigned);
+static Result run         (bool, double, bool);
+static void   report      (const char*, double, const Result*);
+static int    cmp_unsigned(const void*, const void*);
+
+
+/* Private Variables ----------------------------------------------------------------------------- */
+static const double loads[] = { 0.05, 0.1, 0.2, 0.3, 0.35 };
+static Node         nodes[NUM_NODES];
+static unsigned     delays[NUM_SLOTS];
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Tests                                                                                           //
+// ----------------------------------------------------------------------------------------------- //
+/* test_steady **********************************************************************************//**
+ * @brief		Under steady load the adaptive estimator delivers as much as the fixed one without
+ * 				adding delay. */
+static int test_steady(void)
+{
+	unsigned i;
+
+	for(i = 0; i < sizeof(loads) / sizeof(loads[0]); i++)
+	{
+		Result fixed    = run(false, loads[i], false);
+		Result adaptive = run(true,  loads[i], false);
+
+		report("fixed   ", loads[i], &fixed);
+		report("adaptive", loads[i], &adaptive);
+
+		CHECK(adaptive.throughput >= 0.98 * fixed.throughput);
+		CHECK(adaptive.dropped    <= fixed.dropped);
+		CHECK(adaptive.mean       <= 1.1 * fixed.mean + 1.0);
+	}
+
+	return 0;
+}
+
+
+/* test_burst ***********************************************************************************//**
+ * @brief		Bursts of packets from every node at once are delivered sooner and with fewer
+ * 				collisions by the adaptive estimator. */
+static int test_burst(void)
+{
+	Result fixed    = run(false, BURST_LOAD, true);
+	Result adaptive = run(true,  BURST_LOAD, true);
+
+	report("fixed    burst", BURST_LOAD, &fixed);
+	report("adaptive burst", BURST_LOAD, &adaptive);
+
+	CHECK(adaptive.mean       < fixed.mean);
+	CHECK(adaptive.p99        < fixed.p99);
+	CHECK(adaptive.collisions < fixed.collisions);
+	return 0;
+}
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Helpers                                                                                         //
+// ----------------------------------------------------------------------------------------------- //
+/* fixed_init ***********************************************************************************//**
+ * @brief		*/
+static void fixed_init(Fixed* f, float limit)
+{
+	f->v     = 1.0f;
+	f->limit = limit;
+}
+
+
+/* fixed_try ************************************************************************************//**
+ * @brief		*/
+static bool fixed_try(Fixed* f, Prng* rng)
+{
+	return prng_float(rng) < 1.0f / f->v;
+}
+
+
+/* fixed_report *********************************************************************************//**
+ * @brief		Reports the slot's outcome and advances the estimator one slot. */
+static void fixed_report(Fixed* f, BayesOutcome outcome)
+{
+	if(outcome != BAYES_COLLISION)
+	{
+		f->v -= 1.0f;
+	}
+	else if(f->v < f->limit)
+	{
+		f->v += 1.0f / (M_E - 2.0f);
+	}
+
+	f->v = calc_clamp_f(f->v + 1.0f / M_E, 1.0f, f->limit);
+}
+
+
+/* node_try *************************************************************************************//**
+ * @brief		Returns true if the node transmits in this slot. */
+static bool node_try(Node* n, bool adaptive)
+{
+	if(n->len == 0)
+	{
+		return false;
+	}
+
+	return adaptive ? bayes_try(&n->adaptive) : fixed_try(&n->fixed, &n->rng);
+}
+
+
+/* node_report **********************************************************************************//**
+ * @brief		Reports the slot's outcome to the node's estimator and advances it. */
+static void node_report(Node* n, bool adaptive, BayesOutcome outcome)
+{
+	if(!adaptive)
+	{
+		fixed_report(&n->fixed, outcome);
+		return;
+	}
+
+	if(outcome == BAYES_SUCCESS)
+	{
+		bayes_success(&n->adaptive);
+	}
+	else if(outcome == BAYES_COLLISION)
+	{
+		bayes_fail(&n->adaptive);
+	}
+	else
+	{
+		bayes_hole(&n->adaptive);
+	}
+
+	bayes_update(&n->adaptive);
+}
+
+
+/* enqueue **************************************************************************************//**
+ * @brief		Queues a packet that arrived in slot. */
+static void enqueue(Node* n, unsigned slot)
+{
+	if(n->len < QUEUE_LEN)
+	{
+		n->queue[(n->head + n->len++) % QUEUE_LEN] = slot;
+	}
+}
+
+
+/* run ******************************************************************************************//**
+ * @brief		Runs NUM_SLOTS slots at the offered load in packets per slot. Both estimators see
+ * 				the same arrivals. */
+static Result run(bool adaptive, double load, bool bursty)
+{
+	Result   res        = { 0, 0, 0, 0, 0 };
+	unsigned delivered  = 0;
+	unsigned collisions = 0;
+	unsigned offered    = 0;
+	unsigned queued     = 0;
+	unsigned slot, i;
+	Prng     arrivals;
+
+	srand(61);
+	prng_seed(&arrivals, 61, 1);
+
+	uint32_t threshold = prng_threshold(load / NUM_NODES);
+
+	for(i = 0; i < NUM_NODES; i++)
+	{
+		bayes_init(&nodes[i].adaptive, BAYES_LIMIT);
+		fixed_init(&nodes[i].fixed, BAYES_LIMIT);
+		prng_seed(&nodes[i].rng, i, 2 + i);
+		nodes[i].head = 0;
+		nodes[i].len  = 0;
+	}
+
+	for(slot = 0; slot < NUM_SLOTS; slot++)
+	{
+		unsigned transmitters = 0;
+		unsigned sender       = 0;
+
+		for(i = 0; i < NUM_NODES; i++)
+		{
+			unsigned n = bursty && slot % BURST_PERIOD == 0 ? BURST_PACKETS : 0;
+
+			n += prng_chance(&arrivals, threshold);
+
+			for(; n; n--, offered++)
+			{
+				enqueue(&nodes[i], slot);
+			}
+		}
+
+		for(i = 0; i < NUM_NODES; i++)
+		{
+			if(node_try(&nodes[i], adaptive))
+			{
+				transmitters++;
+				sender = i;
+			}
+		}
+
+		BayesOutcome outcome = transmitters == 0 ? BAYES_EMPTY :
+		                       transmitters == 1 ? BAYES_SUCCESS : BAYES_COLLISION;
+
+		if(outcome == BAYES_SUCCESS)
+		{
+			Node* n = &nodes[sender];
+
+			delays[delivered++] = slot - n->queue[n->head];
+			n->head = (n->head + 1) % QUEUE_LEN;
+			n->len--;
+		}
+
+		collisions += outcome == BAYES_COLLISION;
+
+		for(i = 0; i < NUM_NODES; i++)
+		{
+			node_report(&nodes[i], adaptive, outcome);
+		}
+	}
+
+	for(i = 0; i < NUM_NODES; i++)
+	{
+		queued += nodes[i].len;
+	}
+
+	res.throughput = (double)delivered / NUM_SLOTS;
+	res.collisions = (double)collisions / NUM_SLOTS;
+	res.dropped    = offered - delivered - queued;
+
+	if(delivered)
+	{
+		for(i = 0; i < delivered; i++)
+		{
+			res.mean += delays[i];
+		}
+
+		qsort(delays, delivered, sizeof(delays[0]), cmp_unsigned);
+		res.mean /= delivered;
+		res.p99   = delays[(unsigned)(delivered * 0.99)];
+	}
+
+	return res;
+}
+
+
+/* report ***************************************************************************************//**
+ * @brief		*/
+static void report(const char* name, double load, const Result* r)
+{
+	printf("%s load %.2f: throughput %.3f, delay mean %7.1f p99 %6.0f slots, "
+		"collisions %.3f, %u dropped\n",
+		name, load, r->throughput, r->mean, r->p99, r->collisions, r->dropped);
+}
+
+
+/* cmp_unsigned *********************************************************************************//**
+ * @brief		Orders unsigned ints ascending for qsort. */
+static int cmp_unsigned(const void* a, const void* b)
+{
+	unsigned x = *(const unsigned*)a;
+	unsigned y = *(const unsigned*)b;
+
+	return (x > y) - (x < y);
+}
+
+
+/* main *****************************************************************************************//**
+ * @brief		*/
+int main(void)
+{
+	static int (*const tests[])(void) = {
+		test_steady,
+		test_burst,
+	};
+
+	unsigned i;
+	int      failed = 0;
+
+	for(i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+	{
+		failed += tests[i]();
+	}
+
+	printf("%u tests, %d failed\n", (unsigned)(sizeof(tests) / sizeof(tests[0])), failed);
+	return failed ? 1 : 0;
+}
+
+
+/******************************************* END OF FILE *******************************************/
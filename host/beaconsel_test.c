@@ -0,0 +1,350 @@
+/************************************************************************************************//**
+ * @file		beaconsel_test.c
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ * @brief		Simulates beacon selection in a location cell and reports the positioning error
+ * 				percentiles of receivers in the cell with and without the PDOP bias of
+ * 				start_beacon_pdop in location.c.
+ *
+ * 				Each of the cell's six lattice points has a few candidate nodes scattered around it.
+ * 				Without the bias, the candidate closest to the lattice point becomes the beacon, as
+ * 				compare_distances alone decides. With the bias, each index is contended for in turn
+ * 				with the other indices' beacons in place. Every candidate's start timer is its
+ * 				distance shortened by LOC_GDOP_BIAS times the PDOP gain of its own location and the
+ * 				earliest timer wins. Receivers then solve their location with locsolve_toa from
+ * 				ranges with LOC_RANGE_SIGMA of noise.
+ *
+ ***************************************************************************************************/
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "locsolve.h"
+
+
+/* Private Macros -------------------------------------------------------------------------------- */
+#define CHECK(cond)                                                                  \
+	do {                                                                             \
+		if(!(cond))                                                                  \
+		{                                                                            \
+			printf("%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __func__, #cond); \
+			return 1;                                                                \
+		}                                                                            \
+	} while(0)
+
+#define LATTICE_R           (2.5f)		/* LATTICE_R in location.h */
+#define GDOP_BIAS           (0.5f)		/* LOC_GDOP_BIAS in location.c */
+#define RANGE_SIGMA         (0.1f)		/* LOC_RANGE_SIGMA in location.c */
+#define NUM_BEACONS         (6)
+#define NUM_CANDIDATES      (3)			/* Candidate nodes per lattice point */
+#define SCATTER             (0.45f)		/* Max candidate offset per axis in LATTICE_R */
+#define NUM_DEPLOYMENTS     (2000)
+#define NUM_RECEIVERS       (10)		/* Receivers per deployment */
+#define NUM_ERRORS          (NUM_DEPLOYMENTS * NUM_RECEIVERS)
+
+
+/* Private Types --------------------------------------------------------------------------------- */
+typedef struct {
+	double p50, p90, p99;
+	unsigned failed;        /* Receivers that could not solve their location */
+} Percentiles;
+
+
+/* Private Functions ----------------------------------------------------------------------------- */
+static double      uniform     (double, double);
+static double      gauss       (void);
+static void        pick_beacons(float (*)[NUM_CANDIDATES][3], bool, float (*)[3]);
+static float       gain        (float (*)[3], unsigned, const float*);
+static Percentiles run         (bool);
+static int         cmp_double  (const void*, const void*);
+
+
+/* Private Variables ----------------------------------------------------------------------------- */
+/* Lattice points of the cell's beacons: a square of four with one above and one below */
+static const float ideal[NUM_BEACONS][3] = {
+	{ 0,         0,         0          },
+	{ LATTICE_R, 0,         0          },
+	{ 0,         LATTICE_R, 0          },
+	{ LATTICE_R, LATTICE_R, 0          },
+	{ LATTICE_R / 2, LATTICE_R / 2,  LATTICE_R },
+	{ LATTICE_R / 2, LATTICE_R / 2, -LATTICE_R },
+};
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Tests                                                                                           //
+// ----------------------------------------------------------------------------------------------- //
+/* test_percentiles *****************************************************************************//**
+ * @brief		The PDOP bias lowers the tail of the positioning error without hurting the median. */
+static int test_percentiles(void)
+{
+	Percentiles before = run(false);
+	Percentiles after  = run(true);
+
+	printf("distance only: p50 %.3f m, p90 %.3f m, p99 %.3f m, %u failed\n",
+		before.p50, before.p90, before.p99, before.failed);
+	printf("PDOP biased:   p50 %.3f m, p90 %.3f m, p99 %.3f m, %u failed\n",
+		after.p50, after.p90, after.p99, after.failed);
+
+	CHECK(after.p50 <= 1.02 * before.p50);
+	CHECK(after.p90 <  before.p90);
+	CHECK(after.p99 <  before.p99);
+	CHECK(after.failed <= before.failed);
+	return 0;
+}
+
+
+/* test_gain ************************************************************************************//**
+ * @brief		A candidate completing a coplanar cell gains the most, and one on the plane gains
+ * 				nothing. */
+static int test_gain(void)
+{
+	float beacons[NUM_BEACONS][3] = {
+		{ 0, 0, 0 }, { 2.5f, 0, 0 }, { 0, 2.5f, 0 }, { 2.5f, 2.5f, 0 }, { 1.25f, 0, 0 }, { 0, 0, 0 },
+	};
+	const float above[3] = { 1.25f, 1.25f, 2.5f };
+	const float plane[3] = { 1.25f, 2.5f, 0 };
+
+	CHECK(gain(beacons, 5, above) == 1.0f);
+	CHECK(gain(beacons, 5, plane) == 0.0f);
+	return 0;
+}
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Helpers                                                                                         //
+// ----------------------------------------------------------------------------------------------- //
+/* uniform **************************************************************************************//**
+ * @brief		Returns a uniform sample in [min, max). */
+static double uniform(double min, double max)
+{
+	return min + (max - min) * rand() / ((double)RAND_MAX + 1.0);
+}
+
+
+/* gauss ****************************************************************************************//**
+ * @brief		Returns a standard normal sample (Box-Muller). */
+static double gauss(void)
+{
+	double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+	double v = (rand() + 1.0) / (RAND_MAX + 2.0);
+
+	return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+
+/* pick_beacons *********************************************************************************//**
+ * @brief		Picks a beacon for every lattice point from its candidates. */
+static void pick_beacons(float (*cand)[NUM_CANDIDATES][3], bool biased, float (*beacons)[3])
+{
+	unsigned i, c, k;
+
+	/* Closest candidate to each lattice point */
+	for(i = 0; i < NUM_BEACONS; i++)
+	{
+		float best = INFINITY;
+
+		for(c = 0; c < NUM_CANDIDATES; c++)
+		{
+			float d = hypotf(hypotf(cand[i][c][0] - ideal[i][0], cand[i][c][1] - ideal[i][1]),
+			                 cand[i][c][2] - ideal[i][2]);
+
+			if(d < best)
+			{
+				best = d;
+
+				for(k = 0; k < 3; k++)
+				{
+					beacons[i][k] = cand[i][c][k];
+				}
+			}
+		}
+	}
+
+	/* Contend for each index again with the other beacons in place */
+	for(i = 0; biased && i < NUM_BEACONS; i++)
+	{
+		float    best = INFINITY;
+		unsigned pick = 0;
+
+		for(c = 0; c < NUM_CANDIDATES; c++)
+		{
+			float d = hypotf(hypotf(cand[i][c][0] - ideal[i][0], cand[i][c][1] - ideal[i][1]),
+			                 cand[i][c][2] - ideal[i][2]);
+			float t = d * (1.0f - GDOP_BIAS * gain(beacons, i, cand[i][c]));
+
+			if(t < best)
+			{
+				best = t;
+				pick = c;
+			}
+		}
+
+		for(k = 0; k < 3; k++)
+		{
+			beacons[i][k] = cand[i][pick][k];
+		}
+	}
+}
+
+
+/* gain *****************************************************************************************//**
+ * @brief		Returns the fractional PDOP improvement of the cell when the beacon at index is
+ * 				placed at pos, as pdop_gain in location.c does for each cell. */
+static float gain(float (*beacons)[3], unsigned index, const float* pos)
+{
+	float    p[NUM_BEACONS][3];
+	unsigned i, k, n = 0;
+
+	for(i = 0; i < NUM_BEACONS; i++)
+	{
+		if(i != index)
+		{
+			for(k = 0; k < 3; k++)
+			{
+				p[n][k] = beacons[i][k];
+			}
+
+			n++;
+		}
+	}
+
+	float before = locsolve_pdop(p, n, LATTICE_R / 10.0f);
+
+	for(k = 0; k < 3; k++)
+	{
+		p[n][k] = pos[k];
+	}
+
+	float after = locsolve_pdop(p, n + 1, LATTICE_R / 10.0f);
+
+	if(!isfinite(after))
+	{
+		return 0;
+	}
+	else if(!isfinite(before))
+	{
+		return 1;
+	}
+
+	return after < before ? (before - after) / before : 0;
+}
+
+
+/* run ******************************************************************************************//**
+ * @brief		Returns the positioning error percentiles of NUM_DEPLOYMENTS random deployments. The
+ * 				same deployments and noise are used with and without the bias. */
+static Percentiles run(bool biased)
+{
+	static double errors[NUM_ERRORS];
+	Percentiles   res = { 0, 0, 0, 0 };
+	unsigned      num = 0;
+	unsigned      t, r, i, c, k;
+
+	srand(56);
+
+	for(t = 0; t < NUM_DEPLOYMENTS; t++)
+	{
+		float cand[NUM_BEACONS][NUM_CANDIDATES][3];
+		float beacons[NUM_BEACONS][3];
+
+		for(i = 0; i < NUM_BEACONS; i++)
+		{
+			for(c = 0; c < NUM_CANDIDATES; c++)
+			{
+				for(k = 0; k < 3; k++)
+				{
+					cand[i][c][k] = ideal[i][k] + uniform(-SCATTER, SCATTER) * LATTICE_R;
+				}
+			}
+		}
+
+		pick_beacons(cand, biased, beacons);
+
+		for(r = 0; r < NUM_RECEIVERS; r++)
+		{
+			double   x[3] = { uniform(0, LATTICE_R), uniform(0, LATTICE_R),
+			                  uniform(-LATTICE_R / 2, LATTICE_R / 2) };
+			float    d[NUM_BEACONS];
+			float    sd[NUM_BEACONS];
+			LocSolve sol;
+
+			for(i = 0; i < NUM_BEACONS; i++)
+			{
+				d[i]  = sqrt(pow(beacons[i][0] - x[0], 2) + pow(beacons[i][1] - x[1], 2) +
+				             pow(beacons[i][2] - x[2], 2)) + RANGE_SIGMA * gauss();
+				sd[i] = RANGE_SIGMA;
+			}
+
+			if(!locsolve_toa(beacons, d, sd, NUM_BEACONS, &sol))
+			{
+				res.failed++;
+				continue;
+			}
+
+			errors[num++] = sqrt(pow(sol.x - x[0], 2) + pow(sol.y - x[1], 2) +
+			                     pow(sol.z - x[2], 2));
+		}
+	}
+
+	if(num)
+	{
+		qsort(errors, num, sizeof(errors[0]), cmp_double);
+		res.p50 = errors[num * 50 / 100];
+		res.p90 = errors[num * 90 / 100];
+		res.p99 = errors[num * 99 / 100];
+	}
+
+	return res;
+}
+
+
+/* cmp_double ***********************************************************************************//**
+ * @brief		Orders doubles ascending for qsort. */
+static int cmp_double(const void* a, const void* b)
+{
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+
+	return (x > y) - (x < y);
+}
+
+
+/* main *****************************************************************************************//**
+ * @brief		*/
+int main(void)
+{
+	static int (*const tests[])(void) = {
+		test_gain,
+		test_percentiles,
+	};
+
+	unsigned i;
+	int      failed = 0;
+
+	for(i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+	{
+		failed += tests[i]();
+	}
+
+	printf("%u tests, %d failed\n", (unsigned)(sizeof(tests) / sizeof(tests[0])), failed);
+	return failed ? 1 : 0;
+}
+
+
+/******************************************* END OF FILE *******************************************/
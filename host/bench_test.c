@@ -0,0 +1,301 @@
+/************************************************************************************************//**
+ * @file		bench_test.c
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ * @brief		Microbenchmarks of the location solvers and the hyperspace routing decisions that the
+ * 				firmware runs per location update and per forwarded packet:
+ *
+ * 					locsolve_toa, locsolve_tdoa     compute_toa_location, compute_tdoa_location
+ * 					locsolve_3sphere                compute_3sphere_location
+ * 					locsolve_springs                compute_springs_location
+ * 					hyper_rate over a neighbor set  hyperspace_closest
+ * 					hypergw_rank                    gateway failover in hyperspace_route
+ *
+ * 				Each benchmark first checks that its inputs give a valid result so that a broken
+ * 				solver is not timed on its error path. Timing is reported only, as it depends on the
+ * 				host. Compare the figures before and after a change to the solvers or the routing.
+ *
+ ***************************************************************************************************/
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hyperembed.h"
+#include "hypergw.h"
+#include "locsolve.h"
+
+
+/* Private Macros -------------------------------------------------------------------------------- */
+#define CHECK(cond)                                                                  \
+	do {                                                                             \
+		if(!(cond))                                                                  \
+		{                                                                            \
+			printf("%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __func__, #cond); \
+			return 1;                                                                \
+		}                                                                            \
+	} while(0)
+
+#define NUM_BENCH           (1u << 18)
+#define NUM_BEACONS         (6)
+#define NUM_NBRS            (16)		/* Neighbors in a dense deployment */
+
+
+/* Private Functions ----------------------------------------------------------------------------- */
+static double now_ns     (void);
+static double bench      (const char*, float (*)(void));
+static float  run_toa    (void);
+static float  run_tdoa   (void);
+static float  run_3sphere(void);
+static float  run_springs(void);
+static float  run_closest(void);
+static float  run_rank   (void);
+
+
+/* Private Variables ----------------------------------------------------------------------------- */
+static const float beacons[NUM_BEACONS][3] = {
+	{ 0, 0, 0 }, { 5, 0, 2.5f }, { 0, 5, 0.5f }, { 5, 5, 0 }, { 2.5f, 0, 3 }, { 0, 2.5f, 2 },
+};
+
+static const float node[3] = { 1.5f, 2.0f, 1.0f };
+
+static float        ranges[NUM_BEACONS];
+static float        pseudoranges[NUM_BEACONS];
+static float        sigmas[NUM_BEACONS];
+static float        spring_pos[3];
+static float        spring_vel[3];
+static float        nbrs[NUM_NBRS][3];	/* Coordinate r, t and link etx of each neighbor */
+static float        self[2];
+static float        dest[2];
+static HyperGwTable gws;
+static uint8_t      uplink[16] = { 0xFD, [15] = 1 };
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Tests                                                                                           //
+// ----------------------------------------------------------------------------------------------- //
+/* test_solvers *********************************************************************************//**
+ * @brief		Times the location solvers. */
+static int test_solvers(void)
+{
+	LocSolve sol;
+	float    x[3];
+	unsigned i;
+
+	for(i = 0; i < NUM_BEACONS; i++)
+	{
+		ranges[i] = sqrtf(powf(beacons[i][0] - node[0], 2) + powf(beacons[i][1] - node[1], 2) +
+			powf(beacons[i][2] - node[2], 2));
+		pseudoranges[i] = ranges[i] - 7.0f;
+		sigmas[i]       = 0.1f;
+	}
+
+	CHECK(locsolve_toa(beacons, ranges, sigmas, NUM_BEACONS, &sol));
+	CHECK(locsolve_tdoa(beacons, pseudoranges, sigmas, NUM_BEACONS, &sol));
+	CHECK(locsolve_3sphere(beacons, ranges, 1.0f, x));
+
+	bench("locsolve_toa       ", run_toa);
+	bench("locsolve_tdoa      ", run_tdoa);
+	bench("locsolve_3sphere   ", run_3sphere);
+	bench("locsolve_springs   ", run_springs);
+	return 0;
+}
+
+
+/* test_routing *********************************************************************************//**
+ * @brief		Times picking the next hop among NUM_NBRS neighbors and ranking the gateways. */
+static int test_routing(void)
+{
+	unsigned i;
+
+	/* This node and its neighbors in the cells around it. The destination is a few cells away. */
+	hyper_embed(0, 0, 0, &self[0], &self[1]);
+	hyper_embed(5, 3, 0, &dest[0], &dest[1]);
+
+	for(i = 0; i < NUM_NBRS; i++)
+	{
+		float cx = (float)(i % 5) - 2.0f;
+		float cy = (float)(i / 5) - 1.0f;
+
+		hyper_embed(cx, cy, 0, &nbrs[i][0], &nbrs[i][1]);
+		nbrs[i][2] = 1.0f + 0.1f * i;
+	}
+
+	CHECK(run_closest() > 0);
+
+	/* A full gateway table, all serving the uplink prefix */
+	hypergw_init(&gws);
+
+	for(i = 0; i < HYPER_MAX_GATEWAYS; i++)
+	{
+		HyperGwAdv adv = { .age = 0, .prefix_len = 8, .prefix = { 0xFD } };
+		float r, t;
+
+		adv.addr[0] = i + 1;
+		hyper_embed(4.0f * i, -2.0f * i, 0, &r, &t);
+		adv.coord = (Hypercoord){ r, t };
+		hypergw_rx(&gws, 1000, &adv, 1);
+	}
+
+	CHECK(run_rank() == HYPER_MAX_GATEWAYS);
+
+	bench("hyperspace_closest ", run_closest);
+	bench("hypergw_rank       ", run_rank);
+	return 0;
+}
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Helpers                                                                                         //
+// ----------------------------------------------------------------------------------------------- //
+/* now_ns ***************************************************************************************//**
+ * @brief		Returns a monotonic time in ns. */
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+/* bench ****************************************************************************************//**
+ * @brief		Prints and returns the mean time in ns of NUM_BENCH calls to run. */
+static double bench(const char* name, float (*run)(void))
+{
+	volatile float sink = 0;
+	unsigned i;
+	double   start = now_ns();
+
+	for(i = 0; i < NUM_BENCH; i++)
+	{
+		sink += run();
+	}
+
+	double ns = (now_ns() - start) / NUM_BENCH;
+
+	printf("%s %8.1f ns/call\n", name, ns);
+	(void)sink;
+	return ns;
+}
+
+
+/* run_toa **************************************************************************************//**
+ * @brief		*/
+static float run_toa(void)
+{
+	LocSolve sol;
+
+	locsolve_toa(beacons, ranges, sigmas, NUM_BEACONS, &sol);
+	return sol.x;
+}
+
+
+/* run_tdoa *************************************************************************************//**
+ * @brief		*/
+static float run_tdoa(void)
+{
+	LocSolve sol;
+
+	locsolve_tdoa(beacons, pseudoranges, sigmas, NUM_BEACONS, &sol);
+	return sol.x;
+}
+
+
+/* run_3sphere **********************************************************************************//**
+ * @brief		*/
+static float run_3sphere(void)
+{
+	float x[3];
+
+	locsolve_3sphere(beacons, ranges, 1.0f, x);
+	return x[0];
+}
+
+
+/* run_springs **********************************************************************************//**
+ * @brief		One time step from a fixed state, as each location update runs one. */
+static float run_springs(void)
+{
+	static const float g[3] = { 2.5f, 2.5f, 0 };
+
+	spring_pos[0] = 2.0f; spring_pos[1] = 2.5f; spring_pos[2] = 0.5f;
+	spring_vel[0] = 0;    spring_vel[1] = 0;    spring_vel[2] = 0;
+
+	locsolve_springs(beacons, ranges, 4, g, spring_pos, spring_vel);
+	return spring_pos[0];
+}
+
+
+/* run_closest **********************************************************************************//**
+ * @brief		The neighbor scan of hyperspace_closest. Returns the best rate found. */
+static float run_closest(void)
+{
+	float    dist = hyper_dist(self[0], self[1], dest[0], dest[1]);
+	float    max_rate = 0;
+	unsigned i;
+
+	for(i = 0; i < NUM_NBRS; i++)
+	{
+		float rate = hyper_rate(dist, nbrs[i][0], nbrs[i][1], dest[0], dest[1], nbrs[i][2]);
+
+		if(rate > max_rate)
+		{
+			max_rate = rate;
+		}
+	}
+
+	return max_rate;
+}
+
+
+/* run_rank *************************************************************************************//**
+ * @brief		Returns the number of gateways ranked. */
+static float run_rank(void)
+{
+	HyperGwAdv advs[HYPER_MAX_GATEWAYS];
+	Hypercoord from = { self[0], self[1] };
+
+	return hypergw_rank(&gws, 2000, uplink, &from, advs);
+}
+
+
+/* main *****************************************************************************************//**
+ * @brief		*/
+int main(void)
+{
+	static int (*const tests[])(void) = {
+		test_solvers,
+		test_routing,
+	};
+
+	unsigned i;
+	int      failed = 0;
+
+	for(i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+	{
+		failed += tests[i]();
+	}
+
+	printf("%u tests, %d failed\n", (unsigned)(sizeof(tests) / sizeof(tests[0])), failed);
+	return failed ? 1 : 0;
+}
+
+
+/******************************************* END OF FILE *******************************************/
@@ -0,0 +1,283 @@
+/************************************************************************************************//**
+ * @file		churn_test.c
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ * @brief		Replays noisy location traces through the capture codec and the hysteretic cell
+ * 				tracker and reports the coordinate churn against rounding the location to a cell.
+ *
+ * 				Each trace is a node's true location plus Gaussian solver noise, filtered by the
+ * 				location IIR filter at LOC_IIR_ALPHA. The filtered locations are coded as captured
+ * 				records with loc_cap_encode, decoded again as locreplay does and passed to
+ * 				hyper_cell_moved as hyperspace_update does. Rates assume one location update per
+ * 				UPDATE_MS. Real captures are replayed the same way by locreplay.
+ *
+ ***************************************************************************************************/
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "hyperembed.h"
+#include "iir.h"
+#include "loccapture.h"
+#include "prng.h"
+
+
+/* Private Macros -------------------------------------------------------------------------------- */
+#define CHECK(cond)                                                                  \
+	do {                                                                             \
+		if(!(cond))                                                                  \
+		{                                                                            \
+			printf("%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __func__, #cond); \
+			return 1;                                                                \
+		}                                                                            \
+	} while(0)
+
+#define CELL                (2.5f)		/* LATTICE_R in location.h */
+#define IIR_ALPHA           (0.965f)	/* LOC_IIR_ALPHA in location.c */
+#define SIGMA_NOMINAL       (0.3f)		/* LOC_SIGMA_NOMINAL in location.c */
+#define SYNC_PERIOD         (32)		/* LOC_CAPTURE_SYNC_PERIOD in location.c */
+#define UPDATE_MS           (1000)
+#define HOUR                (3600000 / UPDATE_MS)
+
+
+/* Private Types --------------------------------------------------------------------------------- */
+typedef struct {
+	Prng        prng;
+	iir         fx, fy, fz;
+	LocCapCodec enc;
+	LocCapCodec dec;
+	uint32_t    seq;
+	HyperCell   cell;
+	float       round[3];
+	unsigned    changes;        /* Coordinate changes of the hysteretic cell */
+	unsigned    round_changes;  /* Coordinate changes of the rounded location */
+} Trace;
+
+
+/* Private Functions ----------------------------------------------------------------------------- */
+static void  trace_init(Trace*, uint64_t);
+static int   trace_step(Trace*, float, float, float, float);
+static float gauss     (Prng*);
+
+
+/* Private Variables ----------------------------------------------------------------------------- */
+static uint8_t buf[LOC_CAPTURE_MAX_LEN];
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Tests                                                                                           //
+// ----------------------------------------------------------------------------------------------- //
+/* test_edge ************************************************************************************//**
+ * @brief		A node standing on a cell's edge keeps its coordinate for an hour at the nominal
+ * 				solver noise and at three times the nominal noise. Rounding flips constantly. */
+static int test_edge(void)
+{
+	static const float sigmas[] = { SIGMA_NOMINAL, 3 * SIGMA_NOMINAL };
+
+	unsigned i, k;
+
+	for(k = 0; k < sizeof(sigmas) / sizeof(sigmas[0]); k++)
+	{
+		Trace t;
+
+		trace_init(&t, k + 1);
+
+		for(i = 0; i < HOUR; i++)
+		{
+			CHECK(trace_step(&t, 1.5f * CELL, 2.0f * CELL, 0, sigmas[k]) == 0);
+		}
+
+		printf("edge, sigma %.1f m: %u coordinate changes/h, rounding %u/h\n",
+			sigmas[k], t.changes, t.round_changes);
+
+		CHECK(t.changes == 1);
+		CHECK(t.round_changes > 10 * t.changes);
+	}
+
+	return 0;
+}
+
+
+/* test_walk ************************************************************************************//**
+ * @brief		A node walking across ten cells changes its coordinate once per cell. */
+static int test_walk(void)
+{
+	Trace    t;
+	unsigned i;
+
+	trace_init(&t, 7);
+
+	/* Walking at 0.25 m/s along x for 10 cells, then standing still while the filter settles */
+	for(i = 0; i < 40 * CELL + 200; i++)
+	{
+		float x = fminf(0.25f * i, 10 * CELL);
+
+		CHECK(trace_step(&t, x, 0, 0, SIGMA_NOMINAL) == 0);
+	}
+
+	printf("walk over 10 cells: %u coordinate changes, rounding %u\n", t.changes, t.round_changes);
+
+	CHECK(t.changes == 11);
+	CHECK(t.round_changes >= t.changes);
+	CHECK(t.cell.x == 10 && t.cell.y == 0 && t.cell.z == 0);
+	return 0;
+}
+
+
+/* test_lost ************************************************************************************//**
+ * @brief		Losing the location clears the cell. The next location is adopted immediately. */
+static int test_lost(void)
+{
+	Trace t;
+
+	trace_init(&t, 9);
+
+	CHECK(trace_step(&t, 0, 0, 0, 0) == 0);
+	CHECK(t.changes == 1);
+
+	CHECK(trace_step(&t, NAN, NAN, NAN, 0) == 0);
+	CHECK(isnan(t.cell.x));
+
+	CHECK(trace_step(&t, 3 * CELL, 0, 0, 0) == 0);
+	CHECK(t.changes == 2 && t.cell.x == 3);
+	return 0;
+}
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Helpers                                                                                         //
+// ----------------------------------------------------------------------------------------------- //
+/* trace_init ***********************************************************************************//**
+ * @brief		*/
+static void trace_init(Trace* t, uint64_t seed)
+{
+	memset(t, 0, sizeof(Trace));
+	prng_seed(&t->prng, seed, 1);
+	iir_init(&t->fx, IIR_ALPHA, NAN);
+	iir_init(&t->fy, IIR_ALPHA, NAN);
+	iir_init(&t->fz, IIR_ALPHA, NAN);
+	loc_cap_reset(&t->enc);
+	loc_cap_reset(&t->dec);
+	hyper_cell_set(&t->cell, NAN, NAN, NAN);
+	t->round[0] = t->round[1] = t->round[2] = NAN;
+}
+
+
+/* trace_step ***********************************************************************************//**
+ * @brief		Filters one noisy solution of the true location (x, y, z), captures the filtered
+ * 				location and tracks the cell of the replayed record. A NAN location clears the
+ * 				filter as loc_clear does. Returns the result of the capture codec. */
+static int trace_step(Trace* t, float x, float y, float z, float sigma)
+{
+	LocCapRecord rec = { 0 };
+	LocCapRecord out;
+	LocCapState  state = { 0 };
+	int          r;
+
+	if(!isfinite(x))
+	{
+		iir_set_value(&t->fx, NAN);
+		iir_set_value(&t->fy, NAN);
+		iir_set_value(&t->fz, NAN);
+	}
+	else if(!isfinite(iir_value(&t->fx)))
+	{
+		iir_set_value(&t->fx, x + sigma * gauss(&t->prng));
+		iir_set_value(&t->fy, y + sigma * gauss(&t->prng));
+		iir_set_value(&t->fz, z + sigma * gauss(&t->prng));
+	}
+	else
+	{
+		iir_filter(&t->fx, x + sigma * gauss(&t->prng));
+		iir_filter(&t->fy, y + sigma * gauss(&t->prng));
+		iir_filter(&t->fz, z + sigma * gauss(&t->prng));
+	}
+
+	rec.seq    = t->seq;
+	rec.uptime = t->seq * UPDATE_MS;
+	rec.state  = 4;
+	rec.x      = iir_value(&t->fx);
+	rec.y      = iir_value(&t->fy);
+	rec.z      = iir_value(&t->fz);
+
+	r = loc_cap_encode(&t->enc, &rec, t->seq % SYNC_PERIOD == 0 ? &state : 0, buf, sizeof(buf));
+	t->seq++;
+
+	if(r < 0 || (r = loc_cap_decode(&t->dec, &out, 0, buf, r)) < 0)
+	{
+		return r;
+	}
+
+	float p[3] = { out.x / CELL, out.y / CELL, out.z / CELL };
+
+	if(!isfinite(p[0]) || !isfinite(p[1]) || !isfinite(p[2]))
+	{
+		hyper_cell_set(&t->cell, NAN, NAN, NAN);
+		t->round[0] = t->round[1] = t->round[2] = NAN;
+		return 0;
+	}
+
+	t->changes += hyper_cell_moved(&t->cell, p[0], p[1], p[2]);
+
+	if(roundf(p[0]) != t->round[0] || roundf(p[1]) != t->round[1] || roundf(p[2]) != t->round[2])
+	{
+		t->round[0] = roundf(p[0]);
+		t->round[1] = roundf(p[1]);
+		t->round[2] = roundf(p[2]);
+		t->round_changes++;
+	}
+
+	return 0;
+}
+
+
+/* gauss ****************************************************************************************//**
+ * @brief		Returns a standard normal random number (Box-Muller). */
+static float gauss(Prng* p)
+{
+	float u1 = 1.0f - prng_float(p);
+	float u2 = prng_float(p);
+
+	return sqrtf(-2.0f * logf(u1)) * cosf(2.0f * 3.14159265f * u2);
+}
+
+
+/* main *****************************************************************************************//**
+ * @brief		*/
+int main(void)
+{
+	static int (*const tests[])(void) = {
+		test_edge,
+		test_walk,
+		test_lost,
+	};
+
+	unsigned i;
+	int      failed = 0;
+
+	for(i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+	{
+		failed += tests[i]();
+	}
+
+	printf("%u tests, %d failed\n", (unsigned)(sizeof(tests) / sizeof(tests[0])), failed);
+	return failed ? 1 : 0;
+}
+
+
+/******************************************* END OF FILE *******************************************/
@@ -0,0 +1,374 @@
+/************************************************************************************************//**
+ * @file		codelsim_test.c
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ * @brief		Simulates one class queue of the shared slot under overload and reports its queueing
+ * 				delay with and without the CoDel control law of codel.c and the ENOBUFS backpressure
+ * 				of tsch_tx_pkt.
+ *
+ * 				Datagrams of one to three fragments arrive at random. Each fragment takes a frame
+ * 				from a pool of TSCH_NUM_FRAMES. When frames run out, the oldest queued datagram is
+ * 				evicted as tsch_evict_frame does. The shared slot comes around once per slotframe
+ * 				and the node wins it with probability TX_PROBABILITY, sending one frame. With CoDel,
+ * 				frames are dequeued through codel_drop and new datagrams are refused while it is
+ * 				dropping. Without it, the queue only sheds load by eviction.
+ *
+ ***************************************************************************************************/
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "codel.h"
+
+
+/* Private Macros -------------------------------------------------------------------------------- */
+#define CHECK(cond)                                                                  \
+	do {                                                                             \
+		if(!(cond))                                                                  \
+		{                                                                            \
+			printf("%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __func__, #cond); \
+			return 1;                                                                \
+		}                                                                            \
+	} while(0)
+
+#define SLOTFRAME_MS        (250)
+#define NUM_FRAMES          (16)		/* TSCH_NUM_FRAMES in tsch.c */
+#define CODEL_TARGET_MS     (2500)		/* TSCH_CODEL_TARGET_MS in tsch.c */
+#define CODEL_INTERVAL_MS   (10000)		/* TSCH_CODEL_INTERVAL_MS in tsch.c */
+#define TX_PROBABILITY      (1.0 / 3.0)	/* A node sends in about every third shared slot */
+#define MAX_FRAGMENTS       (3)
+#define MEAN_FRAGMENTS      ((1.0 + MAX_FRAGMENTS) / 2.0)
+#define NUM_SLOTFRAMES      (400000)	/* About 28 hours */
+#define MAX_DELAYS          (NUM_SLOTFRAMES)
+
+/* Datagrams per slotframe the slot can carry */
+#define CAPACITY            (TX_PROBABILITY / MEAN_FRAGMENTS)
+
+
+/* Private Types --------------------------------------------------------------------------------- */
+typedef struct {
+	uint32_t queued;        /* Time in ms the datagram was queued */
+	uint32_t tag;
+	bool     last;          /* Last fragment of its datagram */
+} Frame;
+
+typedef struct {
+	double   goodput;       /* Datagrams delivered as a fraction of CAPACITY */
+	double   p50;           /* Median delay of delivered datagrams in ms */
+	double   p99;
+	double   max;
+	double   dropped;       /* Fraction of accepted datagrams dropped by CoDel or eviction */
+	double   refused;       /* Fraction of offered datagrams refused with ENOBUFS */
+} Result;
+
+
+/* Private Functions ----------------------------------------------------------------------------- */
+static double   uniform    (void);
+static unsigned poisson    (double);
+static unsigned drop_tag   (uint32_t);
+static void     evict      (void);
+static Result   run        (double, bool);
+static void     report     (const char*, double, const Result*);
+static int      cmp_double (const void*, const void*);
+
+
+/* Private Variables ----------------------------------------------------------------------------- */
+static const double loads[] = { 0.9, 1.5, 3.0, 6.0 };
+static Frame        queue[NUM_FRAMES];
+static unsigned     queue_len;
+static double       delays[MAX_DELAYS];
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Tests                                                                                           //
+// ----------------------------------------------------------------------------------------------- //
+/* test_underload *******************************************************************************//**
+ * @brief		Below capacity CoDel rarely acts. Random gaps in the slot wins alone push some delays
+ * 				past the target, so a few datagrams are still dropped or refused. */
+static int test_underload(void)
+{
+	Result tail  = run(0.5, false);
+	Result codel = run(0.5, true);
+
+	report("tail drop", 0.5, &tail);
+	report("codel    ", 0.5, &codel);
+
+	CHECK(codel.refused < 0.01);
+	CHECK(codel.dropped < 0.015);
+	CHECK(codel.goodput >= 0.97 * tail.goodput);
+	CHECK(codel.p99     <= tail.p99);
+	return 0;
+}
+
+
+/* test_overload ********************************************************************************//**
+ * @brief		At any load the delay stays within an interval of the target and the slot stays
+ * 				busy. */
+static int test_overload(void)
+{
+	unsigned i;
+
+	for(i = 0; i < sizeof(loads) / sizeof(loads[0]); i++)
+	{
+		Result tail  = run(loads[i], false);
+		Result codel = run(loads[i], true);
+
+		report("tail drop", loads[i], &tail);
+		report("codel    ", loads[i], &codel);
+
+		CHECK(codel.p99     <= CODEL_TARGET_MS + CODEL_INTERVAL_MS);
+		CHECK(codel.goodput >= 0.9 * tail.goodput);
+	}
+
+	return 0;
+}
+
+
+/* test_standing ********************************************************************************//**
+ * @brief		Near capacity, where a standing queue builds in the frame pool, CoDel lowers the
+ * 				delay. Backpressure refuses datagrams up front rather than dropping them after they
+ * 				were accepted. */
+static int test_standing(void)
+{
+	static const double standing[] = { 0.9, 1.5 };
+
+	unsigned i;
+
+	for(i = 0; i < sizeof(standing) / sizeof(standing[0]); i++)
+	{
+		Result tail  = run(standing[i], false);
+		Result codel = run(standing[i], true);
+
+		CHECK(codel.p50     <  0.75 * tail.p50);
+		CHECK(codel.p99     <  tail.p99);
+		CHECK(codel.dropped <= tail.dropped);
+	}
+
+	return 0;
+}
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Helpers                                                                                         //
+// ----------------------------------------------------------------------------------------------- //
+/* uniform **************************************************************************************//**
+ * @brief		Returns a uniform sample in [0, 1). */
+static double uniform(void)
+{
+	return rand() / ((double)RAND_MAX + 1.0);
+}
+
+
+/* poisson **************************************************************************************//**
+ * @brief		Returns a Poisson sample with the given mean. */
+static unsigned poisson(double mean)
+{
+	double   limit = exp(-mean);
+	double   p     = uniform();
+	unsigned k     = 0;
+
+	while(p > limit)
+	{
+		p *= uniform();
+		k++;
+	}
+
+	return k;
+}
+
+
+/* drop_tag *************************************************************************************//**
+ * @brief		Removes every queued fragment of the datagram with tag and returns how many. */
+static unsigned drop_tag(uint32_t tag)
+{
+	unsigned i, n = 0;
+
+	for(i = 0; i < queue_len; i++)
+	{
+		if(queue[i].tag != tag)
+		{
+			queue[n++] = queue[i];
+		}
+	}
+
+	i         = queue_len - n;
+	queue_len = n;
+	return i;
+}
+
+
+/* evict ****************************************************************************************//**
+ * @brief		Drops the oldest queued datagram to free frames. */
+static void evict(void)
+{
+	if(queue_len)
+	{
+		drop_tag(queue[0].tag);
+	}
+}
+
+
+/* run ******************************************************************************************//**
+ * @brief		Simulates NUM_SLOTFRAMES slotframes at the offered load, as a multiple of CAPACITY.
+ * 				The same arrivals and slot wins are used with and without CoDel. */
+static Result run(double load, bool aqm)
+{
+	Result   res       = { 0, 0, 0, 0, 0, 0 };
+	Codel    codel;
+	unsigned offered   = 0;
+	unsigned accepted  = 0;
+	unsigned delivered = 0;
+	uint32_t tag       = 0;
+	unsigned sf, i;
+
+	srand(64);
+	codel_init(&codel, CODEL_TARGET_MS, CODEL_INTERVAL_MS);
+	queue_len = 0;
+
+	for(sf = 0; sf < NUM_SLOTFRAMES; sf++)
+	{
+		uint32_t now      = sf * SLOTFRAME_MS;
+		unsigned arrivals = poisson(load * CAPACITY);
+		bool     win      = uniform() < TX_PROBABILITY;
+
+		for(; arrivals; arrivals--)
+		{
+			unsigned frags = 1 + (unsigned)(uniform() * MAX_FRAGMENTS);
+
+			offered++;
+
+			/* tsch_tx_pkt refuses new datagrams while the class is dropping */
+			if(aqm && codel.dropping)
+			{
+				res.refused++;
+				continue;
+			}
+
+			while(queue_len + frags > NUM_FRAMES)
+			{
+				evict();
+			}
+
+			for(i = 0; i < frags; i++)
+			{
+				queue[queue_len++] = (Frame){ now, tag, i == frags - 1 };
+			}
+
+			tag++;
+			accepted++;
+		}
+
+		if(!win)
+		{
+			continue;
+		}
+
+		while(queue_len)
+		{
+			Frame f = queue[0];
+
+			queue_len--;
+
+			for(i = 0; i < queue_len; i++)
+			{
+				queue[i] = queue[i + 1];
+			}
+
+			if(aqm && codel_drop(&codel, now, now - f.queued, queue_len == 0))
+			{
+				drop_tag(f.tag);
+				continue;
+			}
+
+			if(f.last && delivered < MAX_DELAYS)
+			{
+				delays[delivered++] = now - f.queued;
+			}
+
+			break;
+		}
+
+		if(aqm && queue_len == 0)
+		{
+			codel_empty(&codel);
+		}
+	}
+
+	res.goodput = delivered / (CAPACITY * NUM_SLOTFRAMES);
+	res.dropped = accepted ? (double)(accepted - delivered) / accepted : 0;
+	res.refused = offered  ? res.refused / offered : 0;
+
+	if(delivered)
+	{
+		qsort(delays, delivered, sizeof(delays[0]), cmp_double);
+		res.p50 = delays[delivered * 50 / 100];
+		res.p99 = delays[delivered * 99 / 100];
+		res.max = delays[delivered - 1];
+	}
+
+	return res;
+}
+
+
+/* report ***************************************************************************************//**
+ * @brief		*/
+static void report(const char* name, double load, const Result* r)
+{
+	printf("%s load %.1f: goodput %.2f, delay p50 %5.1f s p99 %5.1f s max %5.1f s, "
+		"%4.1f%% dropped, %4.1f%% refused\n",
+		name, load, r->goodput, r->p50 / 1000, r->p99 / 1000, r->max / 1000,
+		100 * r->dropped, 100 * r->refused);
+}
+
+
+/* cmp_double ***********************************************************************************//**
+ * @brief		Orders doubles ascending for qsort. */
+static int cmp_double(const void* a, const void* b)
+{
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+
+	return (x > y) - (x < y);
+}
+
+
+/* main *****************************************************************************************//**
+ * @brief		*/
+int main(void)
+{
+	static int (*const tests[])(void) = {
+		test_underload,
+		test_overload,
+		test_standing,
+	};
+
+	unsigned i;
+	int      failed = 0;
+
+	for(i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+	{
+		failed += tests[i]();
+	}
+
+	printf("%u tests, %d failed\n", (unsigned)(sizeof(tests) / sizeof(tests[0])), failed);
+	return failed ? 1 : 0;
+}
+
+
+/******************************************* END OF FILE *******************************************/
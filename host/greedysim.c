@@ -0,0 +1,606 @@
+/************************************************************************************************//**
+ * @file		greedysim.c
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ * @brief		Simulates greedy hyperspace routing between every pair of nodes of a deployment and
+ * 				reports the greedy success ratio, the stretch of the embedding and the transmissions
+ * 				per delivered packet.
+ *
+ * 				greedysim [-v] [-g] [-c cell] [-r range] topology
+ *
+ * 				The topology file holds one node or link per line. Blank lines and lines starting
+ * 				with # are ignored.
+ *
+ * 					node <name> <x> <y> <z>         Location of a node in m
+ * 					link <name> <name> [etx]        Neighbors, expected transmissions default to 1
+ * 					path <name> <x> <y> <z>         Waypoint in m the node moves to, in order
+ *
+ * 				-r adds a link between every pair of nodes within range m of each other for
+ * 				deployments without measured neighbor tables. -c sets the lattice cell size which
+ * 				must match LATTICE_R in location.h. -g picks next hops by progress alone, ignoring
+ * 				link ETX, to compare against the firmware's metric. -v prints each node's coordinate
+ * 				and every pair that failed.
+ *
+ * 				Each node's coordinate is computed from its cell with hyper_embed, as
+ * 				hyperspace_update does once a node has settled in a cell. Packets are forwarded as in
+ * 				hyperspace_closest: to the neighbor making the most progress towards the destination
+ * 				coordinate per expected transmission. A packet at a node without a closer neighbor is
+ * 				delivered if the destination is a neighbor and is otherwise stuck at a local minimum.
+ * 				Stretch is the greedy path length over the shortest path length in hops. Each hop
+ * 				of a delivered packet costs the ETX of its link in transmissions, including retries.
+ *
+ * 				A node with waypoints then walks along them, MOVE_STEP m per location update, and
+ * 				links to the nodes within range m of it, so path needs -r. Its coordinate changes as
+ * 				in hyperspace_update. Every other node sends it a packet each update, routed to
+ * 				the coordinate it last learnt. With notifications, the moving node sends its new
+ * 				coordinate to every node when it changes, as coord_notify does, and nodes the
+ * 				notification reaches route to the new coordinate. Without, every node keeps routing
+ * 				to the starting coordinate until its route times out. The delivery ratio of both
+ * 				is reported.
+ *
+ ***************************************************************************************************/
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hyperembed.h"
+
+
+/* Private Macros -------------------------------------------------------------------------------- */
+#define MAX_NODES           (1024)
+#define MAX_NAME            (64)
+#define MAX_LINE            (256)
+#define MAX_PATH            (64)
+#define DEFAULT_CELL        (2.5f)	/* LATTICE_R in location.h */
+#define MOVE_STEP           (0.25f)	/* Distance in m moved between location updates */
+
+
+/* Private Types --------------------------------------------------------------------------------- */
+typedef struct {
+	char     name[MAX_NAME];
+	float    x, y, z;
+	float    r, t;          /* Hyperspace coordinate */
+	uint32_t minima;        /* Packets stuck at this node */
+} Node;
+
+
+typedef struct {
+	uint64_t pairs;         /* Pairs of nodes connected by some path */
+	uint64_t disconnected;  /* Pairs of nodes not connected by any path */
+	uint64_t delivered;
+	uint64_t minima;
+	uint64_t greedy_hops;   /* Hops of delivered packets */
+	uint64_t shortest_hops; /* Shortest path hops of delivered packets */
+	double   tx;            /* Expected transmissions of delivered packets */
+	double   stretch_total;
+	double   stretch_max;
+} Result;
+
+
+typedef struct {
+	int       node;              /* Index of the moving node or -1 */
+	int       num_path;
+	float     path[MAX_PATH][3]; /* Waypoints in m */
+	HyperCell cell;              /* Cell the node's coordinate is embedded from */
+} Mobile;
+
+
+/* Private Functions ----------------------------------------------------------------------------- */
+static void usage    (const char*);
+static int  load     (const char*);
+static int  find_node(const char*);
+static void add_link (int, int, float);
+static void bfs      (int, int*);
+static int  route    (int, int, float, float, double*);
+static void mobility (float, float);
+static void relink   (int, float);
+
+
+/* Private Variables ----------------------------------------------------------------------------- */
+static bool     verbose;
+static bool     geometric;	/* Ignore link ETX when picking next hops */
+static Node     nodes[MAX_NODES];
+static int      num_nodes;
+static unsigned num_links;
+static float    etx[MAX_NODES][MAX_NODES];	/* Expected transmissions of each link, 0 if no link */
+static Mobile   mobile = { .node = -1 };
+
+
+/* main *****************************************************************************************//**
+ * @brief		*/
+int main(int argc, char** argv)
+{
+	float cell  = DEFAULT_CELL;
+	float range = 0;
+	int   opt;
+	int   i, j;
+
+	while((opt = getopt(argc, argv, "vgc:r:")) != -1)
+	{
+		switch(opt)
+		{
+			case 'v': verbose   = true;               break;
+			case 'g': geometric = true;               break;
+			case 'c': cell      = strtof(optarg, 0);  break;
+			case 'r': range     = strtof(optarg, 0);  break;
+			default:  usage(argv[0]);                 return 2;
+		}
+	}
+
+	if(optind + 1 != argc || !(cell > 0) || !(range >= 0))
+	{
+		usage(argv[0]);
+		return 2;
+	}
+
+	if(load(argv[optind]) != 0)
+	{
+		return 1;
+	}
+
+	if(mobile.node >= 0 && range == 0)
+	{
+		fprintf(stderr, "path needs -r\n");
+		return 2;
+	}
+
+	for(i = 0; range > 0 && i < num_nodes; i++)
+	{
+		for(j = i + 1; j < num_nodes; j++)
+		{
+			float dx = nodes[i].x - nodes[j].x;
+			float dy = nodes[i].y - nodes[j].y;
+			float dz = nodes[i].z - nodes[j].z;
+
+			if(etx[i][j] == 0 && sqrtf(dx*dx + dy*dy + dz*dz) <= range)
+			{
+				add_link(i, j, 1.0f);
+			}
+		}
+	}
+
+	for(i = 0; i < num_nodes; i++)
+	{
+		Node* n = &nodes[i];
+
+		hyper_embed(roundf(n->x / cell), roundf(n->y / cell), roundf(n->z / cell), &n->r, &n->t);
+
+		if(verbose)
+		{
+			printf("%-16s cell %3.0f %3.0f %3.0f  coord %9.6f %9.6f\n", n->name,
+				roundf(n->x / cell), roundf(n->y / cell), roundf(n->z / cell), n->r, n->t);
+		}
+	}
+
+	static int hops[MAX_NODES];
+	Result res = { 0 };
+
+	for(i = 0; i < num_nodes; i++)
+	{
+		bfs(i, hops);
+
+		for(j = 0; j < num_nodes; j++)
+		{
+			if(j == i)
+			{
+				continue;
+			}
+
+			if(hops[j] < 0)
+			{
+				res.disconnected++;
+				continue;
+			}
+
+			res.pairs++;
+
+			double tx     = 0;
+			int    greedy = route(i, j, nodes[j].r, nodes[j].t, &tx);
+
+			if(greedy < 0)
+			{
+				res.minima++;
+
+				if(verbose)
+				{
+					printf("%s -> %s: local minimum at %s\n",
+						nodes[i].name, nodes[j].name, nodes[-greedy - 1].name);
+				}
+				continue;
+			}
+
+			double stretch = (double)greedy / hops[j];
+
+			res.delivered     += 1;
+			res.greedy_hops   += greedy;
+			res.tx            += tx;
+			res.shortest_hops += hops[j];
+			res.stretch_total += stretch;
+			res.stretch_max    = fmax(res.stretch_max, stretch);
+		}
+	}
+
+	printf("nodes %d, links %u, cell %.2f m\n", num_nodes, num_links, cell);
+	printf("pairs %llu connected, %llu disconnected\n",
+		(unsigned long long)res.pairs, (unsigned long long)res.disconnected);
+
+	if(res.pairs == 0)
+	{
+		return 0;
+	}
+
+	printf("greedy success %llu/%llu (%.1f%%), local minima %llu\n",
+		(unsigned long long)res.delivered, (unsigned long long)res.pairs,
+		100.0 * res.delivered / res.pairs, (unsigned long long)res.minima);
+
+	if(res.delivered)
+	{
+		printf("stretch mean %.3f, max %.3f, total hops %llu greedy / %llu shortest\n",
+			res.stretch_total / res.delivered, res.stretch_max,
+			(unsigned long long)res.greedy_hops, (unsigned long long)res.shortest_hops);
+		printf("transmissions per delivery %.3f, per hop %.3f\n", res.tx / res.delivered,
+			res.tx / res.greedy_hops);
+	}
+
+	for(i = 0; i < num_nodes; i++)
+	{
+		if(nodes[i].minima)
+		{
+			printf("minima at %-16s %u\n", nodes[i].name, nodes[i].minima);
+		}
+	}
+
+	if(mobile.node >= 0)
+	{
+		mobility(cell, range);
+	}
+
+	return 0;
+}
+
+
+/* usage ****************************************************************************************//**
+ * @brief		*/
+static void usage(const char* name)
+{
+	fprintf(stderr, "usage: %s [-v] [-g] [-c cell] [-r range] topology\n", name);
+}
+
+
+/* load *****************************************************************************************//**
+ * @brief		Reads the nodes and links of a topology file. */
+static int load(const char* path)
+{
+	FILE* f = fopen(path, "r");
+	char  line[MAX_LINE];
+	char  a[MAX_NAME], b[MAX_NAME];
+	float x, y, z;
+	int   lineno = 0;
+	int   r = 0;
+
+	if(!f)
+	{
+		perror(path);
+		return -1;
+	}
+
+	while(r == 0 && fgets(line, sizeof(line), f))
+	{
+		char* p = line + strspn(line, " \t");
+		float e = 1.0f;
+		int   n;
+
+		lineno++;
+
+		if(*p == '#' || *p == '\n' || *p == '\0')
+		{
+			continue;
+		}
+
+		if(sscanf(p, "node %63s %f %f %f", a, &x, &y, &z) == 4)
+		{
+			if(find_node(a) >= 0 || num_nodes == MAX_NODES)
+			{
+				fprintf(stderr, "%s:%d: duplicate node or too many nodes\n", path, lineno);
+				r = -1;
+				continue;
+			}
+
+			Node* node = &nodes[num_nodes++];
+			snprintf(node->name, sizeof(node->name), "%s", a);
+			node->x = x;
+			node->y = y;
+			node->z = z;
+		}
+		else if((n = sscanf(p, "link %63s %63s %f", a, b, &e)) >= 2)
+		{
+			int i = find_node(a);
+			int j = find_node(b);
+
+			if(i < 0 || j < 0 || i == j || !(e >= 1.0f))
+			{
+				fprintf(stderr, "%s:%d: invalid link\n", path, lineno);
+				r = -1;
+				continue;
+			}
+
+			add_link(i, j, e);
+		}
+		else if(sscanf(p, "path %63s %f %f %f", a, &x, &y, &z) == 4)
+		{
+			int i = find_node(a);
+
+			if(i < 0 || (mobile.node >= 0 && mobile.node != i) || mobile.num_path == MAX_PATH)
+			{
+				fprintf(stderr, "%s:%d: unknown node, more than one moving node or too many "
+					"waypoints\n", path, lineno);
+				r = -1;
+				continue;
+			}
+
+			mobile.node = i;
+			mobile.path[mobile.num_path][0] = x;
+			mobile.path[mobile.num_path][1] = y;
+			mobile.path[mobile.num_path][2] = z;
+			mobile.num_path++;
+		}
+		else
+		{
+			fprintf(stderr, "%s:%d: expected node, link or path\n", path, lineno);
+			r = -1;
+		}
+	}
+
+	fclose(f);
+	return r;
+}
+
+
+/* find_node ************************************************************************************//**
+ * @brief		Returns the index of the named node or -1. */
+static int find_node(const char* name)
+{
+	int i;
+
+	for(i = 0; i < num_nodes; i++)
+	{
+		if(strcmp(nodes[i].name, name) == 0)
+		{
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+
+/* add_link *************************************************************************************//**
+ * @brief		Links two nodes both ways. */
+static void add_link(int i, int j, float e)
+{
+	if(etx[i][j] == 0)
+	{
+		num_links++;
+	}
+
+	etx[i][j] = e;
+	etx[j][i] = e;
+}
+
+
+/* bfs ******************************************************************************************//**
+ * @brief		Computes the shortest path in hops from src to every node. Unreachable nodes are -1. */
+static void bfs(int src, int* hops)
+{
+	static int queue[MAX_NODES];
+	int head = 0;
+	int tail = 0;
+	int i;
+
+	for(i = 0; i < num_nodes; i++)
+	{
+		hops[i] = -1;
+	}
+
+	hops[src]     = 0;
+	queue[tail++] = src;
+
+	while(head < tail)
+	{
+		int u = queue[head++];
+
+		for(i = 0; i < num_nodes; i++)
+		{
+			if(etx[u][i] != 0 && hops[i] < 0)
+			{
+				hops[i]       = hops[u] + 1;
+				queue[tail++] = i;
+			}
+		}
+	}
+}
+
+
+/* route ****************************************************************************************//**
+ * @brief		Routes a packet greedily from src to dst towards the coordinate r, t, which is dst's
+ * 				coordinate unless the sender's route to dst is stale. Returns the hops taken or
+ * 				-(n + 1) if the packet got stuck at node n. Every hop makes progress so the route
+ * 				always ends. The ETX of each hop is added to tx if tx is not 0. */
+static int route(int src, int dst, float r, float t, double* tx)
+{
+	int u    = src;
+	int hops = 0;
+
+	while(u != dst)
+	{
+		float dist     = hyper_dist(nodes[u].r, nodes[u].t, r, t);
+		float max_rate = 0;
+		int   next     = -1;
+		int   i;
+
+		for(i = 0; i < num_nodes; i++)
+		{
+			if(etx[u][i] != 0)
+			{
+				float cost = geometric ? 1.0f : etx[u][i];
+				float rate = hyper_rate(dist, nodes[i].r, nodes[i].t, r, t, cost);
+
+				if(rate > max_rate)
+				{
+					max_rate = rate;
+					next     = i;
+				}
+			}
+		}
+
+		if(next < 0)
+		{
+			if(etx[u][dst] == 0)
+			{
+				nodes[u].minima++;
+				return -(u + 1);
+			}
+
+			next = dst;
+		}
+
+		if(tx)
+		{
+			*tx += etx[u][next];
+		}
+
+		u = next;
+		hops++;
+	}
+
+	return hops;
+}
+
+
+/* mobility *************************************************************************************//**
+ * @brief		Walks the moving node along its waypoints and prints the delivery ratio of packets
+ * 				sent to it with and without coordinate notifications. */
+static void mobility(float cell, float range)
+{
+	static float known[2][MAX_NODES][2];	/* Coordinate of the moving node each node routes to */
+	Node*    m       = &nodes[mobile.node];
+	uint64_t sent    = 0;
+	uint64_t recv[2] = { 0 };
+	unsigned updates = 0;
+	unsigned changes = 0;
+	float    moved   = 0;
+	int      i, k;
+
+	hyper_cell_set(&mobile.cell, roundf(m->x / cell), roundf(m->y / cell), roundf(m->z / cell));
+
+	for(i = 0; i < num_nodes; i++)
+	{
+		known[0][i][0] = known[1][i][0] = m->r;
+		known[0][i][1] = known[1][i][1] = m->t;
+	}
+
+	for(k = 0; k < mobile.num_path; k++)
+	{
+		float start[3] = { m->x, m->y, m->z };
+		float dx       = mobile.path[k][0] - start[0];
+		float dy       = mobile.path[k][1] - start[1];
+		float dz       = mobile.path[k][2] - start[2];
+		float len      = sqrtf(dx*dx + dy*dy + dz*dz);
+		int   steps    = (int)ceilf(len / MOVE_STEP);
+		int   s;
+
+		for(s = 1; s <= steps; s++)
+		{
+			float f = (float)s / steps;
+
+			m->x = start[0] + f * dx;
+			m->y = start[1] + f * dy;
+			m->z = start[2] + f * dz;
+			relink(mobile.node, range);
+			updates++;
+
+			if(hyper_cell_moved(&mobile.cell, m->x / cell, m->y / cell, m->z / cell))
+			{
+				hyper_embed(mobile.cell.x, mobile.cell.y, mobile.cell.z, &m->r, &m->t);
+				changes++;
+
+				/* Notifications are routed to each node's own coordinate, which is current */
+				for(i = 0; i < num_nodes; i++)
+				{
+					if(i != mobile.node && route(mobile.node, i, nodes[i].r, nodes[i].t, 0) >= 0)
+					{
+						known[1][i][0] = m->r;
+						known[1][i][1] = m->t;
+					}
+				}
+			}
+
+			for(i = 0; i < num_nodes; i++)
+			{
+				if(i == mobile.node)
+				{
+					continue;
+				}
+
+				sent++;
+				recv[0] += route(i, mobile.node, known[0][i][0], known[0][i][1], 0) >= 0;
+				recv[1] += route(i, mobile.node, known[1][i][0], known[1][i][1], 0) >= 0;
+			}
+		}
+
+		moved += len;
+	}
+
+	printf("%s moved %.1f m in %u updates, %u coordinate changes\n", m->name, moved, updates,
+		changes);
+
+	if(sent)
+	{
+		printf("delivery while moving %.1f%% with notifications, %.1f%% without, %llu packets\n",
+			100.0 * recv[1] / sent, 100.0 * recv[0] / sent, (unsigned long long)sent);
+	}
+}
+
+
+/* relink ***************************************************************************************//**
+ * @brief		Replaces the links of node n by links to every node within range m of it. */
+static void relink(int n, float range)
+{
+	int i;
+
+	for(i = 0; i < num_nodes; i++)
+	{
+		float dx = nodes[i].x - nodes[n].x;
+		float dy = nodes[i].y - nodes[n].y;
+		float dz = nodes[i].z - nodes[n].z;
+
+		if(etx[n][i] != 0)
+		{
+			etx[n][i] = 0;
+			etx[i][n] = 0;
+			num_links--;
+		}
+
+		if(i != n && sqrtf(dx*dx + dy*dy + dz*dz) <= range)
+		{
+			add_link(n, i, 1.0f);
+		}
+	}
+}
+
+
+/******************************************* END OF FILE *******************************************/
@@ -0,0 +1,578 @@
+/************************************************************************************************//**
+ * @file		gwsim_test.c
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ * @brief		Simulates gateway announcements and uplink routing with the gateway table of
+ * 				hypergw.c and reports how long a mesh takes to fail over when a gateway's host dies.
+ *
+ * 				Nodes sit on a GRID by GRID lattice with a few cells left empty. Each node's
+ * 				coordinate is computed from its cell with hyper_embed and nodes in adjacent cells,
+ * 				diagonals included, are neighbors. Gateways sit in three corners and serve the same
+ * 				host prefix. Time advances one enhanced beacon period at a time. Every node puts one
+ * 				announcement from hypergw_adv in its beacon and each neighbor hears it with
+ * 				probability 1 - BEACON_LOSS. Hosts send a heartbeat every HEARTBEAT_MS and a gateway
+ * 				originates an announcement every GW_PERIOD_MS while its host was heard within
+ * 				HOST_TIMEOUT_MS, as hyperspace_gateway_timeout does.
+ *
+ * 				Uplink packets are routed as in hyperspace_route: a gateway whose host link is up
+ * 				hands the packet to its host, other nodes forward greedily towards the gateway in the
+ * 				packet and fail over to the next gateway ranked by hypergw_rank when that gateway is
+ * 				lost or no neighbor is closer to it. Without failover the packet is only ever steered
+ * 				to the nearest healthy gateway and is lost at a local minimum, where the old code
+ * 				broadcast it.
+ *
+ ***************************************************************************************************/
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hyperembed.h"
+#include "hypergw.h"
+
+
+/* Private Macros -------------------------------------------------------------------------------- */
+#define CHECK(cond)                                                                  \
+	do {                                                                             \
+		if(!(cond))                                                                  \
+		{                                                                            \
+			printf("%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __func__, #cond); \
+			return 1;                                                                \
+		}                                                                            \
+	} while(0)
+
+#define GRID                (8)
+#define MAX_NODES           (GRID * GRID)
+#define MAX_NBRS            (8)
+#define NUM_GATEWAYS        (3)
+#define HOLE_PROBABILITY    (0.1)		/* Cells without a node */
+#define BEACON_LOSS         (0.1)		/* Beacons a neighbor misses */
+#define STEP_MS             (1000)		/* Enhanced beacon period, every fourth slotframe */
+#define GW_PERIOD_MS        (10*1000)	/* HYPER_GW_PERIOD_MS in hyperspace.c */
+#define HOST_TIMEOUT_MS     (30*1000)	/* HYPER_GW_HOST_TIMEOUT_MS in hyperspace.c */
+#define HEARTBEAT_MS        (10*1000)	/* Heartbeat period of HyperTun */
+#define HOP_LIMIT           (64)
+#define WARMUP_MS           (120*1000)
+#define KILL_MS             (300*1000)	/* Time the first gateway's host dies */
+#define END_MS              (KILL_MS + 180*1000)
+
+/* Phases of test_failover. The host timeout lasts until the dead gateway stops announcing and
+ * expiry until every node has dropped it. */
+#define PHASE_BEFORE        (0)
+#define PHASE_HELD          (1)
+#define PHASE_WINDOW        (2)
+#define PHASE_AFTER         (3)
+#define NUM_PHASES          (4)
+
+
+/* Private Types --------------------------------------------------------------------------------- */
+typedef struct {
+	bool         present;
+	bool         reachable;     /* Connected to a gateway by some path */
+	Hypercoord   coord;
+	HyperGwTable table;
+	int          gw;            /* Index into gateways or -1 */
+	int          nbrs[MAX_NBRS];
+	unsigned     num_nbrs;
+} Node;
+
+
+typedef struct {
+	int      node;
+	bool     host_up;
+	uint32_t host_seen;         /* Time in ms of the last heartbeat */
+	uint8_t  seq;
+} Gateway;
+
+
+typedef struct {
+	unsigned sent;
+	unsigned delivered;
+} Ratio;
+
+
+/* Private Functions ----------------------------------------------------------------------------- */
+static double   uniform    (void);
+static void     setup      (void);
+static void     step       (uint32_t);
+static bool     serving    (int, uint32_t);
+static int      closest    (int, const Hypercoord*);
+static bool     route      (int, uint32_t, bool);
+static unsigned knows      (int, uint32_t);
+static double   ratio      (const Ratio*);
+
+
+/* Private Variables ----------------------------------------------------------------------------- */
+static const uint8_t host_addr[16] = { 0xFD, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 };
+static const int     corners[NUM_GATEWAYS] = { 0, GRID - 1, GRID * GRID - 1 };
+static Node          nodes[MAX_NODES];
+static Gateway       gateways[NUM_GATEWAYS];
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Tests                                                                                           //
+// ----------------------------------------------------------------------------------------------- //
+/* test_prefix **********************************************************************************//**
+ * @brief		Destinations are only uplink if a healthy gateway's prefix covers them and only the
+ * 				gateways serving a destination are ranked, nearest first. */
+static int test_prefix(void)
+{
+	static const uint8_t other[16] = { 0xFD, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2 };
+	static const uint8_t node[16]  = { 0xFD, 0, 0, 0, 0, 0, 0, 0, 0, 0xCF, 0xE5, 0xA0, 0x23, 0x0D };
+
+	HyperGwTable t;
+	HyperGwAdv   adv[3];
+	HyperGwAdv   rank[HYPER_MAX_GATEWAYS];
+	Hypercoord   from = { 0, 0 };
+	unsigned     i;
+
+	memset(adv, 0, sizeof(adv));
+
+	for(i = 0; i < 3; i++)
+	{
+		float r, t;
+
+		hyper_embed(3.0f * i + 1, 0, 0, &r, &t);
+		adv[i].addr[0] = i + 1;
+		adv[i].coord   = (Hypercoord){ r, t };
+		memmove(adv[i].prefix, i == 1 ? other : host_addr, sizeof(adv[i].prefix));
+		adv[i].prefix_len = 128;
+	}
+
+	/* Prefixes that do not end on a byte boundary */
+	adv[2].prefix_len = 60;
+
+	hypergw_init(&t);
+	hypergw_rx(&t, 1000, adv, 3);
+
+	CHECK( hypergw_uplink(&t, 1000, host_addr));
+	CHECK( hypergw_uplink(&t, 1000, other));
+	CHECK( hypergw_uplink(&t, 1000, node));
+	CHECK(!hypergw_uplink(&t, 1000 + HYPER_GW_TIMEOUT_MS, host_addr));
+
+	adv[2].prefix_len = 128;
+	hypergw_init(&t);
+	hypergw_rx(&t, 1000, adv, 3);
+
+	CHECK(!hypergw_uplink(&t, 1000, node));
+	CHECK(hypergw_rank(&t, 1000, host_addr, &from, rank) == 2);
+	CHECK(rank[0].addr[0] == 1 && rank[1].addr[0] == 3);
+	CHECK(hypergw_rank(&t, 1000, other, &from, rank) == 1 && rank[0].addr[0] == 2);
+
+	/* A prefix longer than an address is never accepted */
+	adv[0].addr[0]    = 4;
+	adv[0].prefix_len = 129;
+	hypergw_rx(&t, 2000, adv, 1);
+	CHECK(hypergw_rank(&t, 2000, host_addr, &from, rank) == 2);
+	return 0;
+}
+
+
+/* test_failover ********************************************************************************//**
+ * @brief		Every node learns every gateway. When a gateway's host dies, every node drops the
+ * 				gateway within HOST_TIMEOUT_MS + HYPER_GW_TIMEOUT_MS of the last heartbeat. Failing
+ * 				over to the next gateway delivers at least as much as steering to the nearest one in
+ * 				every phase, and more while the dead gateway is still announced. */
+static int test_failover(void)
+{
+	static const char* const names[NUM_PHASES] = {
+		"before failure", "host timeout", "until expiry", "after expiry"
+	};
+
+	Ratio    failover[NUM_PHASES];
+	Ratio    nearest[NUM_PHASES];
+	uint32_t expired = 0;
+	uint32_t known   = 0;
+	uint32_t pairs   = 0;
+	uint32_t last_hb = 0;
+	unsigned present = 0;
+	uint32_t now;
+	int      i;
+
+	memset(failover, 0, sizeof(failover));
+	memset(nearest,  0, sizeof(nearest));
+	setup();
+
+	for(now = 0; now < END_MS; now += STEP_MS)
+	{
+		if(now == KILL_MS)
+		{
+			gateways[0].host_up = false;
+			last_hb             = gateways[0].host_seen;
+		}
+
+		step(now);
+
+		if(now < WARMUP_MS)
+		{
+			continue;
+		}
+
+		if(now >= KILL_MS && !expired && knows(-1, now) == 0)
+		{
+			expired = now;
+		}
+
+		int phase = now < KILL_MS                   ? PHASE_BEFORE :
+		            now < last_hb + HOST_TIMEOUT_MS ? PHASE_HELD   :
+		            !expired                        ? PHASE_WINDOW : PHASE_AFTER;
+
+		for(i = 0; i < MAX_NODES; i++)
+		{
+			if(!nodes[i].reachable)
+			{
+				continue;
+			}
+
+			/* Gateways known by each node while all are up */
+			if(phase == PHASE_BEFORE)
+			{
+				known += knows(i, now);
+				pairs += NUM_GATEWAYS;
+			}
+
+			failover[phase].sent++;
+			failover[phase].delivered += route(i, now, true);
+			nearest[phase].sent++;
+			nearest[phase].delivered += route(i, now, false);
+		}
+	}
+
+	for(i = 0; i < MAX_NODES; i++)
+	{
+		present += nodes[i].reachable;
+	}
+
+	printf("%u nodes, %.1f%% of gateways known\n", present, 100.0 * known / pairs);
+	printf("gateway lost %.0f s after its host died, %.0f s after its last heartbeat\n",
+		(expired - KILL_MS) / 1000.0, (expired - last_hb) / 1000.0);
+
+	for(i = 0; i < NUM_PHASES; i++)
+	{
+		printf("delivered %-14s %5.1f%% failover, %5.1f%% nearest only\n",
+			names[i], 100 * ratio(&failover[i]), 100 * ratio(&nearest[i]));
+	}
+
+	CHECK(known >= 0.99 * pairs);
+	CHECK(expired != 0);
+	CHECK(expired - last_hb <= HOST_TIMEOUT_MS + HYPER_GW_TIMEOUT_MS);
+	CHECK(ratio(&failover[PHASE_WINDOW]) >  ratio(&nearest[PHASE_WINDOW]));
+	CHECK(ratio(&failover[PHASE_AFTER])  >= 0.99);
+
+	for(i = 0; i < NUM_PHASES; i++)
+	{
+		CHECK(ratio(&failover[i]) >= ratio(&nearest[i]));
+	}
+
+	return 0;
+}
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Helpers                                                                                         //
+// ----------------------------------------------------------------------------------------------- //
+/* uniform **************************************************************************************//**
+ * @brief		Returns a uniform sample in [0, 1). */
+static double uniform(void)
+{
+	return rand() / ((double)RAND_MAX + 1.0);
+}
+
+
+/* setup ****************************************************************************************//**
+ * @brief		Places the nodes and gateways and links nodes in adjacent cells. */
+static void setup(void)
+{
+	int queue[MAX_NODES];
+	int head = 0, tail = 0;
+	int i, j;
+
+	srand(65);
+	memset(nodes, 0, sizeof(nodes));
+
+	for(i = 0; i < MAX_NODES; i++)
+	{
+		Node* n = &nodes[i];
+		float r, t;
+
+		/* Cells are centered on the root as in a deployment */
+		hyper_embed(i % GRID - GRID / 2, i / GRID - GRID / 2, 0, &r, &t);
+		n->present = uniform() >= HOLE_PROBABILITY;
+		n->coord   = (Hypercoord){ r, t };
+		n->gw      = -1;
+		hypergw_init(&n->table);
+	}
+
+	for(i = 0; i < NUM_GATEWAYS; i++)
+	{
+		gateways[i] = (Gateway){ corners[i], true, 0, 0 };
+		nodes[corners[i]].present = true;
+		nodes[corners[i]].gw      = i;
+	}
+
+	for(i = 0; i < MAX_NODES; i++)
+	{
+		for(j = 0; nodes[i].present && j < MAX_NODES; j++)
+		{
+			int dx = abs(i % GRID - j % GRID);
+			int dy = abs(i / GRID - j / GRID);
+
+			if(j != i && nodes[j].present && dx <= 1 && dy <= 1)
+			{
+				nodes[i].nbrs[nodes[i].num_nbrs++] = j;
+			}
+		}
+	}
+
+	/* Only nodes connected to the gateways take part */
+	for(i = 0; i < NUM_GATEWAYS; i++)
+	{
+		nodes[corners[i]].reachable = true;
+		queue[tail++] = corners[i];
+	}
+
+	while(head < tail)
+	{
+		Node* n = &nodes[queue[head++]];
+
+		for(j = 0; j < (int)n->num_nbrs; j++)
+		{
+			if(!nodes[n->nbrs[j]].reachable)
+			{
+				nodes[n->nbrs[j]].reachable = true;
+				queue[tail++] = n->nbrs[j];
+			}
+		}
+	}
+}
+
+
+/* step *****************************************************************************************//**
+ * @brief		Advances the network by one beacon period. */
+static void step(uint32_t now)
+{
+	HyperGwAdv advs[MAX_NODES][HYPER_MAX_GW_ADVS];
+	unsigned   count[MAX_NODES];
+	int        i;
+	unsigned   j;
+
+	for(i = 0; i < NUM_GATEWAYS; i++)
+	{
+		Gateway* gw = &gateways[i];
+		Node*    n  = &nodes[gw->node];
+
+		if(gw->host_up && now % HEARTBEAT_MS == 0)
+		{
+			gw->host_seen = now;
+		}
+
+		/* Gateways announce out of phase with each other */
+		if((now + i * STEP_MS) % GW_PERIOD_MS == 0 && serving(gw->node, now))
+		{
+			HyperGwAdv adv;
+
+			memset(&adv, 0, sizeof(adv));
+			adv.addr[0] = gw->node + 1;
+			adv.coord   = n->coord;
+			adv.seq     = ++gw->seq;
+			memmove(adv.prefix, host_addr, sizeof(adv.prefix));
+			adv.prefix_len = 128;
+			hypergw_rx(&n->table, now, &adv, 1);
+		}
+	}
+
+	for(i = 0; i < MAX_NODES; i++)
+	{
+		count[i] = nodes[i].reachable ?
+			hypergw_adv(&nodes[i].table, now, advs[i], HYPER_MAX_GW_ADVS) : 0;
+	}
+
+	for(i = 0; i < MAX_NODES; i++)
+	{
+		for(j = 0; j < nodes[i].num_nbrs; j++)
+		{
+			if(count[i] && uniform() >= BEACON_LOSS)
+			{
+				hypergw_rx(&nodes[nodes[i].nbrs[j]].table, now, advs[i], count[i]);
+			}
+		}
+	}
+}
+
+
+/* serving **************************************************************************************//**
+ * @brief		Returns true if the node is a gateway that heard its host recently and so hands
+ * 				uplink packets to the host, as hyperspace_gateway_serves does. */
+static bool serving(int node, uint32_t now)
+{
+	int gw = nodes[node].gw;
+
+	return gw >= 0 && now - gateways[gw].host_seen < HOST_TIMEOUT_MS;
+}
+
+
+/* closest **************************************************************************************//**
+ * @brief		Returns the neighbor making the most progress towards the coordinate, as
+ * 				hyperspace_closest does with every link costing one transmission, or -1. */
+static int closest(int u, const Hypercoord* c)
+{
+	const Node* n     = &nodes[u];
+	float       dist  = hyper_dist(n->coord.r, n->coord.t, c->r, c->t);
+	float       best  = 0;
+	int         next  = -1;
+	unsigned    i;
+
+	for(i = 0; i < n->num_nbrs; i++)
+	{
+		const Node* m        = &nodes[n->nbrs[i]];
+		float       progress = dist - hyper_dist(m->coord.r, m->coord.t, c->r, c->t);
+
+		if(progress > best)
+		{
+			best = progress;
+			next = n->nbrs[i];
+		}
+	}
+
+	return next;
+}
+
+
+/* route ****************************************************************************************//**
+ * @brief		Routes an uplink packet from the node and returns true if it reached a live host.
+ * 				With failover each node tries the gateways ranked by hypergw_rank, as
+ * 				hyperspace_gateway_route does. Without it the packet is only re-steered to the
+ * 				nearest gateway when its gateway is lost. */
+static bool route(int u, uint32_t now, bool failover)
+{
+	HyperGwAdv rank[HYPER_MAX_GATEWAYS];
+	Hypercoord dest  = { NAN, NAN };
+	bool       seen[MAX_NODES];
+	unsigned   hops;
+
+	memset(seen, 0, sizeof(seen));
+
+	for(hops = 0; hops < HOP_LIMIT; hops++)
+	{
+		const HyperGwTable* t    = &nodes[u].table;
+		int                 next = -1;
+		unsigned            count, i;
+
+		if(!hypergw_uplink(t, now, host_addr))
+		{
+			return false;
+		}
+
+		if(serving(u, now))
+		{
+			return gateways[nodes[u].gw].host_up;
+		}
+
+		/* The packet cache drops a packet a node has already forwarded */
+		if(seen[u])
+		{
+			return false;
+		}
+
+		seen[u] = true;
+
+		if(hypergw_healthy(t, now, &dest))
+		{
+			next = closest(u, &dest);
+		}
+
+		count = hypergw_rank(t, now, host_addr, &nodes[u].coord, rank);
+
+		for(i = 0; next < 0 && i < count; i++)
+		{
+			if(failover || i == 0)
+			{
+				dest = rank[i].coord;
+				next = closest(u, &dest);
+			}
+		}
+
+		if(next < 0)
+		{
+			return false;
+		}
+
+		u = next;
+	}
+
+	return false;
+}
+
+
+/* knows ****************************************************************************************//**
+ * @brief		Returns how many gateways the node holds as healthy. With node -1 returns how many
+ * 				nodes still hold the first gateway. */
+static unsigned knows(int node, uint32_t now)
+{
+	unsigned count = 0;
+	int      i;
+
+	for(i = 0; i < MAX_NODES; i++)
+	{
+		if(node < 0 && nodes[i].reachable)
+		{
+			count += hypergw_healthy(&nodes[i].table, now, &nodes[gateways[0].node].coord);
+		}
+	}
+
+	for(i = 0; node >= 0 && i < NUM_GATEWAYS; i++)
+	{
+		count += hypergw_healthy(&nodes[node].table, now, &nodes[gateways[i].node].coord);
+	}
+
+	return count;
+}
+
+
+/* ratio ****************************************************************************************//**
+ * @brief		Returns the fraction of packets delivered. */
+static double ratio(const Ratio* r)
+{
+	return r->sent ? (double)r->delivered / r->sent : 0;
+}
+
+
+/* main *****************************************************************************************//**
+ * @brief		*/
+int main(void)
+{
+	static int (*const tests[])(void) = {
+		test_prefix,
+		test_failover,
+	};
+
+	unsigned i;
+	int      failed = 0;
+
+	for(i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+	{
+		failed += tests[i]();
+	}
+
+	printf("%u tests, %d failed\n", (unsigned)(sizeof(tests) / sizeof(tests[0])), failed);
+	return failed ? 1 : 0;
+}
+
+
+/******************************************* END OF FILE *******************************************/
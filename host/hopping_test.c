@@ -0,0 +1,237 @@
+/************************************************************************************************//**
+ * @file		hopping_test.c
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ * @brief		Tests that nodes agree on the channel of every cell once they share a hopping
+ * 				sequence and that sequences the radio can't follow are never adopted.
+ *
+ ***************************************************************************************************/
+#include <stdio.h>
+#include <string.h>
+
+#include "hopping.h"
+
+
+/* Private Macros -------------------------------------------------------------------------------- */
+#define CHECK(cond)                                                                  \
+	do {                                                                             \
+		if(!(cond))                                                                  \
+		{                                                                            \
+			printf("%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __func__, #cond); \
+			return 1;                                                                \
+		}                                                                            \
+	} while(0)
+
+#define NUM_SLOTS           (100)	/* TSCH_DEFAULT_NUM_SLOTS in tsch.h */
+#define PRF                 (DW1000_PRF_64MHZ)	/* dwcfg in tsch.c */
+
+
+/* Inline Function Instances --------------------------------------------------------------------- */
+/* dw1000.c holds the instance on target but doesn't build on the host */
+extern bool dw1000_valid_channel_code(DW1000_Prf, unsigned, unsigned);
+
+
+/* Private Types --------------------------------------------------------------------------------- */
+typedef struct {
+	Tsch_Channel seq[TSCH_MAX_HOPPING_LEN];
+	unsigned     len;
+} Node;
+
+
+/* Private Functions ----------------------------------------------------------------------------- */
+static bool adopt(Node*, const uint8_t*, unsigned);
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Tests                                                                                           //
+// ----------------------------------------------------------------------------------------------- //
+/* test_default *********************************************************************************//**
+ * @brief		The default sequence is valid and its length is coprime with the slotframe. */
+static int test_default(void)
+{
+	unsigned a = NUM_SLOTS;
+	unsigned b = hopping_default_len;
+
+	CHECK(hopping_check(hopping_default_seq, hopping_default_len, PRF));
+
+	while(b)
+	{
+		unsigned t = a % b;
+		a = b;
+		b = t;
+	}
+
+	CHECK(a == 1);
+	return 0;
+}
+
+
+/* test_agreement *******************************************************************************//**
+ * @brief		A node that adopts the advertised sequence hops to the same channel as the advertiser
+ * 				for every cell, including ASNs beyond 32 bits. */
+static int test_agreement(void)
+{
+	static const uint64_t starts[] = { 0, 12345, 0xFFFFFF00ull, 0xFFFFFFFF00ull };
+	static const Tsch_Channel seq[] = {
+		{ .channel = 2, .code = 9  },
+		{ .channel = 5, .code = 10 },
+		{ .channel = 5, .code = 11 },
+		{ .channel = 2, .code = 12 },
+		{ .channel = 5, .code = 9  },
+	};
+
+	Node     joiner = { .len = 0 };
+	uint64_t asn;
+	unsigned i, offset;
+
+	/* The advertiser sends its sequence as the payload of the hopping IE */
+	CHECK(adopt(&joiner, (const uint8_t*)seq, sizeof(seq)));
+	CHECK(joiner.len == sizeof(seq) / sizeof(seq[0]));
+
+	for(i = 0; i < sizeof(starts) / sizeof(starts[0]); i++)
+	{
+		for(asn = starts[i]; asn < starts[i] + 3 * NUM_SLOTS; asn++)
+		{
+			for(offset = 0; offset < 16; offset++)
+			{
+				const Tsch_Channel* a = hopping_channel(seq, 5, asn, offset);
+				const Tsch_Channel* b = hopping_channel(joiner.seq, joiner.len, asn, offset);
+
+				CHECK(a->channel == b->channel && a->code == b->code);
+			}
+		}
+	}
+
+	return 0;
+}
+
+
+/* test_coverage ********************************************************************************//**
+ * @brief		Every cell of the slotframe visits every entry of the default sequence within
+ * 				hopping length slotframes. */
+static int test_coverage(void)
+{
+	unsigned slot, sf;
+
+	for(slot = 0; slot < NUM_SLOTS; slot++)
+	{
+		bool seen[TSCH_MAX_HOPPING_LEN] = { false };
+
+		for(sf = 0; sf < hopping_default_len; sf++)
+		{
+			const Tsch_Channel* ch = hopping_channel(
+				hopping_default_seq, hopping_default_len, (uint64_t)sf * NUM_SLOTS + slot, 0);
+
+			seen[ch - hopping_default_seq] = true;
+		}
+
+		for(sf = 0; sf < hopping_default_len; sf++)
+		{
+			CHECK(seen[sf]);
+		}
+	}
+
+	return 0;
+}
+
+
+/* test_reject **********************************************************************************//**
+ * @brief		Sequences the radio can't follow are rejected as a whole and leave the node's
+ * 				sequence unchanged, instead of being truncated or failing later in the slot. */
+static int test_reject(void)
+{
+	static const Tsch_Channel bad_channel[] = { { 5, 10 }, { 6, 10 } };
+	static const Tsch_Channel zero_channel[] = { { 0, 10 } };
+	static const Tsch_Channel high_channel[] = { { 8, 10 } };
+	static const Tsch_Channel bad_code[] = { { 2, 9 }, { 5, 4 } };
+	static const Tsch_Channel high_code[] = { { 2, 25 } };
+
+	Tsch_Channel too_long[TSCH_MAX_HOPPING_LEN + 1];
+	Node         node;
+	unsigned     i;
+
+	for(i = 0; i < TSCH_MAX_HOPPING_LEN + 1; i++)
+	{
+		too_long[i] = hopping_default_seq[0];
+	}
+
+	memmove(node.seq, hopping_default_seq, hopping_default_len * sizeof(Tsch_Channel));
+	node.len = hopping_default_len;
+
+	CHECK(!adopt(&node, (const uint8_t*)too_long, sizeof(too_long)));
+	CHECK(!adopt(&node, (const uint8_t*)bad_channel, sizeof(bad_channel)));
+	CHECK(!adopt(&node, (const uint8_t*)zero_channel, sizeof(zero_channel)));
+	CHECK(!adopt(&node, (const uint8_t*)high_channel, sizeof(high_channel)));
+	CHECK(!adopt(&node, (const uint8_t*)bad_code, sizeof(bad_code)));
+	CHECK(!adopt(&node, (const uint8_t*)high_code, sizeof(high_code)));
+	CHECK(!adopt(&node, 0, 0));
+
+	CHECK(node.len == hopping_default_len);
+	CHECK(memcmp(node.seq, hopping_default_seq, node.len * sizeof(Tsch_Channel)) == 0);
+
+	/* Codes 1-8 are only valid at 16 MHz PRF */
+	CHECK(hopping_check(bad_code + 1, 1, DW1000_PRF_16MHZ));
+	CHECK(!hopping_check(bad_code, 1, DW1000_PRF_16MHZ));
+	return 0;
+}
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Helpers                                                                                         //
+// ----------------------------------------------------------------------------------------------- //
+/* adopt ****************************************************************************************//**
+ * @brief		Adopts the sequence carried by a hopping IE payload as tsch_scan_slot does. */
+static bool adopt(Node* node, const uint8_t* payload, unsigned length)
+{
+	unsigned len = length / sizeof(Tsch_Channel);
+
+	if(!hopping_check((const Tsch_Channel*)payload, len, PRF))
+	{
+		return false;
+	}
+
+	memmove(node->seq, payload, len * sizeof(Tsch_Channel));
+	node->len = len;
+	return true;
+}
+
+
+/* main *****************************************************************************************//**
+ * @brief		*/
+int main(void)
+{
+	static int (*const tests[])(void) = {
+		test_default,
+		test_agreement,
+		test_coverage,
+		test_reject,
+	};
+
+	unsigned i;
+	int      failed = 0;
+
+	for(i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+	{
+		failed += tests[i]();
+	}
+
+	printf("%u tests, %d failed\n", (unsigned)(sizeof(tests) / sizeof(tests[0])), failed);
+	return failed ? 1 : 0;
+}
+
+
+/******************************************* END OF FILE *******************************************/
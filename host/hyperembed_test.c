@@ -0,0 +1,107 @@
+/************************************************************************************************//**
+ * @file		hyperembed_test.c
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ * @brief		Tests the lattice embedding that assigns hyperspace coordinates.
+ *
+ ***************************************************************************************************/
+#include <math.h>
+#include <stdio.h>
+
+#include "hyperembed.h"
+
+
+/* Private Macros -------------------------------------------------------------------------------- */
+#define CHECK(cond)                                                                  \
+	do {                                                                             \
+		if(!(cond))                                                                  \
+		{                                                                            \
+			printf("%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __func__, #cond); \
+			return 1;                                                                \
+		}                                                                            \
+	} while(0)
+
+#define NEAR(a, b)          (fabsf((a) - (b)) < 1e-4f)
+#define PI_F                (3.14159265f)
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Tests                                                                                           //
+// ----------------------------------------------------------------------------------------------- //
+/* test_axes ************************************************************************************//**
+ * @brief		The origin cell is at the center and each axis leads away at its own angle. */
+static int test_axes(void)
+{
+	float r, t;
+
+	hyper_embed(0, 0, 0, &r, &t);
+	CHECK(r == 0 && t == 0);
+
+	hyper_embed(1, 0, 0, &r, &t);
+	CHECK(NEAR(r, HYPER_LATTICE_R) && NEAR(t, 0));
+
+	hyper_embed(0, 1, 0, &r, &t);
+	CHECK(NEAR(r, HYPER_LATTICE_R) && NEAR(t, PI_F / 3));
+
+	hyper_embed(0, 0, 1, &r, &t);
+	CHECK(NEAR(r, HYPER_LATTICE_R) && NEAR(t, PI_F * 2 / 3));
+
+	hyper_embed(-1, 0, 0, &r, &t);
+	CHECK(NEAR(r, HYPER_LATTICE_R) && NEAR(t, PI_F));
+	return 0;
+}
+
+
+/* test_dist ************************************************************************************//**
+ * @brief		Distance is symmetric and matches the translation along an axis. */
+static int test_dist(void)
+{
+	float r1, t1, r2, t2;
+
+	hyper_embed(1, 2, 0, &r1, &t1);
+	hyper_embed(3, 0, 1, &r2, &t2);
+
+	CHECK(NEAR(hyper_dist(r1, t1, r2, t2), hyper_dist(r2, t2, r1, t1)));
+	CHECK(NEAR(hyper_dist(0, 0, r1, t1), r1));
+
+	hyper_embed(2, 0, 0, &r2, &t2);
+	CHECK(NEAR(hyper_dist(0, 0, r2, t2), 2 * HYPER_LATTICE_R));
+	return 0;
+}
+
+
+/* main *****************************************************************************************//**
+ * @brief		*/
+int main(void)
+{
+	static int (*const tests[])(void) = {
+		test_axes,
+		test_dist,
+	};
+
+	unsigned i;
+	int      failed = 0;
+
+	for(i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+	{
+		failed += tests[i]();
+	}
+
+	printf("%u tests, %d failed\n", (unsigned)(sizeof(tests) / sizeof(tests[0])), failed);
+	return failed ? 1 : 0;
+}
+
+
+/******************************************* END OF FILE *******************************************/
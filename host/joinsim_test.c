@@ -0,0 +1,716 @@
+/************************************************************************************************//**
+ * @file		joinsim_test.c
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ * @brief		Simulates nodes joining a network and reports the join time percentiles at several
+ * 				node counts with and without the join accelerators of tsch.c.
+ *
+ * 				Nodes are placed at random with about NUM_NEIGHBORS other nodes in radio range and
+ * 				the root in the middle. Time advances one slotframe at a time. The advertising slot
+ * 				is the shared slot at slot 0 with channel offset 0, so its channel follows
+ * 				hopping_channel. A node hears a frame in the shared slot only if exactly one node in
+ * 				range transmits. Joined nodes run tsch_shared_slot's states: a beacon advertises with
+ * 				TSCH_ADV_PROBABILITY, or always while its advertising burst lasts, and any other
+ * 				queued frame is sent otherwise. Every transmission waits for Bayesian broadcast and
+ * 				is followed by the cool off state. A node that joins queues a router solicitation and
+ * 				joined nodes that hear it start an advertising burst. Nodes picked as beacons start
+ * 				advertising once they have had time to locate themselves.
+ *
+ * 				Scanning nodes stop at the first advertisement they hear. A cold scan listens on the
+ * 				first hopping sequence entry. A directed scan listens on the channel of the predicted
+ * 				slotframe and steps through the slotframes the network may be ahead by, as
+ * 				tsch_warm_channel does.
+ *
+ ***************************************************************************************************/
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hopping.h"
+
+
+/* Private Macros -------------------------------------------------------------------------------- */
+#define CHECK(cond)                                                                  \
+	do {                                                                             \
+		if(!(cond))                                                                  \
+		{                                                                            \
+			printf("%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __func__, #cond); \
+			return 1;                                                                \
+		}                                                                            \
+	} while(0)
+
+#define NUM_SLOTS           (100)		/* TSCH_DEFAULT_NUM_SLOTS in tsch.h */
+#define SLOTFRAME_MS        (250)		/* NUM_SLOTS slots of 2500 us */
+#define WARM_MAX_AGE_SF     (80)		/* TSCH_WARM_MAX_AGE_MS in tsch.c */
+#define WARM_REBOOT_SF      (8)			/* TSCH_WARM_REBOOT_SF in tsch.c */
+#define ADV_BURST_COUNT     (8)			/* TSCH_ADV_BURST_COUNT in tsch.c */
+#define ADV_PROBABILITY     (0.25)		/* TSCH_ADV_PROBABILITY in tsch.c */
+#define BAYES_LIMIT         (10.0)		/* bayes_init in tsch_init */
+#define MAX_DROPS           (5)			/* Transmissions of a frame before it is dropped */
+
+#define MAX_NODES           (200)
+#define MAX_NEIGHBORS       (MAX_NODES)
+#define NUM_NEIGHBORS       (10.0)		/* Average number of nodes in range of a node */
+#define NUM_RUNS            (50)
+#define BOOT_SPREAD_SF      (8)			/* Nodes power up within 2 s of each other */
+#define BEACON_RANGE        (0.5)		/* Beacons are at most this far apart in radio ranges */
+#define BEACON_DELAY_SF     (40)		/* Slotframes from joining to becoming a beacon */
+#define TRAFFIC_PROBABILITY (0.01)		/* Chance per slotframe a joined node queues a frame */
+#define SYNC_LOSS_FRACTION  (0.1)		/* Fraction of the nodes that lose sync */
+#define WARMUP_SF           (400)		/* Slotframes the network runs before sync is lost */
+#define HORIZON_SF          (4800)		/* Nodes not joined after 20 minutes are counted as failed */
+
+
+/* Private Types --------------------------------------------------------------------------------- */
+typedef enum {
+	SCENARIO_POWER_UP,      /* Every node but the root powers up */
+	SCENARIO_REBOOT,        /* Every node but the root reboots as planned */
+	SCENARIO_SYNC_LOSS,     /* A few nodes of a running network lose sync */
+} Scenario;
+
+typedef enum {
+	NODE_OFF,
+	NODE_SCAN,
+	NODE_JOINED,
+} NodeState;
+
+typedef enum {
+	CELL_IDLE,
+	CELL_ADV,
+	CELL_TX,
+	CELL_COOL_OFF,
+} CellState;
+
+typedef enum {
+	SENT_NOTHING,
+	SENT_ADV,
+	SENT_FRAME,
+	SENT_SOLICIT,
+} Sent;
+
+typedef enum {
+	OUTCOME_EMPTY,
+	OUTCOME_SUCCESS,
+	OUTCOME_COLLISION,
+} Outcome;
+
+/* Bayesian broadcast as in bayesian.h. bayesian.c needs mistlib so its estimator is restated */
+typedef struct {
+	double   v;
+	double   limit;
+	double   rate;
+	unsigned slots;
+	unsigned collisions;
+} Bayes;
+
+typedef struct {
+	NodeState state;
+	CellState cell;
+	double    x, y;
+	unsigned  nbrs[MAX_NEIGHBORS];
+	unsigned  num_nbrs;
+	bool      measured;     /* The node's join time is measured */
+	unsigned  start;        /* Slotframe the node started scanning */
+	unsigned  joined;       /* Slotframe the node joined */
+	bool      lattice;      /* The node becomes a beacon once it has located itself */
+	bool      beacon;
+	bool      warm;         /* Scan is directed */
+	unsigned  spread;       /* Slotframes the network may be ahead of the prediction */
+	unsigned  ahead;        /* Slotframes the network is actually ahead of the prediction */
+	unsigned  probe;
+	unsigned  queue;        /* Frames queued for the shared slot */
+	bool      solicit;      /* The head of the queue is a router solicitation */
+	unsigned  cool;
+	unsigned  drops;
+	unsigned  burst;
+	Bayes     bayes;
+} Node;
+
+typedef struct {
+	Scenario scenario;
+	bool     burst;         /* Advertising bursts are enabled */
+	bool     warm;          /* Directed scans are enabled */
+} Config;
+
+typedef struct {
+	double   mean, p50, p90, max;   /* Join time in s */
+	unsigned failed;            /* Nodes that never joined */
+} Percentiles;
+
+
+/* Private Functions ----------------------------------------------------------------------------- */
+static double      uniform    (void);
+static void        bayes_init (Bayes*);
+static bool        bayes_try  (const Bayes*);
+static void        bayes_done (Bayes*, Outcome);
+static void        deploy     (Node*, unsigned);
+static void        join       (Node*, unsigned);
+static unsigned    listen     (const Node*, unsigned);
+static Sent        shared_slot(Node*, const Config*);
+static void        slotframe  (Node*, unsigned, const Config*, unsigned);
+static Percentiles run        (unsigned, const Config*);
+static void        report     (const char*, unsigned, const Percentiles*);
+static int         cmp_double (const void*, const void*);
+
+
+/* Inline Function Instances --------------------------------------------------------------------- */
+/* dw1000.c holds the instance on target but doesn't build on the host */
+extern bool dw1000_valid_channel_code(DW1000_Prf, unsigned, unsigned);
+
+
+/* Private Variables ----------------------------------------------------------------------------- */
+static const unsigned node_counts[] = { 10, 50, 200 };
+static Node           nodes[MAX_NODES];
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Tests                                                                                           //
+// ----------------------------------------------------------------------------------------------- //
+/* test_burst ***********************************************************************************//**
+ * @brief		Advertising bursts shorten the join time of nodes that power up together. Nodes far
+ * 				from the root mostly wait for the nodes between to join and locate themselves, which
+ * 				bursts can't shorten. */
+static int test_burst(void)
+{
+	const Config base  = { SCENARIO_POWER_UP, false, false };
+	const Config burst = { SCENARIO_POWER_UP, true,  false };
+	unsigned     i;
+
+	for(i = 0; i < sizeof(node_counts) / sizeof(node_counts[0]); i++)
+	{
+		Percentiles before = run(node_counts[i], &base);
+		Percentiles after  = run(node_counts[i], &burst);
+
+		report("power up, no burst", node_counts[i], &before);
+		report("power up, burst   ", node_counts[i], &after);
+
+		CHECK(after.failed == 0);
+		CHECK(after.mean <  before.mean);
+		CHECK(after.p90  <= before.p90);
+	}
+
+	return 0;
+}
+
+
+/* test_sync_loss *******************************************************************************//**
+ * @brief		A directed scan rejoins a running network sooner than a cold scan. The grid keeps
+ * 				running after sync is lost so the prediction is exact and every window listens on
+ * 				the advertising slot's channel. */
+static int test_sync_loss(void)
+{
+	const Config cold = { SCENARIO_SYNC_LOSS, true, false };
+	const Config warm = { SCENARIO_SYNC_LOSS, true, true  };
+	unsigned     i;
+
+	for(i = 0; i < sizeof(node_counts) / sizeof(node_counts[0]); i++)
+	{
+		Percentiles before = run(node_counts[i], &cold);
+		Percentiles after  = run(node_counts[i], &warm);
+
+		report("sync loss, cold   ", node_counts[i], &before);
+		report("sync loss, warm   ", node_counts[i], &after);
+
+		CHECK(after.failed == 0);
+		CHECK(after.p50 < before.p50);
+		CHECK(after.p90 < before.p90);
+	}
+
+	return 0;
+}
+
+
+/* test_reboot **********************************************************************************//**
+ * @brief		After a planned reboot the network may be up to TSCH_WARM_REBOOT_SF slotframes ahead.
+ * 				The directed scan steps through those slotframes and is no slower than a cold scan.
+ * 				It is hardly faster either. With three hopping sequence entries and nine candidate
+ * 				slotframes, any guess matches the advertising slot's channel one time in three. */
+static int test_reboot(void)
+{
+	const Config cold = { SCENARIO_REBOOT, true, false };
+	const Config warm = { SCENARIO_REBOOT, true, true  };
+	unsigned     i;
+
+	for(i = 0; i < sizeof(node_counts) / sizeof(node_counts[0]); i++)
+	{
+		Percentiles before = run(node_counts[i], &cold);
+		Percentiles after  = run(node_counts[i], &warm);
+
+		report("reboot, cold      ", node_counts[i], &before);
+		report("reboot, warm      ", node_counts[i], &after);
+
+		CHECK(after.failed == 0);
+		CHECK(after.mean <= before.mean);
+	}
+
+	return 0;
+}
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Helpers                                                                                         //
+// ----------------------------------------------------------------------------------------------- //
+/* uniform **************************************************************************************//**
+ * @brief		Returns a uniform sample in [0, 1). */
+static double uniform(void)
+{
+	return rand() / ((double)RAND_MAX + 1.0);
+}
+
+
+/* bayes_init ***********************************************************************************//**
+ * @brief		Initializes the estimator of a node, as bayes_init does. */
+static void bayes_init(Bayes* b)
+{
+	b->v          = 1.0;
+	b->limit      = BAYES_LIMIT;
+	b->rate       = 1.0 / M_E;
+	b->slots      = 0;
+	b->collisions = 0;
+}
+
+
+/* bayes_try ************************************************************************************//**
+ * @brief		Returns true if the node may transmit in this slot. */
+static bool bayes_try(const Bayes* b)
+{
+	return uniform() < 1.0 / b->v;
+}
+
+
+/* bayes_done ***********************************************************************************//**
+ * @brief		Reports the slot's outcome and advances the estimator, as bayes_success, bayes_hole
+ * 				or bayes_fail followed by bayes_update do. */
+static void bayes_done(Bayes* b, Outcome outcome)
+{
+	b->v   += outcome == OUTCOME_COLLISION ? 1.0 / (M_E - 2.0) : -1.0;
+	b->rate = 0.95 * b->rate + 0.05 * (outcome == OUTCOME_SUCCESS ? 1.0 : 0.0);
+	b->rate = fmin(fmax(b->rate, 0.05), 1.0 / M_E);
+	b->v    = fmin(fmax(b->v + b->rate, 1.0), b->limit);
+
+	b->collisions += outcome == OUTCOME_COLLISION;
+
+	if(++b->slots >= 32)
+	{
+		if(b->collisions > 0.35 * b->slots && b->v >= b->limit)
+		{
+			b->limit = fmin(b->limit * 1.5, 40.0);
+		}
+		else if(b->collisions < 0.10 * b->slots)
+		{
+			b->limit = fmax(b->limit * 0.9, BAYES_LIMIT);
+		}
+
+		b->slots      = 0;
+		b->collisions = 0;
+	}
+}
+
+
+/* deploy ***************************************************************************************//**
+ * @brief		Places num nodes at random in a square with unit radio range and the root in the
+ * 				middle. The nodes that will be beacons are picked so that no two are closer than
+ * 				BEACON_RANGE, as the lattice points of location.c are spaced. Deployments where some
+ * 				node can't be reached from the root through beacons are drawn again. */
+static void deploy(Node* nodes, unsigned num)
+{
+	static unsigned queue[MAX_NODES];
+	static bool     seen[MAX_NODES];
+	double          side = sqrt(num * M_PI / NUM_NEIGHBORS);
+	unsigned        head, tail, i, k;
+
+	do {
+		for(i = 0; i < num; i++)
+		{
+			nodes[i].x        = i ? uniform() * side : side / 2;
+			nodes[i].y        = i ? uniform() * side : side / 2;
+			nodes[i].num_nbrs = 0;
+			nodes[i].lattice  = true;
+			seen[i]           = false;
+		}
+
+		for(i = 0; i < num; i++)
+		{
+			for(k = 0; k < num; k++)
+			{
+				double d = hypot(nodes[i].x - nodes[k].x, nodes[i].y - nodes[k].y);
+
+				if(k != i && d < 1.0)
+				{
+					nodes[i].nbrs[nodes[i].num_nbrs++] = k;
+				}
+
+				if(k < i && nodes[k].lattice && d < BEACON_RANGE)
+				{
+					nodes[i].lattice = false;
+				}
+			}
+		}
+
+		/* Breadth first search from the root. Only beacons advertise */
+		queue[0] = 0;
+		seen[0]  = true;
+
+		for(head = 0, tail = 1; head < tail; head++)
+		{
+			Node* n = &nodes[queue[head]];
+
+			for(k = 0; n->lattice && k < n->num_nbrs; k++)
+			{
+				if(!seen[n->nbrs[k]])
+				{
+					seen[n->nbrs[k]] = true;
+					queue[tail++]    = n->nbrs[k];
+				}
+			}
+		}
+	} while(tail < num);
+}
+
+
+/* join *****************************************************************************************//**
+ * @brief		Joins the network in slotframe sf and queues a router solicitation. */
+static void join(Node* n, unsigned sf)
+{
+	n->state   = NODE_JOINED;
+	n->cell    = CELL_IDLE;
+	n->joined  = sf;
+	n->beacon  = false;
+	n->queue   = 1;
+	n->solicit = true;
+	n->cool    = 0;
+	n->drops   = 0;
+	n->burst   = 0;
+	bayes_init(&n->bayes);
+}
+
+
+/* listen ***************************************************************************************//**
+ * @brief		Returns the hopping sequence entry a scanning node listens on in slotframe sf. */
+static unsigned listen(const Node* n, unsigned sf)
+{
+	if(!n->warm || sf - n->start > WARM_MAX_AGE_SF)
+	{
+		return 0;
+	}
+
+	/* The node's grid lags the network by ahead slotframes */
+	uint64_t predicted = sf - n->ahead + n->probe;
+
+	return hopping_channel(hopping_default_seq, hopping_default_len, predicted * NUM_SLOTS, 0) -
+		hopping_default_seq;
+}
+
+
+/* shared_slot **********************************************************************************//**
+ * @brief		Runs a joined node's shared slot states and returns what it transmits, as
+ * 				tsch_shared_slot does. */
+static Sent shared_slot(Node* n, const Config* cfg)
+{
+	if(n->cell == CELL_IDLE)
+	{
+		if(n->beacon && ((cfg->burst && n->burst > 0) || uniform() < ADV_PROBABILITY))
+		{
+			n->cell = CELL_ADV;
+		}
+		else if(n->queue)
+		{
+			n->cell = CELL_TX;
+		}
+	}
+	else if(n->cell == CELL_COOL_OFF)
+	{
+		if(n->cool++ >= 2)
+		{
+			n->cool = 0;
+			n->cell = CELL_IDLE;
+		}
+	}
+
+	if(n->cell == CELL_ADV && bayes_try(&n->bayes))
+	{
+		return SENT_ADV;
+	}
+	else if(n->cell == CELL_TX && bayes_try(&n->bayes))
+	{
+		return n->solicit ? SENT_SOLICIT : SENT_FRAME;
+	}
+
+	return SENT_NOTHING;
+}
+
+
+/* slotframe ************************************************************************************//**
+ * @brief		Runs the advertising slot of slotframe sf. */
+static void slotframe(Node* nodes, unsigned num, const Config* cfg, unsigned sf)
+{
+	static Sent sent[MAX_NODES];
+	unsigned    i, k;
+
+	unsigned channel = hopping_channel(hopping_default_seq, hopping_default_len,
+		(uint64_t)sf * NUM_SLOTS, 0) - hopping_default_seq;
+
+	for(i = 0; i < num; i++)
+	{
+		Node* n = &nodes[i];
+		sent[i] = SENT_NOTHING;
+
+		if(n->state != NODE_JOINED)
+		{
+			continue;
+		}
+
+		if(n->lattice && sf - n->joined >= BEACON_DELAY_SF)
+		{
+			n->beacon = true;
+		}
+
+		if(uniform() < TRAFFIC_PROBABILITY)
+		{
+			n->queue++;
+		}
+
+		sent[i] = shared_slot(n, cfg);
+	}
+
+	for(i = 0; i < num; i++)
+	{
+		Node*    n     = &nodes[i];
+		unsigned heard = 0;
+		unsigned from  = 0;
+
+		for(k = 0; k < n->num_nbrs; k++)
+		{
+			if(sent[n->nbrs[k]] != SENT_NOTHING)
+			{
+				heard++;
+				from = n->nbrs[k];
+			}
+		}
+
+		/* An advertisement isn't acknowledged so its sender can't tell whether it collided. Other
+		 * frames are delivered if no neighbor transmitted at the same time. */
+		if(sent[i] == SENT_ADV)
+		{
+			n->cell = CELL_COOL_OFF;
+			n->cool = 0;
+			n->burst -= n->burst > 0;
+			bayes_done(&n->bayes, OUTCOME_SUCCESS);
+		}
+		else if(sent[i] != SENT_NOTHING)
+		{
+			if(heard == 0 || ++n->drops >= MAX_DROPS)
+			{
+				n->queue--;
+				n->solicit = false;
+				n->drops   = 0;
+				n->cell    = CELL_COOL_OFF;
+				n->cool    = 0;
+			}
+
+			bayes_done(&n->bayes, heard == 0 ? OUTCOME_SUCCESS : OUTCOME_COLLISION);
+		}
+		else if(n->state == NODE_JOINED)
+		{
+			if(heard == 1 && sent[from] == SENT_SOLICIT)
+			{
+				n->burst = ADV_BURST_COUNT;
+			}
+
+			bayes_done(&n->bayes,
+				heard == 0 ? OUTCOME_EMPTY : heard == 1 ? OUTCOME_SUCCESS : OUTCOME_COLLISION);
+		}
+		else if(n->state == NODE_SCAN)
+		{
+			if(heard == 1 && sent[from] == SENT_ADV && listen(n, sf) == channel)
+			{
+				join(n, sf);
+			}
+			else if(n->warm)
+			{
+				n->probe = (n->probe + 1) % (n->spread + 1);
+			}
+		}
+	}
+}
+
+
+/* run ******************************************************************************************//**
+ * @brief		Returns the join time percentiles over NUM_RUNS networks of num nodes. Node 0 is the
+ * 				root and is always joined. */
+static Percentiles run(unsigned num, const Config* cfg)
+{
+	static double times[NUM_RUNS * MAX_NODES];
+	Percentiles   res   = { 0, 0, 0, 0, 0 };
+	unsigned      count = 0;
+	unsigned      r, i, sf;
+
+	for(r = 0; r < NUM_RUNS; r++)
+	{
+		/* Every configuration sees the same deployments */
+		srand(58 + r);
+
+		unsigned start   = 0;
+		unsigned pending = 0;
+
+		deploy(nodes, num);
+
+		for(i = 0; i < num; i++)
+		{
+			join(&nodes[i], 0);
+			nodes[i].queue    = 0;
+			nodes[i].solicit  = false;
+			nodes[i].beacon   = nodes[i].lattice;
+			nodes[i].measured = false;
+		}
+
+		/* Let a running network settle before some of its nodes lose sync */
+		if(cfg->scenario == SCENARIO_SYNC_LOSS)
+		{
+			for(sf = 0; sf < WARMUP_SF; sf++)
+			{
+				slotframe(nodes, num, cfg, sf);
+			}
+
+			start = WARMUP_SF;
+		}
+
+		for(i = 1; i < num; i++)
+		{
+			Node* n = &nodes[i];
+
+			if(cfg->scenario == SCENARIO_SYNC_LOSS)
+			{
+				if(i != 1 && uniform() >= SYNC_LOSS_FRACTION)
+				{
+					continue;
+				}
+
+				n->start  = start;
+				n->spread = 0;
+				n->ahead  = 0;
+			}
+			else
+			{
+				n->start  = (unsigned)(uniform() * BOOT_SPREAD_SF);
+				n->spread = WARM_REBOOT_SF;
+				n->ahead  = (unsigned)(uniform() * (WARM_REBOOT_SF + 1));
+			}
+
+			n->measured = true;
+			n->state    = n->start > start ? NODE_OFF : NODE_SCAN;
+			n->warm     = cfg->warm;
+			n->probe    = 0;
+			pending++;
+		}
+
+		for(sf = start; sf < start + HORIZON_SF && pending; sf++)
+		{
+			for(i = 1; i < num; i++)
+			{
+				if(nodes[i].state == NODE_OFF && nodes[i].start <= sf)
+				{
+					nodes[i].state = NODE_SCAN;
+				}
+			}
+
+			slotframe(nodes, num, cfg, sf);
+
+			for(i = 1, pending = 0; i < num; i++)
+			{
+				pending += nodes[i].measured && nodes[i].state != NODE_JOINED;
+			}
+		}
+
+		for(i = 1; i < num; i++)
+		{
+			Node* n = &nodes[i];
+
+			if(!n->measured)
+			{
+				continue;
+			}
+			else if(n->state != NODE_JOINED)
+			{
+				res.failed++;
+			}
+			else
+			{
+				times[count] = (n->joined - n->start + 1) * SLOTFRAME_MS / 1000.0;
+				res.mean    += times[count++];
+			}
+		}
+	}
+
+	if(count)
+	{
+		qsort(times, count, sizeof(times[0]), cmp_double);
+		res.mean /= count;
+		res.p50 = times[count * 50 / 100];
+		res.p90 = times[count * 90 / 100];
+		res.max = times[count - 1];
+	}
+
+	return res;
+}
+
+
+/* report ***************************************************************************************//**
+ * @brief		Prints the join time percentiles of one configuration. */
+static void report(const char* name, unsigned num, const Percentiles* p)
+{
+	printf("%s %3u nodes: mean %6.2f s, p50 %6.2f s, p90 %6.2f s, max %7.2f s, %u failed\n",
+		name, num, p->mean, p->p50, p->p90, p->max, p->failed);
+}
+
+
+/* cmp_double ***********************************************************************************//**
+ * @brief		Orders doubles ascending for qsort. */
+static int cmp_double(const void* a, const void* b)
+{
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+
+	return (x > y) - (x < y);
+}
+
+
+/* main *****************************************************************************************//**
+ * @brief		*/
+int main(void)
+{
+	static int (*const tests[])(void) = {
+		test_burst,
+		test_sync_loss,
+		test_reboot,
+	};
+
+	unsigned i;
+	int      failed = 0;
+
+	for(i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+	{
+		failed += tests[i]();
+	}
+
+	printf("%u tests, %d failed\n", (unsigned)(sizeof(tests) / sizeof(tests[0])), failed);
+	return failed ? 1 : 0;
+}
+
+
+/******************************************* END OF FILE *******************************************/
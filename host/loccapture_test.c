@@ -0,0 +1,412 @@
+/************************************************************************************************//**
+ * @file		loccapture_test.c
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ * @brief		Tests that captured location updates round trip through the delta coding exactly and
+ * 				that a stream recovers from lost and malformed records at the next sync record.
+ *
+ ***************************************************************************************************/
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "loccapture.h"
+
+
+/* Private Macros -------------------------------------------------------------------------------- */
+#define CHECK(cond)                                                                  \
+	do {                                                                             \
+		if(!(cond))                                                                  \
+		{                                                                            \
+			printf("%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __func__, #cond); \
+			return 1;                                                                \
+		}                                                                            \
+	} while(0)
+
+
+/* Private Functions ----------------------------------------------------------------------------- */
+static void make_nbr    (LocCapNbr*, unsigned);
+static void make_record (LocCapRecord*, uint32_t);
+static void make_state  (LocCapState*);
+static bool same_nbr    (const LocCapNbr*, const LocCapNbr*);
+static bool same_record (const LocCapRecord*, const LocCapRecord*);
+static bool same_state  (const LocCapState*, const LocCapState*);
+
+
+/* Private Variables ----------------------------------------------------------------------------- */
+static uint8_t buf[LOC_CAPTURE_MAX_LEN];
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Tests                                                                                           //
+// ----------------------------------------------------------------------------------------------- //
+/* test_sync ************************************************************************************//**
+ * @brief		A sync record carries the update, its result and the state before the update. */
+static int test_sync(void)
+{
+	LocCapCodec  enc, dec;
+	LocCapRecord rec, out;
+	LocCapState  state, sout;
+
+	loc_cap_reset(&enc);
+	loc_cap_reset(&dec);
+	make_record(&rec, 7);
+	make_state(&state);
+
+	CHECK(loc_cap_encode(&enc, &rec, 0, buf, sizeof(buf)) == -EINVAL);
+
+	int len = loc_cap_encode(&enc, &rec, &state, buf, sizeof(buf));
+	CHECK(len > 0);
+	CHECK(loc_cap_decode(&dec, &out, &sout, buf, len) == 0);
+	CHECK(out.flags & LOC_CAPTURE_SYNC);
+	CHECK(same_record(&rec, &out));
+	CHECK(same_state(&state, &sout));
+	return 0;
+}
+
+
+/* test_delta ***********************************************************************************//**
+ * @brief		Records between sync records only carry the neighbor fields that changed and still
+ * 				decode to the exact update. */
+static int test_delta(void)
+{
+	LocCapCodec  enc, dec;
+	LocCapRecord rec, out;
+	LocCapState  state;
+
+	loc_cap_reset(&enc);
+	loc_cap_reset(&dec);
+	make_record(&rec, 1);
+	make_state(&state);
+
+	int sync = loc_cap_encode(&enc, &rec, &state, buf, sizeof(buf));
+	CHECK(sync > 0);
+	CHECK(loc_cap_decode(&dec, &out, 0, buf, sync) == 0);
+
+	/* Same neighbors with new locations */
+	rec.seq++;
+	rec.update.new_nbrs[1].x += 0.25f;
+	rec.update.new_nbrs[2].z  = NAN;
+	rec.update.tstamps[3]     = 0;
+
+	int len = loc_cap_encode(&enc, &rec, 0, buf, sizeof(buf));
+	CHECK(len > 0 && len < sync / 2);
+	CHECK(loc_cap_decode(&dec, &out, 0, buf, len) == 0);
+	CHECK(!(out.flags & LOC_CAPTURE_SYNC));
+	CHECK(same_record(&rec, &out));
+
+	/* A neighbor changes its table index */
+	rec.seq++;
+	rec.update.index[0] = 19;
+
+	len = loc_cap_encode(&enc, &rec, 0, buf, sizeof(buf));
+	CHECK(len > 0);
+	CHECK(loc_cap_decode(&dec, &out, 0, buf, len) == 0);
+	CHECK(same_record(&rec, &out));
+	return 0;
+}
+
+
+/* test_lost ************************************************************************************//**
+ * @brief		Records following a lost record are rejected until the next sync record. */
+static int test_lost(void)
+{
+	LocCapCodec  enc, dec;
+	LocCapRecord rec, out;
+	LocCapState  state;
+
+	loc_cap_reset(&enc);
+	loc_cap_reset(&dec);
+	make_record(&rec, 1);
+	make_state(&state);
+
+	int len = loc_cap_encode(&enc, &rec, &state, buf, sizeof(buf));
+	CHECK(loc_cap_decode(&dec, &out, 0, buf, len) == 0);
+
+	rec.seq++;
+	rec.update.new_nbrs[0].y += 1.0f;
+	CHECK(loc_cap_encode(&enc, &rec, 0, buf, sizeof(buf)) > 0);
+
+	rec.seq++;
+	len = loc_cap_encode(&enc, &rec, 0, buf, sizeof(buf));
+	CHECK(loc_cap_decode(&dec, &out, 0, buf, len) == -ESTALE);
+	CHECK(!loc_cap_synced(&dec));
+
+	rec.seq++;
+	len = loc_cap_encode(&enc, &rec, 0, buf, sizeof(buf));
+	CHECK(loc_cap_decode(&dec, &out, 0, buf, len) == -ESTALE);
+
+	rec.seq++;
+	len = loc_cap_encode(&enc, &rec, &state, buf, sizeof(buf));
+	CHECK(loc_cap_decode(&dec, &out, 0, buf, len) == 0);
+	CHECK(same_record(&rec, &out));
+	return 0;
+}
+
+
+/* test_malformed *******************************************************************************//**
+ * @brief		Truncated records, trailing bytes and other versions are rejected. */
+static int test_malformed(void)
+{
+	LocCapCodec  enc, dec;
+	LocCapRecord rec, out;
+	LocCapState  state;
+
+	loc_cap_reset(&enc);
+	loc_cap_reset(&dec);
+	make_record(&rec, 1);
+	make_state(&state);
+
+	int len = loc_cap_encode(&enc, &rec, &state, buf, sizeof(buf));
+	CHECK(len > 0);
+	CHECK(loc_cap_decode(&dec, &out, 0, buf, len - 1) == -EBADMSG);
+	CHECK(loc_cap_decode(&dec, &out, 0, buf, 10) == -EBADMSG);
+
+	buf[len] = 0;
+	CHECK(loc_cap_decode(&dec, &out, 0, buf, len + 1) == -EBADMSG);
+
+	buf[4] = LOC_CAPTURE_VERSION + 1;
+	CHECK(loc_cap_decode(&dec, &out, 0, buf, len) == -ENOTSUP);
+
+	buf[4] = LOC_CAPTURE_VERSION;
+	CHECK(loc_cap_decode(&dec, &out, 0, buf, len) == 0);
+
+	/* The encoder needs a sync record after running out of space */
+	CHECK(loc_cap_encode(&enc, &rec, &state, buf, 32) == -ENOSPC);
+	CHECK(!loc_cap_synced(&enc));
+	return 0;
+}
+
+
+/* test_max_len *********************************************************************************//**
+ * @brief		The largest possible record fits in LOC_CAPTURE_MAX_LEN. */
+static int test_max_len(void)
+{
+	LocCapCodec  enc;
+	LocCapRecord rec;
+	LocCapState  state;
+	unsigned     i;
+
+	loc_cap_reset(&enc);
+	make_record(&rec, 1);
+	make_state(&state);
+
+	for(i = 0; i < 21; i++)
+	{
+		rec.update.tstamps[i] = -1 - (int32_t)i;
+	}
+
+	for(i = 0; i < 6; i++)
+	{
+		make_nbr(&rec.update.new_nbrs[i], i);
+	}
+
+	for(i = 0; i < LOC_CAPTURE_NUM_NBRS; i++)
+	{
+		make_nbr(&state.neighbors[i], i);
+	}
+
+	state.all_nbrhood = (1u << LOC_CAPTURE_NUM_NBRS) - 1;
+
+	CHECK(loc_cap_encode(&enc, &rec, &state, buf, sizeof(buf)) == LOC_CAPTURE_MAX_LEN);
+	return 0;
+}
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Helpers                                                                                         //
+// ----------------------------------------------------------------------------------------------- //
+/* make_nbr *************************************************************************************//**
+ * @brief		Fills a neighbor with values derived from i. */
+static void make_nbr(LocCapNbr* n, unsigned i)
+{
+	memset(n, 0, sizeof(LocCapNbr));
+	memset(n->address, 0xA0 + i, sizeof(n->address));
+	n->x       = 1.5f * i;
+	n->y       = -2.0f * i;
+	n->z       = 0.125f;
+	n->r       = 3.0f + i;
+	n->t       = 0.5f;
+	n->nbrhood = 0x3F << i;
+	n->class   = i & 1;
+}
+
+
+/* make_record **********************************************************************************//**
+ * @brief		Creates a record of a location cell in which 4 of 6 beacons were received. */
+static void make_record(LocCapRecord* rec, uint32_t seq)
+{
+	unsigned i;
+
+	memset(rec, 0, sizeof(LocCapRecord));
+	rec->event         = 5;
+	rec->state         = 4;
+	rec->beacon_index  = 11;
+	rec->seq           = seq;
+	rec->uptime        = 123456;
+	rec->solve_us      = 2100;
+	rec->x             = 10.0f;
+	rec->y             = 20.0f;
+	rec->z             = 0.5f;
+	rec->all_nbrhood   = 0x000F3;
+	rec->local_nbrhood = 0x00073;
+
+	LocCapUpdate* u = &rec->update;
+	u->dir         = 3;
+	u->slot        = 2;
+	u->offset      = 6;
+	u->conflicts   = 0x04;
+	u->nlos        = 0x01;
+	u->sigma       = NAN;
+	u->new_nbrhood = 0x4F;
+	u->adj         = 0x1FF;
+
+	for(i = 0; i < 6; i++)
+	{
+		u->index[i] = (uint8_t)(3 * i + 1);
+
+		if(u->new_nbrhood & (1 << i))
+		{
+			make_nbr(&u->new_nbrs[i], u->index[i]);
+		}
+	}
+
+	for(i = 0; i < 9; i++)
+	{
+		u->tstamps[i] = 1000 * (int32_t)i - 4000;
+	}
+}
+
+
+/* make_state ***********************************************************************************//**
+ * @brief		Creates the state of a joined node with a partially filled neighbor table. */
+static void make_state(LocCapState* state)
+{
+	unsigned i;
+
+	memset(state, 0, sizeof(LocCapState));
+	state->state         = 4;
+	state->beacon_index  = 11;
+	state->search_count  = 2;
+	state->x             = 9.5f;
+	state->y             = 19.5f;
+	state->z             = NAN;
+	state->vx            = 0.1f;
+	state->all_nbrhood   = 0x000F3;
+	state->local_nbrhood = 0x00033;
+
+	for(i = 0; i < LOC_CAPTURE_NUM_NBRS; i++)
+	{
+		if(state->all_nbrhood & (1u << i))
+		{
+			make_nbr(&state->neighbors[i], i);
+			state->dropcount[i] = i % 3;
+		}
+	}
+}
+
+
+/* same_nbr *************************************************************************************//**
+ * @brief		Returns true if two neighbors are bitwise equal. */
+static bool same_nbr(const LocCapNbr* a, const LocCapNbr* b)
+{
+	return memcmp(a->address, b->address, sizeof(a->address)) == 0 &&
+	       memcmp(&a->x, &b->x, 5 * sizeof(float)) == 0 &&
+	       a->nbrhood == b->nbrhood && a->class == b->class;
+}
+
+
+/* same_record **********************************************************************************//**
+ * @brief		Returns true if two records are bitwise equal. Index is only compared for the new
+ * 				neighbors that were sent. */
+static bool same_record(const LocCapRecord* a, const LocCapRecord* b)
+{
+	const LocCapUpdate* ua = &a->update;
+	const LocCapUpdate* ub = &b->update;
+	unsigned i;
+
+	for(i = 0; i < 6; i++)
+	{
+		if(!same_nbr(&ua->new_nbrs[i], &ub->new_nbrs[i]) ||
+		  ((ua->new_nbrhood & (1 << i)) && ua->index[i] != ub->index[i]))
+		{
+			return false;
+		}
+	}
+
+	return a->event == b->event && a->state == b->state && a->beacon_index == b->beacon_index &&
+	       a->seq == b->seq && a->dropped == b->dropped && a->uptime == b->uptime &&
+	       a->solve_us == b->solve_us && a->all_nbrhood == b->all_nbrhood &&
+	       a->local_nbrhood == b->local_nbrhood &&
+	       memcmp(&a->x, &b->x, 3 * sizeof(float)) == 0 &&
+	       ua->dir == ub->dir && ua->slot == ub->slot && ua->offset == ub->offset &&
+	       ua->conflicts == ub->conflicts && ua->shouldtx == ub->shouldtx &&
+	       ua->nlos == ub->nlos && memcmp(&ua->sigma, &ub->sigma, sizeof(float)) == 0 &&
+	       ua->new_nbrhood == ub->new_nbrhood && ua->adj == ub->adj &&
+	       memcmp(ua->tstamps, ub->tstamps, sizeof(ua->tstamps)) == 0;
+}
+
+
+/* same_state ***********************************************************************************//**
+ * @brief		Returns true if two states are bitwise equal in their valid neighbors. */
+static bool same_state(const LocCapState* a, const LocCapState* b)
+{
+	unsigned i;
+
+	for(i = 0; i < LOC_CAPTURE_NUM_NBRS; i++)
+	{
+		if((a->all_nbrhood & (1u << i)) && !same_nbr(&a->neighbors[i], &b->neighbors[i]))
+		{
+			return false;
+		}
+	}
+
+	return a->state == b->state && a->beacon_index == b->beacon_index &&
+	       a->search_count == b->search_count && a->all_nbrhood == b->all_nbrhood &&
+	       a->local_nbrhood == b->local_nbrhood &&
+	       memcmp(&a->x, &b->x, 6 * sizeof(float)) == 0 &&
+	       memcmp(a->dropcount, b->dropcount, sizeof(a->dropcount)) == 0;
+}
+
+
+/* main *****************************************************************************************//**
+ * @brief		*/
+int main(void)
+{
+	static int (*const tests[])(void) = {
+		test_sync,
+		test_delta,
+		test_lost,
+		test_malformed,
+		test_max_len,
+	};
+
+	unsigned i;
+	int      failed = 0;
+
+	for(i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+	{
+		failed += tests[i]();
+	}
+
+	printf("%u tests, %d failed\n", (unsigned)(sizeof(tests) / sizeof(tests[0])), failed);
+	return failed ? 1 : 0;
+}
+
+
+/******************************************* END OF FILE *******************************************/
@@ -0,0 +1,383 @@
+/************************************************************************************************//**
+ * @file		loccell_test.c
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ * @brief		Tests that location cells running concurrently on separate lanes never corrupt each
+ * 				other's timestamps. A discrete event simulation runs every slotframe position of every
+ * 				direction with one node per beacon index, all in range of each other. Beacons are
+ * 				sent at their offset's grid time plus the propagation delay. Receivers acquire the
+ * 				first beacon that arrives in their rx window on their channel and code, optionally
+ * 				also acquiring beacons of other lanes as a strong signal on another code can be, and
+ * 				then check the beacon's cell as rx_in_cell in location.c does.
+ *
+ ***************************************************************************************************/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hopping.h"
+#include "loccell.h"
+
+
+/* Private Macros -------------------------------------------------------------------------------- */
+#define CHECK(cond)                                                                  \
+	do {                                                                             \
+		if(!(cond))                                                                  \
+		{                                                                            \
+			printf("%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __func__, #cond); \
+			return 1;                                                                \
+		}                                                                            \
+	} while(0)
+
+#define NUM_SLOTS           (100)	/* TSCH_DEFAULT_NUM_SLOTS in tsch.h */
+#define GRID_NS             (800000.0)	/* LOC_GRID_LENGTH in location.h */
+#define GUARD_NS            (300000.0)	/* LOC_RX_GUARD_TIME in location.h */
+#define C_M_PER_NS          (0.299792458)
+#define AREA_M              (40.0)
+#define NUM_CELL_SLOTS      (4)
+#define NUM_DIRS            (8)
+#define NUM_OFFSETS         (6)
+#define MAX_EVENTS          (LOC_NUM_INDICES * LOC_NUM_INDICES)
+
+
+/* Inline Function Instances --------------------------------------------------------------------- */
+/* dw1000.c holds the instance on target but doesn't build on the host */
+extern bool dw1000_valid_channel_code(DW1000_Prf, unsigned, unsigned);
+
+
+/* Private Types --------------------------------------------------------------------------------- */
+typedef struct {
+	double   x, y, z;
+	unsigned index;
+	unsigned tx;            /* Beacons sent */
+} Node;
+
+
+typedef struct {
+	double              t;      /* Arrival time in ns since the start of the slot */
+	unsigned            src;    /* Sending node */
+	unsigned            dst;    /* Receiving node */
+	unsigned            dir;    /* Cell of the beacon, as in LocBeacon.dir_slot_offset */
+	unsigned            slot;
+	unsigned            offset;
+	const Tsch_Channel* ch;
+} Event;
+
+
+typedef struct {
+	unsigned accepted;      /* Timestamps taken */
+	unsigned rejected;      /* Beacons of another cell acquired and dropped */
+	unsigned corrupt;       /* Timestamps taken from a beacon of another cell */
+} Result;
+
+
+/* Private Functions ----------------------------------------------------------------------------- */
+static void     place  (Node*, unsigned);
+static void     run    (Node*, unsigned, unsigned, unsigned, bool, Result*);
+static int      cmp_evt(const void*, const void*);
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Tests                                                                                           //
+// ----------------------------------------------------------------------------------------------- //
+/* test_disjoint ********************************************************************************//**
+ * @brief		The cells run at the same position share no beacon index so every beacon takes part
+ * 				in at most one lane, and a beacon always picks the lane holding its index. */
+static int test_disjoint(void)
+{
+	unsigned dir, pos, i, j;
+
+	for(dir = 0; dir < NUM_DIRS; dir++)
+	{
+		for(pos = 0; pos < NUM_CELL_SLOTS; pos++)
+		{
+			const uint8_t* a = loccell_order[dir][loccell_slot(pos, 0)];
+			const uint8_t* b = loccell_order[dir][loccell_slot(pos, 1)];
+
+			CHECK(loccell_slot(pos, 0) == pos);
+			CHECK(loccell_slot(pos, 1) != pos);
+
+			for(i = 0; i < NUM_OFFSETS; i++)
+			{
+				for(j = 0; j < NUM_OFFSETS; j++)
+				{
+					CHECK(a[i] != b[j]);
+				}
+
+				CHECK(loccell_lane(dir, pos, 2, a[i], 0, 1) == 0);
+				CHECK(loccell_lane(dir, pos, 2, b[i], 0, 0) == 1);
+				CHECK(loccell_offset(dir, loccell_slot(pos, 1), b[i]) == i);
+			}
+		}
+	}
+
+	return 0;
+}
+
+
+/* test_channels ********************************************************************************//**
+ * @brief		The default sequence supports two lanes and the lanes of a cell never share a channel
+ * 				and code at any ASN. */
+static int test_channels(void)
+{
+	unsigned lanes = hopping_lanes(hopping_default_seq, hopping_default_len, LOC_MAX_LANES);
+	uint64_t asn;
+	unsigned offset;
+
+	static const Tsch_Channel repeat[] = { { 5, 10 }, { 5, 10 }, { 2, 9 } };
+
+	CHECK(lanes == 2);
+	CHECK(hopping_lanes(repeat, 3, LOC_MAX_LANES) == 1);
+	CHECK(hopping_lanes(hopping_default_seq, 1, LOC_MAX_LANES) == 1);
+
+	for(asn = 0; asn < 3 * NUM_SLOTS; asn++)
+	{
+		for(offset = 0; offset < 16; offset++)
+		{
+			const Tsch_Channel* a = hopping_channel(hopping_default_seq, hopping_default_len, asn, offset);
+			const Tsch_Channel* b = hopping_channel(hopping_default_seq, hopping_default_len, asn, offset + 1);
+
+			CHECK(a->channel != b->channel || a->code != b->code);
+		}
+	}
+
+	return 0;
+}
+
+
+/* test_no_corruption ***************************************************************************//**
+ * @brief		No timestamp is ever taken from a beacon of another cell, even if receivers acquire
+ * 				beacons of the other lane. Without leakage the cell check never has to drop one. */
+static int test_no_corruption(void)
+{
+	static Node nodes[LOC_NUM_INDICES];
+	Result      clean = { 0 };
+	Result      leaky = { 0 };
+	unsigned    lanes = hopping_lanes(hopping_default_seq, hopping_default_len, LOC_MAX_LANES);
+	unsigned    dir, pos;
+
+	place(nodes, LOC_NUM_INDICES);
+
+	for(dir = 0; dir < NUM_DIRS; dir++)
+	{
+		for(pos = 0; pos < NUM_CELL_SLOTS; pos++)
+		{
+			run(nodes, dir, pos, lanes, false, &clean);
+			run(nodes, dir, pos, lanes, true,  &leaky);
+		}
+	}
+
+	printf("lanes: clean %u accepted, %u rejected; leaky %u accepted, %u rejected\n",
+		clean.accepted, clean.rejected, leaky.accepted, leaky.rejected);
+
+	CHECK(clean.corrupt == 0 && leaky.corrupt == 0);
+	CHECK(clean.rejected == 0);
+	CHECK(clean.accepted > 0);
+
+	/* The leaky run must actually acquire beacons of the other lane for the check to mean much */
+	CHECK(leaky.rejected > 0);
+	return 0;
+}
+
+
+/* test_capacity ********************************************************************************//**
+ * @brief		With two lanes every beacon transmits in twice as many cells per slotframe as with
+ * 				one, since each cell runs at both positions p and p ^ 2. */
+static int test_capacity(void)
+{
+	static Node one[LOC_NUM_INDICES];
+	static Node two[LOC_NUM_INDICES];
+	Result      res = { 0 };
+	unsigned    dir, pos, i;
+
+	place(one, LOC_NUM_INDICES);
+	place(two, LOC_NUM_INDICES);
+
+	for(dir = 0; dir < NUM_DIRS; dir++)
+	{
+		for(pos = 0; pos < NUM_CELL_SLOTS; pos++)
+		{
+			run(one, dir, pos, 1, false, &res);
+			run(two, dir, pos, 2, false, &res);
+		}
+	}
+
+	for(i = 0; i < LOC_NUM_INDICES; i++)
+	{
+		CHECK(one[i].tx > 0);
+		CHECK(two[i].tx == 2 * one[i].tx);
+	}
+
+	CHECK(res.corrupt == 0);
+	return 0;
+}
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Helpers                                                                                         //
+// ----------------------------------------------------------------------------------------------- //
+/* place ****************************************************************************************//**
+ * @brief		Places one node per beacon index at a random position in range of every other. */
+static void place(Node* nodes, unsigned num)
+{
+	unsigned i;
+
+	srand(52);
+
+	for(i = 0; i < num; i++)
+	{
+		nodes[i].x        = AREA_M * rand() / RAND_MAX;
+		nodes[i].y        = AREA_M * rand() / RAND_MAX;
+		nodes[i].z        = 3.0 * rand() / RAND_MAX;
+		nodes[i].index    = i;
+		nodes[i].tx       = 0;
+	}
+}
+
+
+/* run ******************************************************************************************//**
+ * @brief		Simulates the slot of a direction's slotframe position with the given lanes. */
+static void run(Node* nodes, unsigned dir, unsigned pos, unsigned lanes, bool leaky, Result* res)
+{
+	static Event evts[MAX_EVENTS];
+	unsigned     lane[LOC_NUM_INDICES];
+	unsigned     slot[LOC_NUM_INDICES];
+	unsigned     offset[LOC_NUM_INDICES];
+	bool         heard[LOC_NUM_INDICES][NUM_OFFSETS];
+	unsigned     num = 0;
+	unsigned     i, k;
+	uint64_t     asn = 12345 * NUM_SLOTS + pos;
+
+	/* Every node picks its lane, cell and offset as loc_slot does. All indices are neighbors. */
+	for(i = 0; i < LOC_NUM_INDICES; i++)
+	{
+		lane[i]   = loccell_lane(dir, pos, lanes, nodes[i].index, 0xFFFFF, i);
+		slot[i]   = loccell_slot(pos, lane[i]);
+		offset[i] = loccell_offset(dir, slot[i], nodes[i].index);
+		memset(heard[i], 0, sizeof(heard[i]));
+	}
+
+	/* Every beacon reaches every other node after its propagation delay */
+	for(i = 0; i < LOC_NUM_INDICES; i++)
+	{
+		if(offset[i] == -1u)
+		{
+			continue;
+		}
+
+		nodes[i].tx++;
+
+		for(k = 0; k < LOC_NUM_INDICES; k++)
+		{
+			if(k == i)
+			{
+				continue;
+			}
+
+			double dx = nodes[i].x - nodes[k].x;
+			double dy = nodes[i].y - nodes[k].y;
+			double dz = nodes[i].z - nodes[k].z;
+
+			evts[num++] = (Event) {
+				.t      = offset[i] * GRID_NS + sqrt(dx*dx + dy*dy + dz*dz) / C_M_PER_NS,
+				.src    = i,
+				.dst    = k,
+				.dir    = dir,
+				.slot   = slot[i],
+				.offset = offset[i],
+				.ch     = hopping_channel(hopping_default_seq, hopping_default_len, asn, lane[i]),
+			};
+		}
+	}
+
+	qsort(evts, num, sizeof(evts[0]), cmp_evt);
+
+	/* Each receiver opens a window around every other offset of its cell and takes the first
+	 * beacon it acquires in the window. A beacon of another lane is acquired only when leaky. */
+	for(i = 0; i < num; i++)
+	{
+		const Event*        e  = &evts[i];
+		unsigned            k  = e->dst;
+		unsigned            j  = (unsigned)floor((e->t + GUARD_NS) / GRID_NS);
+		const Tsch_Channel* ch = hopping_channel(hopping_default_seq, hopping_default_len, asn, lane[k]);
+
+		if(j >= NUM_OFFSETS || j == offset[k] || heard[k][j] || fabs(e->t - j * GRID_NS) > GUARD_NS)
+		{
+			continue;
+		}
+
+		if(!leaky && (e->ch->channel != ch->channel || e->ch->code != ch->code))
+		{
+			continue;
+		}
+
+		heard[k][j] = true;
+
+		/* rx_in_cell */
+		if(e->offset != j || e->slot != slot[k] || e->dir != dir)
+		{
+			res->rejected++;
+			continue;
+		}
+
+		res->accepted++;
+
+		if(loccell_order[dir][slot[k]][j] != nodes[e->src].index || slot[e->src] != slot[k])
+		{
+			res->corrupt++;
+		}
+	}
+}
+
+
+/* cmp_evt **************************************************************************************//**
+ * @brief		Orders events by arrival time. */
+static int cmp_evt(const void* a, const void* b)
+{
+	double ta = ((const Event*)a)->t;
+	double tb = ((const Event*)b)->t;
+
+	return (ta > tb) - (ta < tb);
+}
+
+
+/* main *****************************************************************************************//**
+ * @brief		*/
+int main(void)
+{
+	static int (*const tests[])(void) = {
+		test_disjoint,
+		test_channels,
+		test_no_corruption,
+		test_capacity,
+	};
+
+	unsigned i;
+	int      failed = 0;
+
+	for(i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+	{
+		failed += tests[i]();
+	}
+
+	printf("%u tests, %d failed\n", (unsigned)(sizeof(tests) / sizeof(tests[0])), failed);
+	return failed ? 1 : 0;
+}
+
+
+/******************************************* END OF FILE *******************************************/
@@ -0,0 +1,754 @@
+/************************************************************************************************//**
+ * @file		locreplay.c
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ * @brief		Records, decodes and replays the location updates captured by loc_capture.
+ *
+ * 				locreplay [-v] [-c cell] [-n records] [-w capture] -u port
+ * 				locreplay [-v] [-c cell] capture
+ * 				locreplay [-v] [-s source] -r node capture
+ *
+ * 				-u listens for records on a UDP port. -w appends the received records to a capture
+ * 				file. -n stops after a number of records. -v prints every record. A summary per node
+ * 				is printed when decoding stops or on SIGINT.
+ *
+ * 				The summary includes the coordinate churn of each node: every change of the node's
+ * 				filtered location is passed to hyper_cell_moved as hyperspace_update does, and the
+ * 				coordinate changes per hour are compared with those of rounding the location to a
+ * 				cell. -c sets the lattice cell size which must match LATTICE_R in location.h.
+ *
+ * 				-r replays the records of one captured node on the node with the given address. The
+ * 				location pipeline doesn't build on the host, so the replay runs the firmware's own
+ * 				pipeline on a bench node: each record is sent to the node's LOC_CAPTURE_PORT, the
+ * 				node handles the update exactly as the captured node did and sends the result to
+ * 				the border router host's LOC_CAPTURE_PORT, where it is compared with the captured
+ * 				result. The bench node must be built with CONFIG_LOC_REPLAY and only accepts records
+ * 				from the border router host, so run the replay there. Replay starts at the first
+ * 				sync record and records are sent one at a time. -s selects the captured node if the
+ * 				capture holds more than one. Replaying stops live location updates on the bench
+ * 				node until it reboots.
+ *
+ ***************************************************************************************************/
+#include <arpa/inet.h>
+#include <errno.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "hyperembed.h"
+#include "loccapture.h"
+
+
+/* Private Macros -------------------------------------------------------------------------------- */
+#define MAX_NODES           (32)
+#define MAX_DATAGRAM        (1280)
+#define REPLAY_TIMEOUT_MS   (2000)	/* Time to wait for a replayed result */
+#define DEFAULT_CELL        (2.5f)	/* LATTICE_R in location.h */
+
+
+/* Private Types --------------------------------------------------------------------------------- */
+typedef struct {
+	uint32_t count;
+	uint64_t total;
+	uint32_t max;
+} Stat;
+
+
+typedef struct {
+	bool        valid;
+	char        name[INET6_ADDRSTRLEN];
+	LocCapCodec codec;
+	uint64_t    records;
+	uint64_t    syncs;
+	uint64_t    rejected;   /* Records that could not be decoded */
+	uint64_t    dropped;    /* Records the node could not send */
+	Stat        solve_us;
+	HyperCell   cell;       /* Cell the node's coordinate is assigned from */
+	float       round[3];   /* Cell of the rounded location */
+	float       loc[3];     /* Location of the previous record */
+	uint32_t    uptime;     /* Uptime of the previous record */
+	uint64_t    span_ms;    /* Time covered by the records */
+	uint64_t    changes;    /* Coordinate changes */
+	uint64_t    round_changes;
+} Node;
+
+
+typedef struct {
+	uint64_t sent;
+	uint64_t skipped;       /* Records not sent while waiting for a sync record */
+	uint64_t timeouts;
+	uint64_t rejected;      /* Results that could not be decoded */
+	uint64_t matched;
+	uint64_t mismatched;
+	double   total_err;     /* Sum of location differences in m of mismatched results */
+	double   max_err;
+	Stat     captured_us;
+	Stat     replayed_us;
+} Replay;
+
+
+/* Private Functions ----------------------------------------------------------------------------- */
+static void  usage        (const char*);
+static int   decode_file  (const char*);
+static int   decode_udp   (uint16_t, const char*, long);
+static void  decode       (const char*, const uint8_t*, size_t);
+static int   replay       (const char*, const char*, const char*);
+static int   replay_one   (int, const struct sockaddr_in6*, const LocCapRecord*, const uint8_t*,
+                           size_t, Replay*);
+static bool  read_record  (FILE*, char*, uint8_t*, size_t*);
+static Node* node_find    (const char*);
+static void  churn_add    (Node*, const LocCapRecord*);
+static void  print_record (const char*, const LocCapRecord*);
+static void  stat_add     (Stat*, uint32_t);
+static void  stat_print   (const char*, const Stat*);
+static void  print_stats  (void);
+static void  handle_sigint(int);
+
+
+/* Private Variables ----------------------------------------------------------------------------- */
+static const char* const state_names[] = {
+	"init", "searching_nbrhood", "searching", "measure_dist", "joined",
+};
+
+static const char* const event_names[] = {
+	"start", "start_root", "stop", "joined", "lost", "cell_done", "cell_skip", "timeout",
+	"dist_measured",
+};
+
+static Node          nodes[MAX_NODES];
+static float         cell    = DEFAULT_CELL;
+static bool          verbose = false;
+static volatile bool stop    = false;
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Main                                                                                            //
+// ----------------------------------------------------------------------------------------------- //
+/* main *****************************************************************************************//**
+ * @brief		*/
+int main(int argc, char** argv)
+{
+	const char* capture = 0;
+	const char* source  = 0;
+	const char* target  = 0;
+	long        max     = -1;
+	long        port    = -1;
+	int         opt;
+	int         r;
+
+	while((opt = getopt(argc, argv, "vc:n:w:u:s:r:")) != -1)
+	{
+		switch(opt)
+		{
+			case 'v': verbose = true;                  break;
+			case 'c': cell    = strtof(optarg, 0);     break;
+			case 'n': max     = strtol(optarg, 0, 0);  break;
+			case 'w': capture = optarg;                break;
+			case 'u': port    = strtol(optarg, 0, 0);  break;
+			case 's': source  = optarg;                break;
+			case 'r': target  = optarg;                break;
+			default:  usage(argv[0]);                  return 2;
+		}
+	}
+
+	/* No SA_RESTART so that SIGINT interrupts recvfrom and poll */
+	struct sigaction sa = { 0 };
+	sa.sa_handler = handle_sigint;
+	sigaction(SIGINT, &sa, 0);
+
+	if(!(cell > 0))
+	{
+		usage(argv[0]);
+		return 2;
+	}
+
+	if(port >= 0 && port <= UINT16_MAX && !source && !target && optind == argc)
+	{
+		r = decode_udp(port, capture, max);
+	}
+	else if(port < 0 && !capture && target && optind + 1 == argc)
+	{
+		return replay(argv[optind], source, target);
+	}
+	else if(port < 0 && !capture && !source && optind + 1 == argc)
+	{
+		r = decode_file(argv[optind]);
+	}
+	else
+	{
+		usage(argv[0]);
+		return 2;
+	}
+
+	print_stats();
+	return r;
+}
+
+
+/* usage ****************************************************************************************//**
+ * @brief		*/
+static void usage(const char* name)
+{
+	fprintf(stderr,
+		"usage: %s [-v] [-c cell] [-n records] [-w capture] -u port\n"
+		"       %s [-v] [-c cell] capture\n"
+		"       %s [-v] [-s source] -r node capture\n", name, name, name);
+}
+
+
+/* handle_sigint ********************************************************************************//**
+ * @brief		*/
+static void handle_sigint(int sig)
+{
+	(void)sig;
+	stop = true;
+}
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Input                                                                                           //
+// ----------------------------------------------------------------------------------------------- //
+/* decode_file **********************************************************************************//**
+ * @brief		Decodes a capture file. */
+static int decode_file(const char* path)
+{
+	uint8_t buf[MAX_DATAGRAM];
+	char    name[INET6_ADDRSTRLEN];
+	size_t  len;
+
+	FILE* f = fopen(path, "rb");
+
+	if(!f)
+	{
+		perror(path);
+		return 1;
+	}
+
+	while(!stop && read_record(f, name, buf, &len))
+	{
+		decode(name, buf, len);
+	}
+
+	fclose(f);
+	return 0;
+}
+
+
+/* decode_udp ***********************************************************************************//**
+ * @brief		Decodes records received on a UDP port until max records were received or SIGINT.
+ * 				Appends them to the capture file if not null. */
+static int decode_udp(uint16_t port, const char* capture, long max)
+{
+	struct sockaddr_in6 addr = { 0 };
+	uint8_t buf[MAX_DATAGRAM];
+	char    name[INET6_ADDRSTRLEN];
+	FILE*   f = 0;
+	long    n = 0;
+
+	int s = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+
+	addr.sin6_family = AF_INET6;
+	addr.sin6_port   = htons(port);
+	addr.sin6_addr   = in6addr_any;
+
+	if(s < 0 || bind(s, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+	{
+		perror("socket");
+		return 1;
+	}
+
+	if(capture && !(f = fopen(capture, "ab")))
+	{
+		perror(capture);
+		close(s);
+		return 1;
+	}
+
+	while(!stop && (max < 0 || n < max))
+	{
+		socklen_t alen = sizeof(addr);
+		ssize_t   len  = recvfrom(s, buf, sizeof(buf), 0, (struct sockaddr*)&addr, &alen);
+
+		if(len < 0)
+		{
+			break;
+		}
+
+		if(f)
+		{
+			uint8_t hdr[18];
+			memcpy(hdr, &addr.sin6_addr, 16);
+			hdr[16] = len & 0xFF;
+			hdr[17] = len >> 8;
+			fwrite(hdr, sizeof(hdr), 1, f);
+			fwrite(buf, len, 1, f);
+			fflush(f);
+		}
+
+		inet_ntop(AF_INET6, &addr.sin6_addr, name, sizeof(name));
+		decode(name, buf, len);
+		n++;
+	}
+
+	if(f)
+	{
+		fclose(f);
+	}
+
+	close(s);
+	return 0;
+}
+
+
+/* read_record **********************************************************************************//**
+ * @brief		Reads the next record of a capture file. A capture is a sequence of records, each a
+ * 				16 byte source address, a 16 bit little endian length and the datagram. */
+static bool read_record(FILE* f, char* name, uint8_t* buf, size_t* len)
+{
+	uint8_t hdr[18];
+
+	if(fread(hdr, sizeof(hdr), 1, f) != 1)
+	{
+		return false;
+	}
+
+	*len = hdr[16] | (hdr[17] << 8);
+
+	if(*len > MAX_DATAGRAM || fread(buf, *len, 1, f) != 1)
+	{
+		fprintf(stderr, "truncated capture\n");
+		return false;
+	}
+
+	inet_ntop(AF_INET6, hdr, name, INET6_ADDRSTRLEN);
+	return true;
+}
+
+
+/* decode ***************************************************************************************//**
+ * @brief		Decodes one record from a node. */
+static void decode(const char* name, const uint8_t* buf, size_t len)
+{
+	LocCapRecord rec;
+
+	Node* node = node_find(name);
+
+	if(!node)
+	{
+		return;
+	}
+
+	int r = loc_cap_decode(&node->codec, &rec, 0, buf, len);
+
+	if(r < 0)
+	{
+		node->rejected++;
+
+		if(verbose)
+		{
+			printf("%s rejected: %s\n", name, strerror(-r));
+		}
+
+		return;
+	}
+
+	node->records++;
+	node->syncs   += (rec.flags & LOC_CAPTURE_SYNC) != 0;
+	node->dropped += rec.dropped;
+	stat_add(&node->solve_us, rec.solve_us);
+	churn_add(node, &rec);
+
+	if(verbose)
+	{
+		print_record(name, &rec);
+	}
+}
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Replay                                                                                          //
+// ----------------------------------------------------------------------------------------------- //
+/* replay ***************************************************************************************//**
+ * @brief		Replays the records of the source node in a capture file on the target node. */
+static int replay(const char* path, const char* source, const char* target)
+{
+	struct sockaddr_in6 addr = { 0 };
+	uint8_t      buf[MAX_DATAGRAM];
+	char         name[INET6_ADDRSTRLEN];
+	char         src[INET6_ADDRSTRLEN] = { 0 };
+	size_t       len;
+	LocCapCodec  codec;
+	LocCapRecord rec;
+	Replay       stats = { 0 };
+	bool         resync = true;
+
+	addr.sin6_family = AF_INET6;
+	addr.sin6_port   = htons(LOC_CAPTURE_PORT);
+
+	if(inet_pton(AF_INET6, target, &addr.sin6_addr) != 1)
+	{
+		fprintf(stderr, "bad node address %s\n", target);
+		return 2;
+	}
+
+	if(source)
+	{
+		struct in6_addr a;
+
+		if(inet_pton(AF_INET6, source, &a) != 1)
+		{
+			fprintf(stderr, "bad source address %s\n", source);
+			return 2;
+		}
+
+		inet_ntop(AF_INET6, &a, src, sizeof(src));
+	}
+
+	struct sockaddr_in6 local = { 0 };
+	local.sin6_family = AF_INET6;
+	local.sin6_port   = htons(LOC_CAPTURE_PORT);
+	local.sin6_addr   = in6addr_any;
+
+	FILE* f = fopen(path, "rb");
+	int   s = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+
+	if(!f || s < 0 || bind(s, (struct sockaddr*)&local, sizeof(local)) < 0)
+	{
+		perror(f ? "socket" : path);
+		return 1;
+	}
+
+	loc_cap_reset(&codec);
+
+	while(!stop && read_record(f, name, buf, &len))
+	{
+		if(!src[0])
+		{
+			snprintf(src, sizeof(src), "%s", name);
+		}
+
+		if(strcmp(src, name) != 0)
+		{
+			continue;
+		}
+
+		/* Only records the node can decode are sent. After a lost record, the node needs the next
+		 * sync record just like this decoder. */
+		if(loc_cap_decode(&codec, &rec, 0, buf, len) < 0 || (resync && !(rec.flags & LOC_CAPTURE_SYNC)))
+		{
+			stats.skipped++;
+			continue;
+		}
+
+		resync = replay_one(s, &addr, &rec, buf, len, &stats) != 0;
+	}
+
+	fclose(f);
+	close(s);
+
+	printf("replayed %s on %s\n", src[0] ? src : "nothing", target);
+	printf("  sent %llu  skipped %llu  timeouts %llu  rejected %llu\n",
+		(unsigned long long)stats.sent,     (unsigned long long)stats.skipped,
+		(unsigned long long)stats.timeouts, (unsigned long long)stats.rejected);
+	printf("  matched %llu  mismatched %llu", (unsigned long long)stats.matched,
+		(unsigned long long)stats.mismatched);
+
+	if(stats.mismatched)
+	{
+		printf("  location error mean %.3f m  max %.3f m",
+			stats.total_err / stats.mismatched, stats.max_err);
+	}
+
+	printf("\n");
+	stat_print("captured solve", &stats.captured_us);
+	stat_print("replayed solve", &stats.replayed_us);
+
+	return stats.mismatched || stats.timeouts ? 1 : 0;
+}
+
+
+/* replay_one ***********************************************************************************//**
+ * @brief		Sends one record to the target node and compares the result the node sends back with
+ * 				the captured result. Records from other nodes are ignored. Returns 0 or -ETIMEDOUT
+ * 				if the node did not answer, in which case it needs a sync record before it can
+ * 				decode further records. */
+static int replay_one(int s, const struct sockaddr_in6* addr, const LocCapRecord* cap,
+                      const uint8_t* buf, size_t len, Replay* stats)
+{
+	static LocCapCodec codec = { 0 };
+
+	struct pollfd fds = { .fd = s, .events = POLLIN };
+	uint8_t       rx[MAX_DATAGRAM];
+	LocCapRecord  res;
+
+	if(sendto(s, buf, len, 0, (const struct sockaddr*)addr, sizeof(*addr)) < 0)
+	{
+		perror("sendto");
+		stop = true;
+		return -EIO;
+	}
+
+	stats->sent++;
+
+	/* Other nodes may be capturing to the same port. Only the target node's records are results. */
+	struct sockaddr_in6 from;
+	ssize_t n;
+
+	do {
+		socklen_t fromlen = sizeof(from);
+
+		if(poll(&fds, 1, REPLAY_TIMEOUT_MS) <= 0)
+		{
+			stats->timeouts++;
+			fprintf(stderr, "seq %u: no result\n", cap->seq);
+			return -ETIMEDOUT;
+		}
+
+		n = recvfrom(s, rx, sizeof(rx), 0, (struct sockaddr*)&from, &fromlen);
+	} while(n > 0 && memcmp(&from.sin6_addr, &addr->sin6_addr, sizeof(from.sin6_addr)) != 0);
+
+	if(n <= 0 || loc_cap_decode(&codec, &res, 0, rx, n) < 0)
+	{
+		stats->rejected++;
+		return 0;
+	}
+
+	stat_add(&stats->captured_us, cap->solve_us);
+	stat_add(&stats->replayed_us, res.solve_us);
+
+	bool same_loc = memcmp(&cap->x, &res.x, sizeof(float)) == 0 &&
+	                memcmp(&cap->y, &res.y, sizeof(float)) == 0 &&
+	                memcmp(&cap->z, &res.z, sizeof(float)) == 0;
+
+	if(same_loc && cap->state == res.state && cap->beacon_index == res.beacon_index &&
+	   cap->all_nbrhood == res.all_nbrhood && cap->local_nbrhood == res.local_nbrhood)
+	{
+		stats->matched++;
+	}
+	else
+	{
+		double err = sqrt((cap->x - res.x) * (cap->x - res.x) +
+		                  (cap->y - res.y) * (cap->y - res.y) +
+		                  (cap->z - res.z) * (cap->z - res.z));
+
+		/* A location that appears or disappears counts as an infinite error */
+		if(isnan(err) && !(isnan(cap->x) && isnan(res.x)))
+		{
+			err = INFINITY;
+		}
+		else if(isnan(err))
+		{
+			err = 0;
+		}
+
+		stats->mismatched++;
+		stats->total_err += err;
+		stats->max_err    = err > stats->max_err ? err : stats->max_err;
+
+		printf("seq %u mismatch: error %.3f m\n", cap->seq, err);
+		print_record("  captured", cap);
+		print_record("  replayed", &res);
+	}
+
+	if(verbose)
+	{
+		print_record("replayed", &res);
+	}
+
+	return 0;
+}
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Nodes                                                                                           //
+// ----------------------------------------------------------------------------------------------- //
+/* node_find ************************************************************************************//**
+ * @brief		Returns the state of the named node. Adds the node if it is new. */
+static Node* node_find(const char* name)
+{
+	unsigned i;
+
+	for(i = 0; i < MAX_NODES; i++)
+	{
+		if(nodes[i].valid && strcmp(nodes[i].name, name) == 0)
+		{
+			return &nodes[i];
+		}
+	}
+
+	for(i = 0; i < MAX_NODES; i++)
+	{
+		if(!nodes[i].valid)
+		{
+			memset(&nodes[i], 0, sizeof(nodes[i]));
+			nodes[i].valid = true;
+			snprintf(nodes[i].name, sizeof(nodes[i].name), "%s", name);
+			loc_cap_reset(&nodes[i].codec);
+			hyper_cell_set(&nodes[i].cell, NAN, NAN, NAN);
+			nodes[i].round[0] = nodes[i].round[1] = nodes[i].round[2] = NAN;
+			return &nodes[i];
+		}
+	}
+
+	fprintf(stderr, "too many nodes. ignoring %s\n", name);
+	return 0;
+}
+
+
+/* print_record *********************************************************************************//**
+ * @brief		Prints a record's update and result on one line. */
+static void print_record(const char* label, const LocCapRecord* rec)
+{
+	const LocCapUpdate* u = &rec->update;
+
+	const char* state = rec->state < sizeof(state_names) / sizeof(state_names[0]) ?
+		state_names[rec->state] : "?";
+	const char* event = rec->event < sizeof(event_names) / sizeof(event_names[0]) ?
+		event_names[rec->event] : "?";
+
+	printf("%s seq %u %s%s dir %u slot %u nbrs %02X adj %06X -> %s beacon %u "
+		"loc (%.3f, %.3f, %.3f) nbrhood %05X/%05X solve %u us\n",
+		label, rec->seq, event, (rec->flags & LOC_CAPTURE_SYNC) ? " sync" : "",
+		u->dir, u->slot, u->new_nbrhood, u->adj, state, rec->beacon_index,
+		rec->x, rec->y, rec->z, rec->local_nbrhood, rec->all_nbrhood, rec->solve_us);
+}
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Statistics                                                                                      //
+// ----------------------------------------------------------------------------------------------- //
+/* stat_add *************************************************************************************//**
+ * @brief		*/
+static void stat_add(Stat* s, uint32_t value)
+{
+	s->count++;
+	s->total += value;
+	s->max    = value > s->max ? value : s->max;
+}
+
+
+/* stat_print ***********************************************************************************//**
+ * @brief		*/
+static void stat_print(const char* label, const Stat* s)
+{
+	if(s->count == 0)
+	{
+		return;
+	}
+
+	printf("  %-16s n %8u  mean %8.1f us  max %8u us\n",
+		label, s->count, (double)s->total / s->count, s->max);
+}
+
+
+/* churn_add ************************************************************************************//**
+ * @brief		Tracks the coordinate a node would be assigned from the location in a record.
+ * 				hyperspace_update is only called when the filtered location changes, so records that
+ * 				leave it unchanged don't count towards confirming a new cell. */
+static void churn_add(Node* node, const LocCapRecord* rec)
+{
+	float p[3]  = { rec->x / cell, rec->y / cell, rec->z / cell };
+	bool  first = node->records == 1;
+	int   i;
+
+	if(!first)
+	{
+		node->span_ms += (uint32_t)(rec->uptime - node->uptime);
+	}
+
+	node->uptime = rec->uptime;
+
+	if(!first && rec->x == node->loc[0] && rec->y == node->loc[1] && rec->z == node->loc[2])
+	{
+		return;
+	}
+
+	node->loc[0] = rec->x;
+	node->loc[1] = rec->y;
+	node->loc[2] = rec->z;
+
+	if(!isfinite(p[0]) || !isfinite(p[1]) || !isfinite(p[2]))
+	{
+		hyper_cell_set(&node->cell, NAN, NAN, NAN);
+		node->round[0] = node->round[1] = node->round[2] = NAN;
+		return;
+	}
+
+	node->changes += hyper_cell_moved(&node->cell, p[0], p[1], p[2]);
+
+	for(i = 0; i < 3; i++)
+	{
+		if(roundf(p[i]) != node->round[i])
+		{
+			node->round[0] = roundf(p[0]);
+			node->round[1] = roundf(p[1]);
+			node->round[2] = roundf(p[2]);
+			node->round_changes++;
+			break;
+		}
+	}
+}
+
+
+/* print_stats **********************************************************************************//**
+ * @brief		Prints a summary per node. */
+static void print_stats(void)
+{
+	unsigned i;
+
+	for(i = 0; i < MAX_NODES; i++)
+	{
+		const Node* node = &nodes[i];
+
+		if(!node->valid)
+		{
+			continue;
+		}
+
+		printf("%s\n", node->name);
+		printf("  records %llu  sync %llu  rejected %llu  dropped by node %llu\n",
+			(unsigned long long)node->records,  (unsigned long long)node->syncs,
+			(unsigned long long)node->rejected, (unsigned long long)node->dropped);
+		stat_print("solve", &node->solve_us);
+
+		double hours = node->span_ms / 3600e3;
+
+		if(hours > 0)
+		{
+			printf("  coordinate changes %llu (%.1f/h), rounding the location %llu (%.1f/h)\n",
+				(unsigned long long)node->changes,       node->changes / hours,
+				(unsigned long long)node->round_changes, node->round_changes / hours);
+		}
+	}
+}
+
+
+/******************************************* END OF FILE *******************************************/
@@ -0,0 +1,382 @@
+/************************************************************************************************//**
+ * @file		locsolve_test.c
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ * @brief		Compares the RMS error of the weighted and unweighted TOA and TDOA solvers over
+ * 				synthetic noisy geometries. Six beacons and a node are placed at random in a room.
+ * 				LOS ranges have LOC_RANGE_SIGMA of noise. One beacon per trial may be NLOS with
+ * 				LOC_NLOS_SIGMA times the noise and a positive bias, as flagged by the receive
+ * 				diagnostics in location.c.
+ *
+ ***************************************************************************************************/
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "locsolve.h"
+
+
+/* Private Macros -------------------------------------------------------------------------------- */
+#define CHECK(cond)                                                                  \
+	do {                                                                             \
+		if(!(cond))                                                                  \
+		{                                                                            \
+			printf("%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __func__, #cond); \
+			return 1;                                                                \
+		}                                                                            \
+	} while(0)
+
+#define NUM_BEACONS         (6)
+#define NUM_TRIALS          (4000)
+#define ROOM_XY_M           (10.0)
+#define ROOM_Z_M            (3.0)
+#define RANGE_SIGMA         (0.1)		/* LOC_RANGE_SIGMA in location.c */
+#define NLOS_SIGMA          (4.0)		/* LOC_NLOS_SIGMA in location.c */
+#define NLOS_BIAS_M         (0.3)		/* Excess path of a NLOS range */
+
+
+/* Private Types --------------------------------------------------------------------------------- */
+typedef struct {
+	double ls;          /* RMS error of the unweighted solution in m */
+	double wls;         /* RMS error of the weighted solution in m */
+	double sigma;       /* RMS of the weighted solution's sigma in m */
+	unsigned solved;
+} Rms;
+
+
+/* Private Functions ----------------------------------------------------------------------------- */
+static double gauss    (void);
+static double uniform  (double);
+static Rms    run      (bool, double);
+static double err      (const LocSolve*, const double*);
+static double springs_settle(const float (*)[3], const float*, const float*, const float*);
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Tests                                                                                           //
+// ----------------------------------------------------------------------------------------------- //
+/* test_exact ***********************************************************************************//**
+ * @brief		Both solvers recover the exact location from exact ranges, weighted or not. */
+static int test_exact(void)
+{
+	const float p[NUM_BEACONS][3] = {
+		{ 0, 0, 0 }, { 5, 0, 2.5f }, { 0, 5, 0.5f }, { 5, 5, 0 }, { 2.5f, 0, 3 }, { 0, 2.5f, 2 },
+	};
+	const double x[3] = { 1.5, 2.0, 1.0 };
+	float    d[NUM_BEACONS], pr[NUM_BEACONS], s[NUM_BEACONS];
+	LocSolve sol;
+	unsigned i;
+
+	for(i = 0; i < NUM_BEACONS; i++)
+	{
+		d[i]  = sqrt(pow(p[i][0] - x[0], 2) + pow(p[i][1] - x[1], 2) + pow(p[i][2] - x[2], 2));
+		pr[i] = d[i] - 7.0f;
+		s[i]  = RANGE_SIGMA;
+	}
+
+	CHECK(locsolve_toa(p, d, 0, NUM_BEACONS, &sol) && err(&sol, x) < 1e-3);
+	CHECK(locsolve_toa(p, d, s, NUM_BEACONS, &sol) && err(&sol, x) < 1e-3);
+	CHECK(locsolve_toa(p, d, s, 4, &sol) && err(&sol, x) < 1e-3);
+	CHECK(locsolve_tdoa(p, pr, 0, NUM_BEACONS, &sol) && err(&sol, x) < 1e-3);
+	CHECK(locsolve_tdoa(p, pr, s, NUM_BEACONS, &sol) && err(&sol, x) < 1e-3);
+	return 0;
+}
+
+
+/* test_coplanar ********************************************************************************//**
+ * @brief		Coplanar beacons and too few beacons are rejected rather than solved. */
+static int test_coplanar(void)
+{
+	const float p[NUM_BEACONS][3] = {
+		{ 0, 0, 2 }, { 5, 0, 2 }, { 0, 5, 2 }, { 5, 5, 2 }, { 2.5f, 0, 2 }, { 0, 2.5f, 2 },
+	};
+	const float d[NUM_BEACONS] = { 3, 4, 4, 5, 3, 3 };
+	LocSolve sol;
+
+	CHECK(!locsolve_toa(p, d, 0, NUM_BEACONS, &sol));
+	CHECK(!locsolve_tdoa(p, d, 0, NUM_BEACONS, &sol));
+	CHECK(!locsolve_toa(p, d, 0, 3, &sol));
+	return 0;
+}
+
+
+/* test_toa_rms *********************************************************************************//**
+ * @brief		Weighting lowers the RMS error of the TOA solver, more so with NLOS ranges. */
+static int test_toa_rms(void)
+{
+	Rms los  = run(false, 0);
+	Rms nlos = run(false, 1.0);
+
+	printf("TOA  LOS:  LS %.3f m, WLS %.3f m, sigma %.3f m, %u solved\n",
+		los.ls, los.wls, los.sigma, los.solved);
+	printf("TOA  NLOS: LS %.3f m, WLS %.3f m, sigma %.3f m, %u solved\n",
+		nlos.ls, nlos.wls, nlos.sigma, nlos.solved);
+
+	CHECK(los.solved  > NUM_TRIALS * 9 / 10);
+	CHECK(nlos.solved > NUM_TRIALS * 9 / 10);
+	CHECK(los.wls  < los.ls);
+	CHECK(nlos.wls < 0.8 * nlos.ls);
+	return 0;
+}
+
+
+/* test_tdoa_rms ********************************************************************************//**
+ * @brief		Weighting lowers the RMS error of the TDOA solver with NLOS ranges. LOS ranges have
+ * 				equal deviations so the weights only follow the distances, which are estimated from
+ * 				an unweighted solution first, and the error is no worse. */
+static int test_tdoa_rms(void)
+{
+	Rms los  = run(true, 0);
+	Rms nlos = run(true, 1.0);
+
+	printf("TDOA LOS:  LS %.3f m, WLS %.3f m, sigma %.3f m, %u solved\n",
+		los.ls, los.wls, los.sigma, los.solved);
+	printf("TDOA NLOS: LS %.3f m, WLS %.3f m, sigma %.3f m, %u solved\n",
+		nlos.ls, nlos.wls, nlos.sigma, nlos.solved);
+
+	CHECK(los.solved  > NUM_TRIALS * 9 / 10);
+	CHECK(nlos.solved > NUM_TRIALS * 9 / 10);
+	CHECK(los.wls  <= 1.02 * los.ls);
+	CHECK(nlos.wls < 0.8 * nlos.ls);
+	return 0;
+}
+
+
+/* test_sigma ***********************************************************************************//**
+ * @brief		The TOA solver's sigma tracks its actual error, so that loc_filter weighs updates
+ * 				sensibly. */
+static int test_sigma(void)
+{
+	Rms los  = run(false, 0);
+	Rms nlos = run(false, 1.0);
+
+	CHECK(los.sigma  > 0.5 * los.wls  && los.sigma  < 2.0 * los.wls);
+	CHECK(nlos.sigma > 0.5 * nlos.wls && nlos.sigma < 2.0 * nlos.wls);
+	CHECK(nlos.sigma > los.sigma);
+	return 0;
+}
+
+
+
+/* test_3sphere *********************************************************************************//**
+ * @brief		The 3 sphere intersection recovers the location on either side of the beacons' plane
+ * 				and fails if the spheres do not meet. */
+static int test_3sphere(void)
+{
+	const float  p[3][3] = { { 0, 0, 2 }, { 5, 0, 2.5f }, { 0, 5, 1.5f } };
+	const double x[3]    = { 1.5, 2.0, 1.0 };
+	float    d[3], sol[3];
+	unsigned i;
+
+	for(i = 0; i < 3; i++)
+	{
+		d[i] = sqrt(pow(p[i][0] - x[0], 2) + pow(p[i][1] - x[1], 2) + pow(p[i][2] - x[2], 2));
+	}
+
+	/* u3 = u1 x u2 points up out of the beacons' plane and x is below it */
+	CHECK(locsolve_3sphere(p, d, -1.0f, sol));
+	CHECK(fabs(sol[0] - x[0]) < 1e-3 && fabs(sol[1] - x[1]) < 1e-3 && fabs(sol[2] - x[2]) < 1e-3);
+
+	/* The mirror image is above the plane */
+	CHECK(locsolve_3sphere(p, d, 1.0f, sol));
+	CHECK(sol[2] > 2.0f);
+
+	const float far[3] = { 1, 1, 1 };
+	CHECK(!locsolve_3sphere(p, far, 1.0f, sol));
+	return 0;
+}
+
+
+/* test_springs *********************************************************************************//**
+ * @brief		The spring model settles at the location given exact ranges when the location is a
+ * 				lattice point. Otherwise the constant pull towards the lattice point offsets it by a
+ * 				bounded amount. */
+static int test_springs(void)
+{
+	const float  p[4][3] = { { 0, 0, 0 }, { 5, 0, 2.5f }, { 0, 5, 0.5f }, { 5, 5, 0 } };
+	const float  x[3]    = { 2.0f, 2.2f, 0.4f };
+	const float  g[3]    = { 2.5f, 2.5f, 0 };
+	float    d[4];
+	unsigned i;
+
+	for(i = 0; i < 4; i++)
+	{
+		d[i] = sqrt(pow(p[i][0] - x[0], 2) + pow(p[i][1] - x[1], 2) + pow(p[i][2] - x[2], 2));
+	}
+
+	double exact  = springs_settle(p, d, x, x);
+	double offset = springs_settle(p, d, g, x);
+
+	printf("springs: settled %.3f m from a lattice point, %.3f m from between them\n",
+		exact, offset);
+	CHECK(exact  < 1e-3);
+	CHECK(offset < 0.5);
+	return 0;
+}
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Helpers                                                                                         //
+// ----------------------------------------------------------------------------------------------- //
+/* gauss ****************************************************************************************//**
+ * @brief		Returns a standard normal sample (Box-Muller). */
+static double gauss(void)
+{
+	double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+	double v = (rand() + 1.0) / (RAND_MAX + 2.0);
+
+	return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+
+/* uniform **************************************************************************************//**
+ * @brief		Returns a uniform sample in [0, max). */
+static double uniform(double max)
+{
+	return max * rand() / ((double)RAND_MAX + 1.0);
+}
+
+
+/* springs_settle *******************************************************************************//**
+ * @brief		Runs the spring model for 50 s with the ranges d to location x, starting 0.7 m from
+ * 				x, and returns the distance to x it settles at. lattice is the closest lattice
+ * 				point. */
+static double springs_settle(
+	const float (*p)[3],
+	const float* d,
+	const float* lattice,
+	const float* x)
+{
+	float    pos[3] = { x[0] + 0.5f, x[1] - 0.5f, x[2] };
+	float    vel[3] = { 0, 0, 0 };
+	unsigned i;
+
+	for(i = 0; i < 5000; i++)
+	{
+		locsolve_springs(p, d, 4, lattice, pos, vel);
+	}
+
+	return sqrt(pow(pos[0] - x[0], 2) + pow(pos[1] - x[1], 2) + pow(pos[2] - x[2], 2));
+}
+
+
+/* run ******************************************************************************************//**
+ * @brief		Solves NUM_TRIALS random geometries with and without weights and returns the RMS
+ * 				errors over the trials both solved. With probability nlos, one beacon's range is
+ * 				NLOS. The solvers are given the range deviations that location.c assigns from the
+ * 				NLOS flags. */
+static Rms run(bool tdoa, double nlos)
+{
+	Rms      rms = { 0, 0, 0, 0 };
+	unsigned t, i;
+
+	srand(55);
+
+	for(t = 0; t < NUM_TRIALS; t++)
+	{
+		float    p[NUM_BEACONS][3];
+		float    d[NUM_BEACONS];
+		float    s[NUM_BEACONS];
+		double   x[3] = { uniform(ROOM_XY_M), uniform(ROOM_XY_M), uniform(ROOM_Z_M) };
+		double   offset = uniform(100.0);
+		int      bad    = uniform(1.0) < nlos ? (int)uniform(NUM_BEACONS) : -1;
+		LocSolve ls, wls;
+
+		for(i = 0; i < NUM_BEACONS; i++)
+		{
+			p[i][0] = uniform(ROOM_XY_M);
+			p[i][1] = uniform(ROOM_XY_M);
+			p[i][2] = uniform(ROOM_Z_M);
+
+			double dist  = sqrt(pow(p[i][0] - x[0], 2) + pow(p[i][1] - x[1], 2) +
+			                    pow(p[i][2] - x[2], 2));
+			double sigma = (int)i == bad ? RANGE_SIGMA * NLOS_SIGMA : RANGE_SIGMA;
+			double noise = sigma * gauss() + ((int)i == bad ? NLOS_BIAS_M : 0);
+
+			d[i] = dist + noise + (tdoa ? offset : 0);
+			s[i] = sigma;
+		}
+
+		bool ok;
+
+		if(tdoa)
+		{
+			ok = locsolve_tdoa(p, d, 0, NUM_BEACONS, &ls) &&
+			     locsolve_tdoa(p, d, s, NUM_BEACONS, &wls);
+		}
+		else
+		{
+			ok = locsolve_toa(p, d, 0, NUM_BEACONS, &ls) &&
+			     locsolve_toa(p, d, s, NUM_BEACONS, &wls);
+		}
+
+		if(ok)
+		{
+			rms.ls    += pow(err(&ls, x), 2);
+			rms.wls   += pow(err(&wls, x), 2);
+			rms.sigma += pow(wls.sigma, 2);
+			rms.solved++;
+		}
+	}
+
+	if(rms.solved)
+	{
+		rms.ls    = sqrt(rms.ls    / rms.solved);
+		rms.wls   = sqrt(rms.wls   / rms.solved);
+		rms.sigma = sqrt(rms.sigma / rms.solved);
+	}
+
+	return rms;
+}
+
+
+/* err ******************************************************************************************//**
+ * @brief		Returns the distance in m between a solution and the true location. */
+static double err(const LocSolve* sol, const double* x)
+{
+	return sqrt(pow(sol->x - x[0], 2) + pow(sol->y - x[1], 2) + pow(sol->z - x[2], 2));
+}
+
+
+/* main *****************************************************************************************//**
+ * @brief		*/
+int main(void)
+{
+	static int (*const tests[])(void) = {
+		test_exact,
+		test_coplanar,
+		test_toa_rms,
+		test_tdoa_rms,
+		test_sigma,
+		test_3sphere,
+		test_springs,
+	};
+
+	unsigned i;
+	int      failed = 0;
+
+	for(i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+	{
+		failed += tests[i]();
+	}
+
+	printf("%u tests, %d failed\n", (unsigned)(sizeof(tests) / sizeof(tests[0])), failed);
+	return failed ? 1 : 0;
+}
+
+
+/******************************************* END OF FILE *******************************************/
@@ -0,0 +1,399 @@
+/************************************************************************************************//**
+ * @file		prng_test.c
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ * @brief		Checks the PCG32 generator in prng.c against the reference sequence, runs a small
+ * 				statistical suite over its output and times it against libc rand() and the float
+ * 				division that bayes_try used before.
+ *
+ * 				The statistical checks use fixed seeds, so they are deterministic. Their bounds are
+ * 				the 0.1% critical values, so a sound generator passes them for nearly any seed.
+ *
+ ***************************************************************************************************/
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "prng.h"
+
+
+/* Private Macros -------------------------------------------------------------------------------- */
+#define CHECK(cond)                                                                  \
+	do {                                                                             \
+		if(!(cond))                                                                  \
+		{                                                                            \
+			printf("%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __func__, #cond); \
+			return 1;                                                                \
+		}                                                                            \
+	} while(0)
+
+#define NUM_SAMPLES         (1u << 22)
+#define NUM_BENCH           (1u << 24)
+#define CHI2_255_P001       (330.52)	/* Chi-square critical value, 255 dof, p = 0.001 */
+#define CHI2_9_P001         (27.88)		/* Chi-square critical value, 9 dof, p = 0.001 */
+#define Z_P001              (3.29)		/* Two sided normal critical value, p = 0.001 */
+
+
+/* Private Functions ----------------------------------------------------------------------------- */
+static double   now_ns     (void);
+static double   bench      (const char*, uint32_t (*)(void));
+static uint32_t draw_pcg   (void);
+static uint32_t draw_rand  (void);
+static uint32_t draw_float (void);
+static uint32_t draw_chance(void);
+
+
+/* Private Variables ----------------------------------------------------------------------------- */
+static Prng     bench_rng;
+static float    bench_v = 3.7f;     /* Bayesian estimate for the float division path */
+static uint32_t bench_threshold;
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Tests                                                                                           //
+// ----------------------------------------------------------------------------------------------- //
+/* test_reference *******************************************************************************//**
+ * @brief		prng_seed and prng_next reproduce the pcg32_srandom_r(42, 54) reference sequence. */
+static int test_reference(void)
+{
+	static const uint32_t expected[] = {
+		0xA15C02B7, 0x7B47F409, 0xBA1D3330, 0x83D2F293, 0xBFA4784B, 0xCBED606E,
+	};
+
+	Prng     p;
+	unsigned i;
+
+	prng_seed(&p, 42, 54);
+
+	for(i = 0; i < sizeof(expected) / sizeof(expected[0]); i++)
+	{
+		CHECK(prng_next(&p) == expected[i]);
+	}
+
+	return 0;
+}
+
+
+/* test_bytes ***********************************************************************************//**
+ * @brief		Every byte of the output is uniform (chi-square over 256 bins). */
+static int test_bytes(void)
+{
+	static unsigned bins[4][256];
+	Prng     p;
+	unsigned i, k;
+
+	prng_seed(&p, 62, 1);
+
+	for(i = 0; i < NUM_SAMPLES; i++)
+	{
+		uint32_t x = prng_next(&p);
+
+		for(k = 0; k < 4; k++)
+		{
+			bins[k][(x >> (8 * k)) & 0xFF]++;
+		}
+	}
+
+	for(k = 0; k < 4; k++)
+	{
+		double expect = NUM_SAMPLES / 256.0;
+		double chi2   = 0;
+
+		for(i = 0; i < 256; i++)
+		{
+			chi2 += (bins[k][i] - expect) * (bins[k][i] - expect) / expect;
+		}
+
+		printf("byte %u: chi2 %.1f (255 dof)\n", k, chi2);
+		CHECK(chi2 < CHI2_255_P001);
+	}
+
+	return 0;
+}
+
+
+/* test_bits ************************************************************************************//**
+ * @brief		Every bit is set half the time (monobit) and runs of the low bit have the expected
+ * 				count (Wald-Wolfowitz). */
+static int test_bits(void)
+{
+	static unsigned ones[32];
+	Prng     p;
+	unsigned i, k;
+	unsigned runs  = 1;
+	unsigned last  = 0;
+	unsigned total = 0;
+
+	prng_seed(&p, 62, 2);
+
+	for(i = 0; i < NUM_SAMPLES; i++)
+	{
+		uint32_t x = prng_next(&p);
+
+		for(k = 0; k < 32; k++)
+		{
+			ones[k] += (x >> k) & 1;
+		}
+
+		if(i && (x & 1) != last)
+		{
+			runs++;
+		}
+
+		last   = x & 1;
+		total += x & 1;
+	}
+
+	for(k = 0; k < 32; k++)
+	{
+		double z = (ones[k] - NUM_SAMPLES / 2.0) / sqrt(NUM_SAMPLES / 4.0);
+
+		CHECK(fabs(z) < Z_P001);
+	}
+
+	double n1   = total;
+	double n0   = NUM_SAMPLES - n1;
+	double mean = 2.0 * n0 * n1 / NUM_SAMPLES + 1.0;
+	double var  = (mean - 1.0) * (mean - 2.0) / (NUM_SAMPLES - 1.0);
+	double z    = (runs - mean) / sqrt(var);
+
+	printf("low bit runs: %u, z %.2f\n", runs, z);
+	CHECK(fabs(z) < Z_P001);
+	return 0;
+}
+
+
+/* test_correlation *****************************************************************************//**
+ * @brief		Successive outputs, and outputs of two streams seeded with the same state, are
+ * 				uncorrelated. */
+static int test_correlation(void)
+{
+	Prng     a, b;
+	unsigned i;
+	double   prev  = 0;
+	double   lag   = 0;
+	double   cross = 0;
+
+	prng_seed(&a, 62, 3);
+	prng_seed(&b, 62, 4);
+
+	for(i = 0; i < NUM_SAMPLES; i++)
+	{
+		double x = prng_float(&a) - 0.5;
+		double y = prng_float(&b) - 0.5;
+
+		lag   += x * prev;
+		cross += x * y;
+		prev   = x;
+	}
+
+	/* Each product of independent uniforms in [-0.5, 0.5) has a deviation of 1/12 */
+	double z_lag   = lag   / (sqrt(NUM_SAMPLES) / 12.0);
+	double z_cross = cross / (sqrt(NUM_SAMPLES) / 12.0);
+
+	printf("lag 1 z %.2f, cross stream z %.2f\n", z_lag, z_cross);
+	CHECK(fabs(z_lag)   < Z_P001);
+	CHECK(fabs(z_cross) < Z_P001);
+	return 0;
+}
+
+
+/* test_range ***********************************************************************************//**
+ * @brief		prng_range is uniform over a small range, as backoff uses it, and prng_float stays in
+ * 				[0, 1). */
+static int test_range(void)
+{
+	unsigned bins[10] = { 0 };
+	Prng     p;
+	unsigned i;
+	double   chi2 = 0;
+
+	prng_seed(&p, 62, 5);
+
+	for(i = 0; i < NUM_SAMPLES; i++)
+	{
+		uint32_t r = prng_range(&p, 10);
+		float    f = prng_float(&p);
+
+		CHECK(r < 10);
+		CHECK(f >= 0.0f && f < 1.0f);
+		bins[r]++;
+	}
+
+	for(i = 0; i < 10; i++)
+	{
+		double expect = NUM_SAMPLES / 10.0;
+
+		chi2 += (bins[i] - expect) * (bins[i] - expect) / expect;
+	}
+
+	printf("range 10: chi2 %.1f (9 dof)\n", chi2);
+	CHECK(chi2 < CHI2_9_P001);
+	return 0;
+}
+
+
+/* test_chance **********************************************************************************//**
+ * @brief		prng_chance succeeds with the probability given to prng_threshold, including the
+ * 				edge cases. */
+static int test_chance(void)
+{
+	static const float probabilities[] = { 0.01f, 0.1f, 0.25f, 1.0f / 2.71828f, 0.9f };
+
+	Prng     p;
+	unsigned i, k;
+
+	prng_seed(&p, 62, 6);
+
+	for(k = 0; k < sizeof(probabilities) / sizeof(probabilities[0]); k++)
+	{
+		uint32_t threshold = prng_threshold(probabilities[k]);
+		unsigned hits      = 0;
+
+		for(i = 0; i < NUM_SAMPLES; i++)
+		{
+			hits += prng_chance(&p, threshold);
+		}
+
+		double q = probabilities[k];
+		double z = (hits - NUM_SAMPLES * q) / sqrt(NUM_SAMPLES * q * (1.0 - q));
+
+		CHECK(fabs(z) < Z_P001);
+	}
+
+	CHECK(prng_threshold(0.0f)  == 0);
+	CHECK(prng_threshold(-1.0f) == 0);
+	CHECK(prng_threshold(1.0f)  == UINT32_MAX);
+	CHECK(!prng_chance(&p, prng_threshold(0.0f)));
+	return 0;
+}
+
+
+/* test_bench ***********************************************************************************//**
+ * @brief		Reports the time per draw of PCG32, libc rand() and the Bayesian transmit decision
+ * 				with the float division it replaced. Timing is reported only, as it depends on the
+ * 				host. */
+static int test_bench(void)
+{
+	prng_seed(&bench_rng, 62, 7);
+	bench_threshold = prng_threshold(1.0f / bench_v);
+
+	bench("prng_next        ", draw_pcg);
+	bench("rand             ", draw_rand);
+	bench("float divide try ", draw_float);
+	bench("threshold try    ", draw_chance);
+	return 0;
+}
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Helpers                                                                                         //
+// ----------------------------------------------------------------------------------------------- //
+/* now_ns ***************************************************************************************//**
+ * @brief		Returns a monotonic time in ns. */
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+/* bench ****************************************************************************************//**
+ * @brief		Prints and returns the mean time in ns of NUM_BENCH calls to draw. */
+static double bench(const char* name, uint32_t (*draw)(void))
+{
+	volatile uint32_t sink = 0;
+	unsigned i;
+	double   start = now_ns();
+
+	for(i = 0; i < NUM_BENCH; i++)
+	{
+		sink += draw();
+	}
+
+	double ns = (now_ns() - start) / NUM_BENCH;
+
+	printf("%s %.2f ns/draw\n", name, ns);
+	(void)sink;
+	return ns;
+}
+
+
+/* draw_pcg *************************************************************************************//**
+ * @brief		*/
+static uint32_t draw_pcg(void)
+{
+	return prng_next(&bench_rng);
+}
+
+
+/* draw_rand ************************************************************************************//**
+ * @brief		*/
+static uint32_t draw_rand(void)
+{
+	return rand();
+}
+
+
+/* draw_float ***********************************************************************************//**
+ * @brief		The transmit decision of bayes_try before it kept a threshold. */
+static uint32_t draw_float(void)
+{
+	return (float)rand() / (float)RAND_MAX < 1.0f / bench_v;
+}
+
+
+/* draw_chance **********************************************************************************//**
+ * @brief		The transmit decision of bayes_try with the threshold from bayes_update. */
+static uint32_t draw_chance(void)
+{
+	return prng_chance(&bench_rng, bench_threshold);
+}
+
+
+/* main *****************************************************************************************//**
+ * @brief		*/
+int main(void)
+{
+	static int (*const tests[])(void) = {
+		test_reference,
+		test_bytes,
+		test_bits,
+		test_correlation,
+		test_range,
+		test_chance,
+		test_bench,
+	};
+
+	unsigned i;
+	int      failed = 0;
+
+	for(i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+	{
+		failed += tests[i]();
+	}
+
+	printf("%u tests, %d failed\n", (unsigned)(sizeof(tests) / sizeof(tests[0])), failed);
+	return failed ? 1 : 0;
+}
+
+
+/******************************************* END OF FILE *******************************************/
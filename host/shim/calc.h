@@ -0,0 +1,57 @@
+/************************************************************************************************//**
+ * @file		calc.h
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ * @brief		Host replacement for the parts of mistlib's calc.h used by the common/ code that is
+ * 				built on the host.
+ *
+ ***************************************************************************************************/
+#ifndef CALC_H
+#define CALC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Includes -------------------------------------------------------------------------------------- */
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/* Public Functions ------------------------------------------------------------------------------ */
+static inline float calc_min_f(float a, float b)
+{
+	return a < b ? a : b;
+}
+
+
+static inline float calc_max_f(float a, float b)
+{
+	return a > b ? a : b;
+}
+
+
+static inline float calc_clamp_f(float x, float min, float max)
+{
+	return calc_min_f(calc_max_f(x, min), max);
+}
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CALC_H
+/******************************************* END OF FILE *******************************************/
@@ -0,0 +1,50 @@
+/************************************************************************************************//**
+ * @file		crc32_ieee.c
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ ***************************************************************************************************/
+#include <sys/crc.h>
+
+
+/* crc32_ieee ***********************************************************************************//**
+ * @brief		Computes the IEEE 802.3 CRC32 of data. */
+uint32_t crc32_ieee(const uint8_t* data, size_t len)
+{
+	return crc32_ieee_update(0, data, len);
+}
+
+
+/* crc32_ieee_update ****************************************************************************//**
+ * @brief		Continues an IEEE 802.3 CRC32 with more data. Matches Zephyr's crc32_ieee_update. */
+uint32_t crc32_ieee_update(uint32_t crc, const uint8_t* data, size_t len)
+{
+	size_t   i;
+	unsigned j;
+
+	crc = ~crc;
+
+	for(i = 0; i < len; i++)
+	{
+		crc ^= data[i];
+
+		for(j = 0; j < 8; j++)
+		{
+			crc = (crc >> 1) ^ (0xEDB88320u & -(crc & 1));
+		}
+	}
+
+	return ~crc;
+}
+
+
+/******************************************* END OF FILE *******************************************/
@@ -0,0 +1,50 @@
+/************************************************************************************************//**
+ * @file		rand32.h
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ * @brief		Host replacement for Zephyr's random/rand32.h. Draws from the libc generator so that
+ * 				host tests are repeatable with srand.
+ *
+ ***************************************************************************************************/
+#ifndef RANDOM_RAND32_H
+#define RANDOM_RAND32_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Includes -------------------------------------------------------------------------------------- */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+
+/* Public Functions ------------------------------------------------------------------------------ */
+static inline void sys_rand_get(void* dst, size_t len)
+{
+	uint8_t* p = dst;
+
+	while(len--)
+	{
+		*p++ = (uint8_t)rand();
+	}
+}
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // RANDOM_RAND32_H
+/******************************************* END OF FILE *******************************************/
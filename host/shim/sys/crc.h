@@ -0,0 +1,41 @@
+/************************************************************************************************//**
+ * @file		crc.h
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ * @brief		Host replacement for Zephyr's sys/crc.h. Computes the same CRCs as Zephyr.
+ *
+ ***************************************************************************************************/
+#ifndef SYS_CRC_H
+#define SYS_CRC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Includes -------------------------------------------------------------------------------------- */
+#include <stddef.h>
+#include <stdint.h>
+
+
+/* Public Functions ------------------------------------------------------------------------------ */
+uint32_t crc32_ieee       (const uint8_t*, size_t);
+uint32_t crc32_ieee_update(uint32_t, const uint8_t*, size_t);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SYS_CRC_H
+/******************************************* END OF FILE *******************************************/
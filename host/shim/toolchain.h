@@ -0,0 +1,26 @@
+/************************************************************************************************//**
+ * @file		toolchain.h
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ * @brief		Host replacement for the parts of Zephyr's toolchain.h used by common/.
+ *
+ ***************************************************************************************************/
+#ifndef TOOLCHAIN_H
+#define TOOLCHAIN_H
+
+#ifndef __packed
+#define __packed __attribute__((__packed__))
+#endif
+
+#endif // TOOLCHAIN_H
+/******************************************* END OF FILE *******************************************/
@@ -0,0 +1,28 @@
+/************************************************************************************************//**
+ * @file		zephyr.h
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ * @brief		Host replacement for zephyr.h. Only provides what common/ headers need for their types
+ * 				so that host tools can share them with the firmware.
+ *
+ ***************************************************************************************************/
+#ifndef ZEPHYR_H
+#define ZEPHYR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <toolchain.h>
+
+#endif // ZEPHYR_H
+/******************************************* END OF FILE *******************************************/
@@ -0,0 +1,323 @@
+/************************************************************************************************//**
+ * @file		snaplog_test.c
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ * @brief		Tests the snapshot log's record validation, rollback to older records and page handling
+ * 				on a RAM store that behaves like NOR flash.
+ *
+ ***************************************************************************************************/
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "snaplog.h"
+
+
+/* Private Macros -------------------------------------------------------------------------------- */
+#define PAGE_SIZE       (256)
+#define NUM_PAGES       (3)
+#define HEADER_SIZE     (16)
+#define RECORD_SIZE     (HEADER_SIZE + sizeof(Record))
+#define PER_PAGE        (PAGE_SIZE / RECORD_SIZE)
+#define VERSION         (3)
+
+#define CHECK(cond)                                                                  \
+	do {                                                                             \
+		if(!(cond))                                                                  \
+		{                                                                            \
+			printf("%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __func__, #cond); \
+			return 1;                                                                \
+		}                                                                            \
+	} while(0)
+
+
+/* Private Types --------------------------------------------------------------------------------- */
+typedef struct {
+	uint32_t value;
+	uint8_t  bytes[34];
+} Record;
+
+
+/* Private Functions ----------------------------------------------------------------------------- */
+static void setup       (SnapStore*, SnapLog*);
+static int  write_value (SnapLog*, uint32_t);
+static int  read_value  (SnapLog*, uint32_t*);
+
+
+/* Private Variables ----------------------------------------------------------------------------- */
+static uint8_t mem[PAGE_SIZE * NUM_PAGES];
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Tests                                                                                           //
+// ----------------------------------------------------------------------------------------------- //
+/* test_empty ***********************************************************************************//**
+ * @brief		An erased store holds no record. */
+static int test_empty(void)
+{
+	SnapStore store;
+	SnapLog   log;
+	uint32_t  value;
+
+	setup(&store, &log);
+	CHECK(!log.found);
+	CHECK(read_value(&log, &value) == -ENOENT);
+	return 0;
+}
+
+
+/* test_latest **********************************************************************************//**
+ * @brief		The latest record is found again after a reboot. */
+static int test_latest(void)
+{
+	SnapStore store;
+	SnapLog   log;
+	uint32_t  value;
+	uint32_t  i;
+
+	setup(&store, &log);
+
+	for(i = 1; i <= 3; i++)
+	{
+		CHECK(write_value(&log, i) == 0);
+	}
+
+	CHECK(snap_log_init(&log, &store, VERSION, sizeof(Record)) == 0);
+	CHECK(log.found);
+	CHECK(log.seq == 3);
+	CHECK(read_value(&log, &value) == 0 && value == 3);
+	return 0;
+}
+
+
+/* test_bad_crc *********************************************************************************//**
+ * @brief		A record with corrupt data is rejected and the log rolls back to the previous record. */
+static int test_bad_crc(void)
+{
+	SnapStore store;
+	SnapLog   log;
+	uint32_t  value;
+
+	setup(&store, &log);
+	CHECK(write_value(&log, 1) == 0);
+	CHECK(write_value(&log, 2) == 0);
+
+	mem[log.latest + HEADER_SIZE + 5] ^= 0x01;
+
+	CHECK(snap_log_init(&log, &store, VERSION, sizeof(Record)) == 0);
+	CHECK(log.seq == 1);
+	CHECK(read_value(&log, &value) == 0 && value == 1);
+	return 0;
+}
+
+
+/* test_torn_write ******************************************************************************//**
+ * @brief		A record interrupted after its header is ignored. The next write skips the damaged
+ * 				location and moves onto the spare page. */
+static int test_torn_write(void)
+{
+	SnapStore store;
+	SnapLog   log;
+	uint32_t  value;
+	uint32_t  torn;
+	uint32_t  half = (RECORD_SIZE / 2) & ~3u;
+
+	setup(&store, &log);
+	CHECK(write_value(&log, 1) == 0);
+	CHECK(write_value(&log, 2) == 0);
+
+	/* Write only the first half of a record as if the node reset during the write */
+	torn = log.next;
+	CHECK(write_value(&log, 3) == 0);
+	memset(&mem[torn + half], 0xFF, RECORD_SIZE - half);
+
+	CHECK(snap_log_init(&log, &store, VERSION, sizeof(Record)) == 0);
+	CHECK(log.seq == 2);
+	CHECK(read_value(&log, &value) == 0 && value == 2);
+	CHECK(log.next == torn);
+
+	CHECK(write_value(&log, 4) == 0);
+	CHECK(log.latest == PAGE_SIZE);
+
+	CHECK(snap_log_init(&log, &store, VERSION, sizeof(Record)) == 0);
+	CHECK(read_value(&log, &value) == 0 && value == 4);
+	return 0;
+}
+
+
+/* test_version *********************************************************************************//**
+ * @brief		Records of another version or length are ignored. */
+static int test_version(void)
+{
+	SnapStore store;
+	SnapLog   log;
+
+	setup(&store, &log);
+	CHECK(write_value(&log, 1) == 0);
+
+	CHECK(snap_log_init(&log, &store, VERSION + 1, sizeof(Record)) == 0);
+	CHECK(!log.found);
+
+	CHECK(snap_log_init(&log, &store, VERSION, sizeof(Record) - 4) == 0);
+	CHECK(!log.found);
+	return 0;
+}
+
+
+/* test_spare ***********************************************************************************//**
+ * @brief		Writes never erase. Moving onto a spare page that is not erased fails with -EAGAIN and
+ * 				leaves the latest record intact until the spare page is erased. */
+static int test_spare(void)
+{
+	SnapStore store;
+	SnapLog   log;
+	uint32_t  value;
+	uint32_t  i;
+
+	setup(&store, &log);
+	memset(&mem[PAGE_SIZE], 0x00, 2 * PAGE_SIZE);
+
+	for(i = 1; i <= PER_PAGE; i++)
+	{
+		CHECK(write_value(&log, i) == 0);
+	}
+
+	CHECK(!snap_log_spare_erased(&log));
+	CHECK(write_value(&log, 100) == -EAGAIN);
+	CHECK(read_value(&log, &value) == 0 && value == PER_PAGE);
+
+	CHECK(snap_log_erase_spare(&log) == 0);
+	CHECK(snap_log_spare_erased(&log));
+	CHECK(write_value(&log, 100) == 0);
+	CHECK(log.latest == PAGE_SIZE);
+	CHECK(!snap_log_spare_erased(&log));
+	return 0;
+}
+
+
+/* test_wrap ************************************************************************************//**
+ * @brief		The log wraps around the store and the largest sequence number wins even when it is in
+ * 				an earlier page than older records. */
+static int test_wrap(void)
+{
+	SnapStore store;
+	SnapLog   log;
+	uint32_t  value;
+	uint32_t  i;
+	uint32_t  n = PER_PAGE * (NUM_PAGES + 1) + 1;
+
+	setup(&store, &log);
+
+	for(i = 1; i <= n; i++)
+	{
+		if(!snap_log_spare_erased(&log))
+		{
+			CHECK(snap_log_erase_spare(&log) == 0);
+		}
+
+		CHECK(write_value(&log, i) == 0);
+	}
+
+	CHECK(log.latest / PAGE_SIZE == 1);
+
+	CHECK(snap_log_init(&log, &store, VERSION, sizeof(Record)) == 0);
+	CHECK(log.seq == n);
+	CHECK(read_value(&log, &value) == 0 && value == n);
+	return 0;
+}
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Helpers                                                                                         //
+// ----------------------------------------------------------------------------------------------- //
+/* setup ****************************************************************************************//**
+ * @brief		Erases the memory and opens a log on it. */
+static void setup(SnapStore* store, SnapLog* log)
+{
+	memset(mem, 0xFF, sizeof(mem));
+	snap_ram_store(store, mem, PAGE_SIZE, NUM_PAGES);
+	snap_log_init(log, store, VERSION, sizeof(Record));
+}
+
+
+/* write_value **********************************************************************************//**
+ * @brief		Writes a record holding value. */
+static int write_value(SnapLog* log, uint32_t value)
+{
+	Record r;
+
+	memset(&r, (uint8_t)value, sizeof(r));
+	r.value = value;
+	return snap_log_write(log, &r);
+}
+
+
+/* read_value ***********************************************************************************//**
+ * @brief		Reads the latest record's value and checks the rest of the record. */
+static int read_value(SnapLog* log, uint32_t* value)
+{
+	Record   r;
+	unsigned i;
+
+	int ret = snap_log_read(log, &r);
+
+	if(ret < 0)
+	{
+		return ret;
+	}
+
+	for(i = 0; i < sizeof(r.bytes); i++)
+	{
+		if(r.bytes[i] != (uint8_t)r.value)
+		{
+			return -EIO;
+		}
+	}
+
+	*value = r.value;
+	return 0;
+}
+
+
+/* main *****************************************************************************************//**
+ * @brief		*/
+int main(void)
+{
+	static int (*const tests[])(void) = {
+		test_empty,
+		test_latest,
+		test_bad_crc,
+		test_torn_write,
+		test_version,
+		test_spare,
+		test_wrap,
+	};
+
+	unsigned i;
+	int      failed = 0;
+
+	for(i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+	{
+		failed += tests[i]();
+	}
+
+	printf("%u tests, %d failed\n", (unsigned)(sizeof(tests) / sizeof(tests[0])), failed);
+	return failed ? 1 : 0;
+}
+
+
+/******************************************* END OF FILE *******************************************/
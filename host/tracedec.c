@@ -0,0 +1,569 @@
+/************************************************************************************************//**
+ * @file		tracedec.c
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ * @brief		Decodes the trace datagrams sent by trace_drain into per slot timelines and prints
+ * 				histograms of slot execution times and event counts per node.
+ *
+ * 				tracedec [-t] [-n datagrams] [-w capture] -u port
+ * 				tracedec [-t] capture
+ *
+ * 				-u listens for datagrams on a UDP port. -w appends the received datagrams to a
+ * 				capture file that can be decoded again later. -n stops after a number of datagrams.
+ * 				-t prints the timeline. Histograms are printed when decoding stops or on SIGINT.
+ *
+ ***************************************************************************************************/
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+
+/* Private Macros -------------------------------------------------------------------------------- */
+#define MAX_NODES           (32)
+#define MAX_DATAGRAM        (1280)
+#define MAX_SLOTS           (256)	/* Slot indices kept in the slot histograms */
+#define MAX_SLOT_EVENTS     (32)	/* Events printed per slot in the timeline */
+#define NUM_BINS            (16)	/* Histogram bins. Bin i counts times in [2^(i-1), 2^i) us. */
+
+
+/* Private Types --------------------------------------------------------------------------------- */
+typedef struct {
+	uint32_t count;
+	uint64_t total_us;
+	uint32_t max_us;
+	uint32_t bins[NUM_BINS];
+} Histogram;
+
+
+typedef struct {
+	bool      valid;
+	char      name[INET6_ADDRSTRLEN];
+	bool      started;
+	uint32_t  last;             /* Last raw timestamp in cycles */
+	uint64_t  now;              /* Unwrapped time of the last event in cycles */
+	uint64_t  lost;
+	uint64_t  counts[TRACE_NUM_IDS];
+
+	/* Slot being decoded */
+	bool       in_slot;
+	uint16_t   slot;
+	uint64_t   slot_start;
+	unsigned   num_events;
+	TraceEntry events[MAX_SLOT_EVENTS];
+	uint64_t   times[MAX_SLOT_EVENTS];
+
+	Histogram slots[MAX_SLOTS];
+} Node;
+
+
+/* Private Functions ----------------------------------------------------------------------------- */
+static void        usage        (const char*);
+static int         decode_file  (const char*);
+static int         decode_udp   (uint16_t, const char*, long);
+static void        decode       (const char*, const uint8_t*, size_t);
+static Node*       node_find    (const char*);
+static void        node_event   (Node*, const TraceEntry*);
+static void        node_slot_end(Node*);
+static void        hist_add     (Histogram*, uint32_t);
+static void        hist_print   (const char*, const Histogram*);
+static void        print_stats  (void);
+static const char* event_name   (uint16_t);
+static void        handle_sigint(int);
+
+
+/* Private Variables ----------------------------------------------------------------------------- */
+static const char* const event_names[TRACE_NUM_IDS] = {
+	[TRACE_NONE]            = "none",
+	[TRACE_SLOT_START]      = "slot_start",
+	[TRACE_SLOT_END]        = "slot_end",
+	[TRACE_LOC_SLOT]        = "loc_slot",
+	[TRACE_LOC_SOLVE_START] = "loc_solve_start",
+	[TRACE_LOC_SOLVE_END]   = "loc_solve_end",
+	[TRACE_LOC_OVERRUN]     = "loc_overrun",
+	[TRACE_SHARED_ADV]      = "shared_adv",
+	[TRACE_SHARED_TX]       = "shared_tx",
+	[TRACE_SHARED_RX]       = "shared_rx",
+	[TRACE_TX_ACK]          = "tx_ack",
+	[TRACE_TX_COLLISION]    = "tx_collision",
+	[TRACE_TX_DROP]         = "tx_drop",
+	[TRACE_RX_TIMEOUT]      = "rx_timeout",
+	[TRACE_RX_COLLISION]    = "rx_collision",
+	[TRACE_QUEUE_DROP]      = "queue_drop",
+};
+
+static Node          nodes[MAX_NODES];
+static bool          timeline = false;
+static volatile bool stop     = false;
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Main                                                                                            //
+// ----------------------------------------------------------------------------------------------- //
+/* main *****************************************************************************************//**
+ * @brief		*/
+int main(int argc, char** argv)
+{
+	const char* capture = 0;
+	long        max     = -1;
+	long        port    = -1;
+	int         opt;
+	int         r;
+
+	while((opt = getopt(argc, argv, "tn:w:u:")) != -1)
+	{
+		switch(opt)
+		{
+			case 't': timeline = true;                 break;
+			case 'n': max      = strtol(optarg, 0, 0); break;
+			case 'w': capture  = optarg;               break;
+			case 'u': port     = strtol(optarg, 0, 0); break;
+			default:  usage(argv[0]);                  return 2;
+		}
+	}
+
+	if(port >= 0 && port <= UINT16_MAX && optind == argc)
+	{
+		/* No SA_RESTART so that SIGINT interrupts recvfrom */
+		struct sigaction sa = { 0 };
+		sa.sa_handler = handle_sigint;
+		sigaction(SIGINT, &sa, 0);
+
+		r = decode_udp(port, capture, max);
+	}
+	else if(port < 0 && !capture && optind + 1 == argc)
+	{
+		r = decode_file(argv[optind]);
+	}
+	else
+	{
+		usage(argv[0]);
+		return 2;
+	}
+
+	print_stats();
+	return r;
+}
+
+
+/* usage ****************************************************************************************//**
+ * @brief		*/
+static void usage(const char* name)
+{
+	fprintf(stderr,
+		"usage: %s [-t] [-n datagrams] [-w capture] -u port\n"
+		"       %s [-t] capture\n", name, name);
+}
+
+
+/* handle_sigint ********************************************************************************//**
+ * @brief		*/
+static void handle_sigint(int sig)
+{
+	(void)sig;
+	stop = true;
+}
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Input                                                                                           //
+// ----------------------------------------------------------------------------------------------- //
+/* decode_file **********************************************************************************//**
+ * @brief		Decodes a capture file. A capture is a sequence of records, each a 16 byte source
+ * 				address, a 16 bit little endian length and the datagram. */
+static int decode_file(const char* path)
+{
+	uint8_t buf[MAX_DATAGRAM];
+	uint8_t hdr[18];
+	char    name[INET6_ADDRSTRLEN];
+
+	FILE* f = fopen(path, "rb");
+
+	if(!f)
+	{
+		perror(path);
+		return 1;
+	}
+
+	while(fread(hdr, sizeof(hdr), 1, f) == 1)
+	{
+		size_t len = hdr[16] | (hdr[17] << 8);
+
+		if(len > sizeof(buf) || fread(buf, len, 1, f) != 1)
+		{
+			fprintf(stderr, "%s: truncated capture\n", path);
+			break;
+		}
+
+		inet_ntop(AF_INET6, hdr, name, sizeof(name));
+		decode(name, buf, len);
+	}
+
+	fclose(f);
+	return 0;
+}
+
+
+/* decode_udp ***********************************************************************************//**
+ * @brief		Decodes datagrams received on a UDP port until max datagrams were received or SIGINT.
+ * 				Appends them to the capture file if not null. */
+static int decode_udp(uint16_t port, const char* capture, long max)
+{
+	struct sockaddr_in6 addr = { 0 };
+	uint8_t buf[MAX_DATAGRAM];
+	char    name[INET6_ADDRSTRLEN];
+	FILE*   f = 0;
+	long    n = 0;
+
+	int s = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+
+	addr.sin6_family = AF_INET6;
+	addr.sin6_port   = htons(port);
+	addr.sin6_addr   = in6addr_any;
+
+	if(s < 0 || bind(s, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+	{
+		perror("socket");
+		return 1;
+	}
+
+	if(capture && !(f = fopen(capture, "ab")))
+	{
+		perror(capture);
+		close(s);
+		return 1;
+	}
+
+	while(!stop && (max < 0 || n < max))
+	{
+		socklen_t alen = sizeof(addr);
+		ssize_t   len  = recvfrom(s, buf, sizeof(buf), 0, (struct sockaddr*)&addr, &alen);
+
+		if(len < 0)
+		{
+			break;
+		}
+
+		if(f)
+		{
+			uint8_t hdr[18];
+
+			memcpy(hdr, &addr.sin6_addr, 16);
+			hdr[16] = len & 0xFF;
+			hdr[17] = len >> 8;
+			fwrite(hdr, sizeof(hdr), 1, f);
+			fwrite(buf, len, 1, f);
+			fflush(f);
+		}
+
+		inet_ntop(AF_INET6, &addr.sin6_addr, name, sizeof(name));
+		decode(name, buf, len);
+		n++;
+	}
+
+	if(f)
+	{
+		fclose(f);
+	}
+
+	close(s);
+	return 0;
+}
+
+
+/* decode ***************************************************************************************//**
+ * @brief		Decodes one trace datagram from a node. */
+static void decode(const char* name, const uint8_t* buf, size_t len)
+{
+	TraceHeader hdr;
+	TraceEntry  entry;
+	unsigned    i;
+
+	if(len < sizeof(hdr))
+	{
+		return;
+	}
+
+	memcpy(&hdr, buf, sizeof(hdr));
+
+	if(memcmp(hdr.magic, "TRCE", sizeof(hdr.magic)) != 0 || hdr.version != TRACE_VERSION ||
+	   len < sizeof(hdr) + hdr.count * sizeof(TraceEntry))
+	{
+		fprintf(stderr, "%s: bad datagram\n", name);
+		return;
+	}
+
+	Node* node = node_find(name);
+
+	if(!node)
+	{
+		return;
+	}
+
+	if(hdr.lost)
+	{
+		node->lost += hdr.lost;
+
+		/* Events are missing so the open slot can't be timed */
+		node->in_slot = false;
+
+		if(timeline)
+		{
+			printf("%s lost %u events\n", node->name, hdr.lost);
+		}
+	}
+
+	for(i = 0; i < hdr.count; i++)
+	{
+		memcpy(&entry, buf + sizeof(hdr) + i * sizeof(entry), sizeof(entry));
+		node_event(node, &entry);
+	}
+}
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Nodes                                                                                           //
+// ----------------------------------------------------------------------------------------------- //
+/* node_find ************************************************************************************//**
+ * @brief		Returns the state of the named node. Adds the node if it is new. */
+static Node* node_find(const char* name)
+{
+	unsigned i;
+
+	for(i = 0; i < MAX_NODES; i++)
+	{
+		if(nodes[i].valid && strcmp(nodes[i].name, name) == 0)
+		{
+			return &nodes[i];
+		}
+	}
+
+	for(i = 0; i < MAX_NODES; i++)
+	{
+		if(!nodes[i].valid)
+		{
+			memset(&nodes[i], 0, sizeof(nodes[i]));
+			nodes[i].valid = true;
+			snprintf(nodes[i].name, sizeof(nodes[i].name), "%s", name);
+			return &nodes[i];
+		}
+	}
+
+	fprintf(stderr, "too many nodes. ignoring %s\n", name);
+	return 0;
+}
+
+
+/* node_event ***********************************************************************************//**
+ * @brief		Adds an event to a node's timeline and histograms. Timestamps are unwrapped assuming
+ * 				consecutive events are less than one wrap (67 s) apart. */
+static void node_event(Node* node, const TraceEntry* e)
+{
+	if(!node->started)
+	{
+		node->started = true;
+		node->now     = 0;
+	}
+	else
+	{
+		node->now += (uint32_t)(e->tstamp - node->last);
+	}
+
+	node->last = e->tstamp;
+
+	if(e->id < TRACE_NUM_IDS)
+	{
+		node->counts[e->id]++;
+	}
+
+	switch(e->id)
+	{
+		case TRACE_SLOT_START:
+			node->in_slot    = true;
+			node->slot       = e->arg;
+			node->slot_start = node->now;
+			node->num_events = 0;
+			break;
+
+		case TRACE_SLOT_END:
+			if(node->in_slot && node->slot == e->arg)
+			{
+				node_slot_end(node);
+			}
+			node->in_slot = false;
+			return;
+
+		default:
+			break;
+	}
+
+	if(node->in_slot)
+	{
+		if(e->id != TRACE_SLOT_START && node->num_events < MAX_SLOT_EVENTS)
+		{
+			node->events[node->num_events] = *e;
+			node->times [node->num_events] = node->now;
+			node->num_events++;
+		}
+	}
+	else if(timeline)
+	{
+		printf("%s %12.3f ms %s(%u)\n", node->name,
+			(double)node->now / TRACE_CYCLES_PER_US / 1000, event_name(e->id), e->arg);
+	}
+}
+
+
+/* node_slot_end ********************************************************************************//**
+ * @brief		Adds the slot that just ended to the slot histograms and prints its timeline line: the
+ * 				slot start time, slot index, execution time and each event's offset into the slot. */
+static void node_slot_end(Node* node)
+{
+	uint32_t us = (node->now - node->slot_start) / TRACE_CYCLES_PER_US;
+	unsigned i;
+
+	if(node->slot < MAX_SLOTS)
+	{
+		hist_add(&node->slots[node->slot], us);
+	}
+
+	if(!timeline)
+	{
+		return;
+	}
+
+	printf("%s %12.3f ms slot %3u %6u us:", node->name,
+		(double)node->slot_start / TRACE_CYCLES_PER_US / 1000, node->slot, us);
+
+	for(i = 0; i < node->num_events; i++)
+	{
+		printf(" %s(%u)@%u", event_name(node->events[i].id), node->events[i].arg,
+			(unsigned)((node->times[i] - node->slot_start) / TRACE_CYCLES_PER_US));
+	}
+
+	printf("\n");
+}
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Statistics                                                                                      //
+// ----------------------------------------------------------------------------------------------- //
+/* hist_add *************************************************************************************//**
+ * @brief		Adds a time in us to a histogram. */
+static void hist_add(Histogram* h, uint32_t us)
+{
+	unsigned bin = 0;
+
+	while(bin < NUM_BINS - 1 && (1u << bin) <= us)
+	{
+		bin++;
+	}
+
+	h->count++;
+	h->total_us += us;
+	h->max_us    = us > h->max_us ? us : h->max_us;
+	h->bins[bin]++;
+}
+
+
+/* hist_print ***********************************************************************************//**
+ * @brief		Prints a histogram's summary on one line followed by its non-empty bins. */
+static void hist_print(const char* label, const Histogram* h)
+{
+	unsigned i;
+
+	if(h->count == 0)
+	{
+		return;
+	}
+
+	printf("  %-20s n %8u  mean %8.1f us  max %8u us\n",
+		label, h->count, (double)h->total_us / h->count, h->max_us);
+
+	for(i = 0; i < NUM_BINS; i++)
+	{
+		if(h->bins[i])
+		{
+			printf("    < %6u us %8u %5.1f%%\n",
+				1u << i, h->bins[i], 100.0 * h->bins[i] / h->count);
+		}
+	}
+}
+
+
+/* print_stats **********************************************************************************//**
+ * @brief		Prints every node's event counts and histograms. */
+static void print_stats(void)
+{
+	char     label[32];
+	unsigned i, j;
+
+	for(i = 0; i < MAX_NODES; i++)
+	{
+		const Node* node = &nodes[i];
+
+		if(!node->valid)
+		{
+			continue;
+		}
+
+		printf("\n%s: %.3f s traced, %llu events lost\n", node->name,
+			(double)node->now / TRACE_CYCLES_PER_US / 1000000,
+			(unsigned long long)node->lost);
+
+		printf(" events\n");
+
+		for(j = 1; j < TRACE_NUM_IDS; j++)
+		{
+			if(node->counts[j])
+			{
+				printf("  %-20s %8llu\n", event_name(j), (unsigned long long)node->counts[j]);
+			}
+		}
+
+		printf(" slot execution time\n");
+
+		for(j = 0; j < MAX_SLOTS; j++)
+		{
+			snprintf(label, sizeof(label), "slot %u", j);
+			hist_print(label, &node->slots[j]);
+		}
+	}
+}
+
+
+/* event_name ***********************************************************************************//**
+ * @brief		*/
+static const char* event_name(uint16_t id)
+{
+	return id < TRACE_NUM_IDS && event_names[id] ? event_names[id] : "unknown";
+}
+
+
+/******************************************* END OF FILE *******************************************/
@@ -0,0 +1,177 @@
+/************************************************************************************************//**
+ * @file		twr_test.c
+ *
+ * @copyright	Copyright 2022 Kurt Hildebrand.
+ * @license		Licensed under the Apache License, Version 2.0 (the "License"); you may not use this
+ *				file except in compliance with the License. You may obtain a copy of the License at
+ *
+ *				http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *				Unless required by applicable law or agreed to in writing, software distributed under
+ *				the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF
+ *				ANY KIND, either express or implied. See the License for the specific language
+ *				governing permissions and limitations under the License.
+ *
+ * @brief		Compares the clock error of single-sided and double-sided TWR. Both nodes measure
+ * 				durations with crystals that are off by up to the DW1000's +-20 ppm. SS-TWR corrects
+ * 				the reply with the rx clock offset which the DW1000 only estimates to about a ppm.
+ * 				DS-TWR closes the round trip with the responder's next ACK which may be seconds
+ * 				later, as the shared cell ACK exchange in tsch.c does.
+ *
+ ***************************************************************************************************/
+#include <math.h>
+#include <stdio.h>
+
+#include "twr.h"
+
+
+/* Private Macros -------------------------------------------------------------------------------- */
+#define CHECK(cond)                                                                  \
+	do {                                                                             \
+		if(!(cond))                                                                  \
+		{                                                                            \
+			printf("%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __func__, #cond); \
+			return 1;                                                                \
+		}                                                                            \
+	} while(0)
+
+#define TICKS_PER_S         (499.2e6 * 128)	/* DW1000 timestamp resolution */
+#define M_PER_TICK          (299792458.0 / TICKS_PER_S)
+#define MAX_PPM             (20)			/* DW1000 crystal trim tolerance */
+#define RCO_ERR_PPM         (1.0)			/* Error of the rx clock offset estimate */
+#define ACK_REPLY_S         (1e-3)			/* Responder's ACK turnaround */
+#define MAX_ROUND_S         (10.0)			/* TSCH_DSTWR_MAX_AGE_MS in tsch.c */
+#define DIST_M              (30.0)
+
+
+/* Private Types --------------------------------------------------------------------------------- */
+typedef struct {
+	double ss;      /* Worst SS-TWR error in ticks */
+	double ds;      /* Worst DS-TWR error in ticks */
+} Error;
+
+
+/* Private Functions ----------------------------------------------------------------------------- */
+static Error worst(double, double);
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Tests                                                                                           //
+// ----------------------------------------------------------------------------------------------- //
+/* test_ideal ***********************************************************************************//**
+ * @brief		Both methods measure the exact distance with perfect clocks. */
+static int test_ideal(void)
+{
+	double tof   = DIST_M / M_PER_TICK;
+	double reply = ACK_REPLY_S * TICKS_PER_S;
+	double wait  = 2.0 * TICKS_PER_S;
+
+	CHECK(fabs(twr_ss_tof(2 * tof + reply, reply, 0) - tof) <= 0.5);
+	CHECK(fabs(twr_ds_tof(2 * tof + reply, reply, 2 * tof + wait, wait) - tof) <= 0.5);
+
+	/* Replies that are too long for the round are clamped to no distance */
+	CHECK(twr_ss_tof(reply, 2 * reply, 0) == 0);
+	CHECK(twr_ds_tof(reply, 2 * reply, wait, 2 * wait) == 0);
+	return 0;
+}
+
+
+/* test_clock_error *****************************************************************************//**
+ * @brief		DS-TWR stays within a tick for every crystal error and round trip up to the maximum
+ * 				age of an exchange. SS-TWR's error grows with the reply time and already exceeds
+ * 				DS-TWR's at the ACK turnaround. */
+static int test_clock_error(void)
+{
+	double waits[] = { 0.01, 0.1, 1.0, MAX_ROUND_S };
+	Error  ack     = worst(ACK_REPLY_S, MAX_ROUND_S);
+	Error  slow    = worst(10 * ACK_REPLY_S, MAX_ROUND_S);
+	unsigned i;
+
+	printf("reply %5.0f us: SS-TWR %6.1f ticks (%.3f m), DS-TWR %4.1f ticks (%.3f m)\n",
+		ACK_REPLY_S * 1e6, ack.ss, ack.ss * M_PER_TICK, ack.ds, ack.ds * M_PER_TICK);
+	printf("reply %5.0f us: SS-TWR %6.1f ticks (%.3f m), DS-TWR %4.1f ticks (%.3f m)\n",
+		10 * ACK_REPLY_S * 1e6, slow.ss, slow.ss * M_PER_TICK, slow.ds, slow.ds * M_PER_TICK);
+
+	for(i = 0; i < sizeof(waits) / sizeof(waits[0]); i++)
+	{
+		CHECK(worst(ACK_REPLY_S, waits[i]).ds <= 1.0);
+	}
+
+	/* SS-TWR's error is half the reply times the error of the clock offset estimate */
+	CHECK(fabs(ack.ss - ACK_REPLY_S * TICKS_PER_S * RCO_ERR_PPM * 1e-6 / 2) <= 1.0);
+	CHECK(slow.ss > 9 * ack.ss);
+	CHECK(ack.ss > 10 * ack.ds);
+	return 0;
+}
+
+
+
+
+// ----------------------------------------------------------------------------------------------- //
+// Helpers                                                                                         //
+// ----------------------------------------------------------------------------------------------- //
+/* worst ****************************************************************************************//**
+ * @brief		Returns the worst error of both methods over the crystal errors of the initiator and
+ * 				the responder and the sign of the clock offset estimate's error. reply_s is the
+ * 				responder's ACK turnaround and wait_s the time until the initiator's next frame. */
+static Error worst(double reply_s, double wait_s)
+{
+	Error  err = { 0, 0 };
+	double tof = DIST_M / M_PER_TICK;
+	int    a, b, sign;
+
+	for(a = -MAX_PPM; a <= MAX_PPM; a += 5)
+	{
+		for(b = -MAX_PPM; b <= MAX_PPM; b += 5)
+		{
+			double ea = a * 1e-6;	/* Initiator */
+			double eb = b * 1e-6;	/* Responder */
+
+			/* Each duration is measured by the clock of the node that measures it */
+			double reply1 = reply_s * TICKS_PER_S * (1 + eb);
+			double round1 = (2 * tof + reply_s * TICKS_PER_S) * (1 + ea);
+			double reply2 = wait_s * TICKS_PER_S * (1 + ea);
+			double round2 = (2 * tof + wait_s * TICKS_PER_S) * (1 + eb);
+			double ds     = twr_ds_tof(round1, reply1, round2, reply2);
+
+			err.ds = fmax(err.ds, fabs(ds - tof));
+
+			for(sign = -1; sign <= 1; sign += 2)
+			{
+				float  rco = (eb - ea) + sign * RCO_ERR_PPM * 1e-6;
+				double ss  = twr_ss_tof(round1, reply1, rco);
+
+				err.ss = fmax(err.ss, fabs(ss - tof));
+			}
+		}
+	}
+
+	return err;
+}
+
+
+/* main *****************************************************************************************//**
+ * @brief		*/
+int main(void)
+{
+	static int (*const tests[])(void) = {
+		test_ideal,
+		test_clock_error,
+	};
+
+	unsigned i;
+	int      failed = 0;
+
+	for(i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+	{
+		failed += tests[i]();
+	}
+
+	printf("%u tests, %d failed\n", (unsigned)(sizeof(tests) / sizeof(tests[0])), failed);
+	return failed ? 1 : 0;
+}
+
+
+/******************************************* END OF FILE *******************************************/
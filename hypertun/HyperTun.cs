@@ -71,9 +71,12 @@ namespace Hyperspace
 					});
 			});
 
+			/* The prefix of the addresses this host serves may be given as the first argument, for
+			 * example "fd00::1/128". The mesh routes packets within it to this host's gateway. */
 			HyperTun tun = new HyperTun(
 				loggerFactory.CreateLogger<HyperTun>(),
-				"Host=localhost;Username=pi;Password=justtryit;Database=hyperspace;");
+				"Host=localhost;Username=pi;Password=justtryit;Database=hyperspace;",
+				args.Length > 0 ? args[0] : "fd00::1/128");
 
 			tun.Setup();
 
@@ -89,18 +92,27 @@ namespace Hyperspace
 		private uint   spi_speed = 8000000;
 		private string tun_name  = "tun0";
 
+		/* The gateway expects a heartbeat well within its 30 s host timeout. The heartbeat is 40
+		 * bytes so that it fits the first SPI transfer. Its magic starts with version nibble 4 so it
+		 * is never taken for an IPv6 packet. */
+		private static readonly TimeSpan heartbeat_period = TimeSpan.FromSeconds(10);
+		private static readonly byte[]   heartbeat_magic  = { (byte)'H', (byte)'Y', (byte)'G', (byte)'W' };
+		private const int                heartbeat_len    = 40;
+
 		private nint spifd;
 		private nint readyfd;
 		private nint tunfd;
 
 		private ILogger<HyperTun> logger;
 		private string connection;
+		private string prefix;
 		private readonly object spilock = new object();
 
-		public HyperTun(ILogger<HyperTun> logger, string connection)
+		public HyperTun(ILogger<HyperTun> logger, string connection, string prefix)
 		{
 			this.logger     = logger;
 			this.connection = connection;
+			this.prefix     = prefix;
 		}
 
 		public void Setup()
@@ -288,6 +300,8 @@ namespace Hyperspace
 			var    rxbuf = new PinnedBuffer(2048);	/* Receiving from SPI */
 			IntPtr pkt;
 
+			DateTime heartbeat_next = DateTime.UtcNow;
+
 			unsafe
 			{
 				pkt = hyperopt_alloc_pkt();
@@ -311,7 +325,13 @@ namespace Hyperspace
 
 				ret = Poll(events, 2, token);
 
-				if(ret < 0)
+				bool heartbeat = DateTime.UtcNow >= heartbeat_next;
+
+				if(ret == -ETIMEDOUT && !heartbeat)
+				{
+					continue;
+				}
+				else if(ret < 0 && ret != -ETIMEDOUT)
 				{
 					return;
 				}
@@ -319,8 +339,15 @@ namespace Hyperspace
 				nint txcount = 0;
 				nint rxcount = 0;
 
+				/* Send a heartbeat when it is due. Data from the TUN stays readable and is sent in
+				 * the next transaction. */
+				if(heartbeat)
+				{
+					txcount        = Heartbeat(txbuf);
+					heartbeat_next = DateTime.UtcNow + heartbeat_period;
+				}
 				/* Handle data to transmit to the SPI device */
-				if(events[0].revents != 0)
+				else if(events[0].revents != 0)
 				{
 					txcount = await HandleTxData(pkt, txbuf, db, token);
 				}
@@ -380,11 +407,33 @@ namespace Hyperspace
 				{
 					return ret;
 				}
+
+				/* Return on timeout so that heartbeats are sent while there is no traffic */
+				return -ETIMEDOUT;
 			}
 
 			return -ECANCELED;
 		}
 
+		/* Heartbeat ****************************************************************************//**
+		 * @brief		Writes a heartbeat with the prefix this host serves to the buffer and returns its
+		 * 				length. The gateway announces the prefix to the mesh while heartbeats arrive. */
+		private nint Heartbeat(PinnedBuffer txbuf)
+		{
+			string[] parts = prefix.Split('/');
+			byte[]   addr  = IPAddress.Parse(parts[0]).GetAddressBytes();
+			byte     len   = parts.Length > 1 ? byte.Parse(parts[1]) : (byte)128;
+
+			Array.Clear(txbuf.Data, 0, heartbeat_len);
+			Array.Copy(heartbeat_magic, 0, txbuf.Data, 0, heartbeat_magic.Length);
+			txbuf[heartbeat_magic.Length] = len;
+			Array.Copy(addr, 0, txbuf.Data, heartbeat_magic.Length + 1, addr.Length);
+
+			logger.LogDebug("heartbeat {0}", prefix);
+
+			return heartbeat_len;
+		}
+
 		private async Task<nint> HandleTxData(
 			IntPtr            pkt,
 			PinnedBuffer      txbuf,
@@ -160,6 +160,14 @@ void update_hyperspace_coords(void* p1, void* p2, void* p3)
 	while(1)
 	{
 		k_sleep(K_MSEC(5000));
+
+		/* Skip this update rather than add load to a congested mesh */
+		if(tsch_congested())
+		{
+			LOG_WRN("mesh congested. skipping HYPR update");
+			continue;
+		}
+
 		Vec3 loc = loc_current();
 
 		unsigned len = snprintf(json_str, sizeof(json_str), "{\"loc\":[%f,%f,%f],\"bindex\":%d}",
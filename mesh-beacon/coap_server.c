@@ -39,9 +39,12 @@ LOG_MODULE_REGISTER(net_coap_server_sample, LOG_LEVEL_ERR);
 #include <net/coap_link_format.h>
 
 #include "buffer.h"
+#include "diag.h"
 #include "fw_version.h"
 #include "ipv6.h"
 #include "net_private.h"
+#include "snapshot.h"
+#include "telemetry.h"
 
 
 /* Inline Function Instances --------------------------------------------------------------------- */
@@ -51,7 +54,6 @@ NET_L2_DECLARE_PUBLIC(TSCH_L2);
 #define MAX_COAP_MSG_LEN				(256)
 #define MY_COAP_PORT					(5683)
 #define BLOCK_WISE_TRANSFER_SIZE_GET	(2048)
-#define NUM_OBSERVERS					(3)
 #define NUM_PENDINGS					(3)
 #define ALL_NODES_LOCAL_COAP_MCAST		{{{ 0xFF,0x02,0,0,0,0,0,0,0,0,0,0,0,0,0,0xFD }}}
 
@@ -71,10 +73,8 @@ typedef struct {
 static int  coap_join_mcast_group(void);
 static int  coap_start_server    (void);
 static void retransmit_request   (struct k_work*);
-static void update_counter       (struct k_work*);
 static void process_coap_request (uint8_t*, uint16_t,struct sockaddr*,socklen_t);
 static int  send_coap_reply      (struct coap_packet*, const struct sockaddr*, socklen_t);
-static struct coap_resource* find_resource_by_observer(struct coap_resource*,struct coap_observer*);
 
 static int  fw_put    (struct coap_resource*, struct coap_packet*, struct sockaddr*, socklen_t);
 static int  fw_get    (struct coap_resource*, struct coap_packet*, struct sockaddr*, socklen_t);
@@ -92,19 +92,15 @@ static int well_known_core_get(
 
 /* Private Variables ----------------------------------------------------------------------------- */
 static int sock;
-static int obs_counter;
 static const uint8_t plain_text_format;
-static struct coap_observer    observers[NUM_OBSERVERS];
 static struct coap_pending     pendings[NUM_PENDINGS];
-static struct k_work_delayable observer_work;
-static struct coap_resource*   resource_to_notify;
 static struct k_work_delayable retransmit_work;
 static Ota ota;
 static bool green_led;
 
-static const char* fw_path[]     = { "firmware", 0 };
-static const char* reboot_path[] = { "reboot",   0 };
-static const char* led_path[]    = { "led",      0 };
+static const char* fw_path[]      = { "firmware", 0 };
+static const char* reboot_path[]  = { "reboot",   0 };
+static const char* led_path[]     = { "led",      0 };
 
 static struct coap_resource resources[] = {
 	{
@@ -120,6 +116,8 @@ static struct coap_resource resources[] = {
 		.path = reboot_path,
 		.put  = reboot_put,
 	},
+	DIAG_RESOURCES,
+	TELEMETRY_RESOURCES,
 	{
 		.path = led_path,
 		.get  = led_get,
@@ -241,7 +239,8 @@ static int coap_start_server(void)
 	}
 
 	k_work_init_delayable(&retransmit_work, retransmit_request);
-	k_work_init_delayable(&observer_work,   update_counter);
+	telemetry_init(sock);
+	diag_init(sock);
 
 	return 0;
 }
@@ -269,21 +268,6 @@ static void retransmit_request(struct k_work* work)
 }
 
 
-/* update_counter *******************************************************************************//**
- * @brief		*/
-static void update_counter(struct k_work* work)
-{
-	obs_counter++;
-
-	if(resource_to_notify)
-	{
-		coap_resource_notify(resource_to_notify);
-	}
-
-	k_work_schedule(&observer_work, K_SECONDS(5));
-}
-
-
 /* process_coap_request *************************************************************************//**
  * @brief		*/
 static void process_coap_request(
@@ -324,27 +308,11 @@ static void process_coap_request(
 	return;
 
 	not_found:
-		if(type == COAP_TYPE_RESET)
+		if(type == COAP_TYPE_RESET && !telemetry_reset(client_addr))
 		{
-			struct coap_observer* o = coap_find_observer_by_addr(
-				observers, NUM_OBSERVERS, client_addr);
-
-			if(!o)
-			{
-				LOG_ERR("observer not found");
-				goto end;
-			}
-
-			struct coap_resource* r = find_resource_by_observer(resources, o);
-
-			if(!r)
-			{
-				LOG_ERR("observer found but resource not found");
-				goto end;
-			}
+			LOG_ERR("observer not found");
 		}
 
-	end:
 		r = coap_handle_request(&request, resources, options, opt_num, client_addr, client_addr_len);
 
 		if(r < 0)
@@ -354,31 +322,6 @@ static void process_coap_request(
 }
 
 
-/* find_resource_by_observer ********************************************************************//**
- * @brief		*/
-static struct coap_resource* find_resource_by_observer(
-	struct coap_resource* resources,
-	struct coap_observer* o)
-{
-	struct coap_resource* r;
-
-	for(r = resources; r && r->path; r++)
-	{
-		sys_snode_t *node;
-
-		SYS_SLIST_FOR_EACH_NODE(&r->observers, node)
-		{
-			if(&o->list == node)
-			{
-				return r;
-			}
-		}
-	}
-
-	return 0;
-}
-
-
 /* send_coap_reply ******************************************************************************//**
  * @brief		Transmits a COAP packet to the specified address. */
 static int send_coap_reply(struct coap_packet *cpkt, const struct sockaddr *addr, socklen_t addr_len)
@@ -647,6 +590,7 @@ static int reboot_put(
 		boot_request_upgrade(BOOT_UPGRADE_TEST);
 	}
 
+	snap_save();
 	sys_reboot(SYS_REBOOT_COLD);
 }
 
@@ -41,6 +41,8 @@
 #include "ieee_802_15_4.h"
 #include "hyperspace.h"
 #include "location.h"
+#include "telemetry.h"
+#include "trace.h"
 #include "tsch.h"
 
 #include "logging/log.h"
@@ -78,6 +80,14 @@ struct k_thread tid_update_hyperspace_coords;
 K_THREAD_STACK_DEFINE(tid_mcast_listener_stack, 2048);
 struct k_thread tid_mcast_listener;
 
+#if defined(CONFIG_TRACE_DRAIN)
+K_THREAD_STACK_DEFINE(tid_trace_drain_stack, 1024);
+struct k_thread tid_trace_drain;
+#endif
+
+K_THREAD_STACK_DEFINE(tid_capture_drain_stack, 1024);
+struct k_thread tid_capture_drain;
+
 K_THREAD_STACK_DEFINE(coap_stack, 2048);
 bool tid_net_test_running = false;
 struct k_thread tid_coap;
@@ -150,6 +160,26 @@ void main(void)
 
 	k_thread_name_set(&tid_mcast_listener, "Multicast Listener");
 
+	#if defined(CONFIG_TRACE_DRAIN)
+	k_thread_create(&tid_trace_drain,
+		tid_trace_drain_stack,
+		K_THREAD_STACK_SIZEOF(tid_trace_drain_stack),
+		trace_drain,
+		NULL, NULL, NULL,
+		K_PRIO_PREEMPT(14), 0, K_NO_WAIT);
+
+	k_thread_name_set(&tid_trace_drain, "Trace Drain");
+	#endif
+
+	k_thread_create(&tid_capture_drain,
+		tid_capture_drain_stack,
+		K_THREAD_STACK_SIZEOF(tid_capture_drain_stack),
+		loc_capture_drain,
+		NULL, NULL, NULL,
+		K_PRIO_PREEMPT(14), 0, K_NO_WAIT);
+
+	k_thread_name_set(&tid_capture_drain, "Location Capture Drain");
+
 	k_thread_create(&tid_coap,
 		coap_stack,
 		K_THREAD_STACK_SIZEOF(coap_stack),
@@ -208,10 +238,27 @@ void update_hyperspace_coords(void* p1, void* p2, void* p3)
 	inet_pton(AF_INET6, "fd00::1", &addr6.sin6_addr);
 
 	int s = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+	uint32_t announced = 0;
 
 	while(1)
 	{
 		k_sleep(K_MSEC(5000));
+
+		/* Announce this node every 5 s until the border router observes telemetry/loc. After that
+		 * announce it every TELEMETRY_ANNOUNCE_MS so that a border router that lost its
+		 * observation finds this node again. */
+		if(telemetry_observed() && k_uptime_get_32() - announced < TELEMETRY_ANNOUNCE_MS)
+		{
+			continue;
+		}
+
+		/* Skip this update rather than add load to a congested mesh */
+		if(tsch_congested())
+		{
+			LOG_WRN("mesh congested. skipping HYPR update");
+			continue;
+		}
+
 		Vec3 loc = loc_current();
 
 		json_write_float(xstr, sizeof(xstr), loc.x);
@@ -224,6 +271,8 @@ void update_hyperspace_coords(void* p1, void* p2, void* p3)
 		unsigned len = snprintf(json_str, sizeof(json_str), "{\"loc\":[%s,%s,%s],\"bindex\":%d}",
 			xstr, ystr, zstr, loc_beacon_index());
 
+		announced = k_uptime_get_32();
+
 		int ret = sendto(s, json_str, len, 0, (struct sockaddr*)&addr6, sizeof(addr6));
 		LOG_INF("sent udp HYPR update %d: %s", ret, json_str);
 	}